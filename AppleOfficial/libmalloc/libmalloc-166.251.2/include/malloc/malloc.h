@@ -215,6 +215,9 @@ local_memory: set to a contiguous chunk of memory; validity of local_memory is a
 typedef void vm_range_recorder_t(task_t, void *, unsigned type, vm_range_t *, unsigned);
     /* given a task and context, "records" the specified addresses */
 
+struct malloc_zone_telemetry_s;
+    /* see <malloc_private.h> */
+
 typedef struct malloc_introspection_t {
 	kern_return_t (* MALLOC_INTROSPECT_FN_PTR(enumerator))(task_t task, void *, unsigned type_mask, vm_address_t zone_address, memory_reader_t reader, vm_range_recorder_t recorder); /* enumerates all the malloc pointers in use */
 	size_t	(* MALLOC_INTROSPECT_FN_PTR(good_size))(malloc_zone_t *zone, size_t size);
@@ -236,6 +239,7 @@ typedef struct malloc_introspection_t {
     void	*enumerate_unavailable_without_blocks;   
 #endif /* __BLOCKS__ */
 	void	(* MALLOC_INTROSPECT_FN_PTR(reinit_lock))(malloc_zone_t *zone); /* Reinitialize zone locks, called only from atfork_child handler. Present in version >= 9. */
+	boolean_t	(* MALLOC_INTROSPECT_FN_PTR(telemetry))(malloc_zone_t *zone, struct malloc_zone_telemetry_s *telemetry); /* Fills per size class and per magazine telemetry. Present in version >= 11. */
 } malloc_introspection_t;
 
 extern void malloc_printf(const char *format, ...);
@@ -76,4 +76,192 @@ boolean_t malloc_zone_claimed_address(malloc_zone_t *zone, void *ptr) __result_u
 API_AVAILABLE(macos(10.14), ios(12.0), tvos(12.0), watchos(5.0))
 int malloc_engaged_nano(void) __result_use_check;
 
+/*
+ * Large allocation cache statistics for a scalable zone. Freed large blocks
+ * are kept on the cache for reuse, bucketed by size; entries are evicted
+ * oldest first once the cache is out of slots or holds more than
+ * reserve_limit bytes that have not been returned with madvise().
+ */
+typedef struct malloc_large_cache_statistics_s {
+	unsigned entries;			/* blocks currently cached */
+	unsigned max_entries;
+	size_t bytes_cached;		/* bytes currently cached */
+	size_t bytes_resident;		/* cached bytes that were not madvise()d */
+	size_t reserve_limit;
+	uint64_t hits;				/* large allocations satisfied by the cache */
+	uint64_t misses;			/* cacheable allocations that went to the VM */
+	uint64_t evictions;			/* cached blocks returned to the VM to make room */
+} malloc_large_cache_statistics_t;
+
+/*
+ * Fills in large cache statistics for a scalable zone. Returns false if the
+ * zone is not a scalable zone or the large cache is not configured.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+boolean_t scalable_zone_large_cache_statistics(malloc_zone_t *zone,
+		malloc_large_cache_statistics_t *stats);
+
+/*
+ * Large realloc statistics for a scalable zone. A large block that grows is
+ * first extended in place, either into free address space above it or into
+ * headroom reserved by an earlier remap. Failing that, blocks of 2MB or more
+ * are moved by remapping their pages into a mapping with headroom for further
+ * growth, and only the rest are copied.
+ */
+typedef struct malloc_large_realloc_statistics_s {
+	uint64_t grown_in_place;		/* blocks extended into free address space */
+	uint64_t grown_into_headroom;	/* blocks extended into reserved headroom */
+	uint64_t remaps;				/* blocks moved by remapping their pages */
+	uint64_t bytes_remapped;
+	uint64_t copies;				/* large blocks moved by copying */
+	uint64_t bytes_copied;
+} malloc_large_realloc_statistics_t;
+
+/*
+ * Fills in large realloc statistics for a scalable zone. Returns false if the
+ * zone is not a scalable zone.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+boolean_t scalable_zone_large_realloc_statistics(malloc_zone_t *zone,
+		malloc_large_realloc_statistics_t *stats);
+
+/*
+ * Per-thread cache statistics for a scalable zone. The cache is only engaged
+ * for the default zone, and only when the MallocThreadCache environment
+ * variable is set. Counters of threads that have exited are folded into the
+ * totals; blocks_cached and bytes_cached describe the caches of live threads.
+ */
+typedef struct malloc_thread_cache_statistics_s {
+	unsigned threads;			/* live threads with a cache */
+	unsigned blocks_cached;		/* blocks currently parked in thread caches */
+	size_t bytes_cached;		/* bytes currently parked in thread caches */
+	size_t max_bytes_per_thread;
+	uint64_t hits;				/* allocations satisfied by a thread cache */
+	uint64_t misses;			/* allocations that went to a magazine */
+	uint64_t frees;				/* frees absorbed by a thread cache */
+	uint64_t flushes;			/* batches returned to the magazines */
+	uint64_t flushed_blocks;	/* blocks returned to the magazines */
+} malloc_thread_cache_statistics_t;
+
+/*
+ * Fills in thread cache statistics for a scalable zone. Returns false if the
+ * zone is not a scalable zone or does not have thread caching enabled.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+boolean_t scalable_zone_thread_cache_statistics(malloc_zone_t *zone,
+		malloc_thread_cache_statistics_t *stats);
+
+/*
+ * Background scavenger statistics. The scavenger runs only when the
+ * MallocScavenger environment variable is set or MallocNanoMadvisePolicy is
+ * "background". bytes_scavenged is an upper bound: it counts the free bytes of
+ * each region scanned and the full size of each nano block madvised.
+ */
+typedef struct malloc_scavenger_statistics_s {
+	unsigned clients;				/* zones registered with the scavenger */
+	uint64_t ticks;					/* scavenger passes */
+	uint64_t budget_exhausted;		/* passes cut short by the time or byte budget */
+	uint64_t regions_scavenged;		/* tiny and small depot regions madvised */
+	uint64_t nano_blocks_scavenged;	/* empty nano blocks madvised */
+	uint64_t bytes_scavenged;		/* bytes handed back to the kernel */
+} malloc_scavenger_statistics_t;
+
+/*
+ * Fills in the background scavenger statistics. Returns false if the
+ * scavenger is not enabled.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+boolean_t malloc_scavenger_statistics(malloc_scavenger_statistics_t *stats);
+
+/*
+ * Per size class and per magazine heap telemetry, for diagnosing whether a
+ * regression comes from lock contention or from fragmentation.
+ *
+ * The caller sets version to MALLOC_ZONE_TELEMETRY_VERSION; zones fill in
+ * that version of the structure, or fail if they do not support it. Later
+ * versions only ever add fields at the end. The structure is tens of
+ * kilobytes, so allocate it rather than putting it on a thread stack.
+ *
+ * Size classes follow the allocator's free lists: size is the smallest block
+ * in the class, and the last classes of the small and medium allocators hold
+ * coalesced free blocks bigger than the largest allocation. A magazine's
+ * one-element "last free" cache counts as free, blocks parked in thread caches
+ * count as in use. The counters in malloc_magazine_telemetry_t are cumulative and wrap
+ * at 32 bits on 32-bit targets; callers that sample periodically should
+ * report differences.
+ */
+#define MALLOC_ZONE_TELEMETRY_VERSION 1
+#define MALLOC_TELEMETRY_MAX_SIZE_CLASSES 320
+#define MALLOC_TELEMETRY_MAX_MAGAZINES 64
+
+typedef struct malloc_size_class_telemetry_s {
+	size_t size;				/* smallest block in the class */
+	unsigned blocks_in_use;
+	unsigned blocks_free;		/* blocks on the free lists of all magazines */
+} malloc_size_class_telemetry_t;
+
+/*
+ * For the depot, regions_to_depot and regions_from_depot count the regions it
+ * received and handed out.
+ */
+typedef struct malloc_magazine_telemetry_s {
+	uint64_t lock_acquisitions;
+	uint64_t lock_contentions;		/* acquisitions that found the lock held */
+	uint64_t regions_to_depot;		/* regions recirculated to the depot */
+	uint64_t regions_from_depot;	/* regions taken back from the depot */
+	uint64_t bytes_madvised;		/* free bytes handed back with madvise() */
+	size_t bytes_in_use;
+	size_t bytes_in_magazine;		/* bytes of regions owned by the magazine */
+} malloc_magazine_telemetry_t;
+
+typedef struct malloc_allocator_telemetry_s {
+	unsigned num_size_classes;
+	unsigned num_magazines;			/* not counting the depot */
+	uint64_t bytes_madvised;		/* total over the depot and all magazines */
+	malloc_size_class_telemetry_t size_classes[MALLOC_TELEMETRY_MAX_SIZE_CLASSES];
+	malloc_magazine_telemetry_t depot;
+	malloc_magazine_telemetry_t magazines[MALLOC_TELEMETRY_MAX_MAGAZINES];
+} malloc_allocator_telemetry_t;
+
+typedef struct malloc_zone_telemetry_s {
+	unsigned version;				/* set by the caller */
+	malloc_allocator_telemetry_t nano;	/* no magazines */
+	malloc_allocator_telemetry_t tiny;
+	malloc_allocator_telemetry_t small;
+	malloc_allocator_telemetry_t medium;	/* empty if medium is not engaged */
+	unsigned large_blocks_in_use;
+	size_t large_bytes_in_use;
+} malloc_zone_telemetry_t;
+
+/*
+ * Fills in telemetry for a zone. Returns false if the zone does not support
+ * telemetry or the requested version. Takes each magazine lock in turn, and
+ * walks the regions and free lists the magazine owns while holding it, so it
+ * is too expensive to call on a hot path. The calls are themselves counted as
+ * lock acquisitions.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+boolean_t malloc_zone_telemetry(malloc_zone_t *zone,
+		malloc_zone_telemetry_t *telemetry);
+
+/*
+ * Heap snapshots, for starting a process with a heap that an earlier process
+ * built. malloc_zone_snapshot() writes the pages of a scalable zone created
+ * with malloc_create_zone() to fd and returns 0, or an errno value: EINVAL if
+ * the zone is not a scalable zone, ENOTSUP if it uses thread caches or guard
+ * pages. The zone is locked while the snapshot is written.
+ *
+ * malloc_zone_restore() maps a snapshot copy-on-write at the addresses it was
+ * taken from, registers the zone and returns it. It returns NULL and sets
+ * errno to EEXIST if any of those addresses is in use in this process, or to
+ * EINVAL if the file is not a snapshot from this build of libmalloc. Restore
+ * early, before the address space fills up. The restored zone has no name,
+ * and the file may be closed once it returns.
+ */
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+int malloc_zone_snapshot(malloc_zone_t *zone, int fd);
+
+API_AVAILABLE(macos(10.15), ios(13.0), tvos(13.0), watchos(6.0))
+malloc_zone_t *malloc_zone_restore(int fd);
+
 #endif /* _MALLOC_PRIVATE_H_ */
@@ -127,6 +127,14 @@ typedef struct large_entry_s large_entry_t;
 typedef struct szone_s szone_t;
 typedef struct rack_s rack_t;
 typedef struct magazine_s magazine_t;
+typedef struct remote_free_set_s remote_free_set_t;
+typedef struct malloc_large_cache_statistics_s malloc_large_cache_statistics_t;
+typedef struct malloc_large_realloc_statistics_s malloc_large_realloc_statistics_t;
+typedef struct malloc_thread_cache_statistics_s malloc_thread_cache_statistics_t;
+typedef struct malloc_scavenger_statistics_s malloc_scavenger_statistics_t;
+typedef struct malloc_scavenger_tick_s malloc_scavenger_tick_t;
+typedef struct malloc_allocator_telemetry_s malloc_allocator_telemetry_t;
+typedef struct malloc_zone_telemetry_s malloc_zone_telemetry_t;
 typedef int mag_index_t;
 typedef void *region_t;
 
@@ -176,3 +176,416 @@ malloc_jumpstart(uintptr_t cookie)
 
 	return 0;
 }
+
+/********* Zone snapshots for warm start ************/
+
+/*
+ * malloc_zone_snapshot() writes every page that a scalable zone owns -- the
+ * szone itself, its magazines and region hash rings, its regions, its large
+ * entry table and its large blocks -- to a file. malloc_zone_restore() maps
+ * those pages back, copy-on-write, at the same addresses in a later process
+ * and registers the zone, which then allocates and frees as if it had been
+ * created there. Pointers in the image are absolute, so the restore fails if
+ * any of the addresses is already in use, and an image can only be restored
+ * by the same build of libmalloc.
+ *
+ * The snapshot is taken with all of the zone's locks held. Only pages that
+ * are resident or paged out are read; pages that were never touched or that
+ * the VM has reclaimed, and pages that are entirely zero, are left as holes in
+ * the file. Untouched parts of regions and the realloc headroom of large
+ * blocks therefore take no space and are not faulted in. Death-row large
+ * blocks are not saved, and zones with thread caches, guard pages or a helper
+ * zone are not supported.
+ *
+ * A restored zone's pages stay file-backed until they are written, and
+ * MADV_FREE_REUSABLE does not reclaim file-backed pages, so freeing in a
+ * restored zone only returns the pages that the process has dirtied.
+ */
+
+#define MALLOC_SNAPSHOT_MAGIC 0x6d616c6c6f63736eULL // "mallocsn"
+#define MALLOC_SNAPSHOT_VERSION 1
+
+// The range is surrounded by guard pages, see mvm_allocate_pages().
+#define MALLOC_SNAPSHOT_RANGE_GUARDED 0x1
+
+typedef struct {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t num_ranges;
+	uint64_t page_size;
+	uint64_t szone_size;	// sizeof(szone_t), as a check on the layout
+	uint64_t magazine_size; // sizeof(magazine_t), likewise
+	uint64_t zone;			// address of the szone
+} malloc_snapshot_header_t;
+
+typedef struct {
+	uint64_t address;
+	uint64_t size;
+	uint64_t offset; // of the contents in the file, page aligned
+	uint32_t flags;
+	uint32_t reserved;
+} malloc_snapshot_range_t;
+
+static unsigned
+snapshot_add_range(malloc_snapshot_range_t *ranges, unsigned count, void *address, size_t size, uint32_t flags)
+{
+	if (ranges) {
+		ranges[count].address = (uintptr_t)address;
+		ranges[count].size = round_page_quanta(size);
+		ranges[count].offset = 0;
+		ranges[count].flags = flags;
+		ranges[count].reserved = 0;
+	}
+	return count + 1;
+}
+
+static unsigned
+snapshot_collect_rack(rack_t *rack, size_t region_size, malloc_snapshot_range_t *ranges, unsigned count)
+{
+	region_hash_generation_t *rg = rack->region_generation;
+
+	if (!rack->num_magazines) {
+		return count;
+	}
+
+	// See rack_init() and rack_destroy().
+	count = snapshot_add_range(ranges, count, &rack->magazines[DEPOT_MAGAZINE_INDEX],
+			sizeof(magazine_t) * (rack->num_magazines + 1), MALLOC_SNAPSHOT_RANGE_GUARDED);
+	if (rg->hashed_regions != rack->initial_regions) {
+		count = snapshot_add_range(ranges, count, rg->hashed_regions,
+				rg->num_regions_allocated * sizeof(region_t), 0);
+	}
+	for (size_t i = 0; i < rg->num_regions_allocated; i++) {
+		region_t region = rg->hashed_regions[i];
+		if (region != HASHRING_OPEN_ENTRY && region != HASHRING_REGION_DEALLOCATED) {
+			count = snapshot_add_range(ranges, count, region, region_size, 0);
+		}
+	}
+	return count;
+}
+
+// Lists the ranges to save, or just counts them if ranges is NULL. Assumes
+// the zone is locked.
+static unsigned
+snapshot_collect(szone_t *szone, malloc_snapshot_range_t *ranges)
+{
+	unsigned count = 0;
+
+	count = snapshot_add_range(ranges, count, szone, SZONE_PAGED_SIZE, 0);
+	count = snapshot_collect_rack(&szone->tiny_rack, TINY_REGION_SIZE, ranges, count);
+	count = snapshot_collect_rack(&szone->small_rack, SMALL_REGION_SIZE, ranges, count);
+#if CONFIG_MEDIUM_ALLOCATOR
+	if (szone->is_medium_engaged) {
+		count = snapshot_collect_rack(&szone->medium_rack, MEDIUM_REGION_SIZE, ranges, count);
+	}
+#endif // CONFIG_MEDIUM_ALLOCATOR
+
+	if (szone->num_large_entries) {
+		count = snapshot_add_range(ranges, count, szone->large_entries,
+				szone->num_large_entries * sizeof(large_entry_t), 0);
+		for (unsigned i = 0; i < szone->num_large_entries; i++) {
+			large_entry_t *entry = &szone->large_entries[i];
+			if (entry->address) {
+				count = snapshot_add_range(ranges, count, (void *)entry->address,
+						entry->size + LARGE_ENTRY_HEADROOM(entry), 0);
+			}
+		}
+	}
+	return count;
+}
+
+static boolean_t
+snapshot_page_is_zero(const uint8_t *page)
+{
+	const uint64_t *words = (const uint64_t *)page;
+	for (size_t i = 0; i < vm_page_quanta_size / sizeof(uint64_t); i++) {
+		if (words[i]) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// Returns TRUE if any of [address, address + size) is mapped from a file, as
+// it is in a zone that was itself restored from a snapshot. Untouched pages of
+// such a mapping hold the file's contents rather than zeros, so they can't be
+// told apart by their disposition.
+static boolean_t
+snapshot_range_is_file_backed(mach_vm_address_t address, mach_vm_size_t size)
+{
+	mach_vm_address_t end = address + size;
+
+	while (address < end) {
+		mach_vm_address_t region = address;
+		mach_vm_size_t region_size = 0;
+		vm_region_extended_info_data_t info;
+		mach_msg_type_number_t count = VM_REGION_EXTENDED_INFO_COUNT;
+		mach_port_t object_name = MACH_PORT_NULL;
+
+		kern_return_t kr = mach_vm_region(mach_task_self(), &region, &region_size,
+				VM_REGION_EXTENDED_INFO, (vm_region_info_t)&info, &count, &object_name);
+		if (kr != KERN_SUCCESS || region > address || info.external_pager) {
+			return TRUE;
+		}
+		address = region + region_size;
+	}
+	return FALSE;
+}
+
+// Writes the pages [start, end) of a range. Returns 0 or an errno value.
+static int
+snapshot_write_pages(int fd, const malloc_snapshot_range_t *range, size_t start, size_t end)
+{
+	const uint8_t *base = (const uint8_t *)(uintptr_t)range->address;
+	size_t len = end - start;
+
+	if (len && pwrite(fd, base + start, len, (off_t)(range->offset + start)) != (ssize_t)len) {
+		return errno ? errno : EIO;
+	}
+	return 0;
+}
+
+// Pages are queried this many at a time.
+#define SNAPSHOT_QUERY_PAGES 256
+
+// Writes the contents of a range, leaving holes for pages that hold nothing.
+// A page is only read if the VM reports it resident or paged out, or if it
+// can't say, and is then skipped if it is all zero. Returns 0 or an errno
+// value.
+static int
+snapshot_write_range(int fd, const malloc_snapshot_range_t *range)
+{
+	const uint8_t *base = (const uint8_t *)(uintptr_t)range->address;
+	boolean_t file_backed = snapshot_range_is_file_backed(range->address, range->size);
+	int dispositions[SNAPSHOT_QUERY_PAGES];
+	size_t offset = 0;
+	size_t run = 0; // start of the pages waiting to be written
+	int err;
+
+	while (offset < range->size) {
+		size_t chunk = MIN((size_t)range->size - offset, SNAPSHOT_QUERY_PAGES * vm_page_quanta_size);
+		size_t pages = chunk / vm_page_quanta_size;
+		mach_vm_size_t queried = 0;
+
+		if (!file_backed) {
+			queried = pages;
+			if (mach_vm_page_range_query(mach_task_self(), range->address + offset, chunk,
+					(mach_vm_address_t)(uintptr_t)dispositions, &queried) != KERN_SUCCESS) {
+				queried = 0;
+			}
+		}
+
+		for (size_t i = 0; i < pages; i++, offset += vm_page_quanta_size) {
+			boolean_t empty;
+			if (i < queried && !(dispositions[i] &
+					(VM_PAGE_QUERY_PAGE_PRESENT | VM_PAGE_QUERY_PAGE_PAGED_OUT))) {
+				empty = TRUE;
+			} else {
+				empty = snapshot_page_is_zero(base + offset);
+			}
+			if (empty) {
+				err = snapshot_write_pages(fd, range, run, offset);
+				if (err) {
+					return err;
+				}
+				run = offset + vm_page_quanta_size;
+			}
+		}
+	}
+	return snapshot_write_pages(fd, range, run, offset);
+}
+
+int
+malloc_zone_snapshot(malloc_zone_t *zone, int fd)
+{
+	szone_t *szone = (szone_t *)zone;
+	int err = 0;
+
+	if (zone->introspect != (struct malloc_introspection_t *)&szone_introspect) {
+		return EINVAL;
+	}
+	if (szone->helper_zone || (szone->debug_flags & MALLOC_ADD_GUARD_PAGES)) {
+		return ENOTSUP;
+	}
+#if CONFIG_THREAD_CACHE
+	if (szone->tcache_max_bytes) {
+		// Blocks parked in other threads' caches can't be accounted for.
+		return ENOTSUP;
+	}
+#endif // CONFIG_THREAD_CACHE
+
+	zone->introspect->force_lock(zone);
+
+	// The range table is taken straight from the VM, since the zone being
+	// saved may be the one that malloc() would use.
+	unsigned num_ranges = snapshot_collect(szone, NULL);
+	size_t table_size = round_page_quanta(sizeof(malloc_snapshot_header_t) +
+			num_ranges * sizeof(malloc_snapshot_range_t));
+	malloc_snapshot_header_t *header = mvm_allocate_pages(table_size, 0, 0, VM_MEMORY_MALLOC);
+	if (!header) {
+		zone->introspect->force_unlock(zone);
+		return ENOMEM;
+	}
+	malloc_snapshot_range_t *ranges = (malloc_snapshot_range_t *)(header + 1);
+
+	header->magic = MALLOC_SNAPSHOT_MAGIC;
+	header->version = MALLOC_SNAPSHOT_VERSION;
+	header->num_ranges = num_ranges;
+	header->page_size = vm_page_quanta_size;
+	header->szone_size = sizeof(szone_t);
+	header->magazine_size = sizeof(magazine_t);
+	header->zone = (uintptr_t)szone;
+
+	snapshot_collect(szone, ranges);
+	uint64_t offset = table_size;
+	for (unsigned i = 0; i < num_ranges; i++) {
+		ranges[i].offset = offset;
+		offset += ranges[i].size;
+	}
+
+	if (ftruncate(fd, (off_t)offset) == -1 ||
+			pwrite(fd, header, table_size, 0) != (ssize_t)table_size) {
+		err = errno ? errno : EIO;
+	}
+	for (unsigned i = 0; !err && i < num_ranges; i++) {
+		err = snapshot_write_range(fd, &ranges[i]);
+	}
+
+	zone->introspect->force_unlock(zone);
+	mvm_deallocate_pages(header, table_size, 0);
+	return err;
+}
+
+static void
+snapshot_unmap_range(const malloc_snapshot_range_t *range)
+{
+	uintptr_t address = (uintptr_t)range->address;
+	size_t size = (size_t)range->size;
+
+	if (range->flags & MALLOC_SNAPSHOT_RANGE_GUARDED) {
+		address -= vm_page_quanta_size;
+		size += 2 * vm_page_quanta_size;
+	}
+	munmap((void *)address, size);
+}
+
+// Maps a range of the image copy-on-write at its original address. Returns 0,
+// EEXIST if something else is already mapped there, or another errno value.
+static int
+snapshot_map_range(int fd, const malloc_snapshot_range_t *range)
+{
+	void *address = (void *)(uintptr_t)range->address;
+	size_t size = (size_t)range->size;
+	void *p;
+
+	if (range->flags & MALLOC_SNAPSHOT_RANGE_GUARDED) {
+		// Claim the guard pages along with the range, then map the image
+		// over the middle.
+		void *guarded = (void *)((uintptr_t)address - vm_page_quanta_size);
+		size_t guarded_size = size + 2 * vm_page_quanta_size;
+
+		p = mmap(guarded, guarded_size, PROT_NONE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		if (p == MAP_FAILED) {
+			return errno;
+		}
+		if (p != guarded) {
+			munmap(p, guarded_size);
+			return EEXIST;
+		}
+		p = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)range->offset);
+		if (p == MAP_FAILED) {
+			int err = errno;
+			munmap(guarded, guarded_size);
+			return err;
+		}
+		return 0;
+	}
+
+	p = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)range->offset);
+	if (p == MAP_FAILED) {
+		return errno;
+	}
+	if (p != address) {
+		munmap(p, size);
+		return EEXIST;
+	}
+	return 0;
+}
+
+static void
+snapshot_publish_rack(rack_t *rack)
+{
+	region_hash_generation_t *rg = rack->region_generation;
+
+	for (size_t i = 0; i < rg->num_regions_allocated; i++) {
+		region_t region = rg->hashed_regions[i];
+		if (region != HASHRING_OPEN_ENTRY && region != HASHRING_REGION_DEALLOCATED) {
+			rack_region_publish(rack, region);
+		}
+	}
+}
+
+malloc_zone_t *
+malloc_zone_restore(int fd)
+{
+	malloc_snapshot_header_t header;
+	ssize_t n;
+	int err = 0;
+
+	n = pread(fd, &header, sizeof(header), 0);
+	if (n != sizeof(header)) {
+		errno = (n == -1) ? errno : EINVAL;
+		return NULL;
+	}
+	if (header.magic != MALLOC_SNAPSHOT_MAGIC || header.version != MALLOC_SNAPSHOT_VERSION ||
+			header.page_size != vm_page_quanta_size || header.szone_size != sizeof(szone_t) ||
+			header.magazine_size != sizeof(magazine_t)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	size_t table_size = round_page_quanta(sizeof(malloc_snapshot_header_t) +
+			header.num_ranges * sizeof(malloc_snapshot_range_t));
+	malloc_snapshot_header_t *table = mvm_allocate_pages(table_size, 0, 0, VM_MEMORY_MALLOC);
+	if (!table) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	n = pread(fd, table, table_size, 0);
+	if (n != (ssize_t)table_size) {
+		err = (n == -1) ? errno : EINVAL;
+		mvm_deallocate_pages(table, table_size, 0);
+		errno = err;
+		return NULL;
+	}
+	malloc_snapshot_range_t *ranges = (malloc_snapshot_range_t *)(table + 1);
+
+	unsigned mapped;
+	for (mapped = 0; mapped < header.num_ranges; mapped++) {
+		err = snapshot_map_range(fd, &ranges[mapped]);
+		if (err) {
+			while (mapped--) {
+				snapshot_unmap_range(&ranges[mapped]);
+			}
+			mvm_deallocate_pages(table, table_size, 0);
+			errno = err;
+			return NULL;
+		}
+	}
+	mvm_deallocate_pages(table, table_size, 0);
+
+	szone_t *szone = (szone_t *)(uintptr_t)header.zone;
+	szone_reactivate(szone);
+	malloc_zone_register(&szone->basic_zone);
+
+	// The zone index only takes ranges for registered zones.
+	snapshot_publish_rack(&szone->tiny_rack);
+	snapshot_publish_rack(&szone->small_rack);
+#if CONFIG_MEDIUM_ALLOCATOR
+	if (szone->is_medium_engaged) {
+		snapshot_publish_rack(&szone->medium_rack);
+	}
+#endif // CONFIG_MEDIUM_ALLOCATOR
+
+	return &szone->basic_zone;
+}
@@ -46,6 +46,7 @@
 #include <mach-o/dyld_priv.h>
 #include <mach/mach.h>
 #include <mach/mach_init.h>
+#include <mach/mach_time.h>
 #include <mach/mach_types.h>
 #include <mach/mach_vm.h>
 #include <mach/shared_region.h>
@@ -107,6 +108,7 @@
 #include "nano_zone_common.h"
 #include "nano_zone.h"
 #include "nanov2_zone.h"
+#include "malloc_scavenger.h"
 
 #include "magazine_inline.h"
 
@@ -129,4 +131,14 @@ malloc_gdb_po_unsafe(void);
 MALLOC_NOEXPORT
 extern uint64_t max_lite_mallocs;
 
+#if CONFIG_ZONE_INDEX
+MALLOC_NOEXPORT
+void
+malloc_zone_index_insert(malloc_zone_t *zone, vm_address_t addr, vm_size_t size);
+
+MALLOC_NOEXPORT
+void
+malloc_zone_index_remove(vm_address_t addr, vm_size_t size);
+#endif // CONFIG_ZONE_INDEX
+
 #endif // __INTERNAL_H
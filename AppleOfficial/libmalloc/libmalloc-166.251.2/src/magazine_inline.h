@@ -163,7 +163,14 @@ SZONE_REINIT_LOCK(szone_t *szone)
 static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
 SZONE_MAGAZINE_PTR_LOCK(magazine_t *mag_ptr)
 {
-	_malloc_lock_lock(&mag_ptr->magazine_lock);
+	// Try first so that contention can be counted. The counters share a
+	// cache line with the lock, so this costs nothing measurable when the
+	// lock is free.
+	if (!_malloc_lock_trylock(&mag_ptr->magazine_lock)) {
+		_malloc_lock_lock(&mag_ptr->magazine_lock);
+		mag_ptr->mag_lock_contentions++;
+	}
+	mag_ptr->mag_lock_acquisitions++;
 }
 
 static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
@@ -175,7 +182,11 @@ SZONE_MAGAZINE_PTR_UNLOCK(magazine_t *mag_ptr)
 static MALLOC_INLINE MALLOC_ALWAYS_INLINE bool
 SZONE_MAGAZINE_PTR_TRY_LOCK(magazine_t *mag_ptr)
 {
-	return _malloc_lock_trylock(&mag_ptr->magazine_lock);
+	if (_malloc_lock_trylock(&mag_ptr->magazine_lock)) {
+		mag_ptr->mag_lock_acquisitions++;
+		return true;
+	}
+	return false;
 }
 
 static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
@@ -477,6 +488,102 @@ mag_lock_zine_for_region_trailer(magazine_t *magazines, region_trailer_t *traile
 	return mag_ptr;
 }
 
+#pragma mark known zero
+
+/*
+ * The head and tail of a magazine's last region, mag_bytes_free_at_start and
+ * mag_bytes_free_at_end, have never been handed out and still hold the zero
+ * fill of the fresh mapping. Carving a block from either one shrinks it, so
+ * comparing this before and after an allocation tells whether the block is
+ * known to be zero. Madvised ranges are not counted: MADV_FREE_REUSABLE pages
+ * keep their contents until the kernel reclaims them. Assumes the magazine is
+ * locked.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE size_t
+mag_untouched_bytes(magazine_t *mag_ptr)
+{
+	return mag_ptr->mag_bytes_free_at_end + mag_ptr->mag_bytes_free_at_start;
+}
+
+#pragma mark remote free
+
+/*
+ * A thread that frees a tiny or small block while another CPU holds the
+ * owning magazine's lock pushes the block onto the magazine's remote free
+ * list and returns, rather than waiting and pulling the lock's cache line
+ * over. The list is a lock-free stack with any number of producers. The next
+ * thread to take the magazine lock detaches the whole list with a single
+ * exchange and frees the blocks; until then they are still marked in use.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+mag_remote_free_push(rack_t *rack, magazine_t *mag_ptr, void *ptr)
+{
+	remote_free_t *entry = ptr;
+	remote_free_t *head = os_atomic_load(&mag_ptr->mag_remote_free, relaxed);
+
+	do {
+		entry->next.u = free_list_checksum_ptr(rack, head);
+	} while (!os_atomic_cmpxchgv(&mag_ptr->mag_remote_free, head, entry, &head, release));
+}
+
+/*
+ * Detaches a magazine's remote free list. Assumes the magazine is locked.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE remote_free_t *
+mag_remote_free_take(magazine_t *mag_ptr)
+{
+	if (!os_atomic_load(&mag_ptr->mag_remote_free, relaxed)) {
+		return NULL;
+	}
+	return os_atomic_xchg(&mag_ptr->mag_remote_free, NULL, acquire);
+}
+
+/*
+ * Whether a block was on a remote free list when the set was collected.
+ */
+static MALLOC_INLINE boolean_t
+mag_remote_free_set_contains(remote_free_set_t *set, vm_address_t addr)
+{
+	unsigned lo = 0, hi = set->count;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (set->addrs[mid] == addr) {
+			return TRUE;
+		}
+		if (set->addrs[mid] < addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return FALSE;
+}
+
+#pragma mark telemetry
+
+/*
+ * Copies a magazine's counters into the allocator's telemetry. Assumes the
+ * magazine is locked.
+ */
+static MALLOC_INLINE void
+magazine_telemetry(magazine_t *magazines, mag_index_t mag_index,
+		malloc_allocator_telemetry_t *telemetry)
+{
+	magazine_t *mag_ptr = &(magazines[mag_index]);
+	malloc_magazine_telemetry_t *mt = (DEPOT_MAGAZINE_INDEX == mag_index) ?
+			&telemetry->depot : &telemetry->magazines[mag_index];
+
+	mt->lock_acquisitions = mag_ptr->mag_lock_acquisitions;
+	mt->lock_contentions = mag_ptr->mag_lock_contentions;
+	mt->regions_to_depot = mag_ptr->mag_regions_to_depot;
+	mt->regions_from_depot = mag_ptr->mag_regions_from_depot;
+	mt->bytes_madvised = mag_ptr->mag_bytes_madvised;
+	mt->bytes_in_use = mag_ptr->mag_num_bytes_in_objects;
+	mt->bytes_in_magazine = mag_ptr->num_bytes_in_magazine;
+	telemetry->bytes_madvised += mag_ptr->mag_bytes_madvised;
+}
+
 #pragma mark tiny allocator
 
 /*
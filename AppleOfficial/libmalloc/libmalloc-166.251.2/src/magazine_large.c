@@ -165,6 +165,7 @@ large_entries_rehash_after_entry_no_lock(szone_t *szone, large_entry_t *entry)
 		szone->large_entries[index].address = (vm_address_t)0;
 		szone->large_entries[index].size = 0;
 		szone->large_entries[index].did_madvise_reusable = FALSE;
+		szone->large_entries[index].headroom_pages = 0;
 		large_entry_insert_no_lock(szone, range); // this will reinsert in the
 		// proper place
 	} while (index != hash_index);
@@ -243,7 +244,7 @@ large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
 	MALLOC_TRACE(TRACE_large_free, (uintptr_t)szone, (uintptr_t)entry->address, entry->size, 0);
 
 	range.address = entry->address;
-	range.size = entry->size;
+	range.size = entry->size + LARGE_ENTRY_HEADROOM(entry);
 
 	if (szone->debug_flags & MALLOC_ADD_GUARD_PAGES) {
 		mvm_protect((void *)range.address, range.size, PROT_READ | PROT_WRITE, szone->debug_flags);
@@ -254,6 +255,7 @@ large_entry_free_no_lock(szone_t *szone, large_entry_t *entry)
 	entry->address = 0;
 	entry->size = 0;
 	entry->did_madvise_reusable = FALSE;
+	entry->headroom_pages = 0;
 	large_entries_rehash_after_entry_no_lock(szone, entry);
 
 #if DEBUG_MALLOC
@@ -314,106 +316,292 @@ large_in_use_enumerator(task_t task,
 	return 0;
 }
 
-void *
-large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, boolean_t cleared_requested)
+#if CONFIG_LARGE_CACHE
+/*
+ * The large entry cache ("death row") holds freed large entries for reuse.
+ * Entries are bucketed by size, four buckets per power of two pages, so a
+ * lookup only visits the few buckets that can satisfy a request within the
+ * 50% fragmentation limit. Each bucket is kept most-recently-freed first,
+ * and all entries are also on an age list so that the oldest can be evicted
+ * when the cache runs out of slots or bytes.
+ *
+ * large_entry_cache_reserve_limit bounds the bytes on death row that have not
+ * been madvise()d, i.e. the dirty memory the cache is hoarding. Arrivals that
+ * would exceed it evict the oldest entries; only an entry that is larger than
+ * the whole budget is madvise()d on its way in.
+ */
+static MALLOC_INLINE unsigned
+large_cache_bucket(size_t size)
 {
-	void *addr;
-	vm_range_t range_to_deallocate;
-	size_t size;
-	large_entry_t large_entry;
+	size_t pages = size >> vm_page_quanta_shift;
+	unsigned log2 = (unsigned)(sizeof(size_t) * CHAR_BIT - 1 - __builtin_clzl(pages));
+	unsigned sub = (unsigned)((log2 >= 2 ? pages >> (log2 - 2) : pages << (2 - log2)) & 3);
+	return MIN(log2 * 4 + sub, LARGE_CACHE_BUCKETS - 1);
+}
 
-	MALLOC_TRACE(TRACE_large_malloc, (uintptr_t)szone, num_kernel_pages, alignment, cleared_requested);
+// Smallest size that maps to bucket b.
+static MALLOC_INLINE size_t
+large_cache_bucket_base(unsigned b)
+{
+	size_t pages = ((size_t)(4 + (b & 3)) << (b >> 2)) >> 2;
+	return pages << vm_page_quanta_shift;
+}
 
-	if (!num_kernel_pages) {
-		num_kernel_pages = 1; // minimal allocation size for this szone
+void
+large_cache_init(szone_t *szone)
+{
+	for (int i = 0; i < LARGE_ENTRY_CACHE_SIZE; i++) {
+		szone->large_entry_cache[i].entry.address = 0;
+		szone->large_entry_cache[i].entry.size = 0;
+		szone->large_entry_cache[i].entry.did_madvise_reusable = FALSE;
+		szone->large_entry_cache[i].entry.headroom_pages = 0;
 	}
-	size = (size_t)num_kernel_pages << vm_page_quanta_shift;
-	range_to_deallocate.size = 0;
-	range_to_deallocate.address = 0;
+	for (int i = 0; i < LARGE_CACHE_BUCKETS; i++) {
+		szone->large_entry_cache_bucket_head[i] = LARGE_CACHE_NONE;
+	}
+	szone->large_entry_cache_bucket_map = 0;
+	szone->large_entry_cache_newest = LARGE_CACHE_NONE;
+	szone->large_entry_cache_oldest = LARGE_CACHE_NONE;
+	szone->large_entry_cache_bytes = 0;
+	szone->large_entry_cache_reserve_bytes = 0;
+}
 
-#if CONFIG_LARGE_CACHE
-	if (size < LARGE_CACHE_SIZE_ENTRY_LIMIT) { // Look for a large_entry_t on the death-row cache?
-		SZONE_LOCK(szone);
+static void
+large_cache_link_no_lock(szone_t *szone, int16_t slot, large_entry_t entry)
+{
+	large_cache_entry_t *lce = &szone->large_entry_cache[slot];
+	unsigned b = large_cache_bucket(entry.size);
 
-		int i, best = -1, idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
-		size_t best_size = SIZE_T_MAX;
+	lce->entry = entry;
 
-		while (1) { // Scan large_entry_cache for best fit, starting with most recent entry
-			size_t this_size = szone->large_entry_cache[idx].size;
-			addr = (void *)szone->large_entry_cache[idx].address;
+	lce->bucket_prev = LARGE_CACHE_NONE;
+	lce->bucket_next = szone->large_entry_cache_bucket_head[b];
+	if (lce->bucket_next != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->bucket_next].bucket_prev = slot;
+	}
+	szone->large_entry_cache_bucket_head[b] = slot;
+	szone->large_entry_cache_bucket_map |= 1ULL << b;
 
-			if (0 == alignment || 0 == (((uintptr_t)addr) & (((uintptr_t)1 << alignment) - 1))) {
-				if (size == this_size) { // size match!
-					best = idx;
-					best_size = this_size;
-					break;
-				}
+	lce->age_newer = LARGE_CACHE_NONE;
+	lce->age_older = szone->large_entry_cache_newest;
+	if (lce->age_older != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->age_older].age_newer = slot;
+	} else {
+		szone->large_entry_cache_oldest = slot;
+	}
+	szone->large_entry_cache_newest = slot;
+
+	szone->large_entry_cache_bytes += entry.size;
+	if (!entry.did_madvise_reusable) { // Entered on death-row without madvise() => up the hoard total
+		szone->large_entry_cache_reserve_bytes += entry.size;
+	}
+}
+
+static large_entry_t
+large_cache_unlink_no_lock(szone_t *szone, int16_t slot)
+{
+	large_cache_entry_t *lce = &szone->large_entry_cache[slot];
+	large_entry_t entry = lce->entry;
+	unsigned b = large_cache_bucket(entry.size);
+
+	if (lce->bucket_prev != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->bucket_prev].bucket_next = lce->bucket_next;
+	} else {
+		szone->large_entry_cache_bucket_head[b] = lce->bucket_next;
+		if (lce->bucket_next == LARGE_CACHE_NONE) {
+			szone->large_entry_cache_bucket_map &= ~(1ULL << b);
+		}
+	}
+	if (lce->bucket_next != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->bucket_next].bucket_prev = lce->bucket_prev;
+	}
+
+	if (lce->age_newer != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->age_newer].age_older = lce->age_older;
+	} else {
+		szone->large_entry_cache_newest = lce->age_older;
+	}
+	if (lce->age_older != LARGE_CACHE_NONE) {
+		szone->large_entry_cache[lce->age_older].age_newer = lce->age_newer;
+	} else {
+		szone->large_entry_cache_oldest = lce->age_newer;
+	}
+
+	szone->large_entry_cache_bytes -= entry.size;
+	if (!entry.did_madvise_reusable) {
+		szone->large_entry_cache_reserve_bytes -= entry.size;
+	}
+
+	lce->entry.address = 0;
+	lce->entry.size = 0;
+	lce->entry.did_madvise_reusable = FALSE;
+	return entry;
+}
+
+static int16_t
+large_cache_free_slot_no_lock(szone_t *szone)
+{
+	for (int16_t slot = 0; slot < LARGE_ENTRY_CACHE_SIZE; slot++) {
+		if (0 == szone->large_entry_cache[slot].entry.address) {
+			return slot;
+		}
+	}
+	return LARGE_CACHE_NONE;
+}
 
-				if (size <= this_size && this_size < best_size) { // improved fit?
-					best = idx;
+/*
+ * Find the cached entry that best satisfies a request. Entries whose pages
+ * were never madvise()d are preferred since reusing them doesn't fault, then
+ * the tightest fit. Returns LARGE_CACHE_NONE if nothing fits.
+ */
+static int16_t
+large_cache_find_no_lock(szone_t *szone, size_t size, unsigned char alignment)
+{
+	uint64_t map = szone->large_entry_cache_bucket_map;
+	unsigned b = large_cache_bucket(size);
+	int16_t best = LARGE_CACHE_NONE;
+	boolean_t best_resident = FALSE;
+	size_t best_size = SIZE_T_MAX;
+
+	map &= ~0ULL << b;
+	while (map) {
+		b = __builtin_ctzll(map);
+		map &= map - 1;
+		if (large_cache_bucket_base(b) >= 2 * size) {
+			break; // limit fragmentation to 50%
+		}
+
+		int16_t slot = szone->large_entry_cache_bucket_head[b];
+		while (slot != LARGE_CACHE_NONE) {
+			large_entry_t *entry = &szone->large_entry_cache[slot].entry;
+			size_t this_size = entry->size;
+
+			if (size <= this_size && (this_size - size) < size &&
+					(0 == alignment || 0 == (entry->address & (((uintptr_t)1 << alignment) - 1)))) {
+				boolean_t resident = !entry->did_madvise_reusable;
+				if (best == LARGE_CACHE_NONE || (resident && !best_resident) ||
+						(resident == best_resident && this_size < best_size)) {
+					best = slot;
+					best_resident = resident;
 					best_size = this_size;
+					if (resident && this_size == size) { // size match!
+						return best;
+					}
 				}
 			}
+			slot = szone->large_entry_cache[slot].bucket_next;
+		}
 
-			if (idx == stop_idx) { // exhausted live ring?
-				break;
-			}
+		if (best_resident) {
+			break; // higher buckets can only fit worse
+		}
+	}
+	return best;
+}
 
-			if (idx) {
-				idx--; // bump idx down
-			} else {
-				idx = LARGE_ENTRY_CACHE_SIZE - 1; // wrap idx
-			}
+/*
+ * Evict the oldest entries until an entry of the given size fits within the
+ * slot and byte budgets. Returns the number of ranges stored in evicted[],
+ * which the caller deallocates after dropping the lock.
+ */
+static unsigned
+large_cache_evict_no_lock(szone_t *szone, size_t size, boolean_t resident, vm_range_t *evicted)
+{
+	unsigned count = 0;
+
+	while (szone->large_entry_cache_oldest != LARGE_CACHE_NONE) {
+		boolean_t full = large_cache_free_slot_no_lock(szone) == LARGE_CACHE_NONE;
+		boolean_t over_limit = szone->large_entry_cache_bytes + size > LARGE_CACHE_SIZE_LIMIT;
+		boolean_t over_reserve = resident &&
+				szone->large_entry_cache_reserve_bytes + size > szone->large_entry_cache_reserve_limit;
+		if (!full && !over_limit && !over_reserve) {
+			break;
 		}
 
-		if (best > -1 && (best_size - size) < size) { // limit fragmentation to 50%
-			addr = (void *)szone->large_entry_cache[best].address;
-			boolean_t was_madvised_reusable = szone->large_entry_cache[best].did_madvise_reusable;
+		large_entry_t entry = large_cache_unlink_no_lock(szone, szone->large_entry_cache_oldest);
+		evicted[count].address = entry.address;
+		evicted[count].size = entry.size;
+		count++;
+		szone->large_entry_cache_evictions++;
+	}
+	return count;
+}
 
-			// Compact live ring to fill entry now vacated at large_entry_cache[best]
-			// while preserving time-order
-			if (szone->large_entry_cache_oldest < szone->large_entry_cache_newest) {
-				// Ring hasn't wrapped. Fill in from right.
-				for (i = best; i < szone->large_entry_cache_newest; ++i) {
-					szone->large_entry_cache[i] = szone->large_entry_cache[i + 1];
-				}
+unsigned
+large_cache_drain(szone_t *szone, size_t *total)
+{
+	vm_range_t ranges[LARGE_ENTRY_CACHE_SIZE];
+	unsigned count = 0;
 
-				szone->large_entry_cache_newest--; // Pull in right endpoint.
+	SZONE_LOCK(szone);
+	while (szone->large_entry_cache_oldest != LARGE_CACHE_NONE) {
+		large_entry_t entry = large_cache_unlink_no_lock(szone, szone->large_entry_cache_oldest);
+		ranges[count].address = entry.address;
+		ranges[count].size = entry.size;
+		count++;
+	}
+	szone->flotsam_enabled = FALSE;
+	SZONE_UNLOCK(szone);
 
-			} else if (szone->large_entry_cache_newest < szone->large_entry_cache_oldest) {
-				// Ring has wrapped. Arrange to fill in from the contiguous side.
-				if (best <= szone->large_entry_cache_newest) {
-					// Fill from right.
-					for (i = best; i < szone->large_entry_cache_newest; ++i) {
-						szone->large_entry_cache[i] = szone->large_entry_cache[i + 1];
-					}
+	// deallocate the death-row cache outside the zone lock
+	size_t bytes = 0;
+	for (unsigned i = 0; i < count; i++) {
+		mvm_deallocate_pages((void *)ranges[i].address, ranges[i].size, 0);
+		bytes += ranges[i].size;
+	}
+	if (total) {
+		*total = bytes;
+	}
+	return count;
+}
 
-					if (0 < szone->large_entry_cache_newest) {
-						szone->large_entry_cache_newest--;
-					} else {
-						szone->large_entry_cache_newest = LARGE_ENTRY_CACHE_SIZE - 1;
-					}
-				} else {
-					// Fill from left.
-					for (i = best; i > szone->large_entry_cache_oldest; --i) {
-						szone->large_entry_cache[i] = szone->large_entry_cache[i - 1];
-					}
+void
+large_cache_statistics(szone_t *szone, malloc_large_cache_statistics_t *stats)
+{
+	SZONE_LOCK(szone);
+	stats->entries = 0;
+	for (int16_t slot = szone->large_entry_cache_newest; slot != LARGE_CACHE_NONE;
+			slot = szone->large_entry_cache[slot].age_older) {
+		stats->entries++;
+	}
+	stats->max_entries = LARGE_ENTRY_CACHE_SIZE;
+	stats->bytes_cached = szone->large_entry_cache_bytes;
+	stats->bytes_resident = szone->large_entry_cache_reserve_bytes;
+	stats->reserve_limit = szone->large_entry_cache_reserve_limit;
+	stats->hits = szone->large_entry_cache_hits;
+	stats->misses = szone->large_entry_cache_misses;
+	stats->evictions = szone->large_entry_cache_evictions;
+	SZONE_UNLOCK(szone);
+}
+#endif // CONFIG_LARGE_CACHE
 
-					if (szone->large_entry_cache_oldest < LARGE_ENTRY_CACHE_SIZE - 1) {
-						szone->large_entry_cache_oldest++;
-					} else {
-						szone->large_entry_cache_oldest = 0;
-					}
-				}
+void *
+large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, boolean_t cleared_requested)
+{
+	void *addr;
+	vm_range_t range_to_deallocate;
+	size_t size;
+	large_entry_t large_entry;
 
-			} else {
-				// By trichotomy, large_entry_cache_newest == large_entry_cache_oldest.
-				// That implies best == large_entry_cache_newest == large_entry_cache_oldest
-				// and the ring is now empty.
-				szone->large_entry_cache[best].address = 0;
-				szone->large_entry_cache[best].size = 0;
-				szone->large_entry_cache[best].did_madvise_reusable = FALSE;
-			}
+	MALLOC_TRACE(TRACE_large_malloc, (uintptr_t)szone, num_kernel_pages, alignment, cleared_requested);
+
+	if (!num_kernel_pages) {
+		num_kernel_pages = 1; // minimal allocation size for this szone
+	}
+	size = (size_t)num_kernel_pages << vm_page_quanta_shift;
+	range_to_deallocate.size = 0;
+	range_to_deallocate.address = 0;
+
+#if CONFIG_LARGE_CACHE
+	if (size < LARGE_CACHE_SIZE_ENTRY_LIMIT) { // Look for a large_entry_t on the death-row cache?
+		SZONE_LOCK(szone);
+
+		int16_t best = large_cache_find_no_lock(szone, size, alignment);
+		if (best != LARGE_CACHE_NONE) {
+			large_entry_t cached = large_cache_unlink_no_lock(szone, best);
+			size_t best_size = cached.size;
+			addr = (void *)cached.address;
+			szone->large_entry_cache_hits++;
 
 			if ((szone->num_large_objects_in_use + 1) * 4 > szone->num_large_entries) {
 				// density of hash table too high; grow table
@@ -428,15 +616,11 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, b
 			large_entry.address = (vm_address_t)addr;
 			large_entry.size = best_size;
 			large_entry.did_madvise_reusable = FALSE;
+			large_entry.headroom_pages = 0;
 			large_entry_insert_no_lock(szone, large_entry);
 
 			szone->num_large_objects_in_use++;
 			szone->num_bytes_in_large_objects += best_size;
-			if (!was_madvised_reusable) {
-				szone->large_entry_cache_reserve_bytes -= best_size;
-			}
-
-			szone->large_entry_cache_bytes -= best_size;
 
 			if (szone->flotsam_enabled && szone->large_entry_cache_bytes < SZONE_FLOTSAM_THRESHOLD_LOW) {
 				szone->flotsam_enabled = FALSE;
@@ -455,6 +639,7 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, b
 
 			return addr;
 		} else {
+			szone->large_entry_cache_misses++;
 			SZONE_UNLOCK(szone);
 		}
 	}
@@ -482,6 +667,7 @@ large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, b
 	large_entry.address = (vm_address_t)addr;
 	large_entry.size = size;
 	large_entry.did_madvise_reusable = FALSE;
+	large_entry.headroom_pages = 0;
 	large_entry_insert_no_lock(szone, large_entry);
 
 	szone->num_large_objects_in_use++;
@@ -506,35 +692,29 @@ free_large(szone_t *szone, void *ptr)
 	entry = large_entry_for_pointer_no_lock(szone, ptr);
 	if (entry) {
 #if CONFIG_LARGE_CACHE
-		if (entry->size < LARGE_CACHE_SIZE_ENTRY_LIMIT &&
+		// Blocks with realloc headroom have been growing and are not kept on
+		// death row, which only tracks the size of each entry.
+		if (entry->size < LARGE_CACHE_SIZE_ENTRY_LIMIT && !entry->headroom_pages &&
 			-1 != madvise((void *)(entry->address), entry->size,
 						  MADV_CAN_REUSE)) { // Put the large_entry_t on the death-row cache?
-				int idx = szone->large_entry_cache_newest, stop_idx = szone->large_entry_cache_oldest;
 				large_entry_t this_entry = *entry; // Make a local copy, "entry" is volatile when lock is let go.
 				boolean_t reusable = TRUE;
-				boolean_t should_madvise =
-				szone->large_entry_cache_reserve_bytes + this_entry.size > szone->large_entry_cache_reserve_limit;
+				// Entries that don't fit in the hoard at all are madvise()d on
+				// arrival; anything smaller displaces the oldest entries instead.
+				boolean_t should_madvise = this_entry.size > szone->large_entry_cache_reserve_limit;
 
 				// Already freed?
 				// [Note that repeated entries in death-row risk vending the same entry subsequently
 				// to two different malloc() calls. By checking here the (illegal) double free
 				// is accommodated, matching the behavior of the previous implementation.]
-				while (1) { // Scan large_entry_cache starting with most recent entry
-					if (szone->large_entry_cache[idx].address == entry->address) {
+				int16_t slot = szone->large_entry_cache_bucket_head[large_cache_bucket(this_entry.size)];
+				while (slot != LARGE_CACHE_NONE) { // Scan this size's bucket of large_entry_cache
+					if (szone->large_entry_cache[slot].entry.address == this_entry.address) {
 						malloc_zone_error(szone->debug_flags, true, "pointer %p being freed already on death-row\n", ptr);
 						SZONE_UNLOCK(szone);
 						return;
 					}
-
-					if (idx == stop_idx) { // exhausted live ring?
-						break;
-					}
-
-					if (idx) {
-						idx--; // bump idx down
-					} else {
-						idx = LARGE_ENTRY_CACHE_SIZE - 1; // wrap idx
-					}
+					slot = szone->large_entry_cache[slot].bucket_next;
 				}
 
 				SZONE_UNLOCK(szone);
@@ -558,7 +738,7 @@ free_large(szone_t *szone, void *ptr)
 					}
 				}
 
-				// madvise(..., MADV_REUSABLE) death-row arrivals if hoarding would exceed large_entry_cache_reserve_limit
+				// madvise(..., MADV_REUSABLE) death-row arrivals that would exceed large_entry_cache_reserve_limit on their own
 				if (should_madvise) {
 					// Issue madvise to avoid paging out the dirtied free()'d pages in "entry"
 					MAGMALLOC_MADVFREEREGION((void *)szone, (void *)0, (void *)(this_entry.address), (int)this_entry.size); // DTrace USDT Probe
@@ -587,80 +767,32 @@ free_large(szone_t *szone, void *ptr)
 					return;
 				}
 
-				// Add "entry" to death-row ring
+				// Add "entry" to death-row, making room by evicting the oldest entries
 				if (reusable) {
-					int idx = szone->large_entry_cache_newest; // Most recently occupied
-					vm_address_t addr;
-					size_t adjsize;
-
-					if (szone->large_entry_cache_newest == szone->large_entry_cache_oldest &&
-						0 == szone->large_entry_cache[idx].address) {
-						// Ring is empty, idx is good as it stands
-						addr = 0;
-						adjsize = 0;
-					} else {
-						// Extend the queue to the "right" by bumping up large_entry_cache_newest
-						if (idx == LARGE_ENTRY_CACHE_SIZE - 1) {
-							idx = 0; // Wrap index
-						} else {
-							idx++; // Bump index
-						}
-						if (idx == szone->large_entry_cache_oldest) { // Fully occupied
-							// Drop this entry from the cache and deallocate the VM
-							addr = szone->large_entry_cache[idx].address;
-							adjsize = szone->large_entry_cache[idx].size;
-							szone->large_entry_cache_bytes -= adjsize;
-							if (!szone->large_entry_cache[idx].did_madvise_reusable) {
-								szone->large_entry_cache_reserve_bytes -= adjsize;
-							}
-						} else {
-							// Using an unoccupied cache slot
-							addr = 0;
-							adjsize = 0;
-						}
-					}
+					vm_range_t evicted[LARGE_ENTRY_CACHE_SIZE];
+					unsigned num_evicted = large_cache_evict_no_lock(szone, entry->size, !should_madvise, evicted);
 
 					if ((szone->debug_flags & MALLOC_DO_SCRIBBLE)) {
 						memset((void *)(entry->address), should_madvise ? SCRUBBLE_BYTE : SCRABBLE_BYTE, entry->size);
 					}
 
 					entry->did_madvise_reusable = should_madvise; // Was madvise()'d above?
-					if (!should_madvise) {						  // Entered on death-row without madvise() => up the hoard total
-						szone->large_entry_cache_reserve_bytes += entry->size;
-					}
-
-					szone->large_entry_cache_bytes += entry->size;
+					large_cache_link_no_lock(szone, large_cache_free_slot_no_lock(szone), *entry);
 
 					if (!szone->flotsam_enabled && szone->large_entry_cache_bytes > SZONE_FLOTSAM_THRESHOLD_HIGH) {
 						szone->flotsam_enabled = TRUE;
 					}
 
-					szone->large_entry_cache[idx] = *entry;
-					szone->large_entry_cache_newest = idx;
-
 					szone->num_large_objects_in_use--;
 					szone->num_bytes_in_large_objects -= entry->size;
 
 					(void)large_entry_free_no_lock(szone, entry);
 
-					if (0 == addr) {
-						SZONE_UNLOCK(szone);
-						return;
-					}
-
-					// Fall through to drop large_entry_cache_oldest from the cache,
-					// and then deallocate its pages.
-
-					// Trim the queue on the "left" by bumping up large_entry_cache_oldest
-					if (szone->large_entry_cache_oldest == LARGE_ENTRY_CACHE_SIZE - 1) {
-						szone->large_entry_cache_oldest = 0;
-					} else {
-						szone->large_entry_cache_oldest++;
-					}
-
 					// we deallocate_pages, including guard pages, outside the lock
 					SZONE_UNLOCK(szone);
-					mvm_deallocate_pages((void *)addr, (size_t)adjsize, 0);
+					for (unsigned i = 0; i < num_evicted; i++) {
+						mvm_deallocate_pages((void *)evicted[i].address, evicted[i].size, 0);
+					}
 					return;
 				} else {
 					/* fall through to discard an allocation that is not reusable */
@@ -717,6 +849,10 @@ large_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new
 		large_entry->size = new_good_size;
 		szone->num_bytes_in_large_objects -= shrinkage;
 		boolean_t guarded = szone->debug_flags & MALLOC_ADD_GUARD_PAGES;
+
+		// A block that shrinks has stopped growing, give up its headroom too.
+		shrinkage += LARGE_ENTRY_HEADROOM(large_entry);
+		large_entry->headroom_pages = 0;
 		SZONE_UNLOCK(szone); // we release the lock asap
 
 		if (guarded) {
@@ -744,7 +880,19 @@ large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 	large_entry_t *large_entry;
 	kern_return_t err;
 
+	new_size = round_page_quanta(new_size);
+
 	SZONE_LOCK(szone);
+	large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+	if (large_entry && LARGE_ENTRY_HEADROOM(large_entry) >= new_size - old_size) {
+		// Grow into the address space reserved above the block by a remap.
+		large_entry->headroom_pages -= (uint32_t)((new_size - old_size) >> vm_page_quanta_shift);
+		large_entry->size = new_size;
+		szone->num_bytes_in_large_objects += new_size - old_size;
+		szone->large_realloc_grown_into_headroom++;
+		SZONE_UNLOCK(szone);
+		return 1;
+	}
 	large_entry = large_entry_for_pointer_no_lock(szone, (void *)addr);
 	SZONE_UNLOCK(szone);
 
@@ -752,7 +900,6 @@ large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 		return 0;	  // large pointer already exists in table - extension is not going to work
 	}
 
-	new_size = round_page_quanta(new_size);
 	/*
 	 * Ask for allocation at a specific address, and mark as realloc
 	 * to request coalescing with previous realloc'ed extensions.
@@ -774,11 +921,98 @@ large_try_realloc_in_place(szone_t *szone, void *ptr, size_t old_size, size_t ne
 	large_entry->address = (vm_address_t)ptr;
 	large_entry->size = new_size;
 	szone->num_bytes_in_large_objects += new_size - old_size;
+	szone->large_realloc_grown_in_place++;
 	SZONE_UNLOCK(szone); // we release the lock asap
 	
 	return 1;
 }
 
+#if CONFIG_LARGE_REALLOC_REMAP
+/*
+ * Moves a large block that cannot grow in place to a new mapping of new_size
+ * plus headroom, by remapping its pages rather than copying them. Returns the
+ * new address, or NULL with the block untouched if it cannot be moved.
+ */
+void *
+large_try_realloc_remap(szone_t *szone, void *ptr, size_t old_size, size_t new_size)
+{
+	mach_vm_address_t remap_addr;
+	vm_prot_t cur_prot, max_prot;
+	large_entry_t *large_entry;
+	large_entry_t new_entry;
+	vm_range_t old_range;
+	kern_return_t kr;
+
+	if (old_size < LARGE_REALLOC_REMAP_THRESHOLD || (szone->debug_flags & MALLOC_ADD_GUARD_PAGES)) {
+		return NULL;
+	}
+
+	new_size = round_page_quanta(new_size);
+	size_t headroom = MIN(new_size, LARGE_REALLOC_HEADROOM_MAX);
+	void *new_ptr = mvm_allocate_pages(new_size + headroom, 0, szone->debug_flags, VM_MEMORY_MALLOC_LARGE);
+	if (!new_ptr) {
+		return NULL;
+	}
+
+	// Replace the start of the new mapping with the block's pages. The block
+	// stays mapped at its old address until its entry has been moved.
+	remap_addr = (mach_vm_address_t)new_ptr;
+	kr = mach_vm_remap(mach_task_self(), &remap_addr, old_size, 0,
+			VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE | VM_MAKE_TAG(VM_MEMORY_MALLOC_LARGE),
+			mach_task_self(), (mach_vm_address_t)ptr, FALSE, &cur_prot, &max_prot,
+			VM_INHERIT_DEFAULT);
+	if (kr != KERN_SUCCESS) {
+		mvm_deallocate_pages(new_ptr, new_size + headroom, 0);
+		return NULL;
+	}
+
+	SZONE_LOCK(szone);
+	large_entry = large_entry_for_pointer_no_lock(szone, ptr);
+	if (!large_entry) {
+		malloc_zone_error(szone->debug_flags, true, "large entry %p reallocated is not properly in table\n", ptr);
+		SZONE_UNLOCK(szone);
+		mvm_deallocate_pages(new_ptr, new_size + headroom, 0);
+		return NULL;
+	}
+
+	// Moving the entry frees one slot and takes one, so the table cannot
+	// need to grow.
+	old_range.address = large_entry->address;
+	old_range.size = large_entry->size + LARGE_ENTRY_HEADROOM(large_entry);
+	large_entry->address = 0;
+	large_entry->size = 0;
+	large_entry->headroom_pages = 0;
+	large_entries_rehash_after_entry_no_lock(szone, large_entry);
+
+	new_entry.address = (vm_address_t)new_ptr;
+	new_entry.size = new_size;
+	new_entry.did_madvise_reusable = FALSE;
+	new_entry.headroom_pages = (uint32_t)(headroom >> vm_page_quanta_shift);
+	large_entry_insert_no_lock(szone, new_entry);
+
+	szone->num_bytes_in_large_objects += new_size - old_size;
+	szone->large_realloc_remaps++;
+	szone->large_realloc_bytes_remapped += old_size;
+	SZONE_UNLOCK(szone);
+
+	mvm_deallocate_pages((void *)old_range.address, old_range.size, 0);
+	return new_ptr;
+}
+#endif // CONFIG_LARGE_REALLOC_REMAP
+
+void
+large_realloc_statistics(szone_t *szone, malloc_large_realloc_statistics_t *stats)
+{
+	SZONE_LOCK(szone);
+	stats->grown_in_place = szone->large_realloc_grown_in_place;
+	stats->grown_into_headroom = szone->large_realloc_grown_into_headroom;
+	stats->remaps = szone->large_realloc_remaps;
+	stats->bytes_remapped = szone->large_realloc_bytes_remapped;
+	stats->copies = szone->large_realloc_copies;
+	stats->bytes_copied = szone->large_realloc_bytes_copied;
+	SZONE_UNLOCK(szone);
+}
+
 boolean_t
 large_claimed_address(szone_t *szone, void *ptr)
 {
@@ -61,6 +61,11 @@ int max_medium_magazines;
 int recirc_retained_regions = DEFAULT_RECIRC_RETAINED_REGIONS;
 #endif // CONFIG_RECIRC_DEPOT
 
+// Per-thread cache budget for the default zone; zero leaves thread caching off.
+#if CONFIG_THREAD_CACHE
+size_t thread_cache_max_bytes = 0;
+#endif // CONFIG_THREAD_CACHE
+
 /*********************	Zone call backs	************************/
 /*
  * Mark these MALLOC_NOINLINE to avoid bloating the purgeable zone call backs
@@ -494,6 +499,13 @@ szone_realloc(szone_t *szone, void *ptr, size_t new_size)
 				memset(ptr + old_size, SCRIBBLE_BYTE, new_good_size - old_size);
 			}
 			return ptr;
+#if CONFIG_LARGE_REALLOC_REMAP
+		} else if ((new_ptr = large_try_realloc_remap(szone, ptr, old_size, new_good_size))) {
+			if (szone->debug_flags & MALLOC_DO_SCRIBBLE) {
+				memset(new_ptr + old_size, SCRIBBLE_BYTE, new_good_size - old_size);
+			}
+			return new_ptr;
+#endif // CONFIG_LARGE_REALLOC_REMAP
 		}
 	}
 
@@ -526,6 +538,10 @@ szone_realloc(szone_t *szone, void *ptr, size_t new_size)
 	{
 		memcpy(new_ptr, ptr, valid_size);
 	}
+	if (old_size > LARGE_THRESHOLD(szone)) {
+		OSAtomicIncrement64((volatile int64_t *)&szone->large_realloc_copies);
+		OSAtomicAdd64((int64_t)valid_size, (volatile int64_t *)&szone->large_realloc_bytes_copied);
+	}
 	szone_free(szone, ptr);
 
 #if DEBUG_MALLOC
@@ -627,8 +643,11 @@ szone_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 
 	CHECK(szone, __PRETTY_FUNCTION__);
 
-	// We only support batch malloc in tiny. Let it free all of the pointers
-	// that belong to it, then let the standard free deal with the rest.
+	// We only support batch malloc in tiny. Sort the pointers so that those
+	// in the same region are adjacent and tiny can free each run under a
+	// single hold of its magazine lock. Let it free all of the pointers that
+	// belong to it, then let the standard free deal with the rest.
+	malloc_common_sort_pointers(to_be_freed, count);
 	tiny_batch_free(szone, to_be_freed, count);
 
 	CHECK(szone, __PRETTY_FUNCTION__);
@@ -640,6 +659,18 @@ szone_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 	}
 }
 
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+// Called on the scavenger thread to madvise the depot regions of this zone
+// that have gone unused for the decay period. Medium regions are still
+// madvised on the free path.
+static void
+szone_scavenge(szone_t *szone, malloc_scavenger_tick_t *tick)
+{
+	tiny_scavenge(&szone->tiny_rack, tick);
+	small_scavenge(&szone->small_rack, tick);
+}
+#endif // CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+
 // FIXME: Suppose one of the locks is held?
 static void
 szone_destroy(szone_t *szone)
@@ -648,36 +679,14 @@ szone_destroy(szone_t *szone)
 	large_entry_t *large;
 	vm_range_t range_to_deallocate;
 
-#if CONFIG_LARGE_CACHE
-	SZONE_LOCK(szone);
-
-	/* disable any memory pressure responder */
-	szone->flotsam_enabled = FALSE;
-
-	// stack allocated copy of the death-row cache
-	int idx = szone->large_entry_cache_oldest, idx_max = szone->large_entry_cache_newest;
-	large_entry_t local_entry_cache[LARGE_ENTRY_CACHE_SIZE];
-
-	memcpy((void *)local_entry_cache, (void *)szone->large_entry_cache, sizeof(local_entry_cache));
-
-	szone->large_entry_cache_oldest = szone->large_entry_cache_newest = 0;
-	szone->large_entry_cache[0].address = 0x0;
-	szone->large_entry_cache[0].size = 0;
-	szone->large_entry_cache_bytes = 0;
-	szone->large_entry_cache_reserve_bytes = 0;
-
-	SZONE_UNLOCK(szone);
+#if CONFIG_SCAVENGER
+	/* make sure the scavenger is done with this zone before tearing it down */
+	malloc_scavenger_unregister(szone);
+#endif
 
-	// deallocate the death-row cache outside the zone lock
-	while (idx != idx_max) {
-		mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-		if (++idx == LARGE_ENTRY_CACHE_SIZE) {
-			idx = 0;
-		}
-	}
-	if (0 != local_entry_cache[idx].address && 0 != local_entry_cache[idx].size) {
-		mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-	}
+#if CONFIG_LARGE_CACHE
+	/* empty the death-row cache and disable any memory pressure responder */
+	large_cache_drain(szone, NULL);
 #endif
 
 	/* destroy large entries */
@@ -685,8 +694,9 @@ szone_destroy(szone_t *szone)
 	while (index--) {
 		large = szone->large_entries + index;
 		if (large->address) {
-			// we deallocate_pages, including guard pages
-			mvm_deallocate_pages((void *)(large->address), large->size, szone->debug_flags);
+			// we deallocate_pages, including guard pages and realloc headroom
+			mvm_deallocate_pages((void *)(large->address), large->size + LARGE_ENTRY_HEADROOM(large),
+					szone->debug_flags);
 		}
 	}
 	large_entries_free_no_lock(szone, szone->large_entries, szone->num_large_entries, &range_to_deallocate);
@@ -895,6 +905,93 @@ szone_check(szone_t *szone)
 	return szone_check_all(szone, "");
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+#define REMOTE_FREE_COLLECT_MAX (1u << 20)
+
+// Walks the remote free lists of a rack in another task, or in this one,
+// storing up to max block addresses in addrs if it isn't NULL. Returns the
+// number of blocks found. The lists may change under us, so a link that
+// can't be read or fails its checksum ends that list rather than trapping.
+static unsigned
+mag_remote_free_walk(task_t task, memory_reader_t reader, rack_t *rack, magazine_t *mags,
+		vm_address_t *addrs, unsigned max)
+{
+	unsigned count = 0;
+	mag_index_t mag_index;
+
+	for (mag_index = 0; mag_index < rack->num_magazines; mag_index++) {
+		vm_address_t entry = (vm_address_t)mags[mag_index].mag_remote_free;
+		while (entry && count < max) {
+			remote_free_t *mapped;
+			if (reader(task, entry, sizeof(remote_free_t), (void **)&mapped)) {
+				break;
+			}
+			if (addrs) {
+				addrs[count] = entry;
+			}
+			count++;
+
+			// free_list_unchecksum_ptr(), without the trap.
+			uintptr_t t = mapped->next.u;
+			t = (t << 4) | (t >> (sizeof(uintptr_t) * 8 - 4));
+			uintptr_t next = t & ~(uintptr_t)0xF;
+			if ((t ^ free_list_gen_checksum(next ^ rack->cookie)) & (uintptr_t)0xF) {
+				break;
+			}
+			entry = next;
+		}
+	}
+	return count;
+}
+
+// The in-use enumerators can neither take locks in the target nor free
+// anything in it, so rather than draining the remote free lists they gather
+// the queued blocks, which are still marked in use, and report them as free.
+// rack and mags are the enumerator's copies. Release the set with
+// mag_remote_free_release().
+void
+mag_remote_free_collect(task_t task, memory_reader_t reader, rack_t *rack, magazine_t *mags,
+		remote_free_set_t *set)
+{
+	set->addrs = NULL;
+	set->count = 0;
+	set->size = 0;
+
+	unsigned count = mag_remote_free_walk(task, reader, rack, mags, NULL, REMOTE_FREE_COLLECT_MAX);
+	if (!count) {
+		return;
+	}
+	vm_size_t size = round_page(count * sizeof(vm_address_t));
+	mach_vm_address_t addrs;
+	if (mach_vm_allocate(mach_task_self(), &addrs, size, VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_MALLOC))) {
+		return;
+	}
+	set->addrs = (vm_address_t *)addrs;
+	set->size = size;
+	set->count = mag_remote_free_walk(task, reader, rack, mags, set->addrs, count);
+	malloc_common_sort_pointers((void **)set->addrs, set->count);
+}
+
+void
+mag_remote_free_release(remote_free_set_t *set)
+{
+	if (set->addrs) {
+		mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)set->addrs, set->size);
+		set->addrs = NULL;
+		set->count = 0;
+	}
+}
+
+// Drains the remote free lists of the tiny and small racks, so that blocks
+// other threads have freed are neither counted nor kept as in use.
+static void
+szone_free_remote_all(szone_t *szone)
+{
+	tiny_free_remote_all(&szone->tiny_rack);
+	small_free_remote_all(&szone->small_rack);
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 static kern_return_t
 szone_ptr_in_use_enumerator(task_t task,
 		void *context,
@@ -1120,6 +1217,9 @@ szone_force_lock(szone_t *szone)
 #endif
 
 	SZONE_LOCK(szone);
+#if CONFIG_THREAD_CACHE
+	_malloc_lock_lock(&szone->tcache_lock);
+#endif
 }
 
 static void
@@ -1127,6 +1227,9 @@ szone_force_unlock(szone_t *szone)
 {
 	mag_index_t i;
 
+#if CONFIG_THREAD_CACHE
+	_malloc_lock_unlock(&szone->tcache_lock);
+#endif
 	SZONE_UNLOCK(szone);
 
 #if CONFIG_MEDIUM_ALLOCATOR
@@ -1151,6 +1254,9 @@ szone_reinit_lock(szone_t *szone)
 {
 	mag_index_t i;
 
+#if CONFIG_THREAD_CACHE
+	_malloc_lock_init(&szone->tcache_lock);
+#endif
 	SZONE_REINIT_LOCK(szone);
 
 #if CONFIG_MEDIUM_ALLOCATOR
@@ -1168,6 +1274,18 @@ szone_reinit_lock(szone_t *szone)
 	for (i = -1; i < szone->tiny_rack.num_magazines; ++i) {
 		SZONE_MAGAZINE_PTR_REINIT_LOCK((&(szone->tiny_rack.magazines[i])));
 	}
+
+#if CONFIG_THREAD_CACHE
+	// Caches of threads other than the forking one would never be used again.
+	thread_cache_reinit_after_fork(szone);
+#endif // CONFIG_THREAD_CACHE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// The child has only the forking thread, which may never touch the
+	// magazines that other threads queued blocks on. The drain can't be done
+	// in szone_force_lock(), which runs with malloc_zone_index_lock held.
+	szone_free_remote_all(szone);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 }
 
 static boolean_t
@@ -1220,6 +1338,12 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 	MAGMALLOC_PRESSURERELIEFBEGIN((void *)szone, szone->basic_zone.zone_name, (int)goal); // DTrace USDT Probe
 	MALLOC_TRACE(TRACE_malloc_memory_pressure | DBG_FUNC_START, (uint64_t)szone, goal, 0, 0);
 
+#if CONFIG_THREAD_CACHE
+	// Only the calling thread's cache can be flushed from here; the others
+	// are flushed by their own threads the next time they use them.
+	thread_cache_invalidate(szone);
+#endif // CONFIG_THREAD_CACHE
+
 #if CONFIG_MADVISE_PRESSURE_RELIEF
 	tiny_madvise_pressure_relief(&szone->tiny_rack);
 	small_madvise_pressure_relief(&szone->small_rack);
@@ -1233,37 +1357,7 @@ szone_pressure_relief(szone_t *szone, size_t goal)
 
 #if CONFIG_LARGE_CACHE
 	if (szone->flotsam_enabled) {
-		SZONE_LOCK(szone);
-
-		// stack allocated copy of the death-row cache
-		int idx = szone->large_entry_cache_oldest, idx_max = szone->large_entry_cache_newest;
-		large_entry_t local_entry_cache[LARGE_ENTRY_CACHE_SIZE];
-
-		memcpy((void *)local_entry_cache, (void *)szone->large_entry_cache, sizeof(local_entry_cache));
-
-		szone->large_entry_cache_oldest = szone->large_entry_cache_newest = 0;
-		szone->large_entry_cache[0].address = 0x0;
-		szone->large_entry_cache[0].size = 0;
-		szone->large_entry_cache_bytes = 0;
-		szone->large_entry_cache_reserve_bytes = 0;
-
-		szone->flotsam_enabled = FALSE;
-
-		SZONE_UNLOCK(szone);
-
-		// deallocate the death-row cache outside the zone lock
-		size_t total = 0;
-		while (idx != idx_max) {
-			mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-			total += local_entry_cache[idx].size;
-			if (++idx == LARGE_ENTRY_CACHE_SIZE) {
-				idx = 0;
-			}
-		}
-		if (0 != local_entry_cache[idx].address && 0 != local_entry_cache[idx].size) {
-			mvm_deallocate_pages((void *)local_entry_cache[idx].address, local_entry_cache[idx].size, 0);
-			total += local_entry_cache[idx].size;
-		}
+		large_cache_drain(szone, &total);
 	}
 #endif
 
@@ -1278,6 +1372,10 @@ scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsign
 {
 	szone_t *szone = (szone_t *)zone;
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	szone_free_remote_all(szone);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	switch (subzone) {
 	case 0: {
 		size_t s = 0;
@@ -1356,6 +1454,51 @@ scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsign
 	return 0;
 }
 
+boolean_t
+scalable_zone_large_cache_statistics(malloc_zone_t *zone, malloc_large_cache_statistics_t *stats)
+{
+#if CONFIG_LARGE_CACHE
+	szone_t *szone = (szone_t *)zone;
+
+	if (zone->introspect != (struct malloc_introspection_t *)&szone_introspect) {
+		return 0;
+	}
+	large_cache_statistics(szone, stats);
+	return 1;
+#else // CONFIG_LARGE_CACHE
+	return 0;
+#endif // CONFIG_LARGE_CACHE
+}
+
+boolean_t
+scalable_zone_large_realloc_statistics(malloc_zone_t *zone, malloc_large_realloc_statistics_t *stats)
+{
+	szone_t *szone = (szone_t *)zone;
+
+	if (zone->introspect != (struct malloc_introspection_t *)&szone_introspect) {
+		return 0;
+	}
+	large_realloc_statistics(szone, stats);
+	return 1;
+}
+
+boolean_t
+scalable_zone_thread_cache_statistics(malloc_zone_t *zone, malloc_thread_cache_statistics_t *stats)
+{
+#if CONFIG_THREAD_CACHE
+	szone_t *szone = (szone_t *)zone;
+
+	if (zone->introspect != (struct malloc_introspection_t *)&szone_introspect ||
+			!szone->tcache_max_bytes) {
+		return 0;
+	}
+	thread_cache_statistics(szone, stats);
+	return 1;
+#else // CONFIG_THREAD_CACHE
+	return 0;
+#endif // CONFIG_THREAD_CACHE
+}
+
 static void
 szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 {
@@ -1366,6 +1509,10 @@ szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 	size_t u = 0;
 	mag_index_t mag_index;
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	szone_free_remote_all(szone);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	for (mag_index = -1; mag_index < szone->tiny_rack.num_magazines; mag_index++) {
 		s += szone->tiny_rack.magazines[mag_index].mag_bytes_free_at_start;
 		s += szone->tiny_rack.magazines[mag_index].mag_bytes_free_at_end;
@@ -1407,6 +1554,50 @@ szone_statistics(szone_t *szone, malloc_statistics_t *stats)
 #endif
 	// Now we account for the untouched areas
 	stats->max_size_in_use -= s;
+
+#if CONFIG_THREAD_CACHE
+	// Blocks parked in thread caches are still marked in use by the magazines.
+	if (szone->tcache_max_bytes) {
+		malloc_thread_cache_statistics_t tstats;
+		thread_cache_statistics(szone, &tstats);
+		stats->blocks_in_use -= tstats.blocks_cached;
+		stats->size_in_use -= tstats.bytes_cached;
+	}
+#endif // CONFIG_THREAD_CACHE
+}
+
+MALLOC_STATIC_ASSERT(MAGAZINE_FREELIST_SLOTS <= MALLOC_TELEMETRY_MAX_SIZE_CLASSES,
+		"MALLOC_TELEMETRY_MAX_SIZE_CLASSES is too small");
+MALLOC_STATIC_ASSERT(TINY_MAX_MAGAZINES <= MALLOC_TELEMETRY_MAX_MAGAZINES &&
+		SMALL_MAX_MAGAZINES <= MALLOC_TELEMETRY_MAX_MAGAZINES,
+		"MALLOC_TELEMETRY_MAX_MAGAZINES is too small");
+
+// Leaves the nano telemetry alone, so that a nano zone can fill that in and
+// then hand over to its helper zone. The caller zeroes the rest.
+static boolean_t
+szone_telemetry(szone_t *szone, malloc_zone_telemetry_t *telemetry)
+{
+	if (telemetry->version != MALLOC_ZONE_TELEMETRY_VERSION) {
+		return 0;
+	}
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	szone_free_remote_all(szone);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	tiny_telemetry(&szone->tiny_rack, &telemetry->tiny);
+	small_telemetry(&szone->small_rack, &telemetry->small);
+#if CONFIG_MEDIUM_ALLOCATOR
+	if (szone->is_medium_engaged) {
+		medium_telemetry(&szone->medium_rack, &telemetry->medium);
+	}
+#endif // CONFIG_MEDIUM_ALLOCATOR
+
+	SZONE_LOCK(szone);
+	telemetry->large_blocks_in_use = szone->num_large_objects_in_use;
+	telemetry->large_bytes_in_use = szone->num_bytes_in_large_objects;
+	SZONE_UNLOCK(szone);
+	return 1;
 }
 
 const struct malloc_introspection_t szone_introspect = {
@@ -1414,8 +1605,34 @@ const struct malloc_introspection_t szone_introspect = {
 		(void *)szone_force_lock, (void *)szone_force_unlock, (void *)szone_statistics, (void *)szone_locked, NULL, NULL, NULL,
 		NULL, /* Zone enumeration version 7 and forward. */
 		(void *)szone_reinit_lock, // reinit_lock version 9 and foward
+		(void *)szone_telemetry, // telemetry version 11 and forward
 }; // marked as const to spare the DATA section
 
+static void
+szone_set_functions(szone_t *szone)
+{
+	szone->basic_zone.version = 11;
+	szone->basic_zone.size = (void *)szone_size;
+	szone->basic_zone.malloc = (void *)szone_malloc;
+	szone->basic_zone.calloc = (void *)szone_calloc;
+	szone->basic_zone.valloc = (void *)szone_valloc;
+	szone->basic_zone.free = (void *)szone_free;
+	szone->basic_zone.realloc = (void *)szone_realloc;
+	szone->basic_zone.destroy = (void *)szone_destroy;
+	szone->basic_zone.batch_malloc = (void *)szone_batch_malloc;
+	szone->basic_zone.batch_free = (void *)szone_batch_free;
+	szone->basic_zone.introspect = (struct malloc_introspection_t *)&szone_introspect;
+	szone->basic_zone.memalign = (void *)szone_memalign;
+	szone->basic_zone.free_definite_size = (void *)szone_free_definite_size;
+	szone->basic_zone.pressure_relief = (void *)szone_pressure_relief;
+	szone->basic_zone.claimed_address = (void *)szone_claimed_address;
+
+	/* Set to zero once and for all as required by CFAllocator. */
+	szone->basic_zone.reserved1 = 0;
+	/* Set to zero once and for all as required by CFAllocator. */
+	szone->basic_zone.reserved2 = 0;
+}
+
 szone_t *
 create_scalable_szone(size_t initial_size, unsigned debug_flags)
 {
@@ -1478,7 +1695,9 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 #endif // CONFIG_MEDIUM_ALLOCATOR
 
 #if CONFIG_LARGE_CACHE
-	// madvise(..., MADV_REUSABLE) death-row arrivals above this threshold [~0.1%]
+	large_cache_init(szone);
+
+	// Death-row holds at most this many bytes that haven't been madvise()d [~0.1%]
 	szone->large_entry_cache_reserve_limit = (size_t)(memsize >> 10);
 
 	/* <rdar://problem/6610904> Reset protection when returning a previous large allocation? */
@@ -1493,26 +1712,7 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 	// Initialize the security token.
 	szone->cookie = (uintptr_t)malloc_entropy[0];
 
-	szone->basic_zone.version = 10;
-	szone->basic_zone.size = (void *)szone_size;
-	szone->basic_zone.malloc = (void *)szone_malloc;
-	szone->basic_zone.calloc = (void *)szone_calloc;
-	szone->basic_zone.valloc = (void *)szone_valloc;
-	szone->basic_zone.free = (void *)szone_free;
-	szone->basic_zone.realloc = (void *)szone_realloc;
-	szone->basic_zone.destroy = (void *)szone_destroy;
-	szone->basic_zone.batch_malloc = (void *)szone_batch_malloc;
-	szone->basic_zone.batch_free = (void *)szone_batch_free;
-	szone->basic_zone.introspect = (struct malloc_introspection_t *)&szone_introspect;
-	szone->basic_zone.memalign = (void *)szone_memalign;
-	szone->basic_zone.free_definite_size = (void *)szone_free_definite_size;
-	szone->basic_zone.pressure_relief = (void *)szone_pressure_relief;
-	szone->basic_zone.claimed_address = (void *)szone_claimed_address;
-
-	/* Set to zero once and for all as required by CFAllocator. */
-	szone->basic_zone.reserved1 = 0;
-	/* Set to zero once and for all as required by CFAllocator. */
-	szone->basic_zone.reserved2 = 0;
+	szone_set_functions(szone);
 
 	/* Prevent overwriting the function pointers in basic_zone. */
 	mprotect(szone, sizeof(szone->basic_zone), PROT_READ);
@@ -1522,6 +1722,10 @@ create_scalable_szone(size_t initial_size, unsigned debug_flags)
 
 	szone->cpu_id_key = -1UL; // Unused.
 
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+	malloc_scavenger_register(szone, (malloc_scavenger_fn_t)szone_scavenge);
+#endif
+
 	CHECK(szone, __PRETTY_FUNCTION__);
 	return szone;
 }
@@ -1531,4 +1735,31 @@ create_scalable_zone(size_t initial_size, unsigned debug_flags) {
 	return (malloc_zone_t *) create_scalable_szone(initial_size, debug_flags);
 }
 
+/*
+ * Makes a scalable zone whose pages were mapped from a snapshot usable in
+ * this process: points the function pointers at this copy of the library,
+ * resets the locks, which were held when the snapshot was taken, and forgets
+ * state that lived outside the snapshot. The large entry cache is emptied
+ * because death-row blocks are not saved, and the zone name is cleared
+ * because it was allocated elsewhere.
+ */
+void
+szone_reactivate(szone_t *szone)
+{
+	mprotect(szone, sizeof(szone->basic_zone), PROT_READ | PROT_WRITE);
+	szone_set_functions(szone);
+	szone->basic_zone.zone_name = NULL;
+	mprotect(szone, sizeof(szone->basic_zone), PROT_READ);
+
+	szone_reinit_lock(szone);
+
+#if CONFIG_LARGE_CACHE
+	large_cache_init(szone);
+#endif
+
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+	malloc_scavenger_register(szone, (malloc_scavenger_fn_t)szone_scavenge);
+#endif
+}
+
 /* vim: set noet:ts=4:sw=4:cindent: */
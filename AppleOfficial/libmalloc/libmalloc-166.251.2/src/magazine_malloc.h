@@ -34,10 +34,26 @@ MALLOC_NOEXPORT
 szone_t *
 create_scalable_szone(size_t initial_size, unsigned debug_flags);
 
+MALLOC_NOEXPORT
+void
+szone_reactivate(szone_t *szone);
+
 MALLOC_EXPORT
 boolean_t
 scalable_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats, unsigned subzone);
 
+MALLOC_EXPORT
+boolean_t
+scalable_zone_large_cache_statistics(malloc_zone_t *zone, malloc_large_cache_statistics_t *stats);
+
+MALLOC_EXPORT
+boolean_t
+scalable_zone_large_realloc_statistics(malloc_zone_t *zone, malloc_large_realloc_statistics_t *stats);
+
+MALLOC_EXPORT
+boolean_t
+scalable_zone_thread_cache_statistics(malloc_zone_t *zone, malloc_thread_cache_statistics_t *stats);
+
 MALLOC_NOEXPORT
 extern int max_magazines;
 
@@ -53,6 +69,11 @@ extern bool magazine_medium_enabled;
 MALLOC_NOEXPORT
 extern uint64_t magazine_medium_active_threshold;
 
+#if CONFIG_THREAD_CACHE
+MALLOC_NOEXPORT
+extern size_t thread_cache_max_bytes;
+#endif // CONFIG_THREAD_CACHE
+
 // MARK: magazine_malloc utility functions
 
 MALLOC_NOEXPORT
@@ -95,6 +116,15 @@ MALLOC_NOEXPORT
 size_t
 szone_pressure_relief(szone_t *szone, size_t goal);
 
+MALLOC_NOEXPORT
+void
+mag_remote_free_collect(task_t task, memory_reader_t reader, rack_t *rack, magazine_t *mags,
+		remote_free_set_t *set);
+
+MALLOC_NOEXPORT
+void
+mag_remote_free_release(remote_free_set_t *set);
+
 MALLOC_NOEXPORT
 boolean_t
 szone_claimed_address(szone_t *szone, void *ptr);
@@ -143,7 +173,7 @@ size_t
 tiny_free_reattach_region(rack_t *rack, magazine_t *tiny_mag_ptr, region_t r);
 
 MALLOC_NOEXPORT
-void
+size_t
 tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r);
 
 MALLOC_NOEXPORT
@@ -191,10 +221,18 @@ MALLOC_NOEXPORT
 void
 tiny_batch_free(szone_t *szone, void **to_be_freed, unsigned count);
 
+MALLOC_NOEXPORT
+void
+tiny_free_thread_cache_batch(rack_t *rack, void **ptrs, unsigned count, msize_t msize);
+
 MALLOC_NOEXPORT
 void
 print_tiny_free_list(rack_t *rack);
 
+MALLOC_NOEXPORT
+void
+tiny_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry);
+
 MALLOC_NOEXPORT
 void
 print_tiny_region(boolean_t verbose, region_t region, size_t bytes_at_start, size_t bytes_at_end);
@@ -205,6 +243,18 @@ void
 tiny_madvise_pressure_relief(rack_t *rack);
 #endif // CONFIG_MADVISE_PRESSURE_RELIEF
 
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+MALLOC_NOEXPORT
+void
+tiny_scavenge(rack_t *rack, malloc_scavenger_tick_t *tick);
+#endif // CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+MALLOC_NOEXPORT
+void
+tiny_free_remote_all(rack_t *rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 // MARK: small region allocation functions
 
 MALLOC_NOEXPORT
@@ -229,7 +279,7 @@ size_t
 small_free_reattach_region(rack_t *rack, magazine_t *small_mag_ptr, region_t r);
 
 MALLOC_NOEXPORT
-void
+size_t
 small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r);
 
 MALLOC_NOEXPORT
@@ -265,10 +315,18 @@ MALLOC_NOEXPORT
 size_t
 small_size(rack_t *rack, const void *ptr);
 
+MALLOC_NOEXPORT
+void
+small_free_thread_cache_batch(rack_t *rack, void **ptrs, unsigned count, msize_t msize);
+
 MALLOC_NOEXPORT
 void
 print_small_free_list(rack_t *rack);
 
+MALLOC_NOEXPORT
+void
+small_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry);
+
 MALLOC_NOEXPORT
 void
 print_small_region(szone_t *szone, boolean_t verbose, region_t region, size_t bytes_at_start, size_t bytes_at_end);
@@ -279,6 +337,18 @@ void
 small_madvise_pressure_relief(rack_t *rack);
 #endif // CONFIG_MADVISE_PRESSURE_RELIEF
 
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+MALLOC_NOEXPORT
+void
+small_scavenge(rack_t *rack, malloc_scavenger_tick_t *tick);
+#endif // CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+MALLOC_NOEXPORT
+void
+small_free_remote_all(rack_t *rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 // MARK: medium region allocation functions
 
 MALLOC_NOEXPORT
@@ -343,6 +413,10 @@ MALLOC_NOEXPORT
 void
 print_medium_free_list(rack_t *rack);
 
+MALLOC_NOEXPORT
+void
+medium_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry);
+
 MALLOC_NOEXPORT
 void
 print_medium_region(szone_t *szone, boolean_t verbose, region_t region, size_t bytes_at_start, size_t bytes_at_end);
@@ -384,6 +458,16 @@ MALLOC_NOEXPORT
 void *
 large_try_shrink_in_place(szone_t *szone, void *ptr, size_t old_size, size_t new_good_size);
 
+#if CONFIG_LARGE_REALLOC_REMAP
+MALLOC_NOEXPORT
+void *
+large_try_realloc_remap(szone_t *szone, void *ptr, size_t old_size, size_t new_size);
+#endif // CONFIG_LARGE_REALLOC_REMAP
+
+MALLOC_NOEXPORT
+void
+large_realloc_statistics(szone_t *szone, malloc_large_realloc_statistics_t *stats);
+
 MALLOC_NOEXPORT
 void *
 large_malloc(szone_t *szone, size_t num_kernel_pages, unsigned char alignment, boolean_t cleared_requested);
@@ -392,10 +476,52 @@ MALLOC_NOEXPORT
 boolean_t
 large_claimed_address(szone_t *szone, void *ptr);
 
+#if CONFIG_LARGE_CACHE
+MALLOC_NOEXPORT
+void
+large_cache_init(szone_t *szone);
+
+MALLOC_NOEXPORT
+unsigned
+large_cache_drain(szone_t *szone, size_t *total);
+
+MALLOC_NOEXPORT
+void
+large_cache_statistics(szone_t *szone, malloc_large_cache_statistics_t *stats);
+#endif // CONFIG_LARGE_CACHE
+
 MALLOC_NOEXPORT
 void *
 szone_malloc_should_clear(szone_t *szone, size_t size, boolean_t cleared_requested);
 
+// MARK: per-thread cache functions
+
+#if CONFIG_THREAD_CACHE
+MALLOC_NOEXPORT
+void
+thread_cache_enable(szone_t *szone, size_t max_bytes);
+
+MALLOC_NOEXPORT
+void *
+thread_cache_malloc(rack_t *rack, msize_t msize);
+
+MALLOC_NOEXPORT
+boolean_t
+thread_cache_free(rack_t *rack, void *ptr, msize_t msize);
+
+MALLOC_NOEXPORT
+void
+thread_cache_invalidate(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+thread_cache_reinit_after_fork(szone_t *szone);
+
+MALLOC_NOEXPORT
+void
+thread_cache_statistics(szone_t *szone, malloc_thread_cache_statistics_t *stats);
+#endif // CONFIG_THREAD_CACHE
+
 // MARK: stack logging lite functionality
 
 #define MALLOC_STOCK_LOGGING_LITE_ZONE_NAME "MallocStackLoggingLiteZone"
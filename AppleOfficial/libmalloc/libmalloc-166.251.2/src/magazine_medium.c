@@ -476,7 +476,7 @@ medium_free_list_add_ptr(rack_t *rack, magazine_t *medium_mag_ptr, void *ptr, ms
 #endif
 		medium_free_list_set_previous(rack, free_head, free_ptr);
 	} else {
-		BITMAPN_SET(medium_mag_ptr->mag_bitmap, slot);
+		magazine_bitmap_set(medium_mag_ptr, slot);
 	}
 
 	medium_mag_ptr->mag_free_list[slot] = free_ptr;
@@ -515,7 +515,7 @@ medium_free_list_remove_ptr_no_clear(rack_t *rack, magazine_t *medium_mag_ptr, f
 #endif
 		medium_mag_ptr->mag_free_list[slot] = next;
 		if (!medium_free_list_get_ptr(rack, next)) {
-			BITMAPN_CLR(medium_mag_ptr->mag_bitmap, slot);
+			magazine_bitmap_clr(medium_mag_ptr, slot);
 		}
 	} else {
 		// Check that the next pointer of "previous" points to "entry".
@@ -808,6 +808,8 @@ medium_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 	}
 
 	if (cnt > 0) {
+		size_t bytes_madvised = 0;
+
 		OSAtomicIncrement32Barrier(
 				&(REGION_TRAILER_FOR_MEDIUM_REGION(r)->pinned_to_depot));
 		SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
@@ -818,8 +820,10 @@ medium_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 
 			mvm_madvise_free(rack, r, addr, addr + size, NULL,
 					rack->debug_flags & MALLOC_DO_SCRIBBLE);
+			bytes_madvised += size;
 		}
 		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+		depot_ptr->mag_bytes_madvised += bytes_madvised;
 		OSAtomicDecrement32Barrier(
 				&(REGION_TRAILER_FOR_MEDIUM_REGION(r)->pinned_to_depot));
 	}
@@ -829,11 +833,9 @@ static region_t
 medium_find_msize_region(rack_t *rack, magazine_t *medium_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
 	void *ptr;
-	grain_t slot = MEDIUM_FREE_SLOT_FOR_MSIZE(rack, msize);
+	grain_t slot = MEDIUM_FREE_FIT_SLOT_FOR_MSIZE(rack, msize);
 	free_list_t *free_list = medium_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
-	free_list_t *limit;
-	unsigned bitmap;
 
 	// Assumes we've locked the magazine
 	CHECK_MAGAZINE_PTR_LOCKED(szone, medium_mag_ptr, __PRETTY_FUNCTION__);
@@ -844,49 +846,17 @@ medium_find_msize_region(rack_t *rack, magazine_t *medium_mag_ptr, mag_index_t m
 		return MEDIUM_REGION_FOR_PTR(ptr);
 	}
 
-	// Mask off the bits representing slots holding free blocks smaller than
-	// the size we need.
-	//
-	// BITMAPN_CTZ implementation
-	unsigned idx = slot >> 5;
-	bitmap = 0;
-	unsigned mask = ~((1 << (slot & 31)) - 1);
-	for (; idx < MEDIUM_FREELIST_BITMAP_WORDS(rack); ++idx) {
-		bitmap = medium_mag_ptr->mag_bitmap[idx] & mask;
-		if (bitmap != 0) {
-			break;
-		}
-		mask = ~0U;
-	}
-	// Check for fallthrough: No bits set in bitmap
-	if ((bitmap == 0) && (idx == MEDIUM_FREELIST_BITMAP_WORDS(rack))) {
-		return NULL;
-	}
-
-	// Start looking at the first set bit, plus 32 bits for every word of
-	// zeroes or entries that were too medium.
-	slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-
-	limit = free_list + MEDIUM_FREE_SLOT_COUNT(rack) - 1;
-	free_list += slot;
-
-	if (free_list < limit) {
-		ptr = medium_free_list_get_ptr(rack, *free_list);
+	// Otherwise take the first non-empty free list at or above it. Every block
+	// on that list is at least msize quanta.
+	int found = magazine_bitmap_find(medium_mag_ptr, slot);
+	if (found >= 0) {
+		ptr = medium_free_list_get_ptr(rack, free_list[found]);
 		if (ptr) {
 			return MEDIUM_REGION_FOR_PTR(ptr);
-		} else {
-			/* Shouldn't happen. Fall through to look at last slot. */
+		}
 #if DEBUG_MALLOC
-			malloc_report(ASL_LEVEL_ERR, "in medium_malloc_from_free_list(), mag_bitmap out of sync, slot=%d\n", slot);
+		malloc_report(ASL_LEVEL_ERR, "in medium_find_msize_region(), mag_bitmap out of sync, slot=%d\n", found);
 #endif
-		}
-	}
-
-	// We are now looking at the last slot, which contains blocks equal to, or
-	// due to coalescing of free blocks, larger than (num_medium_slots - 1) * (medium quantum size).
-	ptr = medium_free_list_get_ptr(rack, *limit);
-	if (ptr) {
-		return MEDIUM_REGION_FOR_PTR(ptr);
 	}
 
 	return NULL;
@@ -955,6 +925,8 @@ medium_get_region_from_depot(rack_t *rack, magazine_t *medium_mag_ptr, mag_index
 
 	// connect to magazine as first node
 	recirc_list_splice_first(rack, medium_mag_ptr, node);
+	medium_mag_ptr->mag_regions_from_depot++;
+	depot_ptr->mag_regions_from_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 
@@ -1027,6 +999,7 @@ medium_madvise_pressure_relief(rack_t *rack)
 			mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 			mag_ptr->num_bytes_in_magazine -= MEDIUM_REGION_PAYLOAD_BYTES;
 			mag_ptr->mag_num_objects -= objects_in_use;
+			mag_ptr->mag_regions_to_depot++;
 
 			/* Now we can drop the magazine lock of the source mag. */
 			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
@@ -1036,6 +1009,7 @@ medium_madvise_pressure_relief(rack_t *rack)
 			medium_depot_ptr->mag_num_objects -= objects_in_use;
 
 			recirc_list_splice_last(rack, medium_depot_ptr, REGION_TRAILER_FOR_MEDIUM_REGION(medium));
+			medium_depot_ptr->mag_regions_to_depot++;
 
 			/* Actually do the scan, done holding the depot lock, the call will drop the lock
 			 * around the actual madvise syscalls.
@@ -1165,6 +1139,7 @@ medium_madvise_free_range_conditional_no_lock(rack_t *rack, magazine_t *mag_ptr,
 				&rack->last_madvise, rack->debug_flags & MALLOC_DO_SCRIBBLE);
 
 		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		mag_ptr->mag_bytes_madvised += hi - lo;
 		OSAtomicDecrement32Barrier(&node->pinned_to_depot);
 		*fl = medium_free_list_add_ptr(rack, mag_ptr, (void *)rangep, flmsz);
 	} else {
@@ -1225,6 +1200,7 @@ medium_madvise_free_range_no_lock(rack_t *rack,
 
 		uintptr_t free_lo = MAX(round_safe, lo);
 		uintptr_t free_hi = MIN(trunc_extent, hi);
+		mvm_large_page_clip(&free_lo, &free_hi, MEDIUM_REGION_SIZE);
 
 		if (free_lo < free_hi) {
 			// Before unlocking, ensure that the metadata for the freed region
@@ -1238,6 +1214,7 @@ medium_madvise_free_range_no_lock(rack_t *rack,
 			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 			mvm_madvise_free(rack, region, free_lo, free_hi, &rack->last_madvise, rack->debug_flags & MALLOC_DO_SCRIBBLE);
 			SZONE_MAGAZINE_PTR_LOCK(medium_mag_ptr);
+			medium_mag_ptr->mag_bytes_madvised += free_hi - free_lo;
 			OSAtomicDecrement32Barrier(&(node->pinned_to_depot));
 			medium_free_list_add_ptr(rack, medium_mag_ptr, ptr, fmsize);
 		}
@@ -1337,6 +1314,7 @@ medium_free_do_recirc_to_depot(rack_t *rack, magazine_t *medium_mag_ptr, mag_ind
 	medium_mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 	medium_mag_ptr->num_bytes_in_magazine -= MEDIUM_REGION_PAYLOAD_BYTES;
 	medium_mag_ptr->mag_num_objects -= objects_in_use;
+	medium_mag_ptr->mag_regions_to_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr); // Unlock the originating magazine
 
@@ -1346,6 +1324,7 @@ medium_free_do_recirc_to_depot(rack_t *rack, magazine_t *medium_mag_ptr, mag_ind
 
 	// connect to Depot as last node
 	recirc_list_splice_last(rack, depot_ptr, node);
+	depot_ptr->mag_regions_to_depot++;
 
 	MAGMALLOC_RECIRCREGION(MEDIUM_SZONE_FROM_RACK(rack), (int)mag_index, (void *)sparse_region, MEDIUM_REGION_SIZE,
 						   (int)BYTES_USED_FOR_MEDIUM_REGION(sparse_region)); // DTrace USDT Probe
@@ -1359,6 +1338,7 @@ medium_free_do_recirc_to_depot(rack_t *rack, magazine_t *medium_mag_ptr, mag_ind
 	region_t r_dealloc = medium_free_try_depot_unmap_no_lock(rack, depot_ptr, node);
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 	if (r_dealloc) {
+		rack_region_unpublish(rack, r_dealloc);
 		mvm_deallocate_pages(r_dealloc, MEDIUM_REGION_SIZE, 0);
 	}
 	return FALSE; // Caller need not unlock the originating magazine
@@ -1420,6 +1400,7 @@ medium_free_try_recirc_to_depot(rack_t *rack,
 			region_t r_dealloc = medium_free_try_depot_unmap_no_lock(rack, medium_mag_ptr, node);
 			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 			if (r_dealloc) {
+				rack_region_unpublish(rack, r_dealloc);
 				mvm_deallocate_pages(r_dealloc, MEDIUM_REGION_SIZE, 0);
 			}
 			return FALSE; // Caller need not unlock
@@ -2080,11 +2061,9 @@ medium_malloc_from_free_list(rack_t *rack, magazine_t *medium_mag_ptr, mag_index
 {
 	msize_t this_msize;
 	bool was_madvised;
-	grain_t slot = MEDIUM_FREE_SLOT_FOR_MSIZE(rack, msize);
+	grain_t slot = MEDIUM_FREE_FIT_SLOT_FOR_MSIZE(rack, msize);
 	free_list_t *free_list = medium_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
-	free_list_t *limit;
-	unsigned bitmap;
 	msize_t leftover_msize;
 	void *leftover_ptr;
 	void *ptr;
@@ -2092,40 +2071,24 @@ medium_malloc_from_free_list(rack_t *rack, magazine_t *medium_mag_ptr, mag_index
 	// Assumes we've locked the region
 	CHECK_MAGAZINE_PTR_LOCKED(szone, medium_mag_ptr, __PRETTY_FUNCTION__);
 
-	// Look for an exact match by checking the freelist for this msize.
-	if (medium_free_list_get_ptr(rack, *the_slot)) {
+	// Look for an exact match by checking the freelist for this msize. Only
+	// the slots up to NUM_MEDIUM_SLOTS hold blocks of a single msize.
+	if (msize <= NUM_MEDIUM_SLOTS && medium_free_list_get_ptr(rack, *the_slot)) {
 		ptr = medium_free_list_get_ptr(rack, *the_slot);
 		this_msize = msize;
 		medium_free_list_remove_ptr(rack, medium_mag_ptr, *the_slot, msize);
 		goto return_medium_alloc;
 	}
 
-	// Mask off the bits representing slots holding free blocks smaller than
-	// the size we need.  If there are no larger free blocks, try allocating
-	// from the free space at the end of the medium region.
-	//
-	// BITMAPN_CTZ implementation
-	unsigned idx = slot >> 5;
-	bitmap = 0;
-	unsigned mask = ~((1 << (slot & 31)) - 1);
-	for (; idx < MEDIUM_FREELIST_BITMAP_WORDS(rack); ++idx) {
-		bitmap = medium_mag_ptr->mag_bitmap[idx] & mask;
-		if (bitmap != 0) {
-			break;
-		}
-		mask = ~0U;
-	}
-	// Check for fallthrough: No bits set in bitmap
-	if ((bitmap == 0) && (idx == MEDIUM_FREELIST_BITMAP_WORDS(rack))) {
+	// Take the first non-empty free list at or above the one for this msize.
+	// Every block on that list is at least msize quanta; the TLSF slots keep
+	// the block we split close to the size we need. If there are no larger free
+	// blocks, try allocating from the free space at the end of the medium region.
+	int found = magazine_bitmap_find(medium_mag_ptr, slot);
+	if (found < 0) {
 		goto try_medium_from_end;
 	}
-
-	// Start looking at the first set bit, plus 32 bits for every word of
-	// zeroes or entries that were too medium.
-	slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-
-	// FIXME: Explain use of - 1 here, last slot has special meaning
-	limit = free_list + MEDIUM_FREE_SLOT_COUNT(rack) - 1;
+	slot = (grain_t)found;
 	free_list += slot;
 
 	// Attempt to pull off the free_list slot that we now think is full.
@@ -2260,22 +2223,27 @@ medium_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_reques
 #endif /* CONFIG_MEDIUM_CACHE */
 
 	while (1) {
+		size_t untouched = mag_untouched_bytes(medium_mag_ptr);
 		ptr = medium_malloc_from_free_list(rack, medium_mag_ptr, mag_index, msize);
 		if (ptr) {
+			// a block carved from the untouched head or tail of the last region is still zero
+			boolean_t known_zero = (mag_untouched_bytes(medium_mag_ptr) != untouched);
 			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 			CHECK(szone, __PRETTY_FUNCTION__);
-			if (cleared_requested) {
+			if (cleared_requested && !known_zero) {
 				memset(ptr, 0, MEDIUM_BYTES_FOR_MSIZE(msize));
 			}
 			return ptr;
 		}
 
 		if (medium_get_region_from_depot(rack, medium_mag_ptr, mag_index, msize)) {
+			untouched = mag_untouched_bytes(medium_mag_ptr);
 			ptr = medium_malloc_from_free_list(rack, medium_mag_ptr, mag_index, msize);
 			if (ptr) {
+				boolean_t known_zero = (mag_untouched_bytes(medium_mag_ptr) != untouched);
 				SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 				CHECK(szone, __PRETTY_FUNCTION__);
-				if (cleared_requested) {
+				if (cleared_requested && !known_zero) {
 					memset(ptr, 0, MEDIUM_BYTES_FOR_MSIZE(msize));
 				}
 				return ptr;
@@ -2318,6 +2286,7 @@ medium_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_reques
 			medium_mag_ptr->alloc_underway = FALSE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
+			rack_region_publish(rack, fresh_region);
 			CHECK(szone, __PRETTY_FUNCTION__);
 			return ptr;
 		} else {
@@ -2419,6 +2388,7 @@ free_medium(rack_t *rack, void *ptr, region_t medium_region, size_t known_size)
 			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 			mvm_madvise_free(rack, medium_region, lo, hi, NULL, false);
 			SZONE_MAGAZINE_PTR_LOCK(medium_mag_ptr);
+			medium_mag_ptr->mag_bytes_madvised += hi - lo;
 
 			medium_madvise_header_mark_clean(MEDIUM_MADVISE_HEADER_FOR_PTR(ptr),
 					MEDIUM_META_INDEX_FOR_PTR(ptr), msize);
@@ -2483,7 +2453,8 @@ print_medium_free_list(rack_t *rack)
 			while (slot < MEDIUM_FREE_SLOT_COUNT(rack)) {
 				ptr = rack->magazines[mag_index].mag_free_list[slot];
 				if (medium_free_list_get_ptr(rack, ptr)) {
-					_simple_sprintf(b, "%s%y[%llu]; ", (slot == MEDIUM_FREE_SLOT_COUNT(rack) - 1) ? ">=" : "", (slot + 1) * MEDIUM_QUANTUM,
+					_simple_sprintf(b, "%s%y[%llu]; ", (slot >= NUM_MEDIUM_SLOTS) ? ">=" : "",
+									FREELIST_MIN_MSIZE_FOR_SLOT(NUM_MEDIUM_SLOTS, slot) * MEDIUM_QUANTUM,
 									medium_free_list_count(rack, ptr));
 				}
 				slot++;
@@ -2579,6 +2550,71 @@ print_medium_region(szone_t *szone, boolean_t verbose, region_t region, size_t b
 	}
 }
 
+// Counts the blocks in use in a medium region by size class. Assumes the region's
+// magazine is locked.
+static void
+medium_region_telemetry(rack_t *rack, region_t region, size_t bytes_at_start, size_t bytes_at_end,
+		malloc_allocator_telemetry_t *telemetry)
+{
+	uintptr_t current = (uintptr_t)MEDIUM_REGION_ADDRESS(region) + bytes_at_start;
+	uintptr_t limit = (uintptr_t)MEDIUM_REGION_END(region) - bytes_at_end;
+	msize_t msize_and_free;
+	msize_t msize;
+
+	while (current < limit) {
+		msize_and_free = *MEDIUM_METADATA_FOR_PTR(current);
+		msize = msize_and_free & ~MEDIUM_IS_FREE;
+		if (!msize) {
+			break;
+		}
+		if (!(msize_and_free & MEDIUM_IS_FREE)) {
+			telemetry->size_classes[MEDIUM_FREE_SLOT_FOR_MSIZE(rack, msize)].blocks_in_use++;
+		}
+		current += MEDIUM_BYTES_FOR_MSIZE(msize);
+	}
+}
+
+void
+medium_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry)
+{
+	mag_index_t mag_index;
+	grain_t slot;
+
+	telemetry->num_size_classes = MEDIUM_FREE_SLOT_COUNT(rack);
+	telemetry->num_magazines = rack->num_magazines;
+	for (slot = 0; slot < MEDIUM_FREE_SLOT_COUNT(rack); slot++) {
+		telemetry->size_classes[slot].size = FREELIST_MIN_MSIZE_FOR_SLOT(NUM_MEDIUM_SLOTS, slot) * MEDIUM_QUANTUM;
+	}
+
+	// Every region is on its magazine's recirculation list, and stays mapped
+	// while it is there.
+	for (mag_index = DEPOT_MAGAZINE_INDEX; mag_index < rack->num_magazines; mag_index++) {
+		magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+		region_trailer_t *node;
+
+		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		magazine_telemetry(rack->magazines, mag_index, telemetry);
+		for (slot = 0; slot < MEDIUM_FREE_SLOT_COUNT(rack); slot++) {
+			telemetry->size_classes[slot].blocks_free +=
+					medium_free_list_count(rack, mag_ptr->mag_free_list[slot]);
+		}
+		for (node = mag_ptr->firstNode; node; node = node->next) {
+			region_t region = MEDIUM_REGION_FOR_PTR(node);
+			boolean_t last = (region == mag_ptr->mag_last_region);
+
+			medium_region_telemetry(rack, region, last ? mag_ptr->mag_bytes_free_at_start : 0,
+					last ? mag_ptr->mag_bytes_free_at_end : 0, telemetry);
+		}
+		if (mag_ptr->mag_last_free) {
+			// Marked in use, but free as far as the caller is concerned.
+			slot = MEDIUM_FREE_SLOT_FOR_MSIZE(rack, mag_ptr->mag_last_free_msize);
+			telemetry->size_classes[slot].blocks_in_use--;
+			telemetry->size_classes[slot].blocks_free++;
+		}
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+}
+
 void
 print_medium_region_vis(szone_t *szone, region_t region)
 {
@@ -2707,6 +2743,12 @@ medium_free_list_check(rack_t *rack, grain_t slot, unsigned counter)
 				SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 				return 0;
 			}
+			if (MEDIUM_FREE_SLOT_FOR_MSIZE(rack, msize_and_free & ~MEDIUM_IS_FREE) != slot) {
+				MEDIUM_FREELIST_FAIL("*** ptr in wrong free list slot=%u count=%d ptr=%p msize=%u\n", slot, count, ptr,
+						msize_and_free & ~MEDIUM_IS_FREE);
+				SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
+				return 0;
+			}
 			if (!medium_region_for_ptr_no_lock(rack, ptr)) {
 				MEDIUM_FREELIST_FAIL("*** ptr not in szone slot=%d count=%d ptr=%p\n", slot, count, ptr);
 				SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
@@ -2722,6 +2764,13 @@ medium_free_list_check(rack_t *rack, grain_t slot, unsigned counter)
 			count++;
 		}
 
+		if (BITMAPN_BIT(medium_mag_ptr->mag_bitmap, slot) != (count != 0) ||
+				!(medium_mag_ptr->mag_bitmap_summary & (1U << (slot >> 5))) != !medium_mag_ptr->mag_bitmap[slot >> 5]) {
+			MEDIUM_FREELIST_FAIL("*** mag_bitmap out of sync slot=%u count=%d\n", slot, count);
+			SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
+			return 0;
+		}
+
 		SZONE_MAGAZINE_PTR_UNLOCK(medium_mag_ptr);
 	}
 	return 1;
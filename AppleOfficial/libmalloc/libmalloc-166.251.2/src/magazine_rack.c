@@ -46,6 +46,7 @@ rack_init(rack_t *rack, rack_type_t type, uint32_t num_magazines, uint32_t debug
 	}
 
 	rack->debug_flags = debug_flags;
+	rack->tcache_enabled = FALSE;
 	rack->num_magazines = num_magazines;
 	rack->num_regions = 0;
 	rack->num_regions_dealloc = 0;
@@ -91,6 +92,7 @@ rack_destroy_regions(rack_t *rack, size_t region_size)
 		if ((rack->region_generation->hashed_regions[i] != HASHRING_OPEN_ENTRY) &&
 			(rack->region_generation->hashed_regions[i] != HASHRING_REGION_DEALLOCATED))
 		{
+			rack_region_unpublish(rack, rack->region_generation->hashed_regions[i]);
 			mvm_deallocate_pages(rack->region_generation->hashed_regions[i], region_size, 0);
 			rack->region_generation->hashed_regions[i] = HASHRING_REGION_DEALLOCATED;
 		}
@@ -157,3 +159,58 @@ rack_region_insert(rack_t *rack, region_t region)
 	rack->num_regions++;
 	_malloc_lock_unlock(&rack->region_lock);
 }
+
+#if CONFIG_ZONE_INDEX
+static void
+rack_region_zone_and_size(rack_t *rack, szone_t **szone, size_t *size)
+{
+	switch (rack->type) {
+	case RACK_TYPE_TINY:
+		*szone = TINY_SZONE_FROM_RACK(rack);
+		*size = TINY_REGION_SIZE;
+		break;
+	case RACK_TYPE_SMALL:
+		*szone = SMALL_SZONE_FROM_RACK(rack);
+		*size = SMALL_REGION_SIZE;
+		break;
+	case RACK_TYPE_MEDIUM:
+		*szone = MEDIUM_SZONE_FROM_RACK(rack);
+		*size = MEDIUM_REGION_SIZE;
+		break;
+	default:
+		*szone = NULL;
+		*size = 0;
+		break;
+	}
+}
+#endif // CONFIG_ZONE_INDEX
+
+void
+rack_region_publish(rack_t *rack, region_t region)
+{
+	// Tell find_registered_zone() which zone owns a freshly allocated region.
+	// Must not be called with any magazine lock held.
+#if CONFIG_ZONE_INDEX
+	szone_t *szone;
+	size_t size;
+	rack_region_zone_and_size(rack, &szone, &size);
+	if (szone) {
+		malloc_zone_index_insert(&szone->basic_zone, (vm_address_t)region, size);
+	}
+#endif // CONFIG_ZONE_INDEX
+}
+
+void
+rack_region_unpublish(rack_t *rack, region_t region)
+{
+	// Called before a region is returned to the OS. Must not be called with
+	// any magazine lock held.
+#if CONFIG_ZONE_INDEX
+	szone_t *szone;
+	size_t size;
+	rack_region_zone_and_size(rack, &szone, &size);
+	if (szone) {
+		malloc_zone_index_remove((vm_address_t)region, size);
+	}
+#endif // CONFIG_ZONE_INDEX
+}
@@ -71,6 +71,9 @@ typedef struct rack_s {
 	int num_magazines_mask_shift;
 	uint32_t debug_flags;
 
+	// Set when per-thread caches front this rack's magazines.
+	boolean_t tcache_enabled;
+
 	// array of per-processor magazines
 	magazine_t *magazines;
 
@@ -95,4 +98,12 @@ MALLOC_NOEXPORT
 void
 rack_region_insert(rack_t *rack, region_t region);
 
+MALLOC_NOEXPORT
+void
+rack_region_publish(rack_t *rack, region_t region);
+
+MALLOC_NOEXPORT
+void
+rack_region_unpublish(rack_t *rack, region_t region);
+
 #endif // __MAGAZINE_RACK_H
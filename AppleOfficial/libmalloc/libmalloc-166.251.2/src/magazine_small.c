@@ -417,7 +417,7 @@ small_free_list_add_ptr(rack_t *rack, magazine_t *small_mag_ptr, void *ptr, msiz
 #endif
 		small_free_list_set_previous(rack, free_head, free_ptr);
 	} else {
-		BITMAPN_SET(small_mag_ptr->mag_bitmap, slot);
+		magazine_bitmap_set(small_mag_ptr, slot);
 	}
 
 	small_mag_ptr->mag_free_list[slot] = free_ptr;
@@ -456,7 +456,7 @@ small_free_list_remove_ptr_no_clear(rack_t *rack, magazine_t *small_mag_ptr, fre
 #endif
 		small_mag_ptr->mag_free_list[slot] = next;
 		if (!small_free_list_get_ptr(rack, next)) {
-			BITMAPN_CLR(small_mag_ptr->mag_bitmap, slot);
+			magazine_bitmap_clr(small_mag_ptr, slot);
 		}
 	} else {
 		// Check that the next pointer of "previous" points to "entry".
@@ -672,7 +672,8 @@ typedef struct {
 	uint16_t pnum, size;
 } small_pg_pair_t;
 
-void
+// Returns the number of bytes madvised.
+size_t
 small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 {
 	uintptr_t start = (uintptr_t)SMALL_REGION_ADDRESS(r);
@@ -682,6 +683,7 @@ small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 	small_pg_pair_t advisory[((SMALL_REGION_PAYLOAD_BYTES + vm_kernel_page_size - 1) >> vm_kernel_page_shift) >>
 							 1]; // 4096bytes stack allocated
 	int advisories = 0;
+	size_t bytes_madvised = 0;
 
 	// Scan the metadata identifying blocks which span one or more pages. Mark the pages MADV_FREE taking care to preserve free list
 	// management data.
@@ -736,22 +738,25 @@ small_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 			uintptr_t addr = (advisory[i].pnum << vm_page_quanta_shift) + start;
 			size_t size = advisory[i].size << vm_page_quanta_shift;
 
-			mvm_madvise_free(rack, r, addr, addr + size, NULL, rack->debug_flags & MALLOC_DO_SCRIBBLE);
+			if (!mvm_madvise_free(rack, r, addr, addr + size, NULL, rack->debug_flags & MALLOC_DO_SCRIBBLE)) {
+				bytes_madvised += size;
+			}
 		}
 		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+		depot_ptr->mag_bytes_madvised += bytes_madvised;
 		OSAtomicDecrement32Barrier(&(REGION_TRAILER_FOR_SMALL_REGION(r)->pinned_to_depot));
 	}
+
+	return bytes_madvised;
 }
 
 static region_t
 small_find_msize_region(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
 	void *ptr;
-	grain_t slot = SMALL_FREE_SLOT_FOR_MSIZE(rack, msize);
+	grain_t slot = SMALL_FREE_FIT_SLOT_FOR_MSIZE(rack, msize);
 	free_list_t *free_list = small_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
-	free_list_t *limit;
-	unsigned bitmap;
 
 	// Assumes we've locked the magazine
 	CHECK_MAGAZINE_PTR_LOCKED(szone, small_mag_ptr, __PRETTY_FUNCTION__);
@@ -762,49 +767,17 @@ small_find_msize_region(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag
 		return SMALL_REGION_FOR_PTR(ptr);
 	}
 
-	// Mask off the bits representing slots holding free blocks smaller than
-	// the size we need.
-	//
-	// BITMAPN_CTZ implementation
-	unsigned idx = slot >> 5;
-	bitmap = 0;
-	unsigned mask = ~((1 << (slot & 31)) - 1);
-	for (; idx < SMALL_FREELIST_BITMAP_WORDS(rack); ++idx) {
-		bitmap = small_mag_ptr->mag_bitmap[idx] & mask;
-		if (bitmap != 0) {
-			break;
-		}
-		mask = ~0U;
-	}
-	// Check for fallthrough: No bits set in bitmap
-	if ((bitmap == 0) && (idx == SMALL_FREELIST_BITMAP_WORDS(rack))) {
-		return NULL;
-	}
-
-	// Start looking at the first set bit, plus 32 bits for every word of
-	// zeroes or entries that were too small.
-	slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-
-	limit = free_list + SMALL_FREE_SLOT_COUNT(rack) - 1;
-	free_list += slot;
-
-	if (free_list < limit) {
-		ptr = small_free_list_get_ptr(rack, *free_list);
+	// Otherwise take the first non-empty free list at or above it. Every block
+	// on that list is at least msize quanta.
+	int found = magazine_bitmap_find(small_mag_ptr, slot);
+	if (found >= 0) {
+		ptr = small_free_list_get_ptr(rack, free_list[found]);
 		if (ptr) {
 			return SMALL_REGION_FOR_PTR(ptr);
-		} else {
-			/* Shouldn't happen. Fall through to look at last slot. */
+		}
 #if DEBUG_MALLOC
-			malloc_report(ASL_LEVEL_ERR, "in small_malloc_from_free_list(), mag_bitmap out of sync, slot=%d\n", slot);
+		malloc_report(ASL_LEVEL_ERR, "in small_find_msize_region(), mag_bitmap out of sync, slot=%d\n", found);
 #endif
-		}
-	}
-
-	// We are now looking at the last slot, which contains blocks equal to, or
-	// due to coalescing of free blocks, larger than (num_small_slots - 1) * (small quantum size).
-	ptr = small_free_list_get_ptr(rack, *limit);
-	if (ptr) {
-		return SMALL_REGION_FOR_PTR(ptr);
 	}
 
 	return NULL;
@@ -873,6 +846,8 @@ small_get_region_from_depot(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t
 
 	// connect to magazine as first node
 	recirc_list_splice_first(rack, small_mag_ptr, node);
+	small_mag_ptr->mag_regions_from_depot++;
+	depot_ptr->mag_regions_from_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 
@@ -889,6 +864,12 @@ small_madvise_pressure_relief(rack_t *rack)
 	mag_index_t mag_index;
 	magazine_t *small_depot_ptr = &rack->magazines[DEPOT_MAGAZINE_INDEX];
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// Blocks that other threads have freed must be back on the free lists
+	// before the regions are scanned, or their pages are never madvised.
+	small_free_remote_all(rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	for (mag_index = 0; mag_index < rack->num_magazines; mag_index++) {
 		size_t index;
 		for (index = 0; index < rack->region_generation->num_regions_allocated; ++index) {
@@ -939,15 +920,17 @@ small_madvise_pressure_relief(rack_t *rack)
 			mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 			mag_ptr->num_bytes_in_magazine -= SMALL_REGION_PAYLOAD_BYTES;
 			mag_ptr->mag_num_objects -= objects_in_use;
+			mag_ptr->mag_regions_to_depot++;
 
 			/* Now we can drop the magazine lock of the source mag. */
 			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
 
 			small_depot_ptr->mag_num_bytes_in_objects += bytes_inplay;
 			small_depot_ptr->num_bytes_in_magazine += SMALL_REGION_PAYLOAD_BYTES;
-			small_depot_ptr->mag_num_objects -= objects_in_use;
+			small_depot_ptr->mag_num_objects += objects_in_use;
 
 			recirc_list_splice_last(rack, small_depot_ptr, REGION_TRAILER_FOR_SMALL_REGION(small));
+			small_depot_ptr->mag_regions_to_depot++;
 
 			/* Actually do the scan, done holding the depot lock, the call will drop the lock
 			 * around the actual madvise syscalls.
@@ -1005,6 +988,7 @@ small_madvise_free_range_no_lock(rack_t *rack,
 
 		uintptr_t free_lo = MAX(round_safe, lo);
 		uintptr_t free_hi = MIN(trunc_extent, hi);
+		mvm_large_page_clip(&free_lo, &free_hi, SMALL_REGION_SIZE);
 
 		if (free_lo < free_hi) {
 			// Before unlocking, ensure that the metadata for the freed region
@@ -1018,6 +1002,7 @@ small_madvise_free_range_no_lock(rack_t *rack,
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 			mvm_madvise_free(rack, region, free_lo, free_hi, &rack->last_madvise, rack->debug_flags & MALLOC_DO_SCRIBBLE);
 			SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+			small_mag_ptr->mag_bytes_madvised += free_hi - free_lo;
 			OSAtomicDecrement32Barrier(&(node->pinned_to_depot));
 			small_free_list_add_ptr(rack, small_mag_ptr, ptr, fmsize);
 		}
@@ -1117,6 +1102,7 @@ small_free_do_recirc_to_depot(rack_t *rack, magazine_t *small_mag_ptr, mag_index
 	small_mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 	small_mag_ptr->num_bytes_in_magazine -= SMALL_REGION_PAYLOAD_BYTES;
 	small_mag_ptr->mag_num_objects -= objects_in_use;
+	small_mag_ptr->mag_regions_to_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr); // Unlock the originating magazine
 
@@ -1126,19 +1112,24 @@ small_free_do_recirc_to_depot(rack_t *rack, magazine_t *small_mag_ptr, mag_index
 
 	// connect to Depot as last node
 	recirc_list_splice_last(rack, depot_ptr, node);
+	depot_ptr->mag_regions_to_depot++;
 
 	MAGMALLOC_RECIRCREGION(SMALL_SZONE_FROM_RACK(rack), (int)mag_index, (void *)sparse_region, SMALL_REGION_SIZE,
 						   (int)BYTES_USED_FOR_SMALL_REGION(sparse_region)); // DTrace USDT Probe
 
 #if !CONFIG_AGGRESSIVE_MADVISE
-	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure
-	small_free_scan_madvise_free(rack, depot_ptr, sparse_region);
+	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure, unless
+	// the background scavenger will do it once the region has gone quiet.
+	if (!malloc_scavenger_defer(node)) {
+		small_free_scan_madvise_free(rack, depot_ptr, sparse_region);
+	}
 #endif
 
 	// If the region is entirely empty vm_deallocate() it outside the depot lock
 	region_t r_dealloc = small_free_try_depot_unmap_no_lock(rack, depot_ptr, node);
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 	if (r_dealloc) {
+		rack_region_unpublish(rack, r_dealloc);
 		mvm_deallocate_pages(r_dealloc, SMALL_REGION_SIZE, 0);
 	}
 	return FALSE; // Caller need not unlock the originating magazine
@@ -1186,8 +1177,10 @@ small_free_try_recirc_to_depot(rack_t *rack,
 	} else {
 #if !CONFIG_AGGRESSIVE_MADVISE
 		// We are free'ing into the depot, so madvise as we do so unless we were madvising every incoming
-		// allocation anyway.
-		small_madvise_free_range_no_lock(rack, small_mag_ptr, region, freee, msize, headptr, headsize);
+		// allocation anyway, or the background scavenger will get to it once the region is quiet.
+		if (!malloc_scavenger_defer(node)) {
+			small_madvise_free_range_no_lock(rack, small_mag_ptr, region, freee, msize, headptr, headsize);
+		}
 #endif
 
 		if (0 < bytes_used || 0 < node->pinned_to_depot) {
@@ -1199,6 +1192,7 @@ small_free_try_recirc_to_depot(rack_t *rack,
 			region_t r_dealloc = small_free_try_depot_unmap_no_lock(rack, small_mag_ptr, node);
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 			if (r_dealloc) {
+				rack_region_unpublish(rack, r_dealloc);
 				mvm_deallocate_pages(r_dealloc, SMALL_REGION_SIZE, 0);
 			}
 			return FALSE; // Caller need not unlock
@@ -1206,6 +1200,41 @@ small_free_try_recirc_to_depot(rack_t *rack,
 	}
 	return TRUE; // Caller must do SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr)
 }
+
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+// Called on the scavenger thread. Madvises the free pages of depot regions
+// whose scavenge_after deadline has passed, stopping when the tick runs out
+// of time or bytes. The depot lock is dropped around each madvise, so the
+// walk starts again from the head of the depot's list after every region;
+// regions already done have had their deadline cleared.
+void
+small_scavenge(rack_t *rack, malloc_scavenger_tick_t *tick)
+{
+	if (rack->num_magazines == 1) {
+		return; // No depot
+	}
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	small_free_remote_all(rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+	SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+	region_trailer_t *node = depot_ptr->firstNode;
+	while (node && !malloc_scavenger_tick_done(tick)) {
+		if (!node->scavenge_after || node->pinned_to_depot ||
+				tick->now < node->scavenge_after) {
+			node = node->next;
+			continue;
+		}
+		node->scavenge_after = 0;
+		size_t bytes_madvised = small_free_scan_madvise_free(rack, depot_ptr, SMALL_REGION_FOR_PTR(node));
+		malloc_scavenger_tick_charge(tick, SCAVENGED_REGION, bytes_madvised);
+		node = depot_ptr->firstNode;
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+}
+#endif // CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
 #endif // CONFIG_RECIRC_DEPOT
 
 static MALLOC_INLINE boolean_t
@@ -1713,6 +1742,9 @@ small_in_use_enumerator(task_t task,
 	msize_t msize_and_free;
 	msize_t msize;
 	magazine_t *small_mag_base = NULL;
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	remote_free_set_t queued = {0};
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 
 	region_hash_generation_t *srg_ptr;
 	err = reader(task, (vm_address_t)szone->small_rack.region_generation, sizeof(region_hash_generation_t), (void **)&srg_ptr);
@@ -1733,6 +1765,10 @@ small_in_use_enumerator(task_t task,
 		if (err) {
 			return err;
 		}
+#if CONFIG_MAGAZINE_REMOTE_FREE
+		// Blocks on the remote free lists are still marked in use.
+		mag_remote_free_collect(task, reader, &szone->small_rack, small_mag_base, &queued);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 	}
 
 	for (index = 0; index < num_regions; ++index) {
@@ -1756,7 +1792,7 @@ small_in_use_enumerator(task_t task,
 
 				err = reader(task, range.address, range.size, (void **)&mapped_region);
 				if (err) {
-					return err;
+					goto out;
 				}
 
 				mag_index_t mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(mapped_region);
@@ -1785,7 +1821,11 @@ small_in_use_enumerator(task_t task,
 					msize_and_free = block_header[block_index];
 					msize = msize_and_free & ~SMALL_IS_FREE;
 					if (!(msize_and_free & SMALL_IS_FREE) &&
-						range.address + SMALL_BYTES_FOR_MSIZE(block_index) != mag_last_free) {
+						range.address + SMALL_BYTES_FOR_MSIZE(block_index) != mag_last_free
+#if CONFIG_MAGAZINE_REMOTE_FREE
+						&& !mag_remote_free_set_contains(&queued, range.address + SMALL_BYTES_FOR_MSIZE(block_index))
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+						) {
 						// Block in use
 						buffer[count].address = range.address + SMALL_BYTES_FOR_MSIZE(block_index);
 						buffer[count].size = SMALL_BYTES_FOR_MSIZE(msize);
@@ -1797,7 +1837,8 @@ small_in_use_enumerator(task_t task,
 					}
 
 					if (!msize) {
-						return KERN_FAILURE; // Somethings amiss. Avoid looping at this block_index.
+						err = KERN_FAILURE; // Somethings amiss. Avoid looping at this block_index.
+						goto out;
 					}
 					block_index += msize;
 				}
@@ -1808,18 +1849,21 @@ small_in_use_enumerator(task_t task,
 			}
 		}
 	}
-	return 0;
+	err = 0;
+out:
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	mag_remote_free_release(&queued);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+	return err;
 }
 
 static void *
 small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index, msize_t msize)
 {
 	msize_t this_msize;
-	grain_t slot = SMALL_FREE_SLOT_FOR_MSIZE(rack, msize);
+	grain_t slot = SMALL_FREE_FIT_SLOT_FOR_MSIZE(rack, msize);
 	free_list_t *free_list = small_mag_ptr->mag_free_list;
 	free_list_t *the_slot = free_list + slot;
-	free_list_t *limit;
-	unsigned bitmap;
 	msize_t leftover_msize;
 	void *leftover_ptr;
 	void *ptr;
@@ -1827,40 +1871,24 @@ small_malloc_from_free_list(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t
 	// Assumes we've locked the region
 	CHECK_MAGAZINE_PTR_LOCKED(szone, small_mag_ptr, __PRETTY_FUNCTION__);
 
-	// Look for an exact match by checking the freelist for this msize.
-	if (small_free_list_get_ptr(rack, *the_slot)) {
+	// Look for an exact match by checking the freelist for this msize. Only
+	// the slots up to NUM_SMALL_SLOTS hold blocks of a single msize.
+	if (msize <= NUM_SMALL_SLOTS && small_free_list_get_ptr(rack, *the_slot)) {
 		ptr = small_free_list_get_ptr(rack, *the_slot);
 		this_msize = msize;
 		small_free_list_remove_ptr(rack, small_mag_ptr, *the_slot, msize);
 		goto return_small_alloc;
 	}
 
-	// Mask off the bits representing slots holding free blocks smaller than
-	// the size we need.  If there are no larger free blocks, try allocating
-	// from the free space at the end of the small region.
-	//
-	// BITMAPN_CTZ implementation
-	unsigned idx = slot >> 5;
-	bitmap = 0;
-	unsigned mask = ~((1 << (slot & 31)) - 1);
-	for (; idx < SMALL_FREELIST_BITMAP_WORDS(rack); ++idx) {
-		bitmap = small_mag_ptr->mag_bitmap[idx] & mask;
-		if (bitmap != 0) {
-			break;
-		}
-		mask = ~0U;
-	}
-	// Check for fallthrough: No bits set in bitmap
-	if ((bitmap == 0) && (idx == SMALL_FREELIST_BITMAP_WORDS(rack))) {
+	// Take the first non-empty free list at or above the one for this msize.
+	// Every block on that list is at least msize quanta; the TLSF slots keep
+	// the block we split close to the size we need. If there are no larger free
+	// blocks, try allocating from the free space at the end of the small region.
+	int found = magazine_bitmap_find(small_mag_ptr, slot);
+	if (found < 0) {
 		goto try_small_from_end;
 	}
-
-	// Start looking at the first set bit, plus 32 bits for every word of
-	// zeroes or entries that were too small.
-	slot = BITMAP32_CTZ((&bitmap)) + (idx * 32);
-
-	// FIXME: Explain use of - 1 here, last slot has special meaning
-	limit = free_list + SMALL_FREE_SLOT_COUNT(rack) - 1;
+	slot = (grain_t)found;
 	free_list += slot;
 
 	// Attempt to pull off the free_list slot that we now think is full.
@@ -1945,6 +1973,79 @@ return_small_alloc:
 	return ptr;
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+// Frees the blocks that other threads left on a magazine's remote free list.
+// Called and returns with the magazine locked, though the lock may be dropped
+// and retaken along the way. A block whose region has since moved to another
+// magazine is passed on to that magazine's list, or freed into the depot.
+static MALLOC_NOINLINE void
+small_free_remote_no_lock(rack_t *rack, magazine_t *small_mag_ptr, mag_index_t mag_index)
+{
+	remote_free_t *entry = mag_remote_free_take(small_mag_ptr);
+
+	while (entry) {
+		remote_free_t *next = free_list_unchecksum_ptr(rack, &entry->next);
+		msize_t msize = SMALL_PTR_SIZE(entry);
+		if (SMALL_PTR_IS_FREE(entry) || entry == small_mag_ptr->mag_last_free) {
+			// Report it, but keep draining so the rest of the list isn't leaked
+			// when corruption reports don't abort.
+			malloc_zone_error(rack->debug_flags, true, "Double free of object %p\n", entry);
+			entry = next;
+			continue;
+		}
+
+		region_t small_region = SMALL_REGION_FOR_PTR(entry);
+		mag_index_t owner = MAGAZINE_INDEX_FOR_SMALL_REGION(small_region);
+
+		if (owner == mag_index) {
+			if (!small_free_no_lock(rack, small_mag_ptr, mag_index, small_region, entry, msize)) {
+				SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+			}
+		} else if (owner == DEPOT_MAGAZINE_INDEX) {
+			// Regions only leave the depot with the depot locked, and the
+			// depot lock may be taken with a magazine lock held.
+			magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+			SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+			owner = MAGAZINE_INDEX_FOR_SMALL_REGION(small_region);
+			if (owner == DEPOT_MAGAZINE_INDEX) {
+				if (small_free_no_lock(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, small_region, entry, msize)) {
+					SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				}
+			} else {
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				mag_remote_free_push(rack, &(rack->magazines[owner]), entry);
+			}
+		} else {
+			mag_remote_free_push(rack, &(rack->magazines[owner]), entry);
+		}
+		entry = next;
+	}
+}
+
+// Frees the blocks on every magazine's remote free list, for the paths that
+// trim or report on the heap without allocating from it: pressure relief,
+// the scavenger, statistics, telemetry and the fork child. Must be called
+// with no magazine lock held.
+void
+small_free_remote_all(rack_t *rack)
+{
+	// A block whose region has changed hands is forwarded to its new owner,
+	// which may already have been visited, so go round twice.
+	for (int pass = 0; pass < 2; pass++) {
+		mag_index_t mag_index;
+		for (mag_index = 0; mag_index < rack->num_magazines; mag_index++) {
+			magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+			if (!os_atomic_load(&mag_ptr->mag_remote_free, relaxed)) {
+				continue;
+			}
+			SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+			small_free_remote_no_lock(rack, mag_ptr, mag_index);
+			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+		}
+	}
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 void *
 small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested)
 {
@@ -1954,8 +2055,26 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 
 	MALLOC_TRACE(TRACE_small_malloc, (uintptr_t)rack, SMALL_BYTES_FOR_MSIZE(msize), (uintptr_t)small_mag_ptr, cleared_requested);
 
+#if CONFIG_THREAD_CACHE
+	if (rack->tcache_enabled) {
+		ptr = thread_cache_malloc(rack, msize);
+		if (ptr) {
+			if (cleared_requested) {
+				memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
+			}
+			return ptr;
+		}
+	}
+#endif // CONFIG_THREAD_CACHE
+
 	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (small_mag_ptr->mag_remote_free) {
+		small_free_remote_no_lock(rack, small_mag_ptr, mag_index);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_SMALL_CACHE
 	ptr = small_mag_ptr->mag_last_free;
 
@@ -1974,22 +2093,27 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 #endif /* CONFIG_SMALL_CACHE */
 
 	while (1) {
+		size_t untouched = mag_untouched_bytes(small_mag_ptr);
 		ptr = small_malloc_from_free_list(rack, small_mag_ptr, mag_index, msize);
 		if (ptr) {
+			// a block carved from the untouched head or tail of the last region is still zero
+			boolean_t known_zero = (mag_untouched_bytes(small_mag_ptr) != untouched);
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 			CHECK(szone, __PRETTY_FUNCTION__);
-			if (cleared_requested) {
+			if (cleared_requested && !known_zero) {
 				memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
 			}
 			return ptr;
 		}
 
 		if (small_get_region_from_depot(rack, small_mag_ptr, mag_index, msize)) {
+			untouched = mag_untouched_bytes(small_mag_ptr);
 			ptr = small_malloc_from_free_list(rack, small_mag_ptr, mag_index, msize);
 			if (ptr) {
+				boolean_t known_zero = (mag_untouched_bytes(small_mag_ptr) != untouched);
 				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 				CHECK(szone, __PRETTY_FUNCTION__);
-				if (cleared_requested) {
+				if (cleared_requested && !known_zero) {
 					memset(ptr, 0, SMALL_BYTES_FOR_MSIZE(msize));
 				}
 				return ptr;
@@ -2028,6 +2152,7 @@ small_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_request
 			small_mag_ptr->alloc_underway = FALSE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+			rack_region_publish(rack, fresh_region);
 			CHECK(szone, __PRETTY_FUNCTION__);
 			return ptr;
 		} else {
@@ -2103,7 +2228,43 @@ free_small(rack_t *rack, void *ptr, region_t small_region, size_t known_size)
 		}
 	}
 
+#if CONFIG_THREAD_CACHE
+	if (rack->tcache_enabled) {
+		// A block that is already free in its region must not be cached, or
+		// the cache and the magazine would both hand it out.
+		if (known_size && SMALL_PTR_IS_FREE(ptr)) {
+			malloc_zone_error(rack->debug_flags, true, "double free for ptr %p\n", ptr);
+			return;
+		}
+		if (thread_cache_free(rack, ptr, msize)) {
+			return;
+		}
+	}
+#endif // CONFIG_THREAD_CACHE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (!SZONE_MAGAZINE_PTR_TRY_LOCK(small_mag_ptr)) {
+		// Another CPU is working in the block's magazine. Rather than queue
+		// behind it, leave the block on the magazine's remote free list.
+		if (DEPOT_MAGAZINE_INDEX != mag_index &&
+				mag_index != small_mag_get_thread_index() % rack->num_magazines) {
+			// Pushing a block that is already free would overwrite its free
+			// list linkage, so catch that here rather than at drain time.
+			if (known_size && SMALL_PTR_IS_FREE(ptr)) {
+				malloc_zone_error(rack->debug_flags, true, "double free for ptr %p\n", ptr);
+				return;
+			}
+			mag_remote_free_push(rack, small_mag_ptr, ptr);
+			return;
+		}
+		SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+	}
+	if (small_mag_ptr->mag_remote_free) {
+		small_free_remote_no_lock(rack, small_mag_ptr, mag_index);
+	}
+#else // CONFIG_MAGAZINE_REMOTE_FREE
 	SZONE_MAGAZINE_PTR_LOCK(small_mag_ptr);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 
 #if CONFIG_SMALL_CACHE
 	// Depot does not participate in CONFIG_SMALL_CACHE since it can't be directly malloc()'d
@@ -2161,6 +2322,46 @@ free_small(rack_t *rack, void *ptr, region_t small_region, size_t known_size)
 	CHECK(szone, __PRETTY_FUNCTION__);
 }
 
+#if CONFIG_THREAD_CACHE
+// Returns a batch of blocks of a single msize from a thread cache to their
+// magazines. The blocks are still marked in use and are expected to be sorted
+// by address, so that runs from the same region share one magazine lock.
+void
+small_free_thread_cache_batch(rack_t *rack, void **ptrs, unsigned count, msize_t msize)
+{
+	region_t small_region = NULL;
+	magazine_t *small_mag_ptr = NULL;
+	mag_index_t mag_index = -1;
+	unsigned cc;
+
+	for (cc = 0; cc < count; cc++) {
+		void *ptr = ptrs[cc];
+
+		if (NULL == small_region || small_region != SMALL_REGION_FOR_PTR(ptr)) {
+			if (small_mag_ptr) { // non-NULL iff magazine lock taken
+				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+			}
+			small_region = SMALL_REGION_FOR_PTR(ptr);
+			small_mag_ptr = mag_lock_zine_for_region_trailer(rack->magazines,
+					REGION_TRAILER_FOR_SMALL_REGION(small_region),
+					MAGAZINE_INDEX_FOR_SMALL_REGION(small_region));
+			mag_index = MAGAZINE_INDEX_FOR_SMALL_REGION(small_region);
+		}
+
+		if (!small_free_no_lock(rack, small_mag_ptr, mag_index, small_region, ptr, msize)) {
+			// Arrange to re-acquire magazine lock
+			small_mag_ptr = NULL;
+			small_region = NULL;
+		}
+	}
+
+	if (small_mag_ptr) {
+		SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+	}
+	CHECK(SMALL_SZONE_FROM_RACK(rack), __PRETTY_FUNCTION__);
+}
+#endif // CONFIG_THREAD_CACHE
+
 void
 print_small_free_list(rack_t *rack)
 {
@@ -2176,7 +2377,8 @@ print_small_free_list(rack_t *rack)
 			while (slot < SMALL_FREE_SLOT_COUNT(rack)) {
 				ptr = rack->magazines[mag_index].mag_free_list[slot];
 				if (small_free_list_get_ptr(rack, ptr)) {
-					_simple_sprintf(b, "%s%y[%d]; ", (slot == SMALL_FREE_SLOT_COUNT(rack) - 1) ? ">=" : "", (slot + 1) * SMALL_QUANTUM,
+					_simple_sprintf(b, "%s%y[%d]; ", (slot >= NUM_SMALL_SLOTS) ? ">=" : "",
+									FREELIST_MIN_MSIZE_FOR_SLOT(NUM_SMALL_SLOTS, slot) * SMALL_QUANTUM,
 									small_free_list_count(rack, ptr));
 				}
 				slot++;
@@ -2260,6 +2462,71 @@ print_small_region(szone_t *szone, boolean_t verbose, region_t region, size_t by
 	}
 }
 
+// Counts the blocks in use in a small region by size class. Assumes the region's
+// magazine is locked.
+static void
+small_region_telemetry(rack_t *rack, region_t region, size_t bytes_at_start, size_t bytes_at_end,
+		malloc_allocator_telemetry_t *telemetry)
+{
+	uintptr_t current = (uintptr_t)SMALL_REGION_ADDRESS(region) + bytes_at_start;
+	uintptr_t limit = (uintptr_t)SMALL_REGION_END(region) - bytes_at_end;
+	msize_t msize_and_free;
+	msize_t msize;
+
+	while (current < limit) {
+		msize_and_free = *SMALL_METADATA_FOR_PTR(current);
+		msize = msize_and_free & ~SMALL_IS_FREE;
+		if (!msize) {
+			break;
+		}
+		if (!(msize_and_free & SMALL_IS_FREE)) {
+			telemetry->size_classes[SMALL_FREE_SLOT_FOR_MSIZE(rack, msize)].blocks_in_use++;
+		}
+		current += SMALL_BYTES_FOR_MSIZE(msize);
+	}
+}
+
+void
+small_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry)
+{
+	mag_index_t mag_index;
+	grain_t slot;
+
+	telemetry->num_size_classes = SMALL_FREE_SLOT_COUNT(rack);
+	telemetry->num_magazines = rack->num_magazines;
+	for (slot = 0; slot < SMALL_FREE_SLOT_COUNT(rack); slot++) {
+		telemetry->size_classes[slot].size = FREELIST_MIN_MSIZE_FOR_SLOT(NUM_SMALL_SLOTS, slot) * SMALL_QUANTUM;
+	}
+
+	// Every region is on its magazine's recirculation list, and stays mapped
+	// while it is there.
+	for (mag_index = DEPOT_MAGAZINE_INDEX; mag_index < rack->num_magazines; mag_index++) {
+		magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+		region_trailer_t *node;
+
+		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		magazine_telemetry(rack->magazines, mag_index, telemetry);
+		for (slot = 0; slot < SMALL_FREE_SLOT_COUNT(rack); slot++) {
+			telemetry->size_classes[slot].blocks_free +=
+					small_free_list_count(rack, mag_ptr->mag_free_list[slot]);
+		}
+		for (node = mag_ptr->firstNode; node; node = node->next) {
+			region_t region = SMALL_REGION_FOR_PTR(node);
+			boolean_t last = (region == mag_ptr->mag_last_region);
+
+			small_region_telemetry(rack, region, last ? mag_ptr->mag_bytes_free_at_start : 0,
+					last ? mag_ptr->mag_bytes_free_at_end : 0, telemetry);
+		}
+		if (mag_ptr->mag_last_free) {
+			// Marked in use, but free as far as the caller is concerned.
+			slot = SMALL_FREE_SLOT_FOR_MSIZE(rack, mag_ptr->mag_last_free_msize);
+			telemetry->size_classes[slot].blocks_in_use--;
+			telemetry->size_classes[slot].blocks_free++;
+		}
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+}
+
 static char *small_freelist_fail_msg = "check: small free list incorrect";
 
 #define SMALL_FREELIST_FAIL(fmt, ...) \
@@ -2293,6 +2560,12 @@ small_free_list_check(rack_t *rack, grain_t slot, unsigned counter)
 				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 				return 0;
 			}
+			if (SMALL_FREE_SLOT_FOR_MSIZE(rack, msize_and_free & ~SMALL_IS_FREE) != slot) {
+				SMALL_FREELIST_FAIL("*** ptr in wrong free list slot=%u count=%d ptr=%p msize=%u\n", slot, count, ptr,
+						msize_and_free & ~SMALL_IS_FREE);
+				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+				return 0;
+			}
 			if (!small_region_for_ptr_no_lock(rack, ptr)) {
 				SMALL_FREELIST_FAIL("*** ptr not in szone slot=%d count=%d ptr=%p\n", slot, count, ptr);
 				SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
@@ -2308,6 +2581,13 @@ small_free_list_check(rack_t *rack, grain_t slot, unsigned counter)
 			count++;
 		}
 
+		if (BITMAPN_BIT(small_mag_ptr->mag_bitmap, slot) != (count != 0) ||
+				!(small_mag_ptr->mag_bitmap_summary & (1U << (slot >> 5))) != !small_mag_ptr->mag_bitmap[slot >> 5]) {
+			SMALL_FREELIST_FAIL("*** mag_bitmap out of sync slot=%u count=%d\n", slot, count);
+			SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
+			return 0;
+		}
+
 		SZONE_MAGAZINE_PTR_UNLOCK(small_mag_ptr);
 	}
 	return 1;
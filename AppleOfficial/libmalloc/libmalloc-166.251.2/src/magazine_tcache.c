@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+
+#if CONFIG_THREAD_CACHE
+
+/*
+ * Per-thread caches for the tiny and small allocators.
+ *
+ * Each thread that frees a tiny or small block into a zone with thread caching
+ * enabled gets a thread_cache_t, reachable through a pthread key. Frees
+ * push the block onto the bin for its msize and mallocs pop from the same bin,
+ * neither taking a magazine lock. Cached blocks are never marked free in their
+ * region's metadata, so coalescing, recirculation and madvise never see them;
+ * they are simply in use by the allocator rather than by the application.
+ *
+ * A bin that overflows TCACHE_BIN_MAX_COUNT, or a cache that would exceed its
+ * byte budget, hands its older blocks back to the magazines in one batch via
+ * tiny_free_thread_cache_batch() / small_free_thread_cache_batch(), which
+ * visit each region's magazine lock once. When the thread exits its cache is
+ * flushed in the same way by the TSD destructor.
+ *
+ * A cache can only be flushed by its own thread. To reclaim every cache, as
+ * pressure relief does, thread_cache_invalidate() bumps the zone's generation
+ * and each thread flushes its cache the next time it finds the generation
+ * changed. In the child of a fork, only the forking thread's cache survives;
+ * the others are flushed and retired by thread_cache_reinit_after_fork().
+ */
+
+static void thread_cache_destroy(void *arg);
+
+// libpthread reserves no TSD slot for libmalloc, so the caches hang off a key
+// of our own. Created by the first thread_cache_enable(), under the malloc
+// lock and before any rack has caching turned on.
+static pthread_key_t thread_cache_key;
+static boolean_t thread_cache_key_created;
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE thread_cache_t *
+thread_cache_get(void)
+{
+	return (thread_cache_t *)pthread_getspecific(thread_cache_key);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE tcache_bin_t *
+thread_cache_bin(thread_cache_t *tc, rack_t *rack, msize_t msize)
+{
+	if (rack->type == RACK_TYPE_TINY) {
+		return (msize <= TCACHE_TINY_BINS) ? &tc->tiny_bins[msize - 1] : NULL;
+	}
+	return (msize <= TCACHE_SMALL_BINS) ? &tc->small_bins[msize - 1] : NULL;
+}
+
+static MALLOC_INLINE size_t
+thread_cache_bytes_for_msize(rack_t *rack, msize_t msize)
+{
+	if (rack->type == RACK_TYPE_TINY) {
+		return TINY_BYTES_FOR_MSIZE(msize);
+	}
+	return SMALL_BYTES_FOR_MSIZE(msize);
+}
+
+void
+thread_cache_enable(szone_t *szone, size_t max_bytes)
+{
+	if (max_bytes == 0) {
+		return;
+	}
+	if (max_bytes > TCACHE_MAX_BYTES_LIMIT) {
+		max_bytes = TCACHE_MAX_BYTES_LIMIT;
+	}
+	if (!thread_cache_key_created) {
+		if (pthread_key_create(&thread_cache_key, thread_cache_destroy) != 0) {
+			return; // caching stays off
+		}
+		thread_cache_key_created = TRUE;
+	}
+
+	_malloc_lock_init(&szone->tcache_lock);
+	szone->tcache_list = NULL;
+	memset(&szone->tcache_retired, 0, sizeof(szone->tcache_retired));
+	szone->tcache_key = (uintptr_t)malloc_entropy[1] ^ (uintptr_t)szone;
+	szone->tcache_max_bytes = max_bytes;
+
+	szone->tiny_rack.tcache_enabled = TRUE;
+	szone->small_rack.tcache_enabled = TRUE;
+}
+
+static MALLOC_NOINLINE thread_cache_t *
+thread_cache_create(szone_t *szone)
+{
+	thread_cache_t *tc = mvm_allocate_pages(THREAD_CACHE_PAGED_SIZE, 0, 0, VM_MEMORY_MALLOC);
+	if (!tc) {
+		return NULL;
+	}
+
+	// mvm_allocate_pages() hands back zero-filled pages, so every bin starts empty.
+	tc->szone = szone;
+	tc->max_bytes = szone->tcache_max_bytes;
+	tc->generation = os_atomic_load(&szone->tcache_generation, relaxed);
+
+	_malloc_lock_lock(&szone->tcache_lock);
+	tc->next = szone->tcache_list;
+	if (tc->next) {
+		tc->next->prev = tc;
+	}
+	szone->tcache_list = tc;
+	_malloc_lock_unlock(&szone->tcache_lock);
+
+	pthread_setspecific(thread_cache_key, tc);
+	return tc;
+}
+
+/*
+ * Detaches all but the 'keep' most recently cached blocks from 'bin' and
+ * returns them to their magazines.
+ */
+static void
+thread_cache_flush_bin(thread_cache_t *tc, rack_t *rack, tcache_bin_t *bin, msize_t msize, uint32_t keep)
+{
+	void *ptrs[TCACHE_BIN_MAX_COUNT];
+	unsigned count = 0;
+	tcache_entry_t *entry = bin->head;
+	tcache_entry_t *last_kept = NULL;
+	uint32_t i;
+
+	if (bin->count <= keep) {
+		return;
+	}
+
+	for (i = 0; i < keep; i++) {
+		last_kept = entry;
+		entry = free_list_unchecksum_ptr(rack, &entry->next);
+	}
+	if (last_kept) {
+		last_kept->next.u = free_list_checksum_ptr(rack, NULL);
+	} else {
+		bin->head = NULL;
+	}
+
+	while (entry) {
+		tcache_entry_t *next = free_list_unchecksum_ptr(rack, &entry->next);
+		entry->key = 0;
+		ptrs[count++] = entry;
+		entry = next;
+	}
+
+	// Sort by address so the batch free takes each region's magazine lock once.
+	for (i = 1; i < count; i++) {
+		void *p = ptrs[i];
+		unsigned j = i;
+		while (j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)p) {
+			ptrs[j] = ptrs[j - 1];
+			j--;
+		}
+		ptrs[j] = p;
+	}
+
+	bin->count = keep;
+	tc->blocks_cached -= count;
+	tc->bytes_cached -= count * thread_cache_bytes_for_msize(rack, msize);
+	tc->counters.flushes++;
+	tc->counters.flushed_blocks += count;
+
+	if (rack->type == RACK_TYPE_TINY) {
+		tiny_free_thread_cache_batch(rack, ptrs, count, msize);
+	} else {
+		small_free_thread_cache_batch(rack, ptrs, count, msize);
+	}
+}
+
+static void
+thread_cache_flush_all(thread_cache_t *tc)
+{
+	szone_t *szone = tc->szone;
+	msize_t msize;
+
+	for (msize = 1; msize <= TCACHE_TINY_BINS; msize++) {
+		thread_cache_flush_bin(tc, &szone->tiny_rack, &tc->tiny_bins[msize - 1], msize, 0);
+	}
+	for (msize = 1; msize <= TCACHE_SMALL_BINS; msize++) {
+		thread_cache_flush_bin(tc, &szone->small_rack, &tc->small_bins[msize - 1], msize, 0);
+	}
+}
+
+// Flushes the cache if its zone's generation has moved on since the cache
+// last looked at it.
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+thread_cache_check_generation(thread_cache_t *tc)
+{
+	uint32_t generation = os_atomic_load(&tc->szone->tcache_generation, relaxed);
+	if (os_unlikely(tc->generation != generation)) {
+		thread_cache_flush_all(tc);
+		tc->generation = generation;
+	}
+}
+
+// Returns the cache's blocks to the magazines, unlinks it from its zone and
+// frees it.
+static void
+thread_cache_retire(thread_cache_t *tc)
+{
+	szone_t *szone = tc->szone;
+
+	thread_cache_flush_all(tc);
+
+	_malloc_lock_lock(&szone->tcache_lock);
+	if (tc->prev) {
+		tc->prev->next = tc->next;
+	} else {
+		szone->tcache_list = tc->next;
+	}
+	if (tc->next) {
+		tc->next->prev = tc->prev;
+	}
+	szone->tcache_retired.hits += tc->counters.hits;
+	szone->tcache_retired.misses += tc->counters.misses;
+	szone->tcache_retired.frees += tc->counters.frees;
+	szone->tcache_retired.flushes += tc->counters.flushes;
+	szone->tcache_retired.flushed_blocks += tc->counters.flushed_blocks;
+	_malloc_lock_unlock(&szone->tcache_lock);
+
+	mvm_deallocate_pages(tc, THREAD_CACHE_PAGED_SIZE, 0);
+}
+
+static void
+thread_cache_destroy(void *arg)
+{
+	// libpthread has already cleared the key, so a free() issued by a later
+	// destructor starts a new cache, which is destroyed in a later round.
+	thread_cache_retire(arg);
+}
+
+void *
+thread_cache_malloc(rack_t *rack, msize_t msize)
+{
+	thread_cache_t *tc = thread_cache_get();
+	if (!tc) {
+		return NULL;
+	}
+
+	tcache_bin_t *bin = thread_cache_bin(tc, rack, msize);
+	if (!bin) {
+		return NULL;
+	}
+	thread_cache_check_generation(tc);
+
+	tcache_entry_t *entry = bin->head;
+	if (!entry) {
+		tc->counters.misses++;
+		return NULL;
+	}
+
+	bin->head = free_list_unchecksum_ptr(rack, &entry->next);
+	// The bin must never be seen pointing at a block that has been handed
+	// out, including by thread_cache_reinit_after_fork() in a child forked
+	// while this thread was here.
+	os_compiler_barrier();
+	bin->count--;
+	tc->blocks_cached--;
+	tc->bytes_cached -= thread_cache_bytes_for_msize(rack, msize);
+	tc->counters.hits++;
+
+	entry->next.u = 0;
+	entry->key = 0;
+	return entry;
+}
+
+boolean_t
+thread_cache_free(rack_t *rack, void *ptr, msize_t msize)
+{
+	szone_t *szone = (rack->type == RACK_TYPE_TINY) ? TINY_SZONE_FROM_RACK(rack) : SMALL_SZONE_FROM_RACK(rack);
+	thread_cache_t *tc = thread_cache_get();
+	tcache_entry_t *entry = ptr;
+
+	if (!tc) {
+		tc = thread_cache_create(szone);
+		if (!tc) {
+			return FALSE;
+		}
+	}
+	if (tc->szone != szone) {
+		return FALSE;
+	}
+
+	tcache_bin_t *bin = thread_cache_bin(tc, rack, msize);
+	if (!bin) {
+		return FALSE;
+	}
+	thread_cache_check_generation(tc);
+
+	// A block carrying the key is already in this or another thread's cache.
+	// Other threads' bins can't be walked safely, and caching the block again
+	// would let two caches hand it out, so it is reported and dropped. Live
+	// data matches the random key only if it was copied out of a freed block.
+	if (os_unlikely(entry->key == szone->tcache_key)) {
+		malloc_zone_error(rack->debug_flags, true, "Double free of object %p\n", ptr);
+		return TRUE;
+	}
+
+	size_t bytes = thread_cache_bytes_for_msize(rack, msize);
+	if (bin->count >= TCACHE_BIN_MAX_COUNT) {
+		thread_cache_flush_bin(tc, rack, bin, msize, TCACHE_FLUSH_COUNT);
+	}
+	if (tc->bytes_cached + bytes > tc->max_bytes) {
+		thread_cache_flush_bin(tc, rack, bin, msize, bin->count / 2);
+		if (tc->bytes_cached + bytes > tc->max_bytes) {
+			return FALSE;
+		}
+	}
+
+	if (rack->debug_flags & MALLOC_DO_SCRIBBLE) {
+		memset(ptr, SCRABBLE_BYTE, bytes);
+	}
+
+	entry->next.u = free_list_checksum_ptr(rack, bin->head);
+	entry->key = szone->tcache_key;
+	os_compiler_barrier(); // link the block before publishing it, as above
+	bin->head = entry;
+	bin->count++;
+	tc->blocks_cached++;
+	tc->bytes_cached += bytes;
+	tc->counters.frees++;
+	return TRUE;
+}
+
+void
+thread_cache_invalidate(szone_t *szone)
+{
+	if (!szone->tcache_max_bytes) {
+		return;
+	}
+
+	uint32_t generation = os_atomic_inc(&szone->tcache_generation, relaxed);
+	thread_cache_t *tc = thread_cache_get();
+	if (tc && tc->szone == szone) {
+		thread_cache_flush_all(tc);
+		tc->generation = generation;
+	}
+}
+
+// Called in the child of a fork, where the zone's locks have just been
+// reinitialized and the forking thread is the only one left.
+void
+thread_cache_reinit_after_fork(szone_t *szone)
+{
+	if (!szone->tcache_max_bytes) {
+		return;
+	}
+
+	thread_cache_t *current = thread_cache_get();
+	thread_cache_t *tc = szone->tcache_list;
+	while (tc) {
+		thread_cache_t *next = tc->next;
+		if (tc != current) {
+			thread_cache_retire(tc);
+		}
+		tc = next;
+	}
+}
+
+void
+thread_cache_statistics(szone_t *szone, malloc_thread_cache_statistics_t *stats)
+{
+	thread_cache_t *tc;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->max_bytes_per_thread = szone->tcache_max_bytes;
+	if (!szone->tcache_max_bytes) {
+		return;
+	}
+
+	// Per-thread counters are updated without synchronization; the totals are
+	// a snapshot rather than an exact accounting.
+	_malloc_lock_lock(&szone->tcache_lock);
+	stats->hits = szone->tcache_retired.hits;
+	stats->misses = szone->tcache_retired.misses;
+	stats->frees = szone->tcache_retired.frees;
+	stats->flushes = szone->tcache_retired.flushes;
+	stats->flushed_blocks = szone->tcache_retired.flushed_blocks;
+	for (tc = szone->tcache_list; tc; tc = tc->next) {
+		stats->threads++;
+		stats->blocks_cached += tc->blocks_cached;
+		stats->bytes_cached += tc->bytes_cached;
+		stats->hits += tc->counters.hits;
+		stats->misses += tc->counters.misses;
+		stats->frees += tc->counters.frees;
+		stats->flushes += tc->counters.flushes;
+		stats->flushed_blocks += tc->counters.flushed_blocks;
+	}
+	_malloc_lock_unlock(&szone->tcache_lock);
+}
+
+#endif // CONFIG_THREAD_CACHE
@@ -547,7 +547,8 @@ typedef struct {
 	uint8_t pnum, size;
 } tiny_pg_pair_t;
 
-void
+// Returns the number of bytes madvised.
+size_t
 tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 {
 	uintptr_t start = (uintptr_t)TINY_REGION_ADDRESS(r);
@@ -558,6 +559,7 @@ tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 	tiny_pg_pair_t advisory[((TINY_REGION_PAYLOAD_BYTES + vm_page_quanta_size - 1) >> vm_page_quanta_shift) >>
 							1]; // 256bytes stack allocated
 	int advisories = 0;
+	size_t bytes_madvised = 0;
 
 	// Scan the metadata identifying blocks which span one or more pages. Mark the pages MADV_FREE taking care to preserve free list
 	// management data.
@@ -614,11 +616,16 @@ tiny_free_scan_madvise_free(rack_t *rack, magazine_t *depot_ptr, region_t r)
 			uintptr_t addr = (advisory[i].pnum << vm_kernel_page_shift) + start;
 			size_t size = advisory[i].size << vm_kernel_page_shift;
 
-			mvm_madvise_free(rack, r, addr, addr + size, NULL, rack->debug_flags & MALLOC_DO_SCRIBBLE);
+			if (!mvm_madvise_free(rack, r, addr, addr + size, NULL, rack->debug_flags & MALLOC_DO_SCRIBBLE)) {
+				bytes_madvised += size;
+			}
 		}
 		SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+		depot_ptr->mag_bytes_madvised += bytes_madvised;
 		OSAtomicDecrement32Barrier(&(REGION_TRAILER_FOR_TINY_REGION(r)->pinned_to_depot));
 	}
+
+	return bytes_madvised;
 }
 
 static region_t
@@ -688,6 +695,12 @@ tiny_madvise_pressure_relief(rack_t *rack)
 	mag_index_t mag_index;
 	magazine_t *tiny_depot_ptr = (&rack->magazines[DEPOT_MAGAZINE_INDEX]);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	// Blocks that other threads have freed must be back on the free lists
+	// before the regions are scanned, or their pages are never madvised.
+	tiny_free_remote_all(rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 	for (mag_index = 0; mag_index < rack->num_magazines; mag_index++) {
 		size_t index;
 		for (index = 0; index < rack->region_generation->num_regions_allocated; ++index) {
@@ -738,15 +751,17 @@ tiny_madvise_pressure_relief(rack_t *rack)
 			mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 			mag_ptr->num_bytes_in_magazine -= TINY_REGION_PAYLOAD_BYTES;
 			mag_ptr->mag_num_objects -= objects_in_use;
+			mag_ptr->mag_regions_to_depot++;
 
 			/* Now we can drop the magazine lock of the source mag. */
 			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
 
 			tiny_depot_ptr->mag_num_bytes_in_objects += bytes_inplay;
 			tiny_depot_ptr->num_bytes_in_magazine += TINY_REGION_PAYLOAD_BYTES;
-			tiny_depot_ptr->mag_num_objects -= objects_in_use;
+			tiny_depot_ptr->mag_num_objects += objects_in_use;
 
 			recirc_list_splice_last(rack, tiny_depot_ptr, REGION_TRAILER_FOR_TINY_REGION(tiny));
+			tiny_depot_ptr->mag_regions_to_depot++;
 
 			/* Actually do the scan, done holding the depot lock, the call will drop the lock
 			 * around the actual madvise syscalls.
@@ -796,6 +811,7 @@ tiny_madvise_free_range_no_lock(rack_t *rack,
 
 		uintptr_t free_lo = MAX(round_safe, lo);
 		uintptr_t free_hi = MIN(trunc_extent, hi);
+		mvm_large_page_clip(&free_lo, &free_hi, TINY_REGION_SIZE);
 
 		if (free_lo < free_hi) {
 			tiny_free_list_remove_ptr(rack, tiny_mag_ptr, ptr, msize);
@@ -805,6 +821,7 @@ tiny_madvise_free_range_no_lock(rack_t *rack,
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 			mvm_madvise_free(rack, region, free_lo, free_hi, &rack->last_madvise, rack->debug_flags & MALLOC_DO_SCRIBBLE);
 			SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+			tiny_mag_ptr->mag_bytes_madvised += free_hi - free_lo;
 			OSAtomicDecrement32Barrier(&(node->pinned_to_depot));
 
 			set_tiny_meta_header_free(ptr, msize);
@@ -876,6 +893,8 @@ tiny_get_region_from_depot(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t m
 
 	// connect to magazine as first node
 	recirc_list_splice_first(rack, tiny_mag_ptr, node);
+	tiny_mag_ptr->mag_regions_from_depot++;
+	depot_ptr->mag_regions_from_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 
@@ -987,6 +1006,7 @@ tiny_free_do_recirc_to_depot(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t
 	tiny_mag_ptr->mag_num_bytes_in_objects -= bytes_inplay;
 	tiny_mag_ptr->num_bytes_in_magazine -= TINY_REGION_PAYLOAD_BYTES;
 	tiny_mag_ptr->mag_num_objects -= objects_in_use;
+	tiny_mag_ptr->mag_regions_to_depot++;
 
 	SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr); // Unlock the originating magazine
 
@@ -996,19 +1016,24 @@ tiny_free_do_recirc_to_depot(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t
 
 	// connect to Depot as last node
 	recirc_list_splice_last(rack, depot_ptr, node);
+	depot_ptr->mag_regions_to_depot++;
 
 	MAGMALLOC_RECIRCREGION(TINY_SZONE_FROM_RACK(rack), (int)mag_index, (void *)sparse_region, TINY_REGION_SIZE,
 						   (int)BYTES_USED_FOR_TINY_REGION(sparse_region)); // DTrace USDT Probe
 
 #if !CONFIG_AGGRESSIVE_MADVISE
-	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure
-	tiny_free_scan_madvise_free(rack, depot_ptr, sparse_region);
+	// Mark free'd dirty pages with MADV_FREE to reduce memory pressure, unless
+	// the background scavenger will do it once the region has gone quiet.
+	if (!malloc_scavenger_defer(node)) {
+		tiny_free_scan_madvise_free(rack, depot_ptr, sparse_region);
+	}
 #endif
 
 	// If the region is entirely empty vm_deallocate() it outside the depot lock
 	region_t r_dealloc = tiny_free_try_depot_unmap_no_lock(rack, depot_ptr, node);
 	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
 	if (r_dealloc) {
+		rack_region_unpublish(rack, r_dealloc);
 		mvm_deallocate_pages(r_dealloc, TINY_REGION_SIZE, 0);
 	}
 	return FALSE; // Caller need not unlock the originating magazine
@@ -1054,8 +1079,10 @@ tiny_free_try_recirc_to_depot(rack_t *rack,
 	} else {
 #if !CONFIG_AGGRESSIVE_MADVISE
 		// We are free'ing into the depot, so madvise as we do so unless we were madvising every incoming
-		// allocation anyway.
-		tiny_madvise_free_range_no_lock(rack, tiny_mag_ptr, region, headptr, headsize, ptr, msize);
+		// allocation anyway, or the background scavenger will get to it once the region is quiet.
+		if (!malloc_scavenger_defer(node)) {
+			tiny_madvise_free_range_no_lock(rack, tiny_mag_ptr, region, headptr, headsize, ptr, msize);
+		}
 #endif
 
 		if (0 < bytes_used || 0 < node->pinned_to_depot) {
@@ -1067,6 +1094,7 @@ tiny_free_try_recirc_to_depot(rack_t *rack,
 			region_t r_dealloc = tiny_free_try_depot_unmap_no_lock(rack, tiny_mag_ptr, node);
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 			if (r_dealloc) {
+				rack_region_unpublish(rack, r_dealloc);
 				mvm_deallocate_pages(r_dealloc, TINY_REGION_SIZE, 0);
 			}
 			return FALSE; // Caller need not unlock
@@ -1074,6 +1102,41 @@ tiny_free_try_recirc_to_depot(rack_t *rack,
 	}
 	return TRUE; // Caller must do SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr)
 }
+
+#if CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
+// Called on the scavenger thread. Madvises the free pages of depot regions
+// whose scavenge_after deadline has passed, stopping when the tick runs out
+// of time or bytes. The depot lock is dropped around each madvise, so the
+// walk starts again from the head of the depot's list after every region;
+// regions already done have had their deadline cleared.
+void
+tiny_scavenge(rack_t *rack, malloc_scavenger_tick_t *tick)
+{
+	if (rack->num_magazines == 1) {
+		return; // No depot
+	}
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	tiny_free_remote_all(rack);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+	magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+	SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+	region_trailer_t *node = depot_ptr->firstNode;
+	while (node && !malloc_scavenger_tick_done(tick)) {
+		if (!node->scavenge_after || node->pinned_to_depot ||
+				tick->now < node->scavenge_after) {
+			node = node->next;
+			continue;
+		}
+		node->scavenge_after = 0;
+		size_t bytes_madvised = tiny_free_scan_madvise_free(rack, depot_ptr, TINY_REGION_FOR_PTR(node));
+		malloc_scavenger_tick_charge(tick, SCAVENGED_REGION, bytes_madvised);
+		node = depot_ptr->firstNode;
+	}
+	SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+}
+#endif // CONFIG_SCAVENGER && !CONFIG_AGGRESSIVE_MADVISE
 #endif // CONFIG_RECIRC_DEPOT
 
 boolean_t
@@ -1679,6 +1742,9 @@ tiny_in_use_enumerator(task_t task,
 	void *mapped_ptr;
 	unsigned bit;
 	magazine_t *tiny_mag_base = NULL;
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	remote_free_set_t queued = {0};
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 
 	region_hash_generation_t *trg_ptr;
 	err = reader(task, (vm_address_t)szone->tiny_rack.region_generation, sizeof(region_hash_generation_t), (void **)&trg_ptr);
@@ -1699,6 +1765,10 @@ tiny_in_use_enumerator(task_t task,
 		if (err) {
 			return err;
 		}
+#if CONFIG_MAGAZINE_REMOTE_FREE
+		// Blocks on the remote free lists are still marked in use.
+		mag_remote_free_collect(task, reader, &szone->tiny_rack, tiny_mag_base, &queued);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 	}
 
 	for (index = 0; index < num_regions; ++index) {
@@ -1722,7 +1792,7 @@ tiny_in_use_enumerator(task_t task,
 
 				err = reader(task, range.address, range.size, (void **)&mapped_region);
 				if (err) {
-					return err;
+					goto out;
 				}
 
 				mag_index_t mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(mapped_region);
@@ -1777,6 +1847,12 @@ tiny_in_use_enumerator(task_t task,
 							bit++;
 							msize++;
 						}
+#if CONFIG_MAGAZINE_REMOTE_FREE
+						if (mag_remote_free_set_contains(&queued, range.address + block_offset)) {
+							block_index += msize;
+							continue;
+						}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 						buffer[count].address = range.address + block_offset;
 						buffer[count].size = TINY_BYTES_FOR_MSIZE(msize);
 						count++;
@@ -1792,7 +1868,8 @@ tiny_in_use_enumerator(task_t task,
 					}
 
 					if (!msize) {
-						return KERN_FAILURE; // Somethings amiss. Avoid looping at this block_index.
+						err = KERN_FAILURE; // Somethings amiss. Avoid looping at this block_index.
+						goto out;
 					}
 					block_index += msize;
 				}
@@ -1803,7 +1880,12 @@ tiny_in_use_enumerator(task_t task,
 			}
 		}
 	}
-	return 0;
+	err = 0;
+out:
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	mag_remote_free_release(&queued);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+	return err;
 }
 
 void *
@@ -2000,6 +2082,80 @@ return_tiny_alloc:
 	return ptr;
 }
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+// Frees the blocks that other threads left on a magazine's remote free list.
+// Called and returns with the magazine locked, though the lock may be dropped
+// and retaken along the way. A block whose region has since moved to another
+// magazine is passed on to that magazine's list, or freed into the depot.
+static MALLOC_NOINLINE void
+tiny_free_remote_no_lock(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index)
+{
+	remote_free_t *entry = mag_remote_free_take(tiny_mag_ptr);
+
+	while (entry) {
+		remote_free_t *next = free_list_unchecksum_ptr(rack, &entry->next);
+		boolean_t is_free;
+		msize_t msize = get_tiny_meta_header(entry, &is_free);
+		if (is_free || entry == tiny_mag_ptr->mag_last_free) {
+			// Report it, but keep draining so the rest of the list isn't leaked
+			// when corruption reports don't abort.
+			malloc_zone_error(rack->debug_flags, true, "Double free of object %p\n", entry);
+			entry = next;
+			continue;
+		}
+
+		region_t tiny_region = TINY_REGION_FOR_PTR(entry);
+		mag_index_t owner = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
+
+		if (owner == mag_index) {
+			if (!tiny_free_no_lock(rack, tiny_mag_ptr, mag_index, tiny_region, entry, msize)) {
+				SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+			}
+		} else if (owner == DEPOT_MAGAZINE_INDEX) {
+			// Regions only leave the depot with the depot locked, and the
+			// depot lock may be taken with a magazine lock held.
+			magazine_t *depot_ptr = &(rack->magazines[DEPOT_MAGAZINE_INDEX]);
+			SZONE_MAGAZINE_PTR_LOCK(depot_ptr);
+			owner = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
+			if (owner == DEPOT_MAGAZINE_INDEX) {
+				if (tiny_free_no_lock(rack, depot_ptr, DEPOT_MAGAZINE_INDEX, tiny_region, entry, msize)) {
+					SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				}
+			} else {
+				SZONE_MAGAZINE_PTR_UNLOCK(depot_ptr);
+				mag_remote_free_push(rack, &(rack->magazines[owner]), entry);
+			}
+		} else {
+			mag_remote_free_push(rack, &(rack->magazines[owner]), entry);
+		}
+		entry = next;
+	}
+}
+
+// Frees the blocks on every magazine's remote free list, for the paths that
+// trim or report on the heap without allocating from it: pressure relief,
+// the scavenger, statistics, telemetry and the fork child. Must be called
+// with no magazine lock held.
+void
+tiny_free_remote_all(rack_t *rack)
+{
+	// A block whose region has changed hands is forwarded to its new owner,
+	// which may already have been visited, so go round twice.
+	for (int pass = 0; pass < 2; pass++) {
+		mag_index_t mag_index;
+		for (mag_index = 0; mag_index < rack->num_magazines; mag_index++) {
+			magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+			if (!os_atomic_load(&mag_ptr->mag_remote_free, relaxed)) {
+				continue;
+			}
+			SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+			tiny_free_remote_no_lock(rack, mag_ptr, mag_index);
+			SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+		}
+	}
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 void *
 tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requested)
 {
@@ -2021,8 +2177,26 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 	}
 #endif
 
+#if CONFIG_THREAD_CACHE
+	if (rack->tcache_enabled) {
+		ptr = thread_cache_malloc(rack, msize);
+		if (ptr) {
+			if (cleared_requested) {
+				memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
+			}
+			return ptr;
+		}
+	}
+#endif // CONFIG_THREAD_CACHE
+
 	SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
 
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (tiny_mag_ptr->mag_remote_free) {
+		tiny_free_remote_no_lock(rack, tiny_mag_ptr, mag_index);
+	}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
 #if CONFIG_TINY_CACHE
 	ptr = tiny_mag_ptr->mag_last_free;
 
@@ -2046,22 +2220,27 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 #endif /* CONFIG_TINY_CACHE */
 
 	while (1) {
+		size_t untouched = mag_untouched_bytes(tiny_mag_ptr);
 		ptr = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
 		if (ptr) {
+			// a block carved from the untouched head or tail of the last region is still zero
+			boolean_t known_zero = (mag_untouched_bytes(tiny_mag_ptr) != untouched);
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 			CHECK(szone, __PRETTY_FUNCTION__);
-			if (cleared_requested) {
+			if (cleared_requested && !known_zero) {
 				memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
 			}
 			return ptr;
 		}
 
 		if (tiny_get_region_from_depot(rack, tiny_mag_ptr, mag_index, msize)) {
+			untouched = mag_untouched_bytes(tiny_mag_ptr);
 			ptr = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
 			if (ptr) {
+				boolean_t known_zero = (mag_untouched_bytes(tiny_mag_ptr) != untouched);
 				SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 				CHECK(szone, __PRETTY_FUNCTION__);
-				if (cleared_requested) {
+				if (cleared_requested && !known_zero) {
 					memset(ptr, 0, TINY_BYTES_FOR_MSIZE(msize));
 				}
 				return ptr;
@@ -2100,6 +2279,7 @@ tiny_malloc_should_clear(rack_t *rack, msize_t msize, boolean_t cleared_requeste
 			tiny_mag_ptr->alloc_underway = FALSE;
 			OSMemoryBarrier();
 			SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
+			rack_region_publish(rack, fresh_region);
 			CHECK(szone, __PRETTY_FUNCTION__);
 			return ptr;
 		} else {
@@ -2187,7 +2367,43 @@ free_tiny(rack_t *rack, void *ptr, region_t tiny_region, size_t known_size)
 	}
 #endif
 
+#if CONFIG_THREAD_CACHE
+	if (rack->tcache_enabled) {
+		// A block that is already free in its region must not be cached, or
+		// the cache and the magazine would both hand it out.
+		if (known_size && tiny_meta_header_is_free(ptr)) {
+			malloc_zone_error(rack->debug_flags, true, "Double free of object %p\n", ptr);
+			return;
+		}
+		if (thread_cache_free(rack, ptr, msize)) {
+			return;
+		}
+	}
+#endif // CONFIG_THREAD_CACHE
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+	if (!SZONE_MAGAZINE_PTR_TRY_LOCK(tiny_mag_ptr)) {
+		// Another CPU is working in the block's magazine. Rather than queue
+		// behind it, leave the block on the magazine's remote free list.
+		if (DEPOT_MAGAZINE_INDEX != mag_index &&
+				mag_index != tiny_mag_get_thread_index() % rack->num_magazines) {
+			// Pushing a block that is already free would overwrite its free
+			// list linkage, so catch that here rather than at drain time.
+			if (known_size && tiny_meta_header_is_free(ptr)) {
+				malloc_zone_error(rack->debug_flags, true, "Double free of object %p\n", ptr);
+				return;
+			}
+			mag_remote_free_push(rack, tiny_mag_ptr, ptr);
+			return;
+		}
+		SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+	}
+	if (tiny_mag_ptr->mag_remote_free) {
+		tiny_free_remote_no_lock(rack, tiny_mag_ptr, mag_index);
+	}
+#else // CONFIG_MAGAZINE_REMOTE_FREE
 	SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
 
 #if CONFIG_TINY_CACHE
 	// Depot does not participate in CONFIG_TINY_CACHE since it can't be directly malloc()'d
@@ -2245,6 +2461,71 @@ free_tiny(rack_t *rack, void *ptr, region_t tiny_region, size_t known_size)
 	CHECK(szone, __PRETTY_FUNCTION__);
 }
 
+// Allocates up to 'count' blocks of 'msize' quanta from a magazine whose lock
+// is held. Exact matches on the free list are taken first. After that, the
+// blocks are carved as one contiguous run from the unclaimed space at the end
+// of the magazine's last region, which needs a single boundary header rather
+// than one per block. Anything still outstanding comes from splitting larger
+// free blocks. Returns the number of blocks allocated.
+static unsigned
+tiny_malloc_run_from_free_list(rack_t *rack, magazine_t *tiny_mag_ptr, mag_index_t mag_index,
+		msize_t msize, void **results, unsigned count)
+{
+	free_list_t *the_slot = tiny_mag_ptr->mag_free_list + tiny_slot_from_msize(msize);
+	size_t block_bytes = TINY_BYTES_FOR_MSIZE(msize);
+	unsigned found = 0;
+	unsigned run;
+
+	CHECK_MAGAZINE_PTR_LOCKED(szone, tiny_mag_ptr, __PRETTY_FUNCTION__);
+
+	while (found < count && the_slot->p) {
+		results[found++] = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
+	}
+
+	run = (unsigned)MIN(count - found, tiny_mag_ptr->mag_bytes_free_at_end / block_bytes);
+	if (run) {
+		region_t region = tiny_mag_ptr->mag_last_region;
+		unsigned char *ptr = (unsigned char *)TINY_REGION_END(region) - tiny_mag_ptr->mag_bytes_free_at_end;
+		size_t run_bytes = run * block_bytes;
+
+		tiny_mag_ptr->mag_bytes_free_at_end -= run_bytes;
+		if (tiny_mag_ptr->mag_bytes_free_at_end) {
+			// let's add an in use block after the run to serve as boundary
+			set_tiny_meta_header_in_use_1(ptr + run_bytes);
+		}
+		for (unsigned i = 0; i < run; i++, ptr += block_bytes) {
+			if (msize > 1) {
+				set_tiny_meta_header_in_use(ptr, msize);
+			} else {
+				set_tiny_meta_header_in_use_1(ptr);
+			}
+			results[found++] = ptr;
+		}
+
+		tiny_mag_ptr->mag_num_objects += run;
+		tiny_mag_ptr->mag_num_bytes_in_objects += run_bytes;
+
+		// Update this region's bytes in use count
+		region_trailer_t *node = REGION_TRAILER_FOR_TINY_REGION(region);
+		size_t bytes_used = node->bytes_used + run_bytes;
+		node->bytes_used = (unsigned int)bytes_used;
+
+		// Emptiness discriminant
+		if (bytes_used >= DENSITY_THRESHOLD(TINY_REGION_PAYLOAD_BYTES)) {
+			node->recirc_suitable = FALSE;
+		}
+	}
+
+	while (found < count) {
+		void *ptr = tiny_malloc_from_free_list(rack, tiny_mag_ptr, mag_index, msize);
+		if (!ptr) {
+			break;
+		}
+		results[found++] = ptr;
+	}
+	return found;
+}
+
 unsigned
 tiny_batch_malloc(szone_t *szone, size_t size, void **results, unsigned count)
 {
@@ -2260,23 +2541,32 @@ tiny_batch_malloc(szone_t *szone, size_t size, void **results, unsigned count)
 
 	CHECK(szone, __PRETTY_FUNCTION__);
 
-	// We must lock the zone now, since tiny_malloc_from_free_list assumes that
-	// the caller has done so.
-	SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
-
-	// with the zone locked, allocate objects from the free list until all
-	// sufficiently large objects have been exhausted, or we have met our quota
-	// of objects to allocate.
 	while (found < count) {
-		void *ptr = tiny_malloc_from_free_list(&szone->tiny_rack, tiny_mag_ptr, mag_index, msize);
-		if (!ptr) {
+		// We must lock the zone now, since tiny_malloc_from_free_list assumes that
+		// the caller has done so.
+		SZONE_MAGAZINE_PTR_LOCK(tiny_mag_ptr);
+
+		// with the zone locked, allocate objects from the magazine until it is
+		// exhausted, pulling in regions from the depot as needed, or we have met
+		// our quota of objects to allocate.
+		do {
+			found += tiny_malloc_run_from_free_list(&szone->tiny_rack, tiny_mag_ptr, mag_index, msize,
+					results + found, count - found);
+		} while (found < count && tiny_get_region_from_depot(&szone->tiny_rack, tiny_mag_ptr, mag_index, msize));
+		SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
+
+		if (found == count) {
 			break;
 		}
 
-		*results++ = ptr;
-		found++;
+		// The magazine is exhausted. Let the regular allocation path obtain a new
+		// region, which the next pass then carves the rest of the batch from.
+		void *ptr = tiny_malloc_should_clear(&szone->tiny_rack, msize, 0);
+		if (!ptr) {
+			break;
+		}
+		results[found++] = ptr;
 	}
-	SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
 	return found;
 }
 
@@ -2345,6 +2635,45 @@ tiny_batch_free(szone_t *szone, void **to_be_freed, unsigned count)
 	}
 }
 
+#if CONFIG_THREAD_CACHE
+// Returns a batch of blocks of a single msize from a thread cache to their
+// magazines. The blocks are still marked in use and are expected to be sorted
+// by address, so that runs from the same region share one magazine lock.
+void
+tiny_free_thread_cache_batch(rack_t *rack, void **ptrs, unsigned count, msize_t msize)
+{
+	region_t tiny_region = NULL;
+	magazine_t *tiny_mag_ptr = NULL;
+	mag_index_t mag_index = -1;
+	unsigned cc;
+
+	for (cc = 0; cc < count; cc++) {
+		void *ptr = ptrs[cc];
+
+		if (NULL == tiny_region || tiny_region != TINY_REGION_FOR_PTR(ptr)) {
+			if (tiny_mag_ptr) { // non-NULL iff magazine lock taken
+				SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
+			}
+			tiny_region = TINY_REGION_FOR_PTR(ptr);
+			tiny_mag_ptr = mag_lock_zine_for_region_trailer(rack->magazines,
+					REGION_TRAILER_FOR_TINY_REGION(tiny_region),
+					MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region));
+			mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(tiny_region);
+		}
+
+		if (!tiny_free_no_lock(rack, tiny_mag_ptr, mag_index, tiny_region, ptr, msize)) {
+			// Arrange to re-acquire magazine lock
+			tiny_mag_ptr = NULL;
+			tiny_region = NULL;
+		}
+	}
+
+	if (tiny_mag_ptr) {
+		SZONE_MAGAZINE_PTR_UNLOCK(tiny_mag_ptr);
+	}
+	CHECK(TINY_SZONE_FROM_RACK(rack), __PRETTY_FUNCTION__);
+}
+#endif // CONFIG_THREAD_CACHE
 
 void
 print_tiny_free_list(rack_t *rack)
@@ -2457,6 +2786,71 @@ print_tiny_region(boolean_t verbose, region_t region, size_t bytes_at_start, siz
 	}
 }
 
+// Counts the blocks in use in a tiny region by size class. Assumes the region's
+// magazine is locked.
+static void
+tiny_region_telemetry(rack_t *rack, region_t region, size_t bytes_at_start, size_t bytes_at_end,
+		malloc_allocator_telemetry_t *telemetry)
+{
+	uintptr_t current = (uintptr_t)TINY_REGION_ADDRESS(region) + bytes_at_start;
+	uintptr_t limit = (uintptr_t)TINY_REGION_END(region) - bytes_at_end;
+	boolean_t is_free;
+	msize_t msize;
+
+	while (current < limit) {
+		msize = get_tiny_meta_header((void *)current, &is_free);
+		if (!msize) {
+			// The rest of the region is free, or the metadata is corrupt.
+			break;
+		}
+		if (!is_free) {
+			telemetry->size_classes[tiny_slot_from_msize(msize)].blocks_in_use++;
+		}
+		current += TINY_BYTES_FOR_MSIZE(msize);
+	}
+}
+
+void
+tiny_telemetry(rack_t *rack, malloc_allocator_telemetry_t *telemetry)
+{
+	mag_index_t mag_index;
+	grain_t slot;
+
+	telemetry->num_size_classes = NUM_TINY_SLOTS + 1;
+	telemetry->num_magazines = rack->num_magazines;
+	for (slot = 0; slot < NUM_TINY_SLOTS + 1; slot++) {
+		telemetry->size_classes[slot].size = TINY_BYTES_FOR_MSIZE(slot + 1);
+	}
+
+	// Every region is on its magazine's recirculation list, and stays mapped
+	// while it is there.
+	for (mag_index = DEPOT_MAGAZINE_INDEX; mag_index < rack->num_magazines; mag_index++) {
+		magazine_t *mag_ptr = &(rack->magazines[mag_index]);
+		region_trailer_t *node;
+
+		SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+		magazine_telemetry(rack->magazines, mag_index, telemetry);
+		for (slot = 0; slot < NUM_TINY_SLOTS + 1; slot++) {
+			telemetry->size_classes[slot].blocks_free +=
+					free_list_count(rack, mag_ptr->mag_free_list[slot]);
+		}
+		for (node = mag_ptr->firstNode; node; node = node->next) {
+			region_t region = TINY_REGION_FOR_PTR(node);
+			boolean_t last = (region == mag_ptr->mag_last_region);
+
+			tiny_region_telemetry(rack, region, last ? mag_ptr->mag_bytes_free_at_start : 0,
+					last ? mag_ptr->mag_bytes_free_at_end : 0, telemetry);
+		}
+		if (mag_ptr->mag_last_free) {
+			// Marked in use, but free as far as the caller is concerned.
+			slot = tiny_slot_from_msize(mag_ptr->mag_last_free_msize);
+			telemetry->size_classes[slot].blocks_in_use--;
+			telemetry->size_classes[slot].blocks_free++;
+		}
+		SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+	}
+}
+
 static char *tiny_freelist_fail_msg = "check: tiny free list incorrect ";
 
 #define TINY_FREELIST_FAIL(fmt, ...) \
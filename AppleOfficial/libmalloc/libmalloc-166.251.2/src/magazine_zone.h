@@ -212,6 +212,10 @@ typedef struct region_trailer {
 	volatile int pinned_to_depot;
 	unsigned bytes_used;
 	mag_index_t mag_index;
+	// mach_absolute_time() after which the background scavenger may madvise
+	// this region's free pages while it sits in the depot. Zero if there is
+	// nothing to do. Protected by the depot lock.
+	uint64_t scavenge_after;
 } region_trailer_t;
 
 typedef struct tiny_region {
@@ -366,9 +370,11 @@ typedef struct tiny_region {
  * Convert from msize unit to free list slot.
  */
 #define SMALL_FREE_SLOT_COUNT(_r) \
-		(NUM_SMALL_SLOTS + 1)
+		FREELIST_SLOT_COUNT(NUM_SMALL_SLOTS, NUM_SMALL_BLOCKS)
 #define SMALL_FREE_SLOT_FOR_MSIZE(_r, _m) \
-		(((_m) <= SMALL_FREE_SLOT_COUNT(_r)) ? ((_m) - 1) : (SMALL_FREE_SLOT_COUNT(_r) - 1))
+		FREELIST_SLOT_FOR_MSIZE(NUM_SMALL_SLOTS, _m)
+#define SMALL_FREE_FIT_SLOT_FOR_MSIZE(_r, _m) \
+		FREELIST_FIT_SLOT_FOR_MSIZE(NUM_SMALL_SLOTS, _m)
 /* compare with MAGAZINE_FREELIST_BITMAP_WORDS */
 #define SMALL_FREELIST_BITMAP_WORDS(_r) ((SMALL_FREE_SLOT_COUNT(_r) + 31) >> 5)
 
@@ -552,9 +558,12 @@ MALLOC_STATIC_ASSERT(NUM_MEDIUM_BLOCKS <= (uint16_t)(~MEDIUM_IS_FREE),
 /*
  * Convert from msize unit to free list slot.
  */
-#define MEDIUM_FREE_SLOT_COUNT(_r) (NUM_MEDIUM_SLOTS + 1)
+#define MEDIUM_FREE_SLOT_COUNT(_r) \
+		FREELIST_SLOT_COUNT(NUM_MEDIUM_SLOTS, NUM_MEDIUM_BLOCKS)
 #define MEDIUM_FREE_SLOT_FOR_MSIZE(_r, _m) \
-		(((_m) <= MEDIUM_FREE_SLOT_COUNT(_r)) ? ((_m) - 1) : (MEDIUM_FREE_SLOT_COUNT(_r) - 1))
+		FREELIST_SLOT_FOR_MSIZE(NUM_MEDIUM_SLOTS, _m)
+#define MEDIUM_FREE_FIT_SLOT_FOR_MSIZE(_r, _m) \
+		FREELIST_FIT_SLOT_FOR_MSIZE(NUM_MEDIUM_SLOTS, _m)
 /* compare with MAGAZINE_FREELIST_BITMAP_WORDS */
 #define MEDIUM_FREELIST_BITMAP_WORDS(_r) ((MEDIUM_FREE_SLOT_COUNT(_r) + 31) >> 5)
 
@@ -641,12 +650,30 @@ typedef struct large_entry_s {
 	vm_address_t address;
 	vm_size_t size;
 	boolean_t did_madvise_reusable;
+	uint32_t headroom_pages; // untouched pages reserved above size for realloc
 } large_entry_t;
 
+#define LARGE_ENTRY_HEADROOM(entry) ((size_t)(entry)->headroom_pages << vm_page_quanta_shift)
+
 #if !CONFIG_LARGE_CACHE && DEBUG_MALLOC
 #warning CONFIG_LARGE_CACHE turned off
 #endif
 
+/*
+ * A slot in the large entry cache. Occupied slots are linked on the list
+ * for their size bucket, most recently freed first, and on the age list
+ * that is trimmed from the oldest end when the cache is over budget.
+ */
+typedef struct large_cache_entry_s {
+	large_entry_t entry; // entry.address == 0 for a free slot
+	int16_t bucket_prev;
+	int16_t bucket_next;
+	int16_t age_newer;
+	int16_t age_older;
+} large_cache_entry_t;
+
+#define LARGE_CACHE_NONE ((int16_t)-1)
+
 #if CONFIG_MEDIUM_ALLOCATOR
 #define LARGE_THRESHOLD(szone) ((szone)->is_medium_engaged ? \
 		(MEDIUM_LIMIT_THRESHOLD) : (SMALL_LIMIT_THRESHOLD))
@@ -659,11 +686,33 @@ typedef struct large_entry_s {
  * Per-processor magazine for tiny and small allocators
  ******************************************************************************/
 
+/*
+ * A tiny or small block waiting on a magazine's remote free list. The link is
+ * checksummed with the rack's cookie, like the free lists.
+ */
+typedef struct remote_free_s {
+	inplace_union next;
+} remote_free_t;
+
+/*
+ * The addresses of the blocks on a rack's remote free lists, gathered by
+ * mag_remote_free_collect() for the in-use enumerators.
+ */
+typedef struct remote_free_set_s {
+	vm_address_t *addrs; // sorted
+	unsigned count;
+	vm_size_t size; // of the pages holding addrs
+} remote_free_set_t;
+
 typedef struct magazine_s { // vm_allocate()'d, so the array of magazines is page-aligned to begin with.
 	// Take magazine_lock first,  Depot lock when needed for recirc, then szone->{tiny,small}_regions_lock when needed for alloc
 	_malloc_lock_s magazine_lock MALLOC_CACHE_ALIGN;
 	// Protection for the crtical section that does allocate_pages outside the magazine_lock
 	volatile boolean_t alloc_underway;
+	// Kept next to the lock, and updated with it held, by
+	// SZONE_MAGAZINE_PTR_LOCK() and SZONE_MAGAZINE_PTR_TRY_LOCK().
+	size_t mag_lock_acquisitions;
+	size_t mag_lock_contentions;	// acquisitions that found the lock held
 
 	// One element deep "death row", optimizes malloc/free/malloc for identical size.
 	void *mag_last_free;
@@ -675,6 +724,8 @@ typedef struct magazine_s { // vm_allocate()'d, so the array of magazines is pag
 
 	free_list_t mag_free_list[MAGAZINE_FREELIST_SLOTS];
 	uint32_t mag_bitmap[MAGAZINE_FREELIST_BITMAP_WORDS];
+	// Small and medium only: bit i is set iff mag_bitmap[i] is non-zero.
+	uint32_t mag_bitmap_summary;
 
 	// the first and last free region in the last block are treated as big blocks in use that are not accounted for
 	size_t mag_bytes_free_at_end;
@@ -693,12 +744,22 @@ typedef struct magazine_s { // vm_allocate()'d, so the array of magazines is pag
 	region_trailer_t *firstNode;
 	region_trailer_t *lastNode;
 
+	// telemetry, see malloc_zone_telemetry(). Only updated with magazine_lock
+	// held.
+	size_t mag_regions_to_depot;
+	size_t mag_regions_from_depot;
+	size_t mag_bytes_madvised;
+
+	// Blocks freed by other threads while magazine_lock was held, see
+	// mag_remote_free_push(). Pushed without the lock, detached with it held.
+	remote_free_t *mag_remote_free;
+
 #if MALLOC_TARGET_64BIT
-	uintptr_t pad[320 - 14 - MAGAZINE_FREELIST_SLOTS -
-			(MAGAZINE_FREELIST_BITMAP_WORDS + 1) / 2];
+	uintptr_t pad[320 - 20 - MAGAZINE_FREELIST_SLOTS -
+			(MAGAZINE_FREELIST_BITMAP_WORDS + 2) / 2];
 #else
-	uintptr_t pad[320 - 16 - MAGAZINE_FREELIST_SLOTS -
-			MAGAZINE_FREELIST_BITMAP_WORDS];
+	uintptr_t pad[320 - 22 - MAGAZINE_FREELIST_SLOTS -
+			MAGAZINE_FREELIST_BITMAP_WORDS - 1];
 #endif
 
 } magazine_t;
@@ -709,6 +770,47 @@ MALLOC_STATIC_ASSERT(sizeof(magazine_t) == 2560, "Incorrect padding in magazine_
 MALLOC_STATIC_ASSERT(sizeof(magazine_t) == 1280, "Incorrect padding in magazine_t");
 #endif
 
+/*
+ * Two-level free list bitmap used by small and medium: mag_bitmap has a bit
+ * per slot and mag_bitmap_summary a bit per mag_bitmap word, so finding the
+ * first non-empty slot at or above any given slot takes at most two ctz
+ * operations. Assumes the magazine is locked.
+ */
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+magazine_bitmap_set(magazine_t *mag_ptr, grain_t slot)
+{
+	BITMAPN_SET(mag_ptr->mag_bitmap, slot);
+	mag_ptr->mag_bitmap_summary |= 1U << (slot >> 5);
+}
+
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE void
+magazine_bitmap_clr(magazine_t *mag_ptr, grain_t slot)
+{
+	BITMAPN_CLR(mag_ptr->mag_bitmap, slot);
+	if (!mag_ptr->mag_bitmap[slot >> 5]) {
+		mag_ptr->mag_bitmap_summary &= ~(1U << (slot >> 5));
+	}
+}
+
+// Returns the first slot at or above 'slot' with a non-empty free list, or -1
+// if there is none.
+static MALLOC_INLINE MALLOC_ALWAYS_INLINE int
+magazine_bitmap_find(magazine_t *mag_ptr, grain_t slot)
+{
+	unsigned idx = slot >> 5;
+	uint32_t bitmap = mag_ptr->mag_bitmap[idx] & ~((1U << (slot & 31)) - 1);
+	if (!bitmap) {
+		// Shifted in 64 bits, since idx may be 31.
+		uint32_t summary = mag_ptr->mag_bitmap_summary & (uint32_t)~((2ULL << idx) - 1);
+		if (!summary) {
+			return -1;
+		}
+		idx = __builtin_ctz(summary);
+		bitmap = mag_ptr->mag_bitmap[idx];
+	}
+	return (int)((idx << 5) + __builtin_ctz(bitmap));
+}
+
 #define TINY_MAX_MAGAZINES 64 /* MUST BE A POWER OF 2! */
 #define TINY_MAGAZINE_PAGED_SIZE                                                   \
 	(((sizeof(magazine_t) * (TINY_MAX_MAGAZINES + 1)) + vm_page_quanta_size - 1) & \
@@ -721,6 +823,62 @@ MALLOC_STATIC_ASSERT(sizeof(magazine_t) == 1280, "Incorrect padding in magazine_
 
 #define DEPOT_MAGAZINE_INDEX -1
 
+/*******************************************************************************
+ * Per-thread cache for tiny and small allocators
+ ******************************************************************************/
+
+/*
+ * A thread cache holds a bounded number of freed tiny and small blocks per
+ * msize so that a thread that frees and reallocates the same sizes does not
+ * take a magazine lock on either path. Blocks parked in a thread cache are
+ * still marked in use in their region's metadata: size() and the in-use
+ * enumerators report them as allocated, and szone_statistics() subtracts them
+ * back out.
+ *
+ * The first two words of a cached block are overlaid with a tcache_entry_t.
+ * The next pointer is checksummed with the owning rack's cookie, exactly like
+ * the magazine free lists. The key is the same for all of a zone's caches, so
+ * that a repeated free of a cached block is detected cheaply whichever thread
+ * cached it.
+ */
+typedef struct tcache_entry_s {
+	inplace_union next;
+	uintptr_t key;
+} tcache_entry_t;
+
+typedef struct tcache_bin_s {
+	tcache_entry_t *head;
+	uint32_t count;
+} tcache_bin_t;
+
+typedef struct tcache_counters_s {
+	uint64_t hits;			 // allocations satisfied from the cache
+	uint64_t misses;		 // allocations that fell through to a magazine
+	uint64_t frees;			 // frees absorbed by the cache
+	uint64_t flushes;		 // batches handed back to the magazines
+	uint64_t flushed_blocks; // blocks handed back to the magazines
+} tcache_counters_t;
+
+typedef struct thread_cache_s {
+	// Linkage on szone->tcache_list, protected by szone->tcache_lock.
+	struct thread_cache_s *next;
+	struct thread_cache_s *prev;
+
+	struct szone_s *szone;
+
+	size_t max_bytes;
+	size_t bytes_cached;
+	uint32_t blocks_cached;
+	uint32_t generation; // szone->tcache_generation when last checked
+
+	tcache_counters_t counters;
+
+	tcache_bin_t tiny_bins[TCACHE_TINY_BINS];
+	tcache_bin_t small_bins[TCACHE_SMALL_BINS];
+} thread_cache_t;
+
+#define THREAD_CACHE_PAGED_SIZE round_page_quanta(sizeof(thread_cache_t))
+
 /****************************** zone itself ***********************************/
 
 /*
@@ -751,15 +909,28 @@ typedef struct szone_s {	  // vm_allocate()'d, so page-aligned to begin with.
 	size_t num_bytes_in_large_objects;
 
 #if CONFIG_LARGE_CACHE
-	int large_entry_cache_oldest;
-	int large_entry_cache_newest;
-	large_entry_t large_entry_cache[LARGE_ENTRY_CACHE_SIZE]; // "death row" for large malloc/free
+	int16_t large_entry_cache_oldest; // tail of the age list
+	int16_t large_entry_cache_newest; // head of the age list
+	int16_t large_entry_cache_bucket_head[LARGE_CACHE_BUCKETS];
+	uint64_t large_entry_cache_bucket_map; // bit per non-empty bucket
+	large_cache_entry_t large_entry_cache[LARGE_ENTRY_CACHE_SIZE]; // "death row" for large malloc/free
 	boolean_t large_legacy_reset_mprotect;
-	size_t large_entry_cache_reserve_bytes;
+	size_t large_entry_cache_reserve_bytes; // death row bytes not madvise()d
 	size_t large_entry_cache_reserve_limit;
 	size_t large_entry_cache_bytes; // total size of death row, bytes
+	uint64_t large_entry_cache_hits;
+	uint64_t large_entry_cache_misses;
+	uint64_t large_entry_cache_evictions;
 #endif
 
+	/* large realloc counters, see malloc_large_realloc_statistics_t */
+	uint64_t large_realloc_grown_in_place;
+	uint64_t large_realloc_grown_into_headroom;
+	uint64_t large_realloc_remaps;
+	uint64_t large_realloc_bytes_remapped;
+	uint64_t large_realloc_copies;
+	uint64_t large_realloc_bytes_copied;
+
 	/* flag and limits pertaining to altered malloc behavior for systems with
 	 * large amounts of physical memory */
 	bool is_medium_engaged;
@@ -772,6 +943,16 @@ typedef struct szone_s {	  // vm_allocate()'d, so page-aligned to begin with.
 	struct szone_s *helper_zone;
 
 	boolean_t flotsam_enabled;
+
+#if CONFIG_THREAD_CACHE
+	/* per-thread caches in front of the tiny and small racks */
+	_malloc_lock_s tcache_lock;
+	size_t tcache_max_bytes; // zero when thread caching is not enabled
+	thread_cache_t *tcache_list;
+	tcache_counters_t tcache_retired; // counters of caches whose thread exited
+	uintptr_t tcache_key; // stored in every block parked in a thread cache
+	uint32_t tcache_generation; // bumped to have every cache flush on its next use
+#endif
 } szone_t;
 
 #define SZONE_PAGED_SIZE round_page_quanta((sizeof(szone_t)))
@@ -22,6 +22,7 @@
  */
 
 #include "internal.h"
+#include "radix_tree.h"
 
 #if TARGET_OS_IPHONE
 // malloc_report(ASL_LEVEL_INFO...) on iOS doesn't show up in the Xcode Console log of the device,
@@ -96,6 +97,38 @@ static int32_t volatile counterAlice = 0, counterBob = 0;
 static int32_t volatile * volatile pFRZCounterLive = &counterAlice;
 static int32_t volatile * volatile pFRZCounterDrain = &counterBob;
 
+/*
+ * Serializes the threads that drain the FRZ counters, and the writers of the
+ * zone address index below. Taken after MALLOC_LOCK and the scavenger lock,
+ * and never while a magazine lock is held.
+ */
+static _malloc_lock_s malloc_zone_index_lock = _MALLOC_LOCK_INIT;
+
+#if CONFIG_ZONE_INDEX
+/*
+ * Address-range index used by find_registered_zone() to pick the zone that
+ * owns a pointer without asking every registered zone in turn. Regions
+ * published by the magazine allocators map to a slot in
+ * malloc_zone_index_owners[], which holds the registered zone that owns them.
+ *
+ * Entries are only hints: the zone named by the index must still claim the
+ * pointer, and anything the index doesn't know about (large allocations,
+ * nano, zones without a slot) is found by the linear scan.
+ *
+ * The tree is a radix_ctree, so readers look it up from inside FRZ without a
+ * lock while writers, serialized on malloc_zone_index_lock, update it in
+ * place. If an update fails the index no longer covers every region, so it
+ * is withdrawn for good and find_registered_zone() goes back to the linear
+ * scan; a partial index is never left published.
+ */
+#define MALLOC_ZONE_INDEX_MAX_OWNERS 256
+#define MALLOC_ZONE_INDEX_KEY(_a) ((uint64_t)(_a) & ~(uint64_t)(4096 - 1))
+
+static struct radix_ctree * volatile malloc_zone_index_tree = NULL;
+static boolean_t malloc_zone_index_failed = false; // protected by malloc_zone_index_lock
+static malloc_zone_t * volatile malloc_zone_index_owners[MALLOC_ZONE_INDEX_MAX_OWNERS];
+#endif // CONFIG_ZONE_INDEX
+
 unsigned int _os_cpu_number_override = -1;
 
 static inline malloc_zone_t *inline_malloc_default_zone(void) __attribute__((always_inline));
@@ -127,6 +160,10 @@ static const char max_medium_magazines_boot_arg[] = "malloc_max_medium_magazines
 static const char medium_activation_threshold_boot_arg[] = "malloc_medium_activation_threshold";
 #endif // CONFIG_MEDIUM_ALLOCATOR
 
+// Large page mode
+static const char large_pages_env[] = "MallocLargePages";
+static const char large_pages_boot_arg[] = "malloc_large_pages";
+
 /*********	Utilities	************/
 static bool _malloc_entropy_initialized;
 
@@ -223,6 +260,33 @@ __malloc_init_from_bootargs(const char *bootargs)
 #endif // CONFIG_MEDIUM_ALLOCATOR
 }
 
+// Large pages have to be configured before the nano zone picks its madvise
+// policy and before the first region is allocated, so this is done here
+// rather than in set_flags_from_environment(). The environment variable
+// overrides the boot argument.
+static void
+__malloc_init_large_pages(const char *envp[], const char *bootargs)
+{
+	char value_buf[256];
+	const char *name = large_pages_env;
+	const char *flag = _simple_getenv(envp, large_pages_env);
+	if (!flag) {
+		flag = malloc_common_value_for_key_copy(bootargs, large_pages_boot_arg,
+				value_buf, sizeof(value_buf));
+		name = large_pages_boot_arg;
+	}
+	if (flag) {
+		const char *endp;
+		long value = malloc_common_convert_to_long(flag, &endp);
+		if (!*endp) {
+			mvm_large_pages_enabled = (value != 0);
+		} else {
+			malloc_report(ASL_LEVEL_ERR, "%s value (%s) invalid - ignored.\n",
+					name, flag);
+		}
+	}
+}
+
 /* TODO: Investigate adding _malloc_initialize() into this libSystem initializer */
 void
 __malloc_init(const char *apple[])
@@ -237,9 +301,16 @@ __malloc_init(const char *apple[])
 		bootargs[len + 1] = '\0';
 	}
 
-#if CONFIG_NANOZONE
 	// TODO: envp should be passed down from Libsystem
 	const char **envp = (const char **)*_NSGetEnviron();
+#if CONFIG_SCAVENGER
+	// Must precede nano_common_init(), which picks the nano madvise policy
+	// based on whether the scavenger is enabled.
+	malloc_scavenger_init(envp, bootargs);
+#endif
+	// Must precede nano_common_init() as well.
+	__malloc_init_large_pages(envp, bootargs);
+#if CONFIG_NANOZONE
 	nano_common_init(envp, apple, bootargs);
 #endif
 
@@ -461,6 +532,14 @@ default_zone_reinit_lock(malloc_zone_t *zone)
 	return zone->introspect->reinit_lock(zone);
 }
 
+static boolean_t
+default_zone_telemetry(malloc_zone_t *zone, malloc_zone_telemetry_t *telemetry)
+{
+	zone = runtime_default_zone();
+
+	return malloc_zone_telemetry(zone, telemetry);
+}
+
 static struct malloc_introspection_t default_zone_introspect = {
 	default_zone_ptr_in_use_enumerator,
 	default_zone_good_size,
@@ -475,7 +554,8 @@ static struct malloc_introspection_t default_zone_introspect = {
 	NULL,
 	NULL,
 	NULL,
-	default_zone_reinit_lock
+	default_zone_reinit_lock,
+	default_zone_telemetry
 };
 
 typedef struct {
@@ -499,7 +579,7 @@ __attribute__((aligned(PAGE_MAX_SIZE))) = {
 	default_zone_batch_malloc,
 	default_zone_batch_free,
 	&default_zone_introspect,
-	10,
+	11,
 	default_zone_memalign,
 	default_zone_free_definite_size,
 	default_zone_pressure_relief,
@@ -585,6 +665,24 @@ find_registered_zone(const void *ptr, size_t *returned_size)
 	//      are still valid). It also ensures that all the pointers in the zones array are
 	//      valid until it returns, so that a stale value in limit is not dangerous.
 
+#if CONFIG_ZONE_INDEX
+	// Try the zone the address index names first. The tree and the owner
+	// stay valid until we leave FRZ.
+	struct radix_ctree *tree = os_atomic_load(&malloc_zone_index_tree, acquire);
+	if (tree) {
+		uint64_t slot = radix_ctree_lookup(tree, MALLOC_ZONE_INDEX_KEY(ptr));
+		if (slot < MALLOC_ZONE_INDEX_MAX_OWNERS) {
+			zone = malloc_zone_index_owners[slot];
+			if (zone) {
+				size = zone->size(zone, ptr);
+				if (size) { // Claimed by this zone?
+					goto out;
+				}
+			}
+		}
+	}
+#endif // CONFIG_ZONE_INDEX
+
 	for (index = 1; index < limit; ++index, ++zones) {
 		zone = *zones;
 		size = zone->size(zone, ptr);
@@ -603,6 +701,102 @@ out:
 	return zone;
 }
 
+// Waits for every thread that is presently inside find_registered_zone() to
+// leave it. Callers must serialize with each other: malloc_zone_unregister()
+// and the zone index writers both hold malloc_zone_index_lock.
+static void
+malloc_frz_drain(void)
+{
+	// Exchange the roles of the FRZ counters. The counter that has captured the number of threads presently
+	// executing *inside* find_regiatered_zone is swapped with the counter drained to zero last time through.
+	// The former is then allowed to drain to zero while this thread yields.
+	int32_t volatile *p = pFRZCounterLive;
+	pFRZCounterLive = pFRZCounterDrain;
+	pFRZCounterDrain = p;
+	OSMemoryBarrier(); // Full memory barrier
+
+	while (0 != *pFRZCounterDrain) {
+		yield();
+	}
+}
+
+#if CONFIG_ZONE_INDEX
+// Withdraws the index after an update failed. Caller holds
+// malloc_zone_index_lock.
+static void
+malloc_zone_index_invalidate_while_locked(void)
+{
+	struct radix_ctree *tree = malloc_zone_index_tree;
+
+	malloc_zone_index_failed = true;
+	os_atomic_store(&malloc_zone_index_tree, NULL, release);
+	malloc_frz_drain();
+	if (tree) {
+		radix_ctree_destroy(tree);
+	}
+}
+
+void
+malloc_zone_index_insert(malloc_zone_t *zone, vm_address_t addr, vm_size_t size)
+{
+	_malloc_lock_lock(&malloc_zone_index_lock);
+
+	if (malloc_zone_index_failed) {
+		goto out;
+	}
+
+	unsigned slot;
+	for (slot = 0; slot < MALLOC_ZONE_INDEX_MAX_OWNERS; slot++) {
+		if (malloc_zone_index_owners[slot] == zone) {
+			break;
+		}
+	}
+	if (slot == MALLOC_ZONE_INDEX_MAX_OWNERS) {
+		// Not a registered zone, or one that didn't get a slot.
+		goto out;
+	}
+
+	struct radix_ctree *tree = malloc_zone_index_tree;
+	if (!tree) {
+		tree = radix_ctree_create();
+		if (!tree) {
+			malloc_zone_index_invalidate_while_locked();
+			goto out;
+		}
+	}
+	if (!radix_ctree_insert(tree, MALLOC_ZONE_INDEX_KEY(addr), size, slot)) {
+		if (tree != malloc_zone_index_tree) {
+			radix_ctree_destroy(tree);
+		}
+		malloc_zone_index_invalidate_while_locked();
+		goto out;
+	}
+	if (tree != malloc_zone_index_tree) {
+		os_atomic_store(&malloc_zone_index_tree, tree, release);
+	}
+
+out:
+	_malloc_lock_unlock(&malloc_zone_index_lock);
+}
+
+void
+malloc_zone_index_remove(vm_address_t addr, vm_size_t size)
+{
+	_malloc_lock_lock(&malloc_zone_index_lock);
+
+	struct radix_ctree *tree = malloc_zone_index_tree;
+	if (!tree || radix_ctree_lookup(tree, MALLOC_ZONE_INDEX_KEY(addr)) == radix_tree_invalid_value) {
+		goto out;
+	}
+	if (!radix_ctree_delete(tree, MALLOC_ZONE_INDEX_KEY(addr), size)) {
+		malloc_zone_index_invalidate_while_locked();
+	}
+
+out:
+	_malloc_lock_unlock(&malloc_zone_index_lock);
+}
+#endif // CONFIG_ZONE_INDEX
+
 void
 malloc_error_break(void)
 {
@@ -712,6 +906,21 @@ malloc_zone_register_while_locked(malloc_zone_t *zone)
 	malloc_zones[malloc_num_zones] = zone;
 	OSAtomicIncrement32Barrier(&malloc_num_zones);
 
+#if CONFIG_ZONE_INDEX
+	/* The zone in malloc_zones[0] is always probed first by
+	 * find_registered_zone(), so only the zones after it get an index slot. */
+	if (malloc_num_zones > 1) {
+		_malloc_lock_lock(&malloc_zone_index_lock);
+		for (i = 0; i < MALLOC_ZONE_INDEX_MAX_OWNERS; i++) {
+			if (!malloc_zone_index_owners[i]) {
+				malloc_zone_index_owners[i] = zone;
+				break;
+			}
+		}
+		_malloc_lock_unlock(&malloc_zone_index_lock);
+	}
+#endif // CONFIG_ZONE_INDEX
+
 	/* Finally, now that the zone is registered, disallow write access to the
 	 * malloc_zones array */
 	mprotect(malloc_zones, protect_size, PROT_READ);
@@ -929,6 +1138,9 @@ _malloc_initialize(void *context __unused)
 	nano_common_configure();
 	
 	malloc_zone_t *helper_zone = create_scalable_zone(0, malloc_debug_flags);
+#if CONFIG_THREAD_CACHE
+	thread_cache_enable((szone_t *)helper_zone, thread_cache_max_bytes);
+#endif // CONFIG_THREAD_CACHE
 
 	if (_malloc_engaged_nano == NANO_V2) {
 		zone = nanov2_create_zone(helper_zone, malloc_debug_flags);
@@ -950,6 +1162,9 @@ _malloc_initialize(void *context __unused)
 	}
 #else
 	zone = create_scalable_zone(0, malloc_debug_flags);
+#if CONFIG_THREAD_CACHE
+	thread_cache_enable((szone_t *)zone, thread_cache_max_bytes);
+#endif // CONFIG_THREAD_CACHE
 	malloc_zone_register_while_locked(zone);
 	malloc_set_zone_name(zone, DEFAULT_MALLOC_ZONE_STRING);
 #endif
@@ -1224,6 +1439,14 @@ set_flags_from_environment(void)
 			malloc_report(ASL_LEVEL_INFO, "recording malloc and VM allocation stacks to disk using standard recorder\n");
 		}
 		stack_logging_enable_logging = 1;
+		if (getenv("MallocStackLoggingBuffered")) {
+			if (stack_logging_mode == stack_logging_mode_all || stack_logging_mode == stack_logging_mode_malloc) {
+				stack_logging_buffered = 1;
+				malloc_report(ASL_LEVEL_INFO, "staging stack logs in per-thread buffers\n");
+			} else {
+				malloc_report(ASL_LEVEL_INFO, "MallocStackLoggingBuffered ignored; only supported for full and malloc modes\n");
+			}
+		}
 		if (stack_logging_dontcompact) {
 			if (stack_logging_mode == stack_logging_mode_all || stack_logging_mode == stack_logging_mode_malloc) {
 				malloc_report(
@@ -1364,6 +1587,28 @@ set_flags_from_environment(void)
 		}
 	}
 #endif // CONFIG_RECIRC_DEPOT
+
+#if CONFIG_THREAD_CACHE
+	flag = getenv("MallocThreadCache");
+	if (flag) {
+		int value = (int)strtol(flag, NULL, 0);
+		thread_cache_max_bytes = value ? TCACHE_DEFAULT_MAX_BYTES : 0;
+
+		flag = getenv("MallocThreadCacheBytes");
+		if (flag && thread_cache_max_bytes) {
+			long bytes = strtol(flag, NULL, 0);
+			if (bytes <= 0) {
+				malloc_report(ASL_LEVEL_ERR, "MallocThreadCacheBytes must be positive - ignored.\n");
+			} else if (bytes > TCACHE_MAX_BYTES_LIMIT) {
+				thread_cache_max_bytes = TCACHE_MAX_BYTES_LIMIT;
+				malloc_report(ASL_LEVEL_INFO, "Thread cache limited to %d bytes per thread\n", TCACHE_MAX_BYTES_LIMIT);
+			} else {
+				thread_cache_max_bytes = (size_t)bytes;
+			}
+		}
+	}
+#endif // CONFIG_THREAD_CACHE
+
 	if (getenv("MallocHelp")) {
 		malloc_report(ASL_LEVEL_INFO,
 				"environment variables that can be set for debug:\n"
@@ -1374,6 +1619,7 @@ set_flags_from_environment(void)
 				"- MallocStackLogging to record all stacks.  Tools like leaks can then be applied\n"
 				"- MallocStackLoggingNoCompact to record all stacks.  Needed for malloc_history\n"
 				"- MallocStackLoggingDirectory to set location of stack logs, which can grow large; default is /tmp\n"
+				"- MallocStackLoggingBuffered to stage stack logs per thread and write them from a background thread\n"
 				"- MallocScribble to detect writing on free blocks and missing initializers:\n"
 				"  0x55 is written upon free and 0xaa is written on allocation\n"
 				"- MallocCheckHeapStart <n> to start checking the heap after <n> operations\n"
@@ -1384,6 +1630,14 @@ set_flags_from_environment(void)
 				"  MallocCorruptionAbort is always set on 64-bit processes\n"
 				"- MallocErrorAbort to abort on any malloc error, including out of memory\n"\
 				"- MallocTracing to emit kdebug trace points on malloc entry points\n"\
+				"- MallocThreadCache <b> to cache freed tiny and small blocks per thread if <b> is non-zero\n"\
+				"- MallocThreadCacheBytes <n> to limit each thread's cache to <n> bytes (default 128KB)\n"\
+				"- MallocScavenger <b> to madvise free memory from a background thread if <b> is non-zero\n"\
+				"- MallocScavengerInterval <ms> to run the scavenger every <ms> milliseconds (default 100)\n"\
+				"- MallocScavengerDecay <ms> to leave freed memory alone for <ms> milliseconds (default 1000)\n"\
+				"- MallocScavengerTickBytes <n> to madvise at most <n> bytes per scavenger pass (default 4MB)\n"\
+				"- MallocScavengerTickTime <us> to limit each scavenger pass to <us> microseconds (default 500)\n"\
+				"- MallocLargePages <b> to align large regions for large page mappings and madvise whole large pages if <b> is non-zero\n"\
 				"- MallocHelp - this help!\n");
 	}
 }
@@ -1757,17 +2011,20 @@ malloc_zone_unregister(malloc_zone_t *z)
 
 		mprotect(malloc_zones, protect_size, PROT_READ);
 
-		// Exchange the roles of the FRZ counters. The counter that has captured the number of threads presently
-		// executing *inside* find_regiatered_zone is swapped with the counter drained to zero last time through.
-		// The former is then allowed to drain to zero while this thread yields.
-		int32_t volatile *p = pFRZCounterLive;
-		pFRZCounterLive = pFRZCounterDrain;
-		pFRZCounterDrain = p;
-		OSMemoryBarrier(); // Full memory barrier
-
-		while (0 != *pFRZCounterDrain) {
-			yield();
+		_malloc_lock_lock(&malloc_zone_index_lock);
+#if CONFIG_ZONE_INDEX
+		// Retire the zone's index slot. Any ranges still pointing at it are
+		// ignored by find_registered_zone() and removed when its regions are
+		// deallocated.
+		for (unsigned slot = 0; slot < MALLOC_ZONE_INDEX_MAX_OWNERS; slot++) {
+			if (malloc_zone_index_owners[slot] == z) {
+				malloc_zone_index_owners[slot] = NULL;
+				break;
+			}
 		}
+#endif // CONFIG_ZONE_INDEX
+		malloc_frz_drain();
+		_malloc_lock_unlock(&malloc_zone_index_lock);
 
 		MALLOC_UNLOCK();
 
@@ -2478,6 +2735,23 @@ malloc_zone_statistics(malloc_zone_t *zone, malloc_statistics_t *stats)
 	}
 }
 
+boolean_t
+malloc_zone_telemetry(malloc_zone_t *zone, malloc_zone_telemetry_t *telemetry)
+{
+	if (zone->version < 11 || !zone->introspect->telemetry) { // Version must be >= 11 to look at telemetry
+		return false;
+	}
+	// The size of the structure depends on the version, so only clear a
+	// version we know.
+	if (telemetry->version != MALLOC_ZONE_TELEMETRY_VERSION) {
+		return false;
+	}
+
+	memset(telemetry, 0, sizeof(*telemetry));
+	telemetry->version = MALLOC_ZONE_TELEMETRY_VERSION;
+	return zone->introspect->telemetry(zone, telemetry);
+}
+
 void
 malloc_zone_log(malloc_zone_t *zone, void *address)
 {
@@ -2533,6 +2807,12 @@ _malloc_lock_all(void (*callout)(void))
 {
 	unsigned index = 0;
 	MALLOC_LOCK();
+#if CONFIG_SCAVENGER
+	// The scavenger takes zone locks, and through them
+	// malloc_zone_index_lock, while holding its own lock.
+	malloc_scavenger_lock();
+#endif
+	_malloc_lock_lock(&malloc_zone_index_lock);
 	while (index < malloc_num_zones) {
 		malloc_zone_t *zone = malloc_zones[index++];
 		zone->introspect->force_lock(zone);
@@ -2549,6 +2829,10 @@ _malloc_unlock_all(void (*callout)(void))
 		malloc_zone_t *zone = malloc_zones[index++];
 		zone->introspect->force_unlock(zone);
 	}
+	_malloc_lock_unlock(&malloc_zone_index_lock);
+#if CONFIG_SCAVENGER
+	malloc_scavenger_unlock();
+#endif
 	MALLOC_UNLOCK();
 }
 
@@ -2557,6 +2841,8 @@ _malloc_reinit_lock_all(void (*callout)(void))
 {
 	unsigned index = 0;
 	callout();
+	// Zones may free regions, and so update the zone index, in reinit_lock.
+	_malloc_lock_init(&malloc_zone_index_lock);
 	while (index < malloc_num_zones) {
 		malloc_zone_t *zone = malloc_zones[index++];
 		if (zone->version < 9) { // Version must be >= 9 to look at reinit_lock
@@ -2589,6 +2875,15 @@ _malloc_fork_parent(void)
 void
 _malloc_fork_child(void)
 {
+	// Threads that were inside find_registered_zone() did not survive the
+	// fork, so nothing can be holding either FRZ counter.
+	counterAlice = counterBob = 0;
+
+#if CONFIG_SCAVENGER
+	// Also reinitializes the scavenger lock.
+	malloc_scavenger_fork_child();
+#endif
+
 #if CONFIG_NANOZONE
 	if (_malloc_initialize_pred) {
 		if (_malloc_engaged_nano == NANO_V2) {
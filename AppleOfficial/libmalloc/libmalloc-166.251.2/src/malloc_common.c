@@ -110,4 +110,56 @@ malloc_common_value_for_key_copy(const char *src, const char *key,
 	return NULL;
 }
 
+// Restores the max-heap property for the subtree of ptrs[0..count) rooted at
+// 'root'.
+static void
+malloc_common_sift_down(void **ptrs, unsigned root, unsigned count)
+{
+	void *value = ptrs[root];
+	unsigned child;
+
+	while ((child = 2 * root + 1) < count) {
+		if (child + 1 < count &&
+				(uintptr_t)ptrs[child] < (uintptr_t)ptrs[child + 1]) {
+			child++;
+		}
+		if ((uintptr_t)value >= (uintptr_t)ptrs[child]) {
+			break;
+		}
+		ptrs[root] = ptrs[child];
+		root = child;
+	}
+	ptrs[root] = value;
+}
+
+// Sorts an array of pointers into ascending address order, in place. Batch
+// free uses this so that it can visit each region or block once, however the
+// caller ordered the array. This is a heapsort: it neither recurses nor
+// allocates, and it is O(n log n) in the worst case. Arrays that are already
+// sorted, which is typical for blocks that came from batch malloc, are
+// detected and left alone.
+void
+malloc_common_sort_pointers(void **ptrs, unsigned count)
+{
+	unsigned i;
 
+	for (i = 1; i < count; i++) {
+		if ((uintptr_t)ptrs[i - 1] > (uintptr_t)ptrs[i]) {
+			break;
+		}
+	}
+	if (i >= count) {
+		return;
+	}
+
+	// Build a max-heap, then repeatedly move its root to the end.
+	for (i = count / 2; i-- > 0; ) {
+		malloc_common_sift_down(ptrs, i, count);
+	}
+	for (i = count - 1; i > 0; i--) {
+		void *tmp = ptrs[0];
+		ptrs[0] = ptrs[i];
+		ptrs[i] = tmp;
+		malloc_common_sift_down(ptrs, 0, i);
+	}
+}
@@ -40,4 +40,8 @@ const char *
 malloc_common_value_for_key_copy(const char *src, const char *key,
 		 char *bufp, size_t maxlen);
 
+MALLOC_NOEXPORT
+void
+malloc_common_sort_pointers(void **ptrs, unsigned count);
+
 #endif // __MALLOC_COMMON_H
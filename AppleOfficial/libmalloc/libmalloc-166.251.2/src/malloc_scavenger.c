@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include "internal.h"
+
+#include <pthread.h>
+#include <pthread/qos.h>
+
+/*
+ * Background incremental scavenger.
+ *
+ * Without the scavenger, free pages are madvised on the free path: the tiny
+ * and small allocators scan a region as it is recirculated to the depot and
+ * madvise every page that a depot free completes, and Nano V2 madvises a
+ * block as soon as its last slot is freed (under the default "immediate"
+ * policy). That puts system calls on the free path and throws away pages that
+ * are often about to be reused.
+ *
+ * When the scavenger is enabled those paths only record when the memory was
+ * freed. Tiny and small stamp the region trailer with a deadline of now plus
+ * the decay time, refreshed on every depot free, so a region is left alone
+ * until it has been quiet for the whole decay period. Nano V2 runs with the
+ * "background" madvise policy, which leaves empty blocks in SLOT_CAN_MADVISE;
+ * the scavenger stamps each one the first time it sees it and madvises it on
+ * a later pass once the stamp is older than the decay time.
+ *
+ * A single background QoS thread wakes every interval_ms and gives each
+ * registered zone a turn, starting with a different zone each time, until the
+ * pass has madvised tick_bytes or run for tick_us. Zones resume where they
+ * left off, so a large heap is covered over several passes rather than in one
+ * long stall.
+ *
+ * The registry lock is held for the whole pass, which keeps a zone from being
+ * destroyed under the scavenger. It is ordered before every zone lock and is
+ * taken by _malloc_fork_prepare() ahead of them. The thread does not survive
+ * fork(); the child disables the scavenger so that the allocators go back to
+ * madvising on the free path.
+ */
+
+static const char scavenger_env[] = "MallocScavenger";
+static const char scavenger_bootarg[] = "malloc_scavenger";
+static const char scavenger_interval_env[] = "MallocScavengerInterval";
+static const char scavenger_decay_env[] = "MallocScavengerDecay";
+static const char scavenger_tick_bytes_env[] = "MallocScavengerTickBytes";
+static const char scavenger_tick_time_env[] = "MallocScavengerTickTime";
+
+malloc_scavenger_config_t malloc_scavenger_config = {
+	.enabled = FALSE,
+	.interval_ms = SCAVENGER_DEFAULT_INTERVAL_MS,
+	.decay_ms = SCAVENGER_DEFAULT_DECAY_MS,
+	.tick_bytes = SCAVENGER_DEFAULT_TICK_BYTES,
+	.tick_us = SCAVENGER_DEFAULT_TICK_US,
+};
+
+typedef struct scavenger_client_s {
+	void *ctx;
+	malloc_scavenger_fn_t fn;
+} scavenger_client_t;
+
+static _malloc_lock_s scavenger_lock = _MALLOC_LOCK_INIT;
+static scavenger_client_t scavenger_clients[SCAVENGER_MAX_CLIENTS];
+static unsigned scavenger_num_clients;
+static unsigned scavenger_next_client;
+static malloc_scavenger_statistics_t scavenger_stats;
+static os_once_t scavenger_thread_pred;
+static mach_timebase_info_data_t scavenger_timebase;
+
+static uint64_t
+scavenger_ns_to_abs(uint64_t ns)
+{
+	return ns * scavenger_timebase.denom / scavenger_timebase.numer;
+}
+
+// Parses a positive integer setting from the environment. Returns the value,
+// or 'current' if the variable is not set or is not valid.
+static uint64_t
+scavenger_env_value(const char *envp[], const char *name, uint64_t current)
+{
+	const char *flag = _simple_getenv(envp, name);
+	if (flag) {
+		const char *endp;
+		long value = malloc_common_convert_to_long(flag, &endp);
+		if (!*endp && value > 0) {
+			return (uint64_t)value;
+		}
+		malloc_report(ASL_LEVEL_ERR, "%s must be positive - ignored.\n", name);
+	}
+	return current;
+}
+
+// Called during libSystem initialization, before nanov2_init(), so that the
+// nano madvise policy can default to "background" when the scavenger is on.
+// Environment variables override boot arguments.
+void
+malloc_scavenger_init(const char *envp[], const char *bootargs)
+{
+	char value_buf[256];
+	const char *name = scavenger_env;
+	const char *flag = _simple_getenv(envp, scavenger_env);
+	if (!flag) {
+		flag = malloc_common_value_for_key_copy(bootargs, scavenger_bootarg,
+				value_buf, sizeof(value_buf));
+		name = scavenger_bootarg;
+	}
+	if (flag) {
+		const char *endp;
+		long value = malloc_common_convert_to_long(flag, &endp);
+		if (!*endp) {
+			malloc_scavenger_config.enabled = (value != 0);
+		} else {
+			malloc_report(ASL_LEVEL_ERR, "%s value (%s) invalid - ignored.\n",
+					name, flag);
+		}
+	}
+
+	malloc_scavenger_config.interval_ms = (uint32_t)MIN(UINT32_MAX,
+			scavenger_env_value(envp, scavenger_interval_env,
+			malloc_scavenger_config.interval_ms));
+	malloc_scavenger_config.decay_ms = (uint32_t)MIN(UINT32_MAX,
+			scavenger_env_value(envp, scavenger_decay_env,
+			malloc_scavenger_config.decay_ms));
+	malloc_scavenger_config.tick_bytes = (size_t)scavenger_env_value(envp,
+			scavenger_tick_bytes_env, malloc_scavenger_config.tick_bytes);
+	malloc_scavenger_config.tick_us = (uint32_t)MIN(UINT32_MAX,
+			scavenger_env_value(envp, scavenger_tick_time_env,
+			malloc_scavenger_config.tick_us));
+
+	mach_timebase_info(&scavenger_timebase);
+	malloc_scavenger_config.decay_abs = scavenger_ns_to_abs(
+			malloc_scavenger_config.decay_ms * NSEC_PER_MSEC);
+}
+
+static void
+scavenger_run_tick(void)
+{
+	_malloc_lock_assert_owner(&scavenger_lock);
+
+	uint64_t now = mach_absolute_time();
+	malloc_scavenger_tick_t tick = {
+		.now = now,
+		.deadline = now + scavenger_ns_to_abs(
+				malloc_scavenger_config.tick_us * NSEC_PER_USEC),
+		.bytes_left = malloc_scavenger_config.tick_bytes,
+		.exhausted = FALSE,
+	};
+
+	// Start with a different zone on each pass so that a zone with a lot of
+	// work to do cannot starve the ones after it.
+	unsigned count = scavenger_num_clients;
+	unsigned first = scavenger_next_client % count;
+	for (unsigned i = 0; i < count && !malloc_scavenger_tick_done(&tick); i++) {
+		scavenger_client_t *client = &scavenger_clients[(first + i) % count];
+		client->fn(client->ctx, &tick);
+	}
+	scavenger_next_client = first + 1;
+
+	scavenger_stats.ticks++;
+	if (tick.exhausted) {
+		scavenger_stats.budget_exhausted++;
+	}
+}
+
+static void *
+scavenger_thread(void *arg MALLOC_UNUSED)
+{
+	pthread_setname_np("com.apple.malloc.scavenger");
+
+	uint64_t interval = scavenger_ns_to_abs(
+			malloc_scavenger_config.interval_ms * NSEC_PER_MSEC);
+	for (;;) {
+		mach_wait_until(mach_absolute_time() + interval);
+
+		_malloc_lock_lock(&scavenger_lock);
+		if (malloc_scavenger_config.enabled && scavenger_num_clients) {
+			scavenger_run_tick();
+		}
+		_malloc_lock_unlock(&scavenger_lock);
+	}
+	return NULL;
+}
+
+static void
+scavenger_start_thread(void *context MALLOC_UNUSED)
+{
+	// pthread_create() maps the new thread's stack and pthread_t directly, so
+	// it is safe to call while the default zone is being created.
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_set_qos_class_np(&attr, QOS_CLASS_BACKGROUND, 0);
+	if (pthread_create(&thread, &attr, scavenger_thread, NULL)) {
+		malloc_report(ASL_LEVEL_ERR,
+				"Failed to start the scavenger thread, error: %d\n", errno);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+// Adds a zone to the set visited by the scavenger, starting the scavenger
+// thread the first time. Does nothing if the scavenger is not enabled.
+void
+malloc_scavenger_register(void *ctx, malloc_scavenger_fn_t fn)
+{
+	if (!malloc_scavenger_config.enabled) {
+		return;
+	}
+
+	_malloc_lock_lock(&scavenger_lock);
+	if (scavenger_num_clients < SCAVENGER_MAX_CLIENTS) {
+		scavenger_clients[scavenger_num_clients].ctx = ctx;
+		scavenger_clients[scavenger_num_clients].fn = fn;
+		scavenger_num_clients++;
+	} else {
+		malloc_report(ASL_LEVEL_INFO,
+				"Too many zones for the scavenger - zone %p not registered\n", ctx);
+	}
+	_malloc_lock_unlock(&scavenger_lock);
+
+	os_once(&scavenger_thread_pred, NULL, scavenger_start_thread);
+}
+
+// Removes a zone from the scavenger. Once this returns the scavenger will not
+// touch the zone again, so it is safe to tear it down.
+void
+malloc_scavenger_unregister(void *ctx)
+{
+	_malloc_lock_lock(&scavenger_lock);
+	for (unsigned i = 0; i < scavenger_num_clients; i++) {
+		if (scavenger_clients[i].ctx == ctx) {
+			scavenger_num_clients--;
+			scavenger_clients[i] = scavenger_clients[scavenger_num_clients];
+			break;
+		}
+	}
+	_malloc_lock_unlock(&scavenger_lock);
+}
+
+// Called by a zone's scavenge function for each region or block that it
+// madvised. Only ever called on the scavenger thread, with the registry lock
+// held.
+void
+malloc_scavenger_tick_charge(malloc_scavenger_tick_t *tick,
+		malloc_scavenger_kind_t kind, size_t bytes)
+{
+	tick->bytes_left -= MIN(bytes, tick->bytes_left);
+	if (kind == SCAVENGED_REGION) {
+		scavenger_stats.regions_scavenged++;
+	} else {
+		scavenger_stats.nano_blocks_scavenged++;
+	}
+	scavenger_stats.bytes_scavenged += bytes;
+}
+
+void
+malloc_scavenger_lock(void)
+{
+	_malloc_lock_lock(&scavenger_lock);
+}
+
+void
+malloc_scavenger_unlock(void)
+{
+	_malloc_lock_unlock(&scavenger_lock);
+}
+
+// The scavenger thread did not survive the fork, so nothing will scavenge in
+// the child. Switch the allocators back to madvising on the free path.
+// Regions and blocks that were already waiting for the scavenger stay dirty
+// until they are reused or released by pressure relief.
+void
+malloc_scavenger_fork_child(void)
+{
+	malloc_scavenger_config.enabled = FALSE;
+	scavenger_num_clients = 0;
+	_malloc_lock_init(&scavenger_lock);
+}
+
+boolean_t
+malloc_scavenger_statistics(malloc_scavenger_statistics_t *stats)
+{
+	if (!malloc_scavenger_config.enabled) {
+		return 0;
+	}
+
+	_malloc_lock_lock(&scavenger_lock);
+	*stats = scavenger_stats;
+	stats->clients = scavenger_num_clients;
+	_malloc_lock_unlock(&scavenger_lock);
+	return 1;
+}
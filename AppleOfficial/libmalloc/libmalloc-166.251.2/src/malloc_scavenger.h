@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef __MALLOC_SCAVENGER_H
+#define __MALLOC_SCAVENGER_H
+
+// Default time between scavenger passes, in milliseconds.
+#define SCAVENGER_DEFAULT_INTERVAL_MS 100
+
+// Default time that freed memory must stay unused before it is madvised, in
+// milliseconds.
+#define SCAVENGER_DEFAULT_DECAY_MS 1000
+
+// Default per-pass budgets: the number of bytes a pass may madvise and the
+// time, in microseconds, that it may spend doing so.
+#define SCAVENGER_DEFAULT_TICK_BYTES (4 * 1024 * 1024)
+#define SCAVENGER_DEFAULT_TICK_US 500
+
+// Maximum number of zones that can be registered with the scavenger.
+#define SCAVENGER_MAX_CLIENTS 16
+
+typedef struct malloc_scavenger_config_s {
+	// Set from MallocScavenger, or implied by a nano madvise policy of
+	// "background". Cleared in the child after fork().
+	boolean_t enabled;
+
+	// Set from MallocScavengerInterval.
+	uint32_t interval_ms;
+
+	// Set from MallocScavengerDecay.
+	uint32_t decay_ms;
+
+	// Set from MallocScavengerTickBytes.
+	size_t tick_bytes;
+
+	// Set from MallocScavengerTickTime.
+	uint32_t tick_us;
+
+	// decay_ms converted to mach_absolute_time() units.
+	uint64_t decay_abs;
+} malloc_scavenger_config_t;
+
+// State of a single scavenger pass, handed to each client in turn. Clients
+// must check malloc_scavenger_tick_done() between units of work and report
+// what they madvise with malloc_scavenger_tick_charge().
+struct malloc_scavenger_tick_s {
+	uint64_t now;			// mach_absolute_time() at the start of the pass
+	uint64_t deadline;		// mach_absolute_time() at which the pass must stop
+	size_t bytes_left;		// remaining madvise budget
+	boolean_t exhausted;	// the pass ran out of time or bytes
+};
+
+typedef enum {
+	SCAVENGED_REGION,
+	SCAVENGED_NANO_BLOCK,
+} malloc_scavenger_kind_t;
+
+typedef void (*malloc_scavenger_fn_t)(void *ctx, malloc_scavenger_tick_t *tick);
+
+MALLOC_NOEXPORT
+extern malloc_scavenger_config_t malloc_scavenger_config;
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_init(const char *envp[], const char *bootargs);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_register(void *ctx, malloc_scavenger_fn_t fn);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_unregister(void *ctx);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_tick_charge(malloc_scavenger_tick_t *tick,
+		malloc_scavenger_kind_t kind, size_t bytes);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_lock(void);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_unlock(void);
+
+MALLOC_NOEXPORT
+void
+malloc_scavenger_fork_child(void);
+
+static MALLOC_INLINE boolean_t
+malloc_scavenger_tick_done(malloc_scavenger_tick_t *tick)
+{
+	if (!tick->exhausted &&
+			(!tick->bytes_left || mach_absolute_time() >= tick->deadline)) {
+		tick->exhausted = TRUE;
+	}
+	return tick->exhausted;
+}
+
+// Called with the depot lock held when free pages of a depot region would
+// otherwise be madvised on the spot. If the scavenger is running, pushes the
+// region's madvise deadline out by the decay time and returns TRUE; the
+// caller must then leave the pages alone.
+static MALLOC_INLINE boolean_t
+malloc_scavenger_defer(region_trailer_t *node)
+{
+#if CONFIG_SCAVENGER
+	if (malloc_scavenger_config.enabled) {
+		node->scavenge_after = mach_absolute_time() +
+				malloc_scavenger_config.decay_abs;
+		return TRUE;
+	}
+#endif // CONFIG_SCAVENGER
+	return FALSE;
+}
+
+#endif // __MALLOC_SCAVENGER_H
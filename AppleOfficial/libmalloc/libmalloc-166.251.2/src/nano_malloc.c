@@ -1813,11 +1813,19 @@ nano_locked(nanozone_t *nanozone)
 	return _nano_locked(nanozone) || zone->introspect->zone_locked(zone);
 }
 
+static boolean_t
+nano_telemetry(nanozone_t *nanozone, malloc_zone_telemetry_t *telemetry)
+{
+	// Only the helper zone keeps telemetry.
+	return malloc_zone_telemetry(nanozone->helper_zone, telemetry);
+}
+
 static const struct malloc_introspection_t nano_introspect = {
 		(void *)nano_ptr_in_use_enumerator, (void *)nano_good_size, (void *)nanozone_check, (void *)nano_print, nano_log,
 		(void *)nano_force_lock, (void *)nano_force_unlock, (void *)nano_statistics, (void *)nano_locked, NULL, NULL, NULL,
 		NULL, /* Zone enumeration version 7 and forward. */
 		(void *)nano_reinit_lock, // reinit_lock version 9 and foward
+		(void *)nano_telemetry, // telemetry version 11 and forward
 }; // marked as const to spare the DATA section
 
 void
@@ -1872,7 +1880,7 @@ nano_create_zone(malloc_zone_t *helper_zone, unsigned debug_flags)
 	}
 
 	/* set up the basic_zone portion of the nanozone structure */
-	nanozone->basic_zone.version = 10;
+	nanozone->basic_zone.version = 11;
 	nanozone->basic_zone.size = (void *)nano_size;
 	nanozone->basic_zone.malloc = (debug_flags & MALLOC_DO_SCRIBBLE) ? (void *)nano_malloc_scribble : (void *)nano_malloc;
 	nanozone->basic_zone.calloc = (void *)nano_calloc;
@@ -37,14 +37,20 @@ static void nanov2_statistics(nanozonev2_t *nanozone, malloc_statistics_t *stats
 
 extern void *nanov2_allocate(nanozonev2_t *nanozone, size_t rounded_size,
 		boolean_t clear);
+extern unsigned nanov2_allocate_batch(nanozonev2_t *nanozone,
+		size_t rounded_size, void **results, unsigned count);
 extern void nanov2_free_to_block(nanozonev2_t *nanozone, void *ptr,
 		nanov2_size_class_t size_class);
+extern void nanov2_free_run_to_block(nanozonev2_t *nanozone, void **ptrs,
+		unsigned count, nanov2_size_class_t size_class);
 extern boolean_t nanov2_madvise_block(nanozonev2_t *nanozone,
 		nanov2_block_meta_t *block_metap, nanov2_block_t *blockp,
 		nanov2_size_class_t size_class);
 extern size_t nanov2_pointer_size(nanozonev2_t *nanozone, void *ptr,
 		boolean_t allow_inner);
 extern size_t nanov2_pressure_relief(nanozonev2_t *nanozone, size_t goal);
+extern void nanov2_scavenge(nanozonev2_t *nanozone,
+		malloc_scavenger_tick_t *tick);
 
 #if OS_VARIANT_RESOLVED
 extern boolean_t nanov2_allocate_new_region(nanozonev2_t *nanozone);
@@ -74,6 +80,7 @@ typedef enum {
 	NANO_MADVISE_IMMEDIATE = 0,
 	NANO_MADVISE_WARNING_PRESSURE,
 	NANO_MADVISE_CRITICAL_PRESSURE,
+	NANO_MADVISE_BACKGROUND,	// Left to the background scavenger
 } nanov2_madvise_policy_t;
 
 typedef struct nanov2_policy_config_s {
@@ -604,6 +611,7 @@ static const char madvise_policy_bootarg[] = "nanov2_madvise_policy";
 static const char madvise_immediate[] = "immediate";
 static const char madvise_warning[] = "warning";
 static const char madvise_critical[] = "critical";
+static const char madvise_background[] = "background";
 
 static const char single_arena_env[] = "MallocNanoSingleArena";
 static const char single_arena_bootarg[] = "nanov2_single_arena";
@@ -615,11 +623,23 @@ static const char size_class_blocks_env[] = "MallocNanoSizeClassBlocks";
 static const char size_class_blocks_bootarg[] = "nanov2_size_class_blocks";
 
 // Parse and set the madvise policy setting. If ptr is NULL, sets the default
-// policy.
+// policy, which is to leave empty blocks to the background scavenger if it is
+// enabled and to madvise them immediately otherwise. With large pages, empty
+// blocks are otherwise only madvised under memory pressure, so that freeing a
+// block does not split the arena's large page. Choosing the "background"
+// policy explicitly also enables the scavenger.
 static void
 nanov2_set_madvise_policy(const char *name, const char *ptr)
 {
 	nanov2_madvise_policy_t madvise_policy = NANO_MADVISE_IMMEDIATE;
+	if (mvm_large_pages_enabled) {
+		madvise_policy = NANO_MADVISE_WARNING_PRESSURE;
+	}
+#if CONFIG_SCAVENGER
+	if (malloc_scavenger_config.enabled) {
+		madvise_policy = NANO_MADVISE_BACKGROUND;
+	}
+#endif // CONFIG_SCAVENGER
 	if (ptr) {
 		if (!strncmp(ptr, madvise_immediate, sizeof(madvise_immediate) - 1)) {
 			madvise_policy = NANO_MADVISE_IMMEDIATE;
@@ -627,6 +647,11 @@ nanov2_set_madvise_policy(const char *name, const char *ptr)
 			madvise_policy = NANO_MADVISE_WARNING_PRESSURE;
 		} else if (!strncmp(ptr, madvise_critical, sizeof(madvise_critical) - 1)) {
 			madvise_policy = NANO_MADVISE_CRITICAL_PRESSURE;
+#if CONFIG_SCAVENGER
+		} else if (!strncmp(ptr, madvise_background, sizeof(madvise_background) - 1)) {
+			madvise_policy = NANO_MADVISE_BACKGROUND;
+			malloc_scavenger_config.enabled = TRUE;
+#endif // CONFIG_SCAVENGER
 		} else {
 			malloc_report(ASL_LEVEL_ERR,
 					"%s value (%s) invalid - ignored.\n", name, ptr);
@@ -1099,15 +1124,8 @@ nanov2_batch_malloc(nanozonev2_t *nanozone, size_t size, void **results,
 	unsigned allocated = 0;
 	size_t rounded_size = _nano_common_good_size(size);
 	if (rounded_size <= NANO_MAX_SIZE) {
-		while (allocated < count) {
-			void *ptr = nanov2_allocate(nanozone, rounded_size, FALSE);
-			if (!ptr) {
-				break;
-			}
-
-			*results++ = ptr;
-			allocated++;
-		}
+		allocated = nanov2_allocate_batch(nanozone, rounded_size, results,
+				count);
 		if (allocated == count) {
 			// Allocated everything.
 			return allocated;
@@ -1116,19 +1134,68 @@ nanov2_batch_malloc(nanozonev2_t *nanozone, size_t size, void **results,
 
 	// We could not allocate everything. Let the helper zone do the rest.
 	return allocated + nanozone->helper_zone->batch_malloc(
-			nanozone->helper_zone, size, results, count - allocated);
+			nanozone->helper_zone, size, results + allocated, count - allocated);
 }
 
+// Frees a batch of pointers. The array is sorted by address so that pointers
+// that share a block are adjacent, and each such run is pushed onto its
+// block's free list with a single update of the block's metadata. Pointers
+// that do not belong to Nano are left in the array and handed to the helper
+// zone's batch_free at the end; the Nano pointers are replaced by NULL.
 void
 nanov2_batch_free(nanozonev2_t *nanozone, void **to_be_freed, unsigned count)
 {
-	if (count) {
-		while (count--) {
-			void *ptr = to_be_freed[count];
-			if (ptr) {
-				nanov2_free(nanozone, ptr);
-			}
+	void *run[NANOV2_BATCH_FREE_RUN_MAX];
+	nanov2_block_t *run_block = NULL;
+	nanov2_size_class_t run_size_class = 0;
+	unsigned run_count = 0;
+	boolean_t helper_has_work = FALSE;
+
+	if (!count) {
+		return;
+	}
+
+	malloc_common_sort_pointers(to_be_freed, count);
+	for (unsigned i = 0; i < count; i++) {
+		void *ptr = to_be_freed[i];
+		if (!ptr) {
+			continue;
+		}
+
+		// nanov2_pointer_size() also rejects slots that are already free,
+		// including ones freed earlier in this batch, because their guards
+		// are set below before the run is pushed.
+		size_t size = nanov2_has_valid_signature(ptr) ?
+				nanov2_pointer_size(nanozone, ptr, FALSE) : 0;
+		if (!size) {
+			helper_has_work = TRUE;
+			continue;
+		}
+
+		nanov2_block_t *blockp = nanov2_block_address_for_ptr(ptr);
+		if (run_count && (blockp != run_block ||
+				run_count == NANOV2_BATCH_FREE_RUN_MAX)) {
+			nanov2_free_run_to_block(nanozone, run, run_count, run_size_class);
+			run_count = 0;
+		}
+		if (os_unlikely(nanozone->debug_flags & MALLOC_DO_SCRIBBLE)) {
+			memset(ptr, SCRABBLE_BYTE, size);
 		}
+		nanov2_free_slot_t *slotp = (nanov2_free_slot_t *)ptr;
+		os_atomic_store(&slotp->double_free_guard,
+				nanozone->slot_freelist_cookie ^ (uintptr_t)ptr, relaxed);
+		run_block = blockp;
+		run_size_class = nanov2_size_class_from_size(size);
+		run[run_count++] = ptr;
+		to_be_freed[i] = NULL;
+	}
+	if (run_count) {
+		nanov2_free_run_to_block(nanozone, run, run_count, run_size_class);
+	}
+
+	if (helper_has_work) {
+		nanozone->helper_zone->batch_free(nanozone->helper_zone, to_be_freed,
+				count);
 	}
 }
 #endif // OS_VARIANT_RESOLVED
@@ -1149,10 +1216,12 @@ size_t
 nanov2_pressure_relief(nanozonev2_t *nanozone, size_t goal)
 {
 	if (nanov2_madvise_policy != NANO_MADVISE_WARNING_PRESSURE
-			&& nanov2_madvise_policy != NANO_MADVISE_CRITICAL_PRESSURE) {
+			&& nanov2_madvise_policy != NANO_MADVISE_CRITICAL_PRESSURE
+			&& nanov2_madvise_policy != NANO_MADVISE_BACKGROUND) {
 		// In the current implementation, we only get called on warning, so
 		// act if the policy is either warning or critical. We would need to
-		// add a new zone entry point to respond to critical.
+		// add a new zone entry point to respond to critical. Blocks waiting
+		// for the background scavenger are released early under pressure.
 		return 0;
 	}
 	const char *name = nanozone->basic_zone.zone_name;
@@ -1209,6 +1278,128 @@ done:
 
 	return total;
 }
+
+#if CONFIG_SCAVENGER
+// Stamp left by the scavenger in the first slot of an empty block the first
+// time it sees the block in state SLOT_CAN_MADVISE. The key mixes in the
+// block's generation count, so any allocation from the block, or a race with
+// one, invalidates the stamp.
+typedef struct {
+	uint64_t key;
+	uint64_t first_seen;
+} nanov2_scavenge_stamp_t;
+
+static MALLOC_INLINE uint64_t
+nanov2_scavenge_stamp_key(nanozonev2_t *nanozone, nanov2_block_t *blockp,
+		nanov2_block_meta_t meta)
+{
+	return nanozone->slot_freelist_cookie ^ (uintptr_t)blockp ^ meta.gen_count;
+}
+
+// Visits every block in an arena that is waiting to be madvised. Blocks that
+// have been empty for the decay time are madvised; blocks seen for the first
+// time are stamped with the current time. The block is put in state
+// SLOT_MADVISING while the stamp is written so that no allocation can race
+// with it.
+//
+// This function must be called with the zone's madvise_lock held
+static void
+nanov2_scavenge_arena(nanozonev2_t *nanozone, nanov2_arena_t *arena,
+		malloc_scavenger_tick_t *tick)
+{
+	_malloc_lock_assert_owner(&nanozone->madvise_lock);
+
+	nanov2_meta_index_t metablock_meta_index = nanov2_metablock_meta_index(nanozone);
+	nanov2_arena_metablock_t *meta_blockp =
+			nanov2_metablock_address_for_ptr(nanozone, arena);
+	nanov2_block_meta_t *block_metap = &meta_blockp->arena_block_meta[0];
+	for (nanov2_meta_index_t i = 0; i < NANOV2_BLOCKS_PER_ARENA;
+			i++, block_metap++) {
+		if (i == metablock_meta_index) {
+			continue;
+		}
+		nanov2_block_meta_t meta = os_atomic_load(block_metap, relaxed);
+		if (meta.next_slot != SLOT_CAN_MADVISE) {
+			continue;
+		}
+
+		nanov2_block_t *blockp = nanov2_block_address_from_meta_index(
+				nanozone, arena, i);
+		nanov2_scavenge_stamp_t *stampp = (nanov2_scavenge_stamp_t *)blockp;
+		if (stampp->key == nanov2_scavenge_stamp_key(nanozone, blockp, meta)) {
+			if (tick->now - stampp->first_seen >= malloc_scavenger_config.decay_abs
+					&& nanov2_madvise_block(nanozone, block_metap, blockp,
+					nanov2_size_class_for_ptr(nanozone, blockp))) {
+				malloc_scavenger_tick_charge(tick, SCAVENGED_NANO_BLOCK,
+						NANOV2_BLOCK_SIZE);
+			}
+			continue;
+		}
+
+		nanov2_block_meta_t busy_meta = meta;
+		busy_meta.next_slot = SLOT_MADVISING;
+		busy_meta.gen_count = meta.gen_count + 1;
+		if (!os_atomic_cmpxchgv(block_metap, meta, busy_meta, &meta, relaxed)) {
+			// Lost a race with an allocation. The block is back in use.
+			continue;
+		}
+
+		nanov2_block_meta_t idle_meta = busy_meta;
+		idle_meta.next_slot = SLOT_CAN_MADVISE;
+		idle_meta.gen_count = busy_meta.gen_count + 1;
+		stampp->key = nanov2_scavenge_stamp_key(nanozone, blockp, idle_meta);
+		stampp->first_seen = tick->now;
+		if (!os_atomic_cmpxchgv(block_metap, busy_meta, idle_meta, &meta,
+				relaxed)) {
+			// This should not happen since we should have exclusive interest
+			// in this block.
+			malloc_zone_error(nanozone->debug_flags, false,
+					"Failed when changing state from MADVISING to CAN_MADVISE, "
+					"block_metap = %p, blockp = %p\n", block_metap, blockp);
+		}
+	}
+}
+
+// Returns the arena after 'arena', wrapping from the last active arena of the
+// last region back to the first arena of the first region.
+static nanov2_arena_t *
+nanov2_scavenge_next_arena(nanozonev2_t *nanozone, nanov2_arena_t *arena)
+{
+	nanov2_region_t *region = nanov2_region_address_for_ptr(arena);
+	arena++;
+	if (arena < nanov2_limit_arena_for_region(nanozone, region)) {
+		return arena;
+	}
+	region = nanov2_next_region_for_region(nanozone, region);
+	if (!region) {
+		region = nanozone->first_region_base;
+	}
+	return nanov2_first_arena_for_region(region);
+}
+
+// Called on the scavenger thread when the madvise policy is
+// NANO_MADVISE_BACKGROUND. Scans arenas one at a time, starting where the
+// previous pass stopped, until the tick's budget runs out or every arena has
+// been visited once. The madvise_lock is taken per arena, as in
+// nanov2_pressure_relief(), so that frees are not held up for long.
+void
+nanov2_scavenge(nanozonev2_t *nanozone, malloc_scavenger_tick_t *tick)
+{
+	nanov2_arena_t *start = nanozone->scavenge_arena;
+	if (!start) {
+		start = nanov2_first_arena_for_region(nanozone->first_region_base);
+	}
+
+	nanov2_arena_t *arena = start;
+	do {
+		_malloc_lock_lock(&nanozone->madvise_lock);
+		nanov2_scavenge_arena(nanozone, arena, tick);
+		_malloc_lock_unlock(&nanozone->madvise_lock);
+		arena = nanov2_scavenge_next_arena(nanozone, arena);
+	} while (arena != start && !malloc_scavenger_tick_done(tick));
+	nanozone->scavenge_arena = arena;
+}
+#endif // CONFIG_SCAVENGER
 #endif // OS_VARIANT_RESOLVED
 
 #pragma mark -
@@ -1706,6 +1897,70 @@ nanov2_statistics(nanozonev2_t *nanozone, malloc_statistics_t *stats)
 	}
 }
 
+// Nano blocks have no magazines, and the helper zone fills in everything but
+// the nano size classes.
+static boolean_t
+nanov2_telemetry(nanozonev2_t *nanozone, malloc_zone_telemetry_t *telemetry)
+{
+	malloc_allocator_telemetry_t *nt = &telemetry->nano;
+	nanov2_region_t *region;
+	nanov2_arena_t *arena;
+	nanov2_meta_index_t metadata_block_index = nanov2_metablock_meta_index(nanozone);
+
+	if (!malloc_zone_telemetry(nanozone->helper_zone, telemetry)) {
+		return false;
+	}
+
+	nt->num_size_classes = NANO_SIZE_CLASSES;
+	for (nanov2_size_class_t size_class = 0; size_class < NANO_SIZE_CLASSES;
+			size_class++) {
+		nt->size_classes[size_class].size = nanov2_size_from_size_class(size_class);
+		nt->bytes_madvised += NANOV2_BLOCK_SIZE *
+				nanozone->statistics.size_class_statistics[size_class].madvised_blocks;
+	}
+
+	// Same walk as nanov2_statistics(). Free slots are counted only for
+	// blocks that are in use, including the bump allocation space.
+	for (region = nanozone->first_region_base; region;
+			region = nanov2_next_region_for_region(nanozone, region)) {
+		for (arena = nanov2_first_arena_for_region(region);
+				arena < nanov2_limit_arena_for_region(nanozone, region);
+				arena++) {
+			nanov2_arena_metablock_t *meta_block =
+					nanov2_metablock_address_for_ptr(nanozone, arena);
+			for (nanov2_meta_index_t i = 0; i < NANOV2_BLOCKS_PER_ARENA; i++) {
+				if (i == metadata_block_index) {
+					continue;
+				}
+
+				nanov2_size_class_t size_class =
+						nanov2_size_class_for_meta_index(nanozone, i);
+				nanov2_block_meta_t meta = os_atomic_load(
+						&meta_block->arena_block_meta[i], relaxed);
+				int slots_in_use;
+				switch (meta.next_slot) {
+				case SLOT_NULL:
+				case SLOT_CAN_MADVISE:
+				case SLOT_MADVISING:
+				case SLOT_MADVISED:
+					continue;
+				case SLOT_FULL:
+					slots_in_use = slots_by_size_class[size_class];
+					break;
+				case SLOT_BUMP:
+				default:
+					slots_in_use = slots_by_size_class[size_class] - meta.free_count - 1;
+					break;
+				}
+				nt->size_classes[size_class].blocks_in_use += slots_in_use;
+				nt->size_classes[size_class].blocks_free +=
+						slots_by_size_class[size_class] - slots_in_use;
+			}
+		}
+	}
+	return true;
+}
+
 static const struct malloc_introspection_t nanov2_introspect = {
 	.enumerator = 	(void *)nanov2_ptr_in_use_enumerator,
 	.good_size =	(void *)nanov2_good_size,
@@ -1724,6 +1979,7 @@ static const struct malloc_introspection_t nanov2_introspect = {
 	.enumerate_unavailable_without_blocks = NULL,
 #endif // __BLOCKS__
 	.reinit_lock = 	(void *)nanov2_reinit_lock,
+	.telemetry =	(void *)nanov2_telemetry,
 };
 
 #endif // OS_VARIANT_NOTRESOLVED
@@ -1945,6 +2201,31 @@ nanov2_allocate_new_region(nanozonev2_t *nanozone)
 
 #if OS_VARIANT_RESOLVED
 
+// Called when an attempt to allocate from a block failed to update the block's
+// meta data because the block was being, or had been, madvised. If it has been
+// madvised, we need to redo the madvise because we may have touched the block
+// when reading the next pointer in the freelist.
+static void
+nanov2_remadvise_after_race(nanozonev2_t *nanozone,
+		nanov2_block_meta_t *block_metap, nanov2_block_meta_t meta)
+{
+	if (meta.next_slot == SLOT_CAN_MADVISE ||
+			meta.next_slot == SLOT_MADVISING ||
+			meta.next_slot == SLOT_MADVISED) {
+		_malloc_lock_lock(&nanozone->madvise_lock);
+		if (meta.next_slot == SLOT_MADVISED) {
+			nanov2_block_t *blockp = nanov2_block_address_from_meta_ptr(nanozone,
+					block_metap);
+			if (mvm_madvise_free(nanozone, nanov2_region_address_for_ptr(blockp),
+					(uintptr_t)blockp, (uintptr_t)(blockp + 1), NULL, FALSE)) {
+				malloc_zone_error(0, false,
+						"Failed to remadvise block at blockp: %p, error: %d\n", blockp, errno);
+			}
+		}
+		_malloc_lock_unlock(&nanozone->madvise_lock);
+	}
+}
+
 // Allocates memory from the block that corresponds to a given block meta data
 // pointer. The memory is taken from the free list if possible, or from the
 // unused region of the block if not. If the block is no longer in use or is
@@ -2002,25 +2283,7 @@ again:
 	// Write the updated meta data; try again if we raced with another thread.
 	if (!os_atomic_cmpxchgv(block_metap, old_meta_view.meta, new_meta,
 				&old_meta_view.meta, dependency)) {
-		if (old_meta_view.meta.next_slot == SLOT_CAN_MADVISE ||
-				old_meta_view.meta.next_slot == SLOT_MADVISING ||
-				old_meta_view.meta.next_slot == SLOT_MADVISED) {
-			_malloc_lock_lock(&nanozone->madvise_lock);
-			if (old_meta_view.meta.next_slot == SLOT_MADVISED) {
-				// We raced against another thread madvising this block. We need
-				// to redo the madvise because we may have touched it when
-				// reading the next pointer in the freelist.
-				if (!blockp) {
-					blockp = nanov2_block_address_from_meta_ptr(nanozone, block_metap);
-				}
-				if (mvm_madvise_free(nanozone, nanov2_region_address_for_ptr(blockp),
-						(uintptr_t)blockp, (uintptr_t)(blockp + 1), NULL, FALSE)) {
-					malloc_zone_error(0, false,
-							"Failed to remadvise block at blockp: %p, error: %d\n", blockp, errno);
-				}
-			}
-			_malloc_lock_unlock(&nanozone->madvise_lock);
-		}
+		nanov2_remadvise_after_race(nanozone, block_metap, old_meta_view.meta);
 		goto again;
 	}
 
@@ -2055,6 +2318,114 @@ again:
 	return ptr;
 }
 
+// Allocates up to 'count' slots from the block that corresponds to a given
+// block meta data pointer and stores their addresses in 'results'. Slots are
+// taken from the free list first and then from the unused region of the block,
+// and all of them are claimed with a single update of the block's meta data.
+// Returns the number of slots allocated, which is zero if the block is no
+// longer in use or is full.
+static unsigned
+nanov2_allocate_run_from_block(nanozonev2_t *nanozone,
+		nanov2_block_meta_t *block_metap, nanov2_size_class_t size_class,
+		void **results, unsigned count)
+{
+	nanov2_block_meta_view_t old_meta_view;
+	old_meta_view.meta = os_atomic_load(block_metap, relaxed);
+	nanov2_block_t *blockp = nanov2_block_address_from_meta_ptr(nanozone,
+			block_metap);
+	int slot_count = slots_by_size_class[size_class];
+	unsigned available;
+	unsigned claimed;
+	unsigned from_free_list;
+	int next_slot;
+
+again:
+	if (!nanov2_can_allocate_from_block(old_meta_view.meta)) {
+		// Move along, nothing to allocate here...
+		return 0;
+	}
+
+	available = old_meta_view.meta.free_count + 1;
+	claimed = 0;
+	next_slot = old_meta_view.meta.next_slot;
+
+	// Walk the free list. If another thread changes it while we do so, the
+	// links that we read may be garbage, but the update of the meta data below
+	// will then fail because the generation count has moved on. Check each
+	// link so that garbage can't take us outside the block.
+	if (next_slot != SLOT_BUMP && next_slot != SLOT_CAN_MADVISE) {
+		while (claimed < count && claimed < available && next_slot != SLOT_BUMP) {
+			int slot = next_slot - 1; // meta.next_slot is 1-based.
+			if (slot < 0 || slot >= slot_count) {
+				if (!claimed) {
+					// The block is not in a state that we can allocate from.
+					return 0;
+				}
+				nanov2_block_meta_view_t meta_view;
+				meta_view.meta = os_atomic_load(block_metap, relaxed);
+				if (meta_view.bits == old_meta_view.bits) {
+					malloc_zone_error(MALLOC_ABORT_ON_CORRUPTION, false,
+							"Heap corruption detected, free list is damaged in block %p\n"
+							"*** Incorrect next slot: %d\n", blockp, next_slot);
+					__builtin_unreachable();
+				}
+				old_meta_view = meta_view;
+				goto again;
+			}
+			void *ptr = nanov2_slot_in_block_ptr(blockp, size_class, slot);
+			results[claimed++] = ptr;
+			next_slot = ((nanov2_free_slot_t *)ptr)->next_slot;
+		}
+	}
+	from_free_list = claimed;
+
+	// Once the free list is empty, the remaining free slots are the unused
+	// ones at the end of the block.
+	if (next_slot == SLOT_BUMP || next_slot == SLOT_CAN_MADVISE) {
+		int slot = slot_count - (int)(available - claimed);
+		while (claimed < count && claimed < available) {
+			results[claimed++] = nanov2_slot_in_block_ptr(blockp, size_class,
+					slot++);
+		}
+		next_slot = SLOT_BUMP;
+	}
+
+	nanov2_block_meta_t new_meta = {
+		.in_use = 1,
+		.free_count = old_meta_view.meta.free_count - claimed,
+		.gen_count = old_meta_view.meta.gen_count + 1,
+		.next_slot = claimed == available ? SLOT_FULL : next_slot,
+	};
+
+	// Write the updated meta data; try again if we raced with another thread.
+	if (!os_atomic_cmpxchgv(block_metap, old_meta_view.meta, new_meta,
+				&old_meta_view.meta, acquire)) {
+		nanov2_remadvise_after_race(nanozone, block_metap, old_meta_view.meta);
+		goto again;
+	}
+
+	// Check the free list canaries of the slots that came from the free list.
+	// As in nanov2_allocate_from_block(), this can only be done once the slots
+	// are ours.
+	for (unsigned i = 0; i < from_free_list; i++) {
+		nanov2_free_slot_t *slotp = (nanov2_free_slot_t *)results[i];
+		uintptr_t guard = os_atomic_load(&slotp->double_free_guard, relaxed);
+		if ((guard ^ nanozone->slot_freelist_cookie) != (uintptr_t)slotp) {
+			malloc_zone_error(MALLOC_ABORT_ON_CORRUPTION, false,
+					"Heap corruption detected, free list is damaged at %p\n"
+					"*** Incorrect guard value: %lu\n", slotp, guard);
+			__builtin_unreachable();
+		}
+	}
+
+#if DEBUG_MALLOC
+	nanozone->statistics.size_class_statistics[size_class].total_allocations +=
+			claimed;
+#endif // DEBUG_MALLOC
+
+	return claimed;
+}
+
 // Finds a block for allocation in an arena and returns a pointer to its
 // metadata header. The search begins from the block with metadata pointer
 // start_block (which must not be NULL). If no acceptable block was found,
@@ -2464,9 +2835,101 @@ done:
 	return ptr;
 }
 
+// Allocates up to 'count' blocks of a given size (which must be a multiple of
+// the Nano quantum size) and stores their addresses in 'results'. Blocks are
+// claimed in runs from the block last used for the caller's context, using a
+// single meta data update per run. When that block is exhausted, another one
+// is found exactly as in nanov2_allocate().
+//
+// Returns the number of blocks allocated, which is less than 'count' if the
+// size class is full and allocations are being delegated to the helper zone.
+unsigned
+nanov2_allocate_batch(nanozonev2_t *nanozone, size_t rounded_size,
+		void **results, unsigned count)
+{
+	nanov2_size_class_t size_class = nanov2_size_class_from_size(rounded_size);
+	MALLOC_ASSERT(size_class < NANO_SIZE_CLASSES);
+	MALLOC_ASSERT(rounded_size != 0);
+	int allocation_index = nanov2_get_allocation_block_index() & MAX_CURRENT_BLOCKS_MASK;
+	nanov2_block_meta_t **block_metapp =
+			&nanozone->current_block[size_class][allocation_index];
+	_malloc_lock_s *lock = &nanozone->current_block_lock[size_class][allocation_index];
+	nanov2_block_meta_t *block_metap;
+	unsigned allocated = 0;
+	unsigned claimed;
+
+	while (allocated < count) {
+		block_metap = os_atomic_load(block_metapp, relaxed);
+		if (block_metap) {
+			claimed = nanov2_allocate_run_from_block(nanozone, block_metap,
+					size_class, results + allocated, count - allocated);
+			if (claimed) {
+				allocated += claimed;
+				continue;
+			}
+		}
+
+		if (nanozone->delegate_allocations & (1 << size_class)) {
+			break;
+		}
+
+		// Lock and try again, then move on to a new block. This is the same
+		// sequence as in nanov2_allocate().
+		claimed = 0;
+		_malloc_lock_lock(lock);
+		block_metap = os_atomic_load(block_metapp, relaxed);
+		if (block_metap) {
+			claimed = nanov2_allocate_run_from_block(nanozone, block_metap,
+					size_class, results + allocated, count - allocated);
+		}
+		if (!claimed) {
+			void *ptr = nanov2_find_block_and_allocate(nanozone, size_class,
+					block_metapp);
+			if (ptr) {
+				results[allocated] = ptr;
+				claimed = 1;
+			}
+		}
+		_malloc_lock_unlock(lock);
+
+		if (!claimed) {
+			_malloc_lock_lock(&nanozone->delegate_allocations_lock);
+			nanozone->delegate_allocations |= 1 << size_class;
+			_malloc_lock_unlock(&nanozone->delegate_allocations_lock);
+			break;
+		}
+		allocated += claimed;
+	}
+
+	// Clear the double-free guards so that we can recognize that these blocks
+	// are not on the free list.
+	for (unsigned i = 0; i < allocated; i++) {
+		nanov2_free_slot_t *slotp = (nanov2_free_slot_t *)results[i];
+		os_atomic_store(&slotp->double_free_guard, 0, relaxed);
+	}
+	return allocated;
+}
+
 #pragma mark -
 #pragma mark Freeing
 
+// If a size class has been marked as full and a block that has just had slots
+// freed is below an acceptable level of occupancy, turns off delegation to the
+// helper. This is done only if the block is not in-use, because an in-use block
+// cannot be a candidate when searching for a new block.
+static void
+nanov2_stop_delegating_if_possible(nanozonev2_t *nanozone,
+		nanov2_block_meta_t new_meta, nanov2_size_class_t size_class)
+{
+	uint16_t class_mask = 1 << size_class;
+	if (!new_meta.in_use && (nanozone->delegate_allocations & class_mask) &&
+			(new_meta.free_count >= 0.75 * slots_by_size_class[size_class])) {
+		_malloc_lock_lock(&nanozone->delegate_allocations_lock);
+		nanozone->delegate_allocations &= ~class_mask;
+		_malloc_lock_unlock(&nanozone->delegate_allocations_lock);
+	}
+}
+
 // Frees an allocation to its owning block and updates the block's state.
 // If the block becomes empty, it is marked as SLOT_CAN_MADVISE and is
 // madvised immediately if the policy is NANO_MADVISE_IMMEDIATE.
@@ -2489,7 +2952,7 @@ again:
 	new_meta.in_use = old_meta.in_use;
 	new_meta.gen_count = old_meta.gen_count + 1;
 	boolean_t freeing_last_active_slot = !was_full &&
-			new_meta.free_count == slots_by_size_class[size_class] - 1;
+			new_meta.free_count == slot_count - 1;
 	if (freeing_last_active_slot) {
 		// Releasing the last active slot onto the free list. Mark the block as
 		// ready to be madvised if it's not in use, otherwise reset next_slot
@@ -2524,23 +2987,79 @@ again:
 		}
 	}
 
-	// If this size class has been marked as full and this block is below an
-	// acceptable level of occupancy, turn off delegation to the helper. Do this
-	// only if the block is not in-use, because an in-use block cannot be a
-	// candidate when searching for a new block.
-	uint16_t class_mask = 1 << size_class;
-	if (!new_meta.in_use && (nanozone->delegate_allocations & class_mask) &&
-			(new_meta.free_count >= 0.75 * slot_count)) {
-		_malloc_lock_lock(&nanozone->delegate_allocations_lock);
-		nanozone->delegate_allocations &= ~class_mask;
-		_malloc_lock_unlock(&nanozone->delegate_allocations_lock);
-	}
+	nanov2_stop_delegating_if_possible(nanozone, new_meta, size_class);
 
 #if DEBUG_MALLOC
 	nanozone->statistics.size_class_statistics[size_class].total_frees++;
 #endif // DEBUG_MALLOC
 }
 
+// Frees a run of allocations that all belong to the same block and whose
+// double-free guards have already been set. The slots are linked together in
+// array order and the resulting chain is pushed onto the block's free list
+// with a single update of the block's meta data. Otherwise, this behaves
+// exactly like calling nanov2_free_to_block() for each allocation.
+void
+nanov2_free_run_to_block(nanozonev2_t *nanozone, void **ptrs, unsigned count,
+		nanov2_size_class_t size_class)
+{
+	nanov2_block_t *blockp = nanov2_block_address_for_ptr(ptrs[0]);
+	nanov2_block_meta_t *block_metap = nanov2_meta_ptr_for_ptr(nanozone, ptrs[0]);
+	nanov2_free_slot_t *tailp = (nanov2_free_slot_t *)ptrs[count - 1];
+	int slot_count = slots_by_size_class[size_class];
+	nanov2_block_meta_t old_meta = os_atomic_load(block_metap, relaxed);
+	nanov2_block_meta_t new_meta;
+	boolean_t was_full;
+	int free_slots;
+
+	// Only the link from the tail of the chain to the rest of the free list
+	// depends on the state of the block, so build the rest just once.
+	for (unsigned i = 0; i + 1 < count; i++) {
+		nanov2_free_slot_t *slotp = (nanov2_free_slot_t *)ptrs[i];
+		slotp->next_slot = nanov2_slot_index_in_block(blockp, size_class,
+				ptrs[i + 1]) + 1;  // meta.next_slot is 1-based
+	}
+	int head_slot = nanov2_slot_index_in_block(blockp, size_class, ptrs[0]) + 1;
+
+again:
+	was_full = old_meta.next_slot == SLOT_FULL;
+	free_slots = (was_full ? 0 : old_meta.free_count + 1) + count;
+	new_meta.free_count = free_slots - 1;
+	new_meta.in_use = old_meta.in_use;
+	new_meta.gen_count = old_meta.gen_count + 1;
+	if (free_slots == slot_count) {
+		// Releasing the last active slots. As in nanov2_free_to_block(), the
+		// free list is discarded and the block is either reset or marked as
+		// ready to be madvised.
+		new_meta.next_slot = new_meta.in_use ? SLOT_BUMP : SLOT_CAN_MADVISE;
+		if (!os_atomic_cmpxchgv(block_metap, old_meta, new_meta, &old_meta, relaxed)) {
+			goto again;
+		}
+
+		if (new_meta.next_slot == SLOT_CAN_MADVISE &&
+				nanov2_madvise_policy == NANO_MADVISE_IMMEDIATE) {
+			_malloc_lock_lock(&nanozone->madvise_lock);
+			nanov2_madvise_block(nanozone, block_metap, blockp, size_class);
+			_malloc_lock_unlock(&nanozone->madvise_lock);
+		}
+	} else {
+		new_meta.next_slot = head_slot;
+		tailp->next_slot = was_full ? SLOT_BUMP : old_meta.next_slot;
+
+		// The chain and the double_free_guard changes must be visible when
+		// the os_atomic_cmpxchgv completes.
+		if (!os_atomic_cmpxchgv(block_metap, old_meta, new_meta, &old_meta, release)) {
+			goto again;
+		}
+	}
+
+	nanov2_stop_delegating_if_possible(nanozone, new_meta, size_class);
+
+#if DEBUG_MALLOC
+	nanozone->statistics.size_class_statistics[size_class].total_frees += count;
+#endif // DEBUG_MALLOC
+}
+
 #endif // OS_VARIANT_RESOLVED
 
 #if OS_VARIANT_NOTRESOLVED
@@ -2567,7 +3086,7 @@ nanov2_create_zone(malloc_zone_t *helper_zone, unsigned debug_flags)
 	}
 
 	// Set up the basic_zone portion of the nanozonev2 structure
-	nanozone->basic_zone.version = 10;
+	nanozone->basic_zone.version = 11;
 	nanozone->basic_zone.size = OS_RESOLVED_VARIANT_ADDR(nanov2_size);
 	nanozone->basic_zone.malloc = OS_RESOLVED_VARIANT_ADDR(nanov2_malloc);
 	nanozone->basic_zone.calloc = OS_RESOLVED_VARIANT_ADDR(nanov2_calloc);
@@ -2648,6 +3167,13 @@ nanov2_create_zone(malloc_zone_t *helper_zone, unsigned debug_flags)
 	nanozone->current_region_limit = region + 1;
 	nanozone->statistics.allocated_regions = 1;
 
+#if CONFIG_SCAVENGER
+	if (nanov2_madvise_policy == NANO_MADVISE_BACKGROUND) {
+		malloc_scavenger_register(nanozone,
+				(malloc_scavenger_fn_t)OS_RESOLVED_VARIANT_ADDR(nanov2_scavenge));
+	}
+#endif // CONFIG_SCAVENGER
+
 	return (malloc_zone_t *)nanozone;
 }
 #endif // OS_VARIANT_NOTRESOLVED
@@ -69,6 +69,10 @@
 // Maximum number of slots per block
 #define NANOV2_MAX_SLOTS_PER_BLOCK	(NANOV2_BLOCK_SIZE/NANO_REGIME_QUANTA_SIZE)
 
+// Maximum number of pointers that nanov2_batch_free() returns to a block with
+// a single update of its metadata.
+#define NANOV2_BATCH_FREE_RUN_MAX	64
+
 // Highest region number.
 #if NANOV2_MULTIPLE_REGIONS
 #define NANOV2_MAX_REGION_NUMBER	((1 << NANOV2_REGION_BITS) - 1)
@@ -303,6 +307,10 @@ typedef struct nanozonev2_s {
 
 	// Global and per-size class statistics
 	nanov2_statistics_t	statistics;
+
+	// Arena at which the next background scavenger pass starts. Only used on
+	// the scavenger thread.
+	nanov2_arena_t		*scavenge_arena;
 } nanozonev2_t;
 
 #define NANOZONEV2_ZONE_PAGED_SIZE	mach_vm_round_page(sizeof(nanozonev2_t))
@@ -74,6 +74,25 @@
 #define CONFIG_SMALL_CACHE 1
 #define CONFIG_MEDIUM_CACHE 1
 
+// Per-thread cache of recently freed tiny and small blocks that sits in front
+// of the magazines. Compiled in everywhere but only engaged when the
+// MallocThreadCache environment variable is set.
+#define CONFIG_THREAD_CACHE 1
+
+// Frees of tiny and small blocks whose magazine is locked by another CPU are
+// queued on that magazine's remote free list instead of waiting for the lock,
+// and are freed by the next thread that takes it.
+#define CONFIG_MAGAZINE_REMOTE_FREE 1
+
+// Address-range index consulted by find_registered_zone() before it falls
+// back to asking every registered zone whether it owns a pointer.
+#define CONFIG_ZONE_INDEX 1
+
+// Background thread that madvises free pages of depot regions and empty nano
+// blocks once they have gone unused for a while. Compiled in everywhere but
+// only started when the MallocScavenger environment variable is set.
+#define CONFIG_SCAVENGER 1
+
 // medium allocator enabled or disabled
 #if MALLOC_TARGET_64BIT
 #if MALLOC_TARGET_IOS
@@ -86,11 +105,7 @@
 #endif // MALLOC_TARGET_64BIT
 
 // The large last-free cache (aka. death row cache)
-#if MALLOC_TARGET_IOS
-#define CONFIG_LARGE_CACHE 0
-#else
 #define CONFIG_LARGE_CACHE 1
-#endif
 
 #if MALLOC_TARGET_IOS
 // The VM system on iOS forces malloc-tagged memory to never be marked as
@@ -101,6 +116,16 @@
 #define CONFIG_REALLOC_CAN_USE_VMCOPY 1
 #endif
 
+// Large blocks that grow are moved by remapping their pages into a bigger
+// reservation, rather than by copying them. That needs the VM to share
+// malloc-tagged pages, as for vm_copy above, and the reservations need the
+// address space of a 64-bit process.
+#if CONFIG_REALLOC_CAN_USE_VMCOPY && MALLOC_TARGET_64BIT
+#define CONFIG_LARGE_REALLOC_REMAP 1
+#else
+#define CONFIG_LARGE_REALLOC_REMAP 0
+#endif
+
 // memory resource exception handling
 #if MALLOC_TARGET_IOS || TARGET_OS_SIMULATOR
 #define ENABLE_MEMORY_RESOURCE_EXCEPTION_HANDLING 0
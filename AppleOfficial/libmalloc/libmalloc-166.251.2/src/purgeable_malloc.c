@@ -347,7 +347,9 @@ create_purgeable_zone(size_t initial_size, malloc_zone_t *malloc_default_zone, u
 	rack_init(&szone->small_rack, RACK_TYPE_SMALL, 0, debug_flags | MALLOC_PURGEABLE);
 
 #if CONFIG_LARGE_CACHE
-	// madvise(..., MADV_REUSABLE) death-row arrivals above this threshold [~0.1%]
+	large_cache_init(szone);
+
+	// Death-row holds at most this many bytes that haven't been madvise()d [~0.1%]
 	szone->large_entry_cache_reserve_limit = (size_t)(hw_memsize >> 10);
 
 	/* <rdar://problem/6610904> Reset protection when returning a previous large allocation? */
@@ -100,4 +100,55 @@ radix_tree_count(struct radix_tree *tree);
 uint64_t
 radix_tree_size(struct radix_tree *tree);
 
+/*
+ * A radix tree that can be read while it is being modified.  Keys, sizes
+ * and values have the same limits as in a radix_tree.
+ *
+ * Lookups are wait-free and may run on any number of threads at once.
+ * Inserts and deletes are serialized on a lock inside the tree.  A lookup
+ * that races with an insert or delete of a range containing its key may
+ * return either the old or the new value, or may transiently find nothing,
+ * because an insert first deletes the keys it overlaps.
+ */
+
+struct radix_ctree;
+
+/*
+ * Create a concurrent radix tree.  Returns NULL on failure.
+ */
+struct radix_ctree *
+radix_ctree_create(void);
+
+/*
+ * Deallocate a concurrent radix tree.  There must be no lookups in progress.
+ */
+void
+radix_ctree_destroy(struct radix_ctree *tree);
+
+/*
+ * Lookup a key and return its value, or radix_tree_invalid_value if it is
+ * not found.  Safe to call concurrently with any other operation.
+ */
+uint64_t
+radix_ctree_lookup(struct radix_ctree *tree, uint64_t key);
+
+/*
+ * Insert a range of keys.  Returns false if the range or value cannot be
+ * represented or the tree is full.
+ */
+bool
+radix_ctree_insert(struct radix_ctree *tree, uint64_t key, uint64_t size, uint64_t value);
+
+/*
+ * Delete a range of keys.  Returns true on success.
+ */
+bool
+radix_ctree_delete(struct radix_ctree *tree, uint64_t key, uint64_t size);
+
+/*
+ * Count the number of keys in a concurrent radix tree.
+ */
+uint64_t
+radix_ctree_count(struct radix_ctree *tree);
+
 #endif
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#include <assert.h>
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#include <os/lock.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <radix_tree.h>
+#include <radix_tree_internal.h>
+
+/*
+ * A radix tree with the same edge and leaf encoding as radix_tree.c, which
+ * readers may search while a writer modifies it.
+ *
+ * Nodes live in fixed size chunks that are never moved, so a reader can
+ * follow a node index without holding any lock.  Every node is read and
+ * written as a single 64 bit word: the writer builds new nodes where no
+ * reader can see them, then publishes each change to a reachable node with
+ * one release store, so a reader always sees either the old or the new
+ * version of any node.
+ *
+ * Nodes that are unlinked by a delete may still be in use by a reader, so
+ * they are retired rather than freed.  Readers count themselves against the
+ * current epoch for the length of a lookup; once the writer has waited for
+ * the readers of both epochs to drain, the retired nodes can be reused.
+ */
+
+#define RADIX_CTREE_CHUNK_SHIFT 9
+#define RADIX_CTREE_CHUNK_NODES (1u << RADIX_CTREE_CHUNK_SHIFT) // 4KB of nodes
+#define RADIX_CTREE_MAX_NODES (1u << 16) // edges hold a 16 bit node index
+#define RADIX_CTREE_MAX_CHUNKS (RADIX_CTREE_MAX_NODES / RADIX_CTREE_CHUNK_NODES)
+#define RADIX_CTREE_MAX_RETIRED 256
+#define RADIX_CTREE_READER_STRIPES 16
+#define RADIX_CTREE_LEAF_SIZE_SHIFT 12 // smallest size of a VM region is 4096
+
+struct radix_ctree_readers {
+	_Atomic int32_t count;
+} __attribute__((aligned(64)));
+
+struct radix_ctree {
+	// Node i is word (i % RADIX_CTREE_CHUNK_NODES) of chunk
+	// (i / RADIX_CTREE_CHUNK_NODES).  Node 0 is the root.
+	_Atomic uint64_t *_Atomic chunks[RADIX_CTREE_MAX_CHUNKS];
+
+	// Everything from here to the reader counts belongs to the writer.
+	os_unfair_lock lock;
+	uint32_t num_chunks;
+	uint32_t next_free;
+	uint32_t num_retired;
+	uint16_t retired[RADIX_CTREE_MAX_RETIRED];
+
+	_Atomic uint64_t epoch;
+	struct radix_ctree_readers readers[2][RADIX_CTREE_READER_STRIPES];
+};
+
+static inline _Atomic uint64_t *
+ctree_slot(struct radix_ctree *tree, unsigned index)
+{
+	_Atomic uint64_t *chunk = atomic_load_explicit(&tree->chunks[index >> RADIX_CTREE_CHUNK_SHIFT],
+			memory_order_relaxed);
+	assert(chunk);
+	return &chunk[index & (RADIX_CTREE_CHUNK_NODES - 1)];
+}
+
+static inline struct radix_node
+ctree_load(struct radix_ctree *tree, unsigned index)
+{
+	return (struct radix_node){.as_u64 = atomic_load_explicit(ctree_slot(tree, index), memory_order_acquire)};
+}
+
+/*
+ * Make a node visible to readers.  Everything the writer stored before this,
+ * including the nodes that this one points to, is visible to a reader that
+ * loads the new value.
+ */
+static inline void
+ctree_publish(struct radix_ctree *tree, unsigned index, struct radix_node node)
+{
+	atomic_store_explicit(ctree_slot(tree, index), node.as_u64, memory_order_release);
+}
+
+static inline uint64_t
+ctree_leaf_size(struct radix_node *leaf)
+{
+	return ((uint64_t)leaf->size) << RADIX_CTREE_LEAF_SIZE_SHIFT;
+}
+
+#pragma mark readers
+
+static _Atomic int32_t *
+ctree_read_begin(struct radix_ctree *tree)
+{
+	// Spread the readers over several cache lines so that they do not all
+	// bounce the same one.
+	uintptr_t hash = (uintptr_t)pthread_self() * 0x9e3779b97f4a7c15ull;
+	unsigned stripe = (unsigned)(hash >> 32) % RADIX_CTREE_READER_STRIPES;
+	unsigned epoch = atomic_load_explicit(&tree->epoch, memory_order_relaxed) & 1;
+	_Atomic int32_t *count = &tree->readers[epoch][stripe].count;
+
+	// Full barrier: the writer must see the count before we load any node.
+	atomic_fetch_add_explicit(count, 1, memory_order_seq_cst);
+	return count;
+}
+
+static void
+ctree_read_end(_Atomic int32_t *count)
+{
+	atomic_fetch_sub_explicit(count, 1, memory_order_release);
+}
+
+/*
+ * Wait until no reader can still hold a node that was unlinked before the
+ * call.  The epoch is flipped twice: a reader that sampled the epoch just
+ * before a flip may count itself against the parity that the writer has
+ * already waited for, and the second flip waits for that reader.
+ */
+static void
+ctree_synchronize(struct radix_ctree *tree)
+{
+	for (int flip = 0; flip < 2; flip++) {
+		unsigned old = atomic_fetch_add_explicit(&tree->epoch, 1, memory_order_seq_cst) & 1;
+		for (unsigned i = 0; i < RADIX_CTREE_READER_STRIPES; i++) {
+			while (atomic_load_explicit(&tree->readers[old][i].count, memory_order_seq_cst)) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+static struct answer
+ctree_lookup_recursive(struct radix_ctree *tree,
+		struct interval keys,	 // keys we're looking for
+		struct interval nodekeys, // keys it is possible that we will find
+		unsigned node_index,
+		int keyshift)
+{
+	struct radix_node node = ctree_load(tree, node_index);
+
+	assert(keyshift < RADIX_TREE_KEY_BITS);
+
+	if (keys.start < nodekeys.start) {
+		uint64_t diff = nodekeys.start - keys.start;
+		if (keys.size <= diff) {
+			return (struct answer){.limit = nodekeys.start, .stackid = radix_tree_invalid_value};
+		}
+		keys.start += diff;
+		keys.size -= diff;
+	}
+
+	for (int i = 1; i >= 0; i--) {
+		struct radix_edge *edge = &node.edges[i];
+		if (!edge_valid(edge)) {
+			continue;
+		}
+		uint64_t edgekeys_start = extend_key(nodekeys.start, edge->labelBits, keyshift, edge->label);
+		struct interval edgekeys = {.start = edgekeys_start, .size = nodekeys.size - (edgekeys_start - nodekeys.start)};
+
+		if (intervals_intersect(edgekeys, keys)) {
+			if (edge->isLeaf) {
+				struct radix_node leaf = ctree_load(tree, edge->index);
+				edgekeys.size = ctree_leaf_size(&leaf); // edgekeys is now exact.
+				if (intervals_intersect(edgekeys, keys)) {
+					return (struct answer){.interval = edgekeys, .stackid = leaf.stackid};
+				}
+				nodekeys = truncate_interval(nodekeys, edgekeys.start);
+			} else {
+				struct answer answer = ctree_lookup_recursive(tree, keys, edgekeys, edge->index, keyshift + edge->labelBits);
+				if (answer_found(answer)) {
+					return answer;
+				}
+				nodekeys = truncate_interval(nodekeys, answer.limit);
+			}
+		}
+	}
+
+	return (struct answer){.limit = nodekeys.start + nodekeys.size, .stackid = radix_tree_invalid_value};
+}
+
+static struct answer
+ctree_lookup_interval(struct radix_ctree *tree, struct interval keys)
+{
+	struct interval max_interval = {.start = 0, .size = (uint64_t)-1};
+	return ctree_lookup_recursive(tree, keys, max_interval, 0, 0);
+}
+
+uint64_t
+radix_ctree_lookup(struct radix_ctree *tree, uint64_t key)
+{
+	_Atomic int32_t *count = ctree_read_begin(tree);
+	uint64_t value = ctree_lookup_interval(tree, (struct interval){.start = key, .size = 1}).stackid;
+	ctree_read_end(count);
+	return value;
+}
+
+#pragma mark writer
+
+static bool
+ctree_grow(struct radix_ctree *tree)
+{
+	if (tree->num_chunks == RADIX_CTREE_MAX_CHUNKS) {
+		return false;
+	}
+	mach_vm_address_t allocated;
+	kern_return_t kr = mach_vm_allocate(mach_task_self(), &allocated, RADIX_CTREE_CHUNK_NODES * sizeof(uint64_t),
+			VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_ANALYSIS_TOOL));
+	if (kr != KERN_SUCCESS) {
+		return false;
+	}
+	_Atomic uint64_t *chunk = (_Atomic uint64_t *)allocated;
+
+	// Put the new nodes on the free list, lowest index first.  The root is
+	// never free.
+	unsigned first = tree->num_chunks << RADIX_CTREE_CHUNK_SHIFT;
+	for (unsigned i = RADIX_CTREE_CHUNK_NODES; i-- > 0;) {
+		if (first + i == 0) {
+			continue;
+		}
+		struct radix_node node = {.as_u64 = 0};
+		node.next_free = tree->next_free;
+		atomic_store_explicit(&chunk[i], node.as_u64, memory_order_relaxed);
+		tree->next_free = first + i;
+	}
+
+	// The chunk must be visible before any node in it is published.
+	atomic_store_explicit(&tree->chunks[tree->num_chunks], chunk, memory_order_release);
+	tree->num_chunks++;
+	return true;
+}
+
+static void
+ctree_free_node(struct radix_ctree *tree, unsigned index)
+{
+	struct radix_node node = {.as_u64 = 0};
+	node.next_free = tree->next_free;
+	atomic_store_explicit(ctree_slot(tree, index), node.as_u64, memory_order_relaxed);
+	tree->next_free = index;
+}
+
+static void
+ctree_reclaim(struct radix_ctree *tree)
+{
+	ctree_synchronize(tree);
+	for (unsigned i = 0; i < tree->num_retired; i++) {
+		ctree_free_node(tree, tree->retired[i]);
+	}
+	tree->num_retired = 0;
+}
+
+static void
+ctree_retire_node(struct radix_ctree *tree, unsigned index)
+{
+	if (tree->num_retired == RADIX_CTREE_MAX_RETIRED) {
+		ctree_reclaim(tree);
+	}
+	tree->retired[tree->num_retired++] = index;
+}
+
+/*
+ * Returns an unpublished node, or 0 if the tree is full.  Growing is cheaper
+ * than waiting for readers, so retired nodes are only reclaimed here once
+ * the tree cannot grow any more.
+ */
+static unsigned
+ctree_allocate_node(struct radix_ctree *tree)
+{
+	if (!tree->next_free && !ctree_grow(tree) && tree->num_retired) {
+		ctree_reclaim(tree);
+	}
+	if (!tree->next_free) {
+		return 0;
+	}
+	unsigned index = tree->next_free;
+	struct radix_node node = ctree_load(tree, index);
+	tree->next_free = node.next_free;
+	return index;
+}
+
+static bool
+ctree_insert_recursive(struct radix_ctree *tree, struct interval keys, uint64_t value, unsigned node_index, int keyshift)
+{
+	struct radix_node node = ctree_load(tree, node_index);
+
+	assert(keyshift < RADIX_TREE_KEY_BITS);
+
+	for (int i = 0; i < 2; i++) {
+		struct radix_edge *edge = &node.edges[i];
+		int matching_bits = count_matching_bits(edge, keys.start, keyshift);
+		if (matching_bits) {
+			if (matching_bits == edge->labelBits) {
+				assert(!edge->isLeaf); // it should have been deleted before we got here
+				return ctree_insert_recursive(tree, keys, value, edge->index, keyshift + edge->labelBits);
+			}
+			unsigned index = ctree_allocate_node(tree);
+			if (!index) {
+				return false;
+			}
+
+			// The new node takes over the tail of the edge's label.
+			struct radix_node newnode = {.as_u64 = 0};
+			newnode.edges[0].labelBits = (edge->labelBits - matching_bits);
+			newnode.edges[0].isLeaf = edge->isLeaf;
+			newnode.edges[0].index = edge->index;
+			newnode.edges[0].label = edge->label & ((1 << (edge->labelBits - matching_bits)) - 1);
+			ctree_publish(tree, index, newnode);
+
+			edge->label = edge->label >> (edge->labelBits - matching_bits);
+			edge->labelBits = matching_bits;
+			edge->isLeaf = false;
+			edge->index = index;
+			fixnode(&node);
+			ctree_publish(tree, node_index, node);
+
+			return ctree_insert_recursive(tree, keys, value, index, keyshift + matching_bits);
+		}
+		if (edge->labelBits == 0) {
+			unsigned index = ctree_allocate_node(tree);
+			if (!index) {
+				return false;
+			}
+
+			struct radix_node child = {.as_u64 = 0};
+			bool leaf = RADIX_TREE_KEY_BITS - keyshift <= RADIX_LABEL_BITS;
+			if (leaf) {
+				child.stackid = value;
+				child.size = keys.size >> RADIX_CTREE_LEAF_SIZE_SHIFT;
+				edge->labelBits = RADIX_TREE_KEY_BITS - keyshift;
+			} else {
+				edge->labelBits = RADIX_LABEL_BITS;
+			}
+			edge->isLeaf = leaf;
+			edge->index = index;
+			edge->label = keybits(keys.start, edge->labelBits, keyshift);
+			ctree_publish(tree, index, child);
+			fixnode(&node);
+			ctree_publish(tree, node_index, node);
+
+			if (leaf) {
+				return true;
+			}
+			return ctree_insert_recursive(tree, keys, value, index, keyshift + RADIX_LABEL_BITS);
+		}
+	}
+
+	abort(); // at least one edge must prefix-match or be unused
+}
+
+static bool
+ctree_delete_recursive(struct radix_ctree *tree, uint64_t key, unsigned node_index, int keyshift)
+{
+	struct radix_node node = ctree_load(tree, node_index);
+
+	assert(keyshift < RADIX_TREE_KEY_BITS);
+
+	for (int i = 0; i < 2; i++) {
+		struct radix_edge *edge = &node.edges[i];
+		if (!edge_matches(edge, key, keyshift)) {
+			continue;
+		}
+		unsigned index = edge->index;
+		if (!edge->isLeaf) {
+			if (!ctree_delete_recursive(tree, key, index, keyshift + edge->labelBits)) {
+				return false;
+			}
+			struct radix_node child = ctree_load(tree, index);
+			if (child.edges[0].labelBits || child.edges[1].labelBits) {
+				return true;
+			}
+		}
+
+		// Unlink the leaf, or the internal node that is now empty.
+		if (i == 0) {
+			node.edges[0] = node.edges[1];
+		}
+		node.edges[1].labelBits = 0;
+		ctree_publish(tree, node_index, node);
+		ctree_retire_node(tree, index);
+		return true;
+	}
+	return false;
+}
+
+static bool
+ctree_delete_locked(struct radix_ctree *tree, struct interval keys)
+{
+	while (1) {
+		struct answer answer = ctree_lookup_interval(tree, keys);
+		if (!answer_found(answer)) {
+			return true;
+		}
+		bool ok = ctree_delete_recursive(tree, answer.interval.start, 0, 0);
+		assert(ok);
+
+		// Put back the parts of the range that we were not asked to delete.
+		// They cannot overlap anything else.
+		if (answer.interval.start < keys.start) {
+			struct interval head = {.start = answer.interval.start, .size = keys.start - answer.interval.start};
+			ok = ctree_insert_recursive(tree, head, answer.stackid, 0, 0);
+			if (!ok) {
+				return false;
+			}
+		}
+		uint64_t answer_end = answer.interval.start + answer.interval.size;
+		uint64_t keys_end = keys.start + keys.size;
+		if (answer_end > keys_end) {
+			struct interval tail = {.start = keys_end, .size = answer_end - keys_end};
+			ok = ctree_insert_recursive(tree, tail, answer.stackid, 0, 0);
+			if (!ok) {
+				return false;
+			}
+		}
+	}
+}
+
+bool
+radix_ctree_insert(struct radix_ctree *tree, uint64_t key, uint64_t size, uint64_t value)
+{
+	struct radix_node node = {.stackid = value, .size = size >> RADIX_CTREE_LEAF_SIZE_SHIFT};
+	if (node.stackid != value || ctree_leaf_size(&node) != size) {
+		return false;
+	}
+	uint64_t mask = ((uint64_t)-1) << (64 - RADIX_TREE_KEY_BITS);
+	if ((key & mask) != key || key + size < key) {
+		return false;
+	}
+
+	struct interval keys = {.start = key, .size = size};
+	os_unfair_lock_lock(&tree->lock);
+	bool ok = ctree_delete_locked(tree, keys) && ctree_insert_recursive(tree, keys, value, 0, 0);
+	os_unfair_lock_unlock(&tree->lock);
+	return ok;
+}
+
+bool
+radix_ctree_delete(struct radix_ctree *tree, uint64_t key, uint64_t size)
+{
+	os_unfair_lock_lock(&tree->lock);
+	bool ok = ctree_delete_locked(tree, (struct interval){.start = key, .size = size});
+	os_unfair_lock_unlock(&tree->lock);
+	return ok;
+}
+
+#pragma mark tree
+
+struct radix_ctree *
+radix_ctree_create(void)
+{
+	mach_vm_address_t allocated;
+	kern_return_t kr = mach_vm_allocate(mach_task_self(), &allocated, round_page(sizeof(struct radix_ctree)),
+			VM_FLAGS_ANYWHERE | VM_MAKE_TAG(VM_MEMORY_ANALYSIS_TOOL));
+	if (kr != KERN_SUCCESS) {
+		return NULL;
+	}
+	struct radix_ctree *tree = (struct radix_ctree *)allocated;
+	tree->lock = OS_UNFAIR_LOCK_INIT;
+	if (!ctree_grow(tree)) {
+		mach_vm_deallocate(mach_task_self(), allocated, round_page(sizeof(struct radix_ctree)));
+		return NULL;
+	}
+	return tree;
+}
+
+void
+radix_ctree_destroy(struct radix_ctree *tree)
+{
+	for (unsigned i = 0; i < tree->num_chunks; i++) {
+		mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)tree->chunks[i],
+				RADIX_CTREE_CHUNK_NODES * sizeof(uint64_t));
+	}
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)tree, round_page(sizeof(struct radix_ctree)));
+}
+
+static uint64_t
+ctree_count_recursive(struct radix_ctree *tree, unsigned node_index)
+{
+	struct radix_node node = ctree_load(tree, node_index);
+	uint64_t count = 0;
+	for (int i = 0; i < 2; i++) {
+		struct radix_edge *edge = &node.edges[i];
+		if (edge->labelBits == 0)
+			continue;
+		if (edge->isLeaf) {
+			struct radix_node leaf = ctree_load(tree, edge->index);
+			count += ctree_leaf_size(&leaf);
+		} else {
+			count += ctree_count_recursive(tree, edge->index);
+		}
+	}
+	return count;
+}
+
+uint64_t
+radix_ctree_count(struct radix_ctree *tree)
+{
+	os_unfair_lock_lock(&tree->lock);
+	uint64_t count = ctree_count_recursive(tree, 0);
+	os_unfair_lock_unlock(&tree->lock);
+	return count;
+}
@@ -168,6 +168,78 @@ getnode(struct radix_tree *tree, unsigned index)
     }
 }
 
+struct interval {
+	uint64_t start;
+	uint64_t size;
+};
+
+struct answer {
+	struct interval interval;
+	uint64_t stackid;
+	uint64_t limit;
+};
+
+static inline bool
+in_interval(uint64_t x, struct interval interval)
+{
+	return x >= interval.start && ((x - interval.start) < interval.size);
+}
+
+static inline bool
+intervals_intersect(struct interval a, struct interval b)
+{
+	if (a.size == 0 || b.size == 0)
+		return false;
+	return (in_interval(a.start, b) || in_interval(a.start + a.size - 1, b) || in_interval(b.start, a) ||
+			in_interval(b.start + b.size - 1, a));
+}
+
+__unused static inline bool
+interval_is_subset(struct interval a, struct interval b)
+{
+	return in_interval(a.start, b) && in_interval(a.start + a.size - 1, b);
+}
+
+static inline struct interval
+truncate_interval(struct interval a, uint64_t limit)
+{
+	if (a.start >= limit) {
+		return (struct interval){.start = a.start, .size = 0};
+	} else {
+		return (struct interval){.start = a.start, .size = limit - a.start};
+	}
+}
+
+static inline bool
+answer_found(struct answer answer)
+{
+	return answer.stackid != radix_tree_invalid_value;
+}
+
+/*
+ * Modify the node to maintain the invariant that the lesser edge is first.
+ * Return true if node needed to be modified.
+ */
+static inline bool
+fixnode(struct radix_node *node)
+{
+	bool swap = false;
+	if (node->edges[0].labelBits && node->edges[1].labelBits) {
+		unsigned label0 = node->edges[0].label << (RADIX_LABEL_BITS - node->edges[0].labelBits);
+		unsigned label1 = node->edges[1].label << (RADIX_LABEL_BITS - node->edges[1].labelBits);
+		if (label1 < label0)
+			swap = true;
+	} else if (node->edges[0].labelBits == 0 && node->edges[1].labelBits != 0) {
+		swap = true;
+	}
+	if (swap) {
+		struct radix_edge edge0 = node->edges[0];
+		node->edges[0] = node->edges[1];
+		node->edges[1] = edge0;
+	}
+	return swap;
+}
+
 /*
  * Initialize a radix tree in a new buffer
  */
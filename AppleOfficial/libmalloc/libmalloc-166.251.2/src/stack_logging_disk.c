@@ -24,6 +24,9 @@
 #include "internal.h"
 #include "radix_tree.h"
 
+#include <pthread.h>
+#include <pthread/qos.h>
+
 #pragma mark -
 #pragma mark Defines
 
@@ -45,6 +48,14 @@
 
 #define BACKTRACE_UNIQUING_DEBUG 0
 
+// Buffered mode (MallocStackLoggingBuffered): records staged per thread before
+// the flusher thread moves them to the index buffer, the size of each thread's
+// cache of recently uniqued stacks, and the deepest stack that it will hold.
+#define STACK_LOGGING_STAGED_EVENTS 256
+#define STACK_LOGGING_FLUSH_INTERVAL_MS 100
+#define STACK_ID_CACHE_ENTRIES 64
+#define STACK_ID_CACHE_MAX_FRAMES 48
+
 // The expansion factor controls the shifting up of table size. A factor of 1 will double the size upon expanding,
 // 2 will quadruple the size, etc. Maintaining a 66% fill in an ideal table requires the collision allowance to
 // increase by 3 for every quadrupling of the table size (although this the constant applied to insertion
@@ -210,6 +221,35 @@ typedef struct {
 
 _Static_assert(sizeof(table_slot_t) == 16, "table_slot_t must be 128 bits");
 
+// An index record waiting in a thread's staging buffer. 'seq' orders records
+// across threads so that the flusher can write them in the order they happened.
+typedef struct {
+	uint64_t seq;
+	stack_logging_index_event event;
+} staged_index_event;
+
+typedef struct {
+	uint64_t hash;
+	uint64_t stack_id;
+	uint32_t count;
+	mach_vm_address_t frames[STACK_ID_CACHE_MAX_FRAMES];
+} stack_id_cache_entry;
+
+// Per-thread state for buffered stack logging, reachable through a reserved
+// TSD slot and linked on thread_buffers. 'lock' is only contended by the
+// flusher; the list itself is protected by stack_logging_lock.
+typedef struct stack_logging_thread_buffer {
+	struct stack_logging_thread_buffer *next;
+	_malloc_lock_s lock;
+	vm_address_t thread; // 0 when the buffer is free for reuse
+	uint32_t count;
+	uint32_t flushed;
+	uint64_t cache_generation;
+	staged_index_event events[STACK_LOGGING_STAGED_EVENTS];
+	vm_address_t stack[STACK_LOGGING_MAX_STACK_SIZE];
+	stack_id_cache_entry cache[STACK_ID_CACHE_ENTRIES];
+} stack_logging_thread_buffer;
+
 #pragma mark -
 #pragma mark Constants/Globals
 
@@ -218,6 +258,7 @@ int stack_logging_dontcompact = 0;
 int stack_logging_finished_init = 0;
 int stack_logging_postponed = 0;
 int stack_logging_mode = stack_logging_mode_none;
+int stack_logging_buffered = 0;
 
 #define MAX_PARENT_NORMAL
 #define MAX_PARENT_REFCOUNT
@@ -233,6 +274,14 @@ static stack_buffer_shared_memory *pre_write_buffers;
 static vm_address_t *stack_buffer;
 static uintptr_t last_logged_malloc_address = 0;
 
+// buffered mode
+static stack_logging_thread_buffer *thread_buffers; // protected by stack_logging_lock
+static boolean_t staged_logging_ready = false;
+static pthread_key_t staged_logging_key; // valid once staged_logging_ready is set
+static uint64_t staged_event_seq = 0;
+static uint64_t stack_id_cache_generation = 0;
+static os_once_t staged_logging_flusher_pred;
+
 // Constants to define part of stack logging file path names.
 // File names are of the form stack-logs.<pid>.<address>.<progname>.XXXXXX.index
 // where <address> is the address of the pre_write_buffers VM region in the target
@@ -899,6 +948,7 @@ __delete_uniquing_table_memory_while_locked(void)
 		__destroy_uniquing_table(pre_write_buffers->uniquing_table);
 		pre_write_buffers->uniquing_table = NULL;
 		uniquing_table_memory_was_deleted = true;
+		os_atomic_inc(&stack_id_cache_generation, relaxed);
 	}
 	
 	// Clear the shared memory address so client tools won't look for the uniquing table memory
@@ -995,6 +1045,314 @@ flush_data(void)
 	pre_write_buffers->next_free_index_buffer_offset = 0;
 }
 
+// Appends one record to the index buffer, flushing the buffer to disk first if
+// it is full. Drops the record if the flush failed.
+static void
+append_index_event_while_locked(const stack_logging_index_event *event)
+{
+	if (pre_write_buffers->next_free_index_buffer_offset + sizeof(stack_logging_index_event) >= STACK_LOGGING_BLOCK_WRITING_SIZE) {
+		flush_data();
+		if (pre_write_buffers->next_free_index_buffer_offset + sizeof(stack_logging_index_event) >= STACK_LOGGING_BLOCK_WRITING_SIZE) {
+			return;
+		}
+	}
+
+	memcpy(pre_write_buffers->index_buffer + pre_write_buffers->next_free_index_buffer_offset, event,
+			sizeof(stack_logging_index_event));
+	pre_write_buffers->next_free_index_buffer_offset += (uint32_t)sizeof(stack_logging_index_event);
+}
+
+#pragma mark -
+#pragma mark Buffered Stack Logging
+
+/*
+ * With MallocStackLoggingBuffered set, full and malloc mode logging stop
+ * serialising every allocation on stack_logging_lock.
+ *
+ * Each thread unwinds into its own stack_logging_thread_buffer and looks the
+ * backtrace up in a small per-thread cache of stacks that it has already
+ * entered into the uniquing table. Stack ids never change once assigned (an
+ * expanded table keeps the old nodes in place), so a hit needs no lock at all;
+ * only a miss takes stack_logging_lock to run enter_frames_in_table(). Full
+ * mode stores the thread id as the coldest frame, which is what makes the
+ * cache naturally per-thread.
+ *
+ * The finished record is stamped with a global sequence number and appended to
+ * the thread's staging buffer under the buffer's own lock. A background thread
+ * wakes every STACK_LOGGING_FLUSH_INTERVAL_MS, takes stack_logging_lock and
+ * every buffer lock, and merges the staged records into the shared index
+ * buffer in sequence order, so the index still lists a free before the malloc
+ * that reuses the address even when the two came from different threads. A
+ * thread whose buffer fills up does the same flush itself.
+ *
+ * Records are visible to analysis tools only once they have been flushed, so
+ * a tool inspecting a suspended process can miss up to one flush interval of
+ * history. Reading our own task flushes first. Compaction of a malloc that is
+ * immediately freed happens within a thread's buffer.
+ *
+ * Lock order is stack_logging_lock, then buffer locks. A thread never takes
+ * stack_logging_lock while holding its own buffer lock.
+ */
+
+static MALLOC_ALWAYS_INLINE uint64_t
+stack_id_cache_hash(const mach_vm_address_t *frames, uint32_t count)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (uint32_t i = 0; i < count; i++) {
+		hash = (hash ^ frames[i]) * 0x100000001b3ull;
+	}
+	return hash ^ count;
+}
+
+// Caller holds stack_logging_lock.
+static void
+flush_staged_events_while_locked(void)
+{
+	stack_logging_thread_buffer *tb;
+
+	if (!pre_write_buffers) {
+		return;
+	}
+
+	for (tb = thread_buffers; tb; tb = tb->next) {
+		_malloc_lock_lock(&tb->lock);
+		tb->flushed = 0;
+	}
+
+	// Every thread's records are already in sequence order, and a sequence
+	// number is only taken with the thread's buffer locked, so with all the
+	// buffer locks held a merge of the buffers sees every record that has been
+	// numbered so far.
+	for (;;) {
+		stack_logging_thread_buffer *next = NULL;
+		for (tb = thread_buffers; tb; tb = tb->next) {
+			if (tb->flushed < tb->count &&
+					(!next || tb->events[tb->flushed].seq < next->events[next->flushed].seq)) {
+				next = tb;
+			}
+		}
+		if (!next) {
+			break;
+		}
+		append_index_event_while_locked(&next->events[next->flushed++].event);
+	}
+
+	for (tb = thread_buffers; tb; tb = tb->next) {
+		tb->count = 0;
+		_malloc_lock_unlock(&tb->lock);
+	}
+
+	// The record before the next one written directly is no longer the last
+	// malloc that the direct path knows about.
+	last_logged_malloc_address = 0ul;
+}
+
+static void
+flush_staged_events(void)
+{
+	__malloc_lock_stack_logging();
+	flush_staged_events_while_locked();
+	__malloc_unlock_stack_logging();
+}
+
+static void *
+staged_logging_flusher_thread(void *arg MALLOC_UNUSED)
+{
+	pthread_setname_np("com.apple.malloc.stack-logging");
+
+	uint64_t interval = STACK_LOGGING_FLUSH_INTERVAL_MS * NSEC_PER_MSEC;
+	mach_timebase_info_data_t timebase;
+	mach_timebase_info(&timebase);
+	interval = interval * timebase.denom / timebase.numer;
+
+	for (;;) {
+		mach_wait_until(mach_absolute_time() + interval);
+
+		__malloc_lock_stack_logging();
+		if (stack_logging_enable_logging) {
+			flush_staged_events_while_locked();
+		}
+		__malloc_unlock_stack_logging();
+	}
+	return NULL;
+}
+
+static void
+staged_logging_thread_buffer_destroy(void *arg)
+{
+	stack_logging_thread_buffer *tb = arg;
+
+	// pthread has already cleared our key, so anything logged by later TSD
+	// destructors gets a fresh buffer, which the next pass hands back again.
+	__malloc_lock_stack_logging();
+	flush_staged_events_while_locked();
+	tb->thread = 0;
+	__malloc_unlock_stack_logging();
+}
+
+static void
+staged_logging_start(void *context MALLOC_UNUSED)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_set_qos_class_np(&attr, QOS_CLASS_UTILITY, 0);
+	if (pthread_create(&thread, &attr, staged_logging_flusher_thread, NULL)) {
+		// Without the flusher, records still reach the index file whenever a
+		// thread fills its buffer or exits.
+		malloc_report(ASL_LEVEL_ERR, "Failed to start the stack logging flusher thread, error: %d\n", errno);
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static MALLOC_NOINLINE stack_logging_thread_buffer *
+staged_logging_thread_buffer_create(vm_address_t self_thread)
+{
+	stack_logging_thread_buffer *tb;
+
+	__malloc_lock_stack_logging();
+	for (tb = thread_buffers; tb; tb = tb->next) {
+		if (tb->thread == 0) {
+			break;
+		}
+	}
+	if (!tb) {
+		// The pages are logged as a VM allocation of our own and dropped, since
+		// we hold stack_logging_lock.
+		tb = sld_allocate_pages((uint64_t)round_page(sizeof(stack_logging_thread_buffer)));
+		if (tb) {
+			_malloc_lock_init(&tb->lock);
+			tb->next = thread_buffers;
+			thread_buffers = tb;
+		}
+	}
+	if (tb) {
+		tb->thread = self_thread;
+		tb->count = 0;
+		tb->cache_generation = os_atomic_load(&stack_id_cache_generation, relaxed);
+		bzero(tb->cache, sizeof(tb->cache));
+		pthread_setspecific(staged_logging_key, tb);
+	}
+	__malloc_unlock_stack_logging();
+	return tb;
+}
+
+// Returns the stack id for the calling thread's backtrace, entering it into
+// the uniquing table only when it is not in the thread's cache.
+// 'num_hot_to_skip' counts the frames above staged_logging_log_stack().
+static MALLOC_NOINLINE uint64_t
+staged_logging_enter_stack(stack_logging_thread_buffer *tb, vm_address_t self_thread, uint32_t num_hot_to_skip)
+{
+	uint32_t count;
+	thread_stack_pcs(tb->stack, STACK_LOGGING_MAX_STACK_SIZE - 1, &count);
+	tb->stack[count++] = self_thread + 1;
+
+	num_hot_to_skip += 3; // staged_logging_log_stack | staged_logging_enter_stack | thread_stack_pcs
+	if (count <= num_hot_to_skip) {
+		return __invalid_stack_id;
+	}
+	count -= num_hot_to_skip;
+
+#if __LP64__
+	mach_vm_address_t *frames = (mach_vm_address_t *)tb->stack + num_hot_to_skip;
+#else
+	mach_vm_address_t frames[STACK_LOGGING_MAX_STACK_SIZE];
+	uint32_t i;
+	for (i = 0; i < count; i++) {
+		frames[i] = tb->stack[i + num_hot_to_skip];
+	}
+#endif
+
+	uint64_t generation = os_atomic_load(&stack_id_cache_generation, relaxed);
+	if (tb->cache_generation != generation) {
+		bzero(tb->cache, sizeof(tb->cache));
+		tb->cache_generation = generation;
+	}
+
+	uint64_t hash = stack_id_cache_hash(frames, count);
+	stack_id_cache_entry *entry = NULL;
+	if (count <= STACK_ID_CACHE_MAX_FRAMES) {
+		entry = &tb->cache[hash & (STACK_ID_CACHE_ENTRIES - 1)];
+		if (entry->count == count && entry->hash == hash &&
+				memcmp(entry->frames, frames, count * sizeof(mach_vm_address_t)) == 0) {
+			return entry->stack_id;
+		}
+	}
+
+	uint64_t uniqueStackIdentifier = __invalid_stack_id;
+	__malloc_lock_stack_logging();
+	backtrace_uniquing_table *uniquing_table = pre_write_buffers ? pre_write_buffers->uniquing_table : NULL;
+	if (uniquing_table) {
+		while (!enter_frames_in_table(uniquing_table, &uniqueStackIdentifier, frames, count, 0)) {
+			if (!__expand_uniquing_table(uniquing_table)) {
+				uniqueStackIdentifier = __invalid_stack_id;
+				break;
+			}
+		}
+	}
+	__malloc_unlock_stack_logging();
+
+	if (entry && uniqueStackIdentifier != __invalid_stack_id) {
+		entry->hash = hash;
+		entry->stack_id = uniqueStackIdentifier;
+		entry->count = count;
+		memcpy(entry->frames, frames, count * sizeof(mach_vm_address_t));
+	}
+	return uniqueStackIdentifier;
+}
+
+static MALLOC_NOINLINE void
+staged_logging_log_stack(uint32_t type_flags, uintptr_t ptr_arg, uintptr_t size, uintptr_t return_val,
+		vm_address_t self_thread, uint32_t num_hot_to_skip)
+{
+	stack_logging_thread_buffer *tb = pthread_getspecific(staged_logging_key);
+	if (!tb) {
+		tb = staged_logging_thread_buffer_create(self_thread);
+		if (!tb) {
+			return;
+		}
+	}
+
+	boolean_t is_alloc = (type_flags & stack_logging_type_alloc) || (type_flags & stack_logging_type_vm_allocate);
+	uintptr_t address = STACK_LOGGING_DISGUISE(is_alloc ? return_val : ptr_arg);
+
+	// compaction, before paying for the backtrace
+	if (logging_use_compaction && (type_flags & stack_logging_type_dealloc)) {
+		_malloc_lock_lock(&tb->lock);
+		if (tb->count) {
+			stack_logging_index_event *last = &tb->events[tb->count - 1].event;
+			if (last->address == address && (STACK_LOGGING_FLAGS(last->offset_and_flags) & stack_logging_type_alloc)) {
+				// *waves hand* the last allocation never occurred
+				tb->count--;
+				_malloc_lock_unlock(&tb->lock);
+				return;
+			}
+		}
+		_malloc_lock_unlock(&tb->lock);
+	}
+
+	// + 1 for __disk_stack_logging_log_stack
+	uint64_t uniqueStackIdentifier = staged_logging_enter_stack(tb, self_thread, num_hot_to_skip + 1);
+	if (uniqueStackIdentifier == __invalid_stack_id) {
+		return;
+	}
+
+	_malloc_lock_lock(&tb->lock);
+	if (tb->count == STACK_LOGGING_STAGED_EVENTS) {
+		_malloc_lock_unlock(&tb->lock);
+		flush_staged_events();
+		_malloc_lock_lock(&tb->lock);
+	}
+
+	staged_index_event *staged = &tb->events[tb->count++];
+	staged->seq = os_atomic_inc_orig(&staged_event_seq, relaxed);
+	staged->event.address = address;
+	staged->event.argument = size;
+	staged->event.offset_and_flags = STACK_LOGGING_OFFSET_AND_FLAGS(uniqueStackIdentifier, type_flags);
+	_malloc_lock_unlock(&tb->lock);
+}
+
 __attribute__((visibility("hidden"))) boolean_t
 __prepare_to_log_stacks(boolean_t lite_or_vmlite_mode)
 {
@@ -1292,11 +1650,25 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 		return;
 	}
 
+	// Pairs with the release store that publishes staged_logging_key.
+	if (os_atomic_load(&staged_logging_ready, acquire) && !stack_logging_mode_lite_or_vmlite) {
+		staged_logging_log_stack(type_flags, ptr_arg, size, return_val, self_thread, num_hot_to_skip);
+		return;
+	}
+
+	boolean_t start_staged_logging = false;
+
 	// lock and enter
 	_malloc_lock_lock(&stack_logging_lock);
 
 	thread_doing_logging = self_thread; // for preventing deadlock'ing on stack logging on a single thread
 
+	if (staged_logging_ready) {
+		// Buffered mode came up while we waited for the lock. Records staged
+		// since then happened before this one.
+		flush_staged_events_while_locked();
+	}
+
 	if (stack_logging_mode_lite_or_vmlite && (type_flags & stack_logging_type_vm_deallocate)) {
 		if (pre_write_buffers && pre_write_buffers->vm_stackid_table) {
 			radix_tree_delete(&pre_write_buffers->vm_stackid_table,
@@ -1318,6 +1690,18 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 		// Only do this second stage of setup when we first record a malloc (as opposed to a VM allocation),
 		// to ensure that the malloc zone has already been created as is necessary for this.
 		__prepare_to_log_stacks_stage2();
+
+		if (stack_logging_buffered && !stack_logging_mode_lite_or_vmlite && !staged_logging_ready) {
+			// The key must exist before any thread sees staged_logging_ready.
+			// libpthread reserves no TSD slot for us, so take a dynamic key; if
+			// none is left, keep logging unbuffered.
+			if (pthread_key_create(&staged_logging_key, staged_logging_thread_buffer_destroy) == 0) {
+				os_atomic_store(&staged_logging_ready, true, release);
+				start_staged_logging = true;
+			} else {
+				stack_logging_buffered = 0;
+			}
+		}
 	}
 
 	// compaction
@@ -1374,19 +1758,16 @@ __disk_stack_logging_log_stack(uint32_t type_flags,
 	//	the following line is a good debugging tool for logging each allocation event as it happens.
 	//	malloc_report(ASL_LEVEL_INFO, "{0x%lx, %lld}\n", STACK_LOGGING_DISGUISE(current_index.address), uniqueStackIdentifier);
 
-	// flush the data buffer to disk if necessary
-	if (pre_write_buffers->next_free_index_buffer_offset + sizeof(stack_logging_index_event) >= STACK_LOGGING_BLOCK_WRITING_SIZE) {
-		flush_data();
-	}
-
-	// store bytes in buffers
-	memcpy(pre_write_buffers->index_buffer + pre_write_buffers->next_free_index_buffer_offset, &current_index,
-			sizeof(stack_logging_index_event));
-	pre_write_buffers->next_free_index_buffer_offset += (uint32_t)sizeof(stack_logging_index_event);
+	// store bytes in buffers, flushing the data buffer to disk if necessary
+	append_index_event_while_locked(&current_index);
 
 out:
 	thread_doing_logging = 0;
 	_malloc_lock_unlock(&stack_logging_lock);
+
+	if (start_staged_logging) {
+		os_once(&staged_logging_flusher_pred, NULL, staged_logging_start);
+	}
 }
 
 void
@@ -1407,6 +1788,12 @@ __stack_logging_fork_child(void)
 	malloc_logger = NULL;
 	stack_logging_enable_logging = 0;
 	_malloc_lock_init(&stack_logging_lock);
+
+	// The flusher thread is gone and other threads' buffers may have been
+	// locked at the time of the fork; don't stage anything in the child.
+	stack_logging_buffered = 0;
+	staged_logging_ready = false;
+	thread_buffers = NULL;
 }
 
 void
@@ -1751,6 +2138,9 @@ update_cache_for_file_streams(remote_task_file_streams *descriptors)
 	bool update_snapshot = false;
 	if (descriptors->remote_task != mach_task_self()) {
 		task_suspend(descriptors->remote_task);
+	} else if (staged_logging_ready) {
+		// make our own staged records visible
+		flush_staged_events();
 	}
 
 	struct stat file_statistics;
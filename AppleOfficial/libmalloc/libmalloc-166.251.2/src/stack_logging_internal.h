@@ -29,6 +29,7 @@ extern int stack_logging_dontcompact; /* default is to compact; when set does no
 extern int stack_logging_finished_init; /* set after we've returned from the Libsystem initialiser */
 extern int stack_logging_postponed; /* set if we needed to postpone logging till after initialisation */
 extern int stack_logging_mode;
+extern int stack_logging_buffered; /* set to stage full and malloc mode records per thread and flush them from a background thread */
 
 extern const uint64_t __invalid_stack_id;
 
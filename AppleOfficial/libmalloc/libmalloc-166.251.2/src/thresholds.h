@@ -110,6 +110,15 @@
  */
 #define VM_COPY_THRESHOLD (2 * 1024 * 1024)
 
+/*
+ * Large blocks of at least LARGE_REALLOC_REMAP_THRESHOLD that cannot grow in
+ * place are moved by remapping their pages. The new mapping reserves as much
+ * address space again as the new size, up to LARGE_REALLOC_HEADROOM_MAX, so
+ * that a buffer which keeps doubling only moves every other time.
+ */
+#define LARGE_REALLOC_REMAP_THRESHOLD VM_COPY_THRESHOLD
+#define LARGE_REALLOC_HEADROOM_MAX (1024ull * 1024 * 1024)
+
 /*
  * <rdar://problem/6881926&27190324> Extremely old versions of Microsoft Word
  * (and, subsequently, versions of Adobe apps) required the Leopard behaviour
@@ -123,18 +132,20 @@
 
 /*
  * Large entry cache (death row) sizes. The large cache is bounded with
- * an overall top limit size, each entry is allowed a given slice of
- * that limit.
+ * an overall top limit size and a limit on the size of any one entry.
+ * Entries are kept in LARGE_CACHE_BUCKETS size buckets, four per power of
+ * two pages, so every cacheable size must map below the last bucket.
  */
 #if MALLOC_TARGET_64BIT
-#define LARGE_ENTRY_CACHE_SIZE 16
+#define LARGE_ENTRY_CACHE_SIZE 64
 #define LARGE_CACHE_SIZE_LIMIT ((vm_size_t)0x80000000) /* 2Gb */
-#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / LARGE_ENTRY_CACHE_SIZE)
+#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / 16) /* 128Mb */
 #else // MALLOC_TARGET_64BIT
-#define LARGE_ENTRY_CACHE_SIZE 8
+#define LARGE_ENTRY_CACHE_SIZE 16
 #define LARGE_CACHE_SIZE_LIMIT ((vm_size_t)0x02000000) /* 32Mb */
-#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / LARGE_ENTRY_CACHE_SIZE)
+#define LARGE_CACHE_SIZE_ENTRY_LIMIT (LARGE_CACHE_SIZE_LIMIT / 8) /* 4Mb */
 #endif // MALLOC_TARGET_64BIT
+#define LARGE_CACHE_BUCKETS 64
 
 /*
  * Large entry cache (death row) "flotsam" limits. Until the large cache
@@ -145,13 +156,62 @@
 #define SZONE_FLOTSAM_THRESHOLD_LOW (1024 * 512)
 #define SZONE_FLOTSAM_THRESHOLD_HIGH (1024 * 1024)
 
+/*
+ * Thread cache sizes. A thread may cache up to TCACHE_BIN_MAX_COUNT blocks of
+ * every tiny msize and of the TCACHE_SMALL_BINS smallest small msizes, subject
+ * to an overall per-thread byte limit (TCACHE_DEFAULT_MAX_BYTES unless set by
+ * MallocThreadCacheBytes). When a bin overflows, TCACHE_FLUSH_COUNT of its
+ * blocks are handed back to their magazines in one batch.
+ */
+#define TCACHE_TINY_BINS NUM_TINY_SLOTS
+#define TCACHE_SMALL_BINS 8
+#define TCACHE_BIN_MAX_COUNT 32
+#define TCACHE_FLUSH_COUNT (TCACHE_BIN_MAX_COUNT / 2)
+#define TCACHE_DEFAULT_MAX_BYTES (128 * 1024)
+#define TCACHE_MAX_BYTES_LIMIT (16 * 1024 * 1024)
+
+/*
+ * Free list slots for the small and medium allocators. Every msize that can be
+ * requested (up to NUM_SMALL_SLOTS or NUM_MEDIUM_SLOTS) has a free list of its
+ * own. Larger free blocks only arise from coalescing and are binned two-level
+ * segregated fit (TLSF) style: first by floor(log2(msize)), then by the next
+ * FREELIST_SL_SHIFT bits of the msize, so that each power of two is split into
+ * FREELIST_SL_COUNT lists. The blocks on one of these lists are within 25% of
+ * each other in size, and a whole region's worth of blocks needs only a few
+ * dozen extra slots.
+ *
+ * _n is the number of exact slots and _m the msize.
+ */
+#define FREELIST_SL_SHIFT 2
+#define FREELIST_SL_COUNT (1 << FREELIST_SL_SHIFT)
+#define FREELIST_FLS(_m) (31 - __builtin_clz((unsigned)(_m)))
+#define FREELIST_TLSF_INDEX(_m) \
+		((FREELIST_FLS(_m) << FREELIST_SL_SHIFT) | \
+		(((_m) >> (FREELIST_FLS(_m) - FREELIST_SL_SHIFT)) & (FREELIST_SL_COUNT - 1)))
+#define FREELIST_SLOT_FOR_MSIZE(_n, _m) \
+		(((_m) <= (_n)) ? ((_m) - 1) : \
+		((_n) + FREELIST_TLSF_INDEX(_m) - FREELIST_TLSF_INDEX((_n) + 1)))
+// The first slot whose blocks are all at least _m quanta: the slot for _m
+// itself, unless _m falls part way into a TLSF class.
+#define FREELIST_FIT_SLOT_FOR_MSIZE(_n, _m) \
+		(FREELIST_SLOT_FOR_MSIZE(_n, _m) + ((_m) > (_n) && \
+		((_m) & ((1 << (FREELIST_FLS(_m) - FREELIST_SL_SHIFT)) - 1)) != 0))
+#define FREELIST_SLOT_COUNT(_n, _max) (FREELIST_SLOT_FOR_MSIZE(_n, _max) + 1)
+// The smallest msize that goes to slot _s.
+#define FREELIST_TLSF_MIN_MSIZE(_t) \
+		((1 << ((_t) >> FREELIST_SL_SHIFT)) | \
+		(((_t) & (FREELIST_SL_COUNT - 1)) << (((_t) >> FREELIST_SL_SHIFT) - FREELIST_SL_SHIFT)))
+#define FREELIST_MIN_MSIZE_FOR_SLOT(_n, _s) \
+		(((_s) < (_n)) ? ((_s) + 1) : \
+		MAX((_n) + 1, FREELIST_TLSF_MIN_MSIZE((_s) - (_n) + FREELIST_TLSF_INDEX((_n) + 1))))
+
 /*
  * The magazine freelist array must be large enough to accomodate the allocation
- * granularity of the tiny, small and medium allocators. In addition, the last
- * slot in the list is special and reserved for coalesced regions bigger than
- * the overall max allocation size of the allocator.
+ * granularity of the tiny, small and medium allocators, plus the TLSF slots
+ * that the small and medium allocators use for coalesced blocks bigger than
+ * their maximum allocation size.
  */
-#define MAGAZINE_FREELIST_SLOTS (NUM_MEDIUM_SLOTS + 1)
+#define MAGAZINE_FREELIST_SLOTS FREELIST_SLOT_COUNT(NUM_MEDIUM_SLOTS, NUM_MEDIUM_BLOCKS)
 #define MAGAZINE_FREELIST_BITMAP_WORDS ((MAGAZINE_FREELIST_SLOTS + 31) >> 5)
 
 /*
@@ -203,17 +263,25 @@ MALLOC_STATIC_ASSERT(NUM_MEDIUM_SLOTS >= MEDIUM_LIMIT_THRESHOLD >> SHIFT_MEDIUM_
 // three allocators, so it must match (at least) the maxmium slot count of the
 // allocator with the largest range.
 //
-// Additionally, each allocator assumes that there is one additional free-list
-// slot above their maximum allocation size. This allows each allocator to
-// store an unordered list of maximally-sized free list entries.
+// Additionally, tiny assumes that there is one additional free-list slot above
+// its maximum allocation size, where it stores an unordered list of
+// maximally-sized free list entries. Small and medium need their TLSF slots.
 MALLOC_STATIC_ASSERT(NUM_TINY_SLOTS < MAGAZINE_FREELIST_SLOTS,
 		"NUM_TINY_SLOTS must be less than MAGAZINE_FREELIST_SLOTS");
 
-MALLOC_STATIC_ASSERT(NUM_SMALL_SLOTS < MAGAZINE_FREELIST_SLOTS,
-		"NUM_SMALL_SLOTS must be less than MAGAZINE_FREELIST_SLOTS");
+MALLOC_STATIC_ASSERT(FREELIST_SLOT_COUNT(NUM_SMALL_SLOTS, NUM_SMALL_BLOCKS) <= MAGAZINE_FREELIST_SLOTS,
+		"MAGAZINE_FREELIST_SLOTS must cover every SMALL free list slot");
+
+MALLOC_STATIC_ASSERT(FREELIST_SLOT_COUNT(NUM_MEDIUM_SLOTS, NUM_MEDIUM_BLOCKS) <= MAGAZINE_FREELIST_SLOTS,
+		"MAGAZINE_FREELIST_SLOTS must cover every MEDIUM free list slot");
+
+// The TLSF index needs FREELIST_SL_SHIFT bits below the leading one.
+MALLOC_STATIC_ASSERT(NUM_SMALL_SLOTS >= FREELIST_SL_COUNT && NUM_MEDIUM_SLOTS >= FREELIST_SL_COUNT,
+		"NUM_SMALL_SLOTS and NUM_MEDIUM_SLOTS must be at least FREELIST_SL_COUNT");
 
-MALLOC_STATIC_ASSERT(NUM_MEDIUM_SLOTS < MAGAZINE_FREELIST_SLOTS,
-		"NUM_MEDIUM_SLOTS must be less than MAGAZINE_FREELIST_SLOTS");
+// One summary bit per mag_bitmap word.
+MALLOC_STATIC_ASSERT(MAGAZINE_FREELIST_BITMAP_WORDS <= 32,
+		"mag_bitmap_summary must have a bit for every mag_bitmap word");
 
 MALLOC_STATIC_ASSERT(VM_COPY_THRESHOLD >= SMALL_LIMIT_THRESHOLD,
 		"VM_COPY_THRESHOLD must be larger than SMALL_LIMIT_THRESHOLD");
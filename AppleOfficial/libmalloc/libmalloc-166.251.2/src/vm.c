@@ -29,6 +29,9 @@ static volatile uintptr_t entropic_limit = 0;
 MALLOC_NOEXPORT
 uint64_t malloc_entropy[2] = {0, 0};
 
+MALLOC_NOEXPORT
+boolean_t mvm_large_pages_enabled = FALSE;
+
 #define ENTROPIC_KABILLION 0x10000000 /* 256Mb */
 
 // <rdar://problem/22277891> align 64bit ARM shift to 32MB PTE entries
@@ -101,6 +104,9 @@ mvm_allocate_pages(size_t size, unsigned char align, unsigned debug_flags, int v
 		} else {
 			allocation_size += 2 * vm_page_quanta_size;
 		}
+	} else {
+		align = mvm_large_page_align(allocation_size, align);
+		allocation_mask = ((mach_vm_offset_t)1 << align) - 1;
 	}
 
 	if (purgeable) {
@@ -178,6 +184,8 @@ mvm_allocate_pages_securely(size_t size, unsigned char align, int vm_page_label,
 	if (allocation_size < size) { // size_t arithmetic wrapped!
 		return NULL;
 	}
+	align = mvm_large_page_align(allocation_size, align);
+	allocation_mask = ((mach_vm_offset_t)1 << align) - 1;
 
 retry:
 	vm_addr = entropic_address;
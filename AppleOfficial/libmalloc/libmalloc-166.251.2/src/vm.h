@@ -31,6 +31,55 @@ mvm_aslr_enabled(void)
 	return _dyld_get_image_slide((const struct mach_header *)_NSGetMachExecuteHeader()) != 0;
 }
 
+/*
+ * Large page mode (MallocLargePages).
+ *
+ * Allocations of at least one large page are aligned to the large page size
+ * so that the pmap can map them with block entries, and madvise on the free
+ * path is clipped to whole large pages so that a densely used region is not
+ * broken up one base page at a time. Only regions of at least one large page
+ * are clipped; they are already aligned to their own size. Tiny regions, and
+ * small regions with 16KB pages, are smaller than a large page and keep
+ * madvising base pages. Large pages are only split back to base
+ * pages by the paths that deal with drained memory: the depot recirculation
+ * scans, the background scavenger and memory pressure relief.
+ *
+ * The large page size matches the block size of the pmap's last-but-one level:
+ * 2MB with 4KB pages and 32MB with 16KB pages.
+ */
+#if MALLOC_TARGET_IOS || __arm64__
+#define MVM_LARGE_PAGE_SHIFT 25
+#else // MALLOC_TARGET_IOS || __arm64__
+#define MVM_LARGE_PAGE_SHIFT 21
+#endif // MALLOC_TARGET_IOS || __arm64__
+#define MVM_LARGE_PAGE_SIZE ((uintptr_t)1 << MVM_LARGE_PAGE_SHIFT)
+
+MALLOC_NOEXPORT
+extern boolean_t mvm_large_pages_enabled;
+
+// Returns the alignment to use for an allocation of 'size' bytes.
+static MALLOC_INLINE unsigned char
+mvm_large_page_align(mach_vm_size_t size, unsigned char align)
+{
+	if (mvm_large_pages_enabled && size >= MVM_LARGE_PAGE_SIZE && align < MVM_LARGE_PAGE_SHIFT) {
+		return MVM_LARGE_PAGE_SHIFT;
+	}
+	return align;
+}
+
+// Shrinks the page range [*lo, *hi), which lies in a region of 'region_size'
+// bytes, to the whole large pages that it covers. Leaves *lo >= *hi if it does
+// not cover one. A region smaller than a large page can never be mapped with
+// one, so its range is left alone and is madvised a base page at a time.
+static MALLOC_INLINE void
+mvm_large_page_clip(uintptr_t *lo, uintptr_t *hi, size_t region_size)
+{
+	if (mvm_large_pages_enabled && region_size >= MVM_LARGE_PAGE_SIZE) {
+		*lo = (*lo + MVM_LARGE_PAGE_SIZE - 1) & ~(MVM_LARGE_PAGE_SIZE - 1);
+		*hi = *hi & ~(MVM_LARGE_PAGE_SIZE - 1);
+	}
+}
+
 MALLOC_NOEXPORT
 void
 mvm_aslr_init(void);
@@ -28,6 +28,7 @@
 #include "balloon.h"
 #include "big.h"
 #include "churn.h"
+#include "crossthread.h"
 #include "fragment.h"
 #include "list.h"
 #include "medium.h"
@@ -61,6 +62,8 @@ static const BenchmarkPair benchmarkPairs[] = {
     { "balloon", benchmark_balloon },
     { "big", benchmark_big },
     { "churn", benchmark_churn },
+    { "fan_in", benchmark_fan_in },
+    { "fan_out", benchmark_fan_out },
     { "fragment", benchmark_fragment },
     { "fragment_iterate", benchmark_fragment_iterate },
     { "list_allocate", benchmark_list_allocate },
@@ -69,6 +72,7 @@ static const BenchmarkPair benchmarkPairs[] = {
     { "memalign", benchmark_memalign },
     { "message_many", benchmark_message_many },
     { "message_one", benchmark_message_one },
+    { "producer_consumer", benchmark_producer_consumer },
     { "realloc", benchmark_realloc },
     { "stress", benchmark_stress },
     { "stress_aligned", benchmark_stress_aligned },
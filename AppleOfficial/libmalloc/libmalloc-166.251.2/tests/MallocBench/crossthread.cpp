@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2019 Apple Inc. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY APPLE INC. ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL APPLE INC. OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+#include "Benchmark.h"
+#include "CPUCount.h"
+#include "crossthread.h"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "mbmalloc.h"
+
+namespace {
+
+// A mix of tiny and small sizes.
+const size_t objectSizes[] = { 16, 48, 128, 400, 1024, 4096 };
+const size_t objectSizesCount = sizeof(objectSizes) / sizeof(objectSizes[0]);
+
+const size_t objectCount = 4 * 1024 * 1024; // Objects passed between threads per run.
+
+// Single producer, single consumer ring of allocated objects.
+class Channel {
+    static const size_t capacity = 1024;
+
+public:
+    Channel()
+        : m_head(0)
+        , m_tail(0)
+    {
+    }
+
+    void push(void* object)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        while (tail - m_head.load(std::memory_order_acquire) == capacity)
+            std::this_thread::yield();
+        m_buffer[tail % capacity] = object;
+        m_tail.store(tail + 1, std::memory_order_release);
+    }
+
+    // Returns 0 when the channel is empty.
+    void* tryPop()
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return 0;
+        void* object = m_buffer[head % capacity];
+        m_head.store(head + 1, std::memory_order_release);
+        return object;
+    }
+
+private:
+    void* m_buffer[capacity];
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+};
+
+struct ThreadReport {
+    const char* role;
+    size_t index;
+    size_t operations;
+    double elapsedMS;
+};
+
+// Allocates 'count' objects and hands them out round robin over 'channels'.
+void produce(std::vector<Channel*> channels, size_t count, ThreadReport* report)
+{
+    double start = Benchmark::currentTimeMS();
+    for (size_t i = 0; i < count; ++i) {
+        size_t size = objectSizes[i % objectSizesCount];
+        void* object = mbmalloc(size);
+        *static_cast<size_t*>(object) = size;
+        channels[i % channels.size()]->push(object);
+    }
+    report->operations = count;
+    report->elapsedMS = Benchmark::currentTimeMS() - start;
+}
+
+// Frees 'count' objects taken round robin from 'channels'.
+void consume(std::vector<Channel*> channels, size_t count, ThreadReport* report)
+{
+    double start = Benchmark::currentTimeMS();
+    size_t next = 0;
+    for (size_t i = 0; i < count; ) {
+        void* object = channels[next++ % channels.size()]->tryPop();
+        if (!object) {
+            std::this_thread::yield();
+            continue;
+        }
+        mbfree(object, *static_cast<size_t*>(object));
+        ++i;
+    }
+    report->operations = count;
+    report->elapsedMS = Benchmark::currentTimeMS() - start;
+}
+
+// Runs 'producers' threads feeding 'consumers' threads. When both are plural
+// the threads are paired, producer i feeding consumer i; otherwise every
+// producer has a channel to every consumer.
+void run(size_t producers, size_t consumers)
+{
+    bool isPaired = producers > 1 && consumers > 1;
+    size_t channelCount = isPaired ? producers : producers * consumers;
+    size_t perChannel = objectCount / channelCount;
+
+    std::vector<Channel*> channels;
+    for (size_t i = 0; i < channelCount; ++i)
+        channels.push_back(new Channel);
+
+    std::vector<ThreadReport> reports(producers + consumers);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < producers; ++i) {
+        std::vector<Channel*> mine;
+        for (size_t j = 0; j < (isPaired ? 1 : consumers); ++j)
+            mine.push_back(channels[isPaired ? i : i * consumers + j]);
+        reports[i] = { "producer", i, 0, 0 };
+        threads.push_back(std::thread(produce, mine, perChannel * mine.size(), &reports[i]));
+    }
+
+    for (size_t i = 0; i < consumers; ++i) {
+        std::vector<Channel*> mine;
+        for (size_t j = 0; j < (isPaired ? 1 : producers); ++j)
+            mine.push_back(channels[isPaired ? i : j * consumers + i]);
+        reports[producers + i] = { "consumer", i, 0, 0 };
+        threads.push_back(std::thread(consume, mine, perChannel * mine.size(), &reports[producers + i]));
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (auto& report : reports) {
+        double throughput = report.elapsedMS ? report.operations / report.elapsedMS : 0;
+        std::cout << "\t" << report.role << " " << report.index << ": "
+            << static_cast<size_t>(throughput) << " objects/ms" << std::endl;
+    }
+
+    for (auto channel : channels)
+        delete channel;
+}
+
+size_t threadCount()
+{
+    return std::max<size_t>(cpuCount(), 2);
+}
+
+} // namespace
+
+void benchmark_producer_consumer(bool isParallel)
+{
+    if (isParallel)
+        abort();
+
+    size_t pairs = threadCount() / 2;
+    run(pairs, pairs);
+}
+
+void benchmark_fan_in(bool isParallel)
+{
+    if (isParallel)
+        abort();
+
+    run(threadCount() - 1, 1);
+}
+
+void benchmark_fan_out(bool isParallel)
+{
+    if (isParallel)
+        abort();
+
+    run(1, threadCount() - 1);
+}
@@ -9,6 +9,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <malloc/malloc.h>
 
 static inline void*
@@ -127,3 +128,34 @@ T_DECL(calloc, "calloc all 512b increments <= 256kb",
 }
 #endif // !TARGET_OS_WATCH && !TARGET_OS_TV
 
+// Fresh regions are handed out without clearing, so interleave calloc with
+// blocks that were dirtied and freed to make sure those are still cleared.
+static void
+test_calloc_dirty(size_t s, size_t n)
+{
+	void *ptrs[n];
+	for (size_t i = 0; i < n; i++) {
+		ptrs[i] = malloc(s);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "allocation");
+		memset(ptrs[i], 0xa5, s);
+	}
+	for (size_t i = 0; i < n; i += 2) {
+		free(ptrs[i]);
+	}
+	for (size_t i = 0; i < n; i += 2) {
+		ptrs[i] = t_calloc(1, s);
+	}
+	for (size_t i = 0; i < n; i++) {
+		free(ptrs[i]);
+	}
+}
+
+T_DECL(calloc_dirty, "calloc of freed and fresh blocks",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	test_calloc_dirty(16, 1000);		// tiny
+	test_calloc_dirty(512, 1000);		// tiny
+	test_calloc_dirty(2048, 200);		// small
+	test_calloc_dirty(32 * 1024, 50);	// small or medium
+	test_calloc_dirty(256 * 1024, 20);	// medium or large
+}
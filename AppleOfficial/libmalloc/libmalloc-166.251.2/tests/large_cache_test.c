@@ -0,0 +1,117 @@
+//
+//  large_cache_test.c
+//  libmalloc
+//
+//  Tests for the size-bucketed large allocation cache (death row).
+//
+#include <darwintest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+static void
+get_stats(malloc_zone_t *zone, malloc_large_cache_statistics_t *stats)
+{
+	T_QUIET; T_ASSERT_TRUE(scalable_zone_large_cache_statistics(zone, stats),
+			"large cache statistics are available");
+}
+
+T_DECL(large_cache_reuse, "Freed large blocks are reused for similar sizes",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	const size_t sizes[] = { 200 * 1024, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024 };
+	malloc_large_cache_statistics_t before, after;
+
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		void *ptr = malloc_zone_malloc(zone, sizes[i]);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc(%zu)", sizes[i]);
+		memset(ptr, 0xa5, sizes[i]);
+		malloc_zone_free(zone, ptr);
+
+		get_stats(zone, &before);
+		T_EXPECT_GE(before.bytes_cached, sizes[i], "free(%zu) was cached", sizes[i]);
+
+		// A slightly smaller request is served from the same bucket.
+		void *ptr2 = malloc_zone_malloc(zone, sizes[i] - 4096);
+		get_stats(zone, &after);
+
+		T_EXPECT_EQ(ptr2, ptr, "malloc(%zu) reuses the cached block", sizes[i] - 4096);
+		T_EXPECT_EQ(after.hits, before.hits + 1, "hit counted");
+		malloc_zone_free(zone, ptr2);
+	}
+
+	malloc_destroy_zone(zone);
+}
+
+T_DECL(large_cache_calloc, "calloc() clears blocks taken from the large cache",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	const size_t size = 512 * 1024;
+
+	unsigned char *ptr = malloc_zone_malloc(zone, size);
+	T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc(%zu)", size);
+	memset(ptr, 0xa5, size);
+	malloc_zone_free(zone, ptr);
+
+	ptr = malloc_zone_calloc(zone, 1, size);
+	T_QUIET; T_ASSERT_NOTNULL(ptr, "calloc(%zu)", size);
+	for (size_t i = 0; i < size; i++) {
+		if (ptr[i]) {
+			T_FAIL("calloc(%zu) byte %zu is 0x%x", size, i, ptr[i]);
+			break;
+		}
+	}
+	malloc_zone_free(zone, ptr);
+	T_PASS("calloc() returned a zeroed block");
+
+	malloc_destroy_zone(zone);
+}
+
+T_DECL(large_cache_no_overfit, "Blocks more than twice the request are not reused",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	malloc_large_cache_statistics_t before, after;
+
+	void *big = malloc_zone_malloc(zone, 4 * 1024 * 1024);
+	T_QUIET; T_ASSERT_NOTNULL(big, "malloc(4MB)");
+	malloc_zone_free(zone, big);
+
+	get_stats(zone, &before);
+	void *small = malloc_zone_malloc(zone, 1024 * 1024);
+	get_stats(zone, &after);
+
+	T_EXPECT_NE(small, big, "4MB block not used for a 1MB request");
+	T_EXPECT_EQ(after.misses, before.misses + 1, "miss counted");
+	malloc_zone_free(zone, small);
+
+	malloc_destroy_zone(zone);
+}
+
+T_DECL(large_cache_bounded, "The large cache evicts its oldest entries when full",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	malloc_large_cache_statistics_t stats;
+	const int count = 256;
+	void *ptrs[count];
+
+	for (int i = 0; i < count; i++) {
+		ptrs[i] = malloc_zone_malloc(zone, 256 * 1024 + i * 4096);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc");
+		memset(ptrs[i], 0xa5, 256 * 1024);
+	}
+	for (int i = 0; i < count; i++) {
+		malloc_zone_free(zone, ptrs[i]);
+	}
+
+	get_stats(zone, &stats);
+	T_EXPECT_LE(stats.entries, stats.max_entries, "cache stays within its slots");
+	T_EXPECT_LE(stats.bytes_resident, stats.reserve_limit, "cache stays within its byte budget");
+	T_EXPECT_GT(stats.evictions, 0ULL, "old entries were evicted");
+
+	malloc_destroy_zone(zone);
+}
@@ -6,6 +6,7 @@
 //
 #include <darwintest.h>
 #include <stdlib.h>
+#include <string.h>
 #include <malloc/malloc.h>
 
 T_DECL(malloc_zone_batch, "malloc_zone_batch_malloc and malloc_zone_batch_free")
@@ -36,3 +37,37 @@ T_DECL(malloc_zone_batch, "malloc_zone_batch_malloc and malloc_zone_batch_free")
 	malloc_zone_batch_free(malloc_default_zone(), results, count);
 	free(results);
 }
+
+T_DECL(malloc_zone_batch_tiny_regions, "batch malloc and free across tiny regions",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	// Enough 64-byte blocks to need more than one tiny region.
+	const unsigned count = 32768;
+	void **results = calloc(count, sizeof(void *));
+	void **freed = calloc(count, sizeof(void *));
+	unsigned number;
+
+	for (int pass = 0; pass < 2; pass++) {
+		number = malloc_zone_batch_malloc(malloc_default_zone(), 64, results, count);
+		T_ASSERT_EQ(number, count, "allocated the whole batch from tiny");
+		for (int i = 0; i < count; i++) {
+			T_QUIET; T_ASSERT_EQ(malloc_size(results[i]), 64UL, "pointer %d has the wrong size", i);
+			memset(results[i], 0xa5, 64);
+		}
+
+		// Free in reverse order, so that batch free has to regroup the
+		// pointers by region. It may overwrite the array, so keep a copy.
+		for (int i = 0; i < count / 2; i++) {
+			void *tmp = results[i];
+			results[i] = results[count - 1 - i];
+			results[count - 1 - i] = tmp;
+		}
+		memcpy(freed, results, count * sizeof(void *));
+		malloc_zone_batch_free(malloc_default_zone(), results, count);
+		for (int i = 0; i < count; i++) {
+			T_QUIET; T_ASSERT_EQ(malloc_size(freed[i]), 0UL, "pointer %d was not freed", i);
+		}
+	}
+	free(freed);
+	free(results);
+}
@@ -123,3 +123,45 @@ T_DECL(basic_small_realloc_in_place, "small rack realloc in place")
 
 	free_small(&rack, ptr, SMALL_REGION_FOR_PTR(ptr), 0);
 }
+
+T_DECL(small_free_list_good_fit, "coalesced blocks are binned by size")
+{
+	struct rack_s rack;
+	test_rack_setup(&rack);
+
+	// Build two coalesced free blocks of 2 and 4 maximally-sized allocations,
+	// separated by blocks that stay in use. The larger one is freed last, so
+	// it is at the head of any shared free list.
+	const msize_t msize = NUM_SMALL_SLOTS;
+	void *ptrs[9];
+	for (int i = 0; i < 9; i++) {
+		ptrs[i] = small_malloc_should_clear(&rack, msize, false);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "allocation %d", i);
+	}
+	void *flush = small_malloc_should_clear(&rack, 1, false);
+	T_QUIET; T_ASSERT_NOTNULL(flush, "flush allocation");
+
+	for (int i = 1; i < 3; i++) {
+		free_small(&rack, ptrs[i], SMALL_REGION_FOR_PTR(ptrs[i]), 0);
+	}
+	for (int i = 4; i < 8; i++) {
+		free_small(&rack, ptrs[i], SMALL_REGION_FOR_PTR(ptrs[i]), 0);
+	}
+
+	// Push the last block out of the one-entry death row cache with a block of
+	// a different size, so that the next allocation goes to the free lists.
+	free_small(&rack, flush, SMALL_REGION_FOR_PTR(flush), 0);
+
+	magazine_t *mag_ptr = &rack.magazines[MAGAZINE_INDEX_FOR_SMALL_REGION(SMALL_REGION_FOR_PTR(ptrs[0]))];
+	T_ASSERT_EQ(SMALL_PTR_SIZE(ptrs[1]), (msize_t)(2 * msize), "first run coalesced");
+	T_ASSERT_EQ(SMALL_PTR_SIZE(ptrs[4]), (msize_t)(4 * msize), "second run coalesced");
+	T_ASSERT_NE(SMALL_FREE_SLOT_FOR_MSIZE(&rack, 2 * msize),
+			SMALL_FREE_SLOT_FOR_MSIZE(&rack, 4 * msize), "runs are on different free lists");
+	T_ASSERT_EQ(magazine_bitmap_find(mag_ptr, SMALL_FREE_FIT_SLOT_FOR_MSIZE(&rack, msize)),
+			(int)SMALL_FREE_SLOT_FOR_MSIZE(&rack, 2 * msize), "bitmap finds the smaller run");
+
+	void *ptr = small_malloc_should_clear(&rack, msize, false);
+	T_ASSERT_EQ_PTR(ptr, ptrs[1], "allocation splits the smaller run");
+	T_ASSERT_TRUE(small_free_list_check(&rack, SMALL_FREE_SLOT_FOR_MSIZE(&rack, msize), 0),
+			"free list slot for the leftover is consistent");
+}
@@ -64,4 +64,60 @@ szone_malloc(szone_t *szone, size_t size)
 	__builtin_trap();
 }
 
+#if CONFIG_THREAD_CACHE
+void *
+thread_cache_malloc(rack_t *rack, msize_t msize)
+{
+	__builtin_trap();
+}
+
+boolean_t
+thread_cache_free(rack_t *rack, void *ptr, msize_t msize)
+{
+	__builtin_trap();
+}
+#endif // CONFIG_THREAD_CACHE
+
+#if CONFIG_ZONE_INDEX
+// The racks under test aren't part of a registered zone, so there is nothing
+// to index.
+void
+malloc_zone_index_insert(malloc_zone_t *zone, vm_address_t addr, vm_size_t size)
+{
+}
+
+void
+malloc_zone_index_remove(vm_address_t addr, vm_size_t size)
+{
+}
+#endif // CONFIG_ZONE_INDEX
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+void
+mag_remote_free_collect(task_t task, memory_reader_t reader, rack_t *rack, magazine_t *mags,
+		remote_free_set_t *set)
+{
+	__builtin_trap();
+}
+
+void
+mag_remote_free_release(remote_free_set_t *set)
+{
+	__builtin_trap();
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
+
+#if CONFIG_SCAVENGER
+// The scavenger is never enabled in these tests, so depot regions are always
+// madvised on the free path.
+malloc_scavenger_config_t malloc_scavenger_config;
+
+void
+malloc_scavenger_tick_charge(malloc_scavenger_tick_t *tick,
+		malloc_scavenger_kind_t kind, size_t bytes)
+{
+	__builtin_trap();
+}
+#endif // CONFIG_SCAVENGER
+
 #endif // __MAGAZINE_TESTING
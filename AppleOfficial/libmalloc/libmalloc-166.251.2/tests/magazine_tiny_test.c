@@ -7,6 +7,7 @@
 //
 
 #include <darwintest.h>
+#include <pthread.h>
 
 #include "../src/magazine_tiny.c"
 #include "magazine_testing.h"
@@ -122,3 +123,107 @@ T_DECL(basic_tiny_realloc_in_place, "tiny rack realloc in place")
 
 	free_tiny(&rack, ptr, TINY_REGION_FOR_PTR(ptr), 0);
 }
+
+#if CONFIG_MAGAZINE_REMOTE_FREE
+// Makes the calling thread, and any thread it starts, use the given magazine.
+static void
+test_use_magazine(rack_t *rack, mag_index_t mag_index)
+{
+	for (unsigned cpu = 0; cpu < 64; cpu++) {
+		_os_cpu_number_override = cpu;
+		if (tiny_mag_get_thread_index() % rack->num_magazines == mag_index) {
+			return;
+		}
+	}
+	T_ASSERT_FAIL("no cpu number selects magazine %d", mag_index);
+}
+
+struct test_remote_free_args {
+	rack_t *rack;
+	void *ptr;
+};
+
+static void *
+test_remote_free_thread(void *arg)
+{
+	struct test_remote_free_args *args = arg;
+	free_tiny(args->rack, args->ptr, TINY_REGION_FOR_PTR(args->ptr), 0);
+	return NULL;
+}
+
+// Frees ptr on a thread that uses another magazine while this thread holds
+// the block's magazine lock, so the block is queued on the remote free list.
+static void
+test_remote_free(rack_t *rack, void *ptr)
+{
+	mag_index_t mag_index = MAGAZINE_INDEX_FOR_TINY_REGION(TINY_REGION_FOR_PTR(ptr));
+	magazine_t *mag_ptr = &rack->magazines[mag_index];
+	struct test_remote_free_args args = { rack, ptr };
+	pthread_t thread;
+
+	SZONE_MAGAZINE_PTR_LOCK(mag_ptr);
+	test_use_magazine(rack, mag_index ? 0 : 1);
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, test_remote_free_thread, &args), "pthread_create");
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	SZONE_MAGAZINE_PTR_UNLOCK(mag_ptr);
+
+	T_ASSERT_EQ_PTR((void *)mag_ptr->mag_remote_free, ptr, "block queued on the remote free list");
+	T_ASSERT_EQ((int)tiny_size(rack, ptr), 32, "queued block is still marked in use");
+}
+
+T_DECL(tiny_remote_free_reuse, "tiny block freed by another thread is reused")
+{
+	// Pressure relief takes the szone lock, so the rack must be in a szone.
+	static szone_t szone;
+	rack_t *rack = &szone.tiny_rack;
+	rack_init(rack, RACK_TYPE_TINY, 2, 0);
+	T_QUIET; T_ASSERT_NOTNULL(rack->magazines, "magazine initialisation");
+
+	// Keep the block's neighbours in use so that it isn't coalesced.
+	test_use_magazine(rack, 0);
+	void *before = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	void *ptr = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	void *after = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	T_QUIET; T_ASSERT_TRUE(before && ptr && after, "allocations");
+
+	test_remote_free(rack, ptr);
+
+	test_use_magazine(rack, 0);
+	void *again = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	T_ASSERT_EQ_PTR(again, ptr, "queued block reused");
+	T_ASSERT_NULL((void *)rack->magazines[0].mag_remote_free, "remote free list drained");
+}
+
+T_DECL(tiny_remote_free_pressure_relief, "pressure relief frees tiny blocks queued by other threads")
+{
+	static szone_t szone;
+	rack_t *rack = &szone.tiny_rack;
+	rack_init(rack, RACK_TYPE_TINY, 2, 0);
+	T_QUIET; T_ASSERT_NOTNULL(rack->magazines, "magazine initialisation");
+
+	test_use_magazine(rack, 0);
+	void *before = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	void *ptr = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	void *after = tiny_malloc_should_clear(rack, TINY_MSIZE_FOR_BYTES(32), false);
+	T_QUIET; T_ASSERT_TRUE(before && ptr && after, "allocations");
+
+	test_remote_free(rack, ptr);
+
+#if CONFIG_MADVISE_PRESSURE_RELIEF
+	tiny_madvise_pressure_relief(rack);
+#else
+	tiny_free_remote_all(rack);
+#endif
+	T_ASSERT_NULL((void *)rack->magazines[0].mag_remote_free, "remote free list drained");
+	T_ASSERT_EQ((int)tiny_size(rack, ptr), 0, "queued block freed");
+
+	// The counts that szone_statistics() adds up.
+	size_t objects = 0, bytes = 0;
+	for (mag_index_t mag_index = -1; mag_index < rack->num_magazines; mag_index++) {
+		objects += rack->magazines[mag_index].mag_num_objects;
+		bytes += rack->magazines[mag_index].mag_num_bytes_in_objects;
+	}
+	T_ASSERT_EQ(objects, 2ul, "blocks in use");
+	T_ASSERT_EQ(bytes, 64ul, "bytes in use");
+}
+#endif // CONFIG_MAGAZINE_REMOTE_FREE
@@ -0,0 +1,143 @@
+//
+//  malloc_snapshot_test.c
+//  libmalloc
+//
+//  Tests for malloc_zone_snapshot() and malloc_zone_restore().
+//
+
+#include <darwintest.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+#define NUM_NODES 4096
+#define LARGE_SIZE (1024 * 1024)
+
+typedef struct node_s {
+	struct node_s *next;
+	size_t value;
+	char payload[40];
+} node_t;
+
+static int
+open_tmp(char *path)
+{
+	int fd = mkstemp(path);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "mkstemp");
+	return fd;
+}
+
+T_DECL(snapshot_restore, "A zone restored from a snapshot keeps its contents and allocates",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	char path[] = "/tmp/malloc_snapshot_test.XXXXXX";
+	int fd = open_tmp(path);
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+
+	// A linked list of tiny nodes, a small table pointing at them and a
+	// large buffer, as a process might build at startup.
+	node_t *head = NULL;
+	node_t **table = malloc_zone_malloc(zone, NUM_NODES * sizeof(node_t *));
+	for (size_t i = 0; i < NUM_NODES; i++) {
+		node_t *node = malloc_zone_malloc(zone, sizeof(node_t));
+		T_QUIET; T_ASSERT_NOTNULL(node, "malloc");
+		node->next = head;
+		node->value = i;
+		head = node;
+		table[i] = node;
+	}
+	unsigned char *large = malloc_zone_malloc(zone, LARGE_SIZE);
+	memset(large, 0x5a, LARGE_SIZE);
+
+	T_ASSERT_POSIX_ZERO(malloc_zone_snapshot(zone, fd), "snapshot");
+
+	errno = 0;
+	T_EXPECT_EQ_PTR(malloc_zone_restore(fd), NULL, "restore fails while the zone is mapped");
+	T_EXPECT_EQ(errno, EEXIST, "errno is EEXIST");
+
+	malloc_destroy_zone(zone);
+
+	malloc_zone_t *restored = malloc_zone_restore(fd);
+	T_ASSERT_NOTNULL(restored, "restore");
+	T_EXPECT_EQ_PTR(restored, zone, "restored at the same address");
+	close(fd);
+	unlink(path);
+
+	size_t count = 0;
+	for (node_t *node = head; node; node = node->next) {
+		T_QUIET; T_ASSERT_EQ(node->value, NUM_NODES - 1 - count, "list value");
+		count++;
+	}
+	T_EXPECT_EQ(count, (size_t)NUM_NODES, "list restored");
+	T_EXPECT_EQ_PTR(malloc_zone_from_ptr(table[0]), restored, "blocks belong to the restored zone");
+	T_EXPECT_EQ(malloc_size(large), (size_t)LARGE_SIZE, "large block restored");
+	T_EXPECT_EQ(large[LARGE_SIZE - 1], 0x5a, "large contents restored");
+
+	// The restored zone frees and allocates as usual.
+	for (size_t i = 0; i < NUM_NODES; i += 2) {
+		malloc_zone_free(restored, table[i]);
+	}
+	for (size_t i = 0; i < NUM_NODES; i += 2) {
+		table[i] = malloc_zone_malloc(restored, sizeof(node_t));
+		T_QUIET; T_ASSERT_NOTNULL(table[i], "malloc after restore");
+		table[i]->value = i;
+	}
+	large = malloc_zone_realloc(restored, large, 2 * LARGE_SIZE);
+	T_EXPECT_EQ(large[0], 0x5a, "realloc keeps the contents");
+	T_EXPECT_TRUE(malloc_zone_check(restored), "zone is consistent");
+
+	malloc_destroy_zone(restored);
+}
+
+T_DECL(snapshot_skips_untouched_pages, "Taking a snapshot does not fault in untouched pages",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	char path[] = "/tmp/malloc_snapshot_test.XXXXXX";
+	int fd = open_tmp(path);
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	size_t page_size = (size_t)getpagesize();
+
+	// Growing a large block leaves untouched realloc headroom after it.
+	unsigned char *large = malloc_zone_malloc(zone, LARGE_SIZE);
+	memset(large, 0x5a, LARGE_SIZE);
+	large = malloc_zone_realloc(zone, large, 2 * LARGE_SIZE);
+	T_ASSERT_NOTNULL(large, "realloc");
+	unsigned char *untouched = large + 2 * LARGE_SIZE;
+	char vec = 0;
+	if (mincore(untouched, page_size, &vec) == -1) {
+		T_SKIP("realloc left no headroom");
+	}
+	T_QUIET; T_ASSERT_FALSE(vec & MINCORE_INCORE, "headroom is not resident");
+
+	T_ASSERT_POSIX_ZERO(malloc_zone_snapshot(zone, fd), "snapshot");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(mincore(untouched, page_size, &vec), "mincore");
+	T_EXPECT_FALSE(vec & MINCORE_INCORE, "headroom is still not resident");
+
+	malloc_destroy_zone(zone);
+	close(fd);
+	unlink(path);
+}
+
+T_DECL(snapshot_restore_invalid, "Restoring a file that is not a snapshot fails",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	char path[] = "/tmp/malloc_snapshot_test.XXXXXX";
+	int fd = open_tmp(path);
+	char junk[4096];
+
+	memset(junk, 0xff, sizeof(junk));
+	T_QUIET; T_ASSERT_EQ(write(fd, junk, sizeof(junk)), (ssize_t)sizeof(junk), "write");
+
+	errno = 0;
+	T_EXPECT_EQ_PTR(malloc_zone_restore(fd), NULL, "restore fails");
+	T_EXPECT_EQ(errno, EINVAL, "errno is EINVAL");
+
+	close(fd);
+	unlink(path);
+}
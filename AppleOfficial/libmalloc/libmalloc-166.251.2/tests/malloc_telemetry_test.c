@@ -0,0 +1,121 @@
+//
+//  malloc_telemetry_test.c
+//  libmalloc
+//
+//  Tests for per size class and per magazine telemetry.
+//
+
+#include <darwintest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+#define NUM_BLOCKS 4096
+
+static void *blocks[NUM_BLOCKS];
+
+static malloc_zone_telemetry_t *
+get_telemetry(malloc_zone_t *zone)
+{
+	malloc_zone_telemetry_t *telemetry = calloc(1, sizeof(*telemetry));
+	T_QUIET; T_ASSERT_NOTNULL(telemetry, "calloc");
+
+	telemetry->version = MALLOC_ZONE_TELEMETRY_VERSION;
+	T_QUIET; T_ASSERT_TRUE(malloc_zone_telemetry(zone, telemetry),
+			"telemetry is available");
+	return telemetry;
+}
+
+static const malloc_size_class_telemetry_t *
+find_size_class(const malloc_allocator_telemetry_t *telemetry, size_t size)
+{
+	for (unsigned i = 0; i < telemetry->num_size_classes; i++) {
+		if (telemetry->size_classes[i].size == size) {
+			return &telemetry->size_classes[i];
+		}
+	}
+	T_FAIL("no size class of %zu bytes", size);
+	return NULL;
+}
+
+static uint64_t
+lock_acquisitions(const malloc_allocator_telemetry_t *telemetry)
+{
+	uint64_t total = telemetry->depot.lock_acquisitions;
+	for (unsigned i = 0; i < telemetry->num_magazines; i++) {
+		total += telemetry->magazines[i].lock_acquisitions;
+	}
+	return total;
+}
+
+T_DECL(telemetry_version, "Telemetry fails for an unknown version",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_telemetry_t *telemetry = calloc(1, sizeof(*telemetry));
+	T_QUIET; T_ASSERT_NOTNULL(telemetry, "calloc");
+
+	telemetry->version = MALLOC_ZONE_TELEMETRY_VERSION + 1;
+	T_EXPECT_FALSE(malloc_zone_telemetry(malloc_default_zone(), telemetry),
+			"unknown version is refused");
+	free(telemetry);
+}
+
+T_DECL(telemetry_size_classes, "Tiny and small blocks are counted by size class",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	malloc_zone_telemetry_t *before = get_telemetry(zone);
+
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		blocks[i] = malloc_zone_malloc(zone, i & 1 ? 2048 : 64);
+		T_QUIET; T_ASSERT_NOTNULL(blocks[i], "malloc");
+	}
+	malloc_zone_telemetry_t *allocated = get_telemetry(zone);
+
+	T_EXPECT_EQ(find_size_class(&allocated->tiny, 64)->blocks_in_use, NUM_BLOCKS / 2,
+			"64 byte blocks in use");
+	T_EXPECT_EQ(find_size_class(&allocated->small, 2048)->blocks_in_use, NUM_BLOCKS / 2,
+			"2048 byte blocks in use");
+	T_EXPECT_GT(lock_acquisitions(&allocated->tiny), lock_acquisitions(&before->tiny),
+			"tiny magazine locks were taken");
+
+	// Free every fourth block, so that the freed blocks cannot coalesce.
+	for (int i = 0; i < NUM_BLOCKS; i += 4) {
+		malloc_zone_free(zone, blocks[i]);
+	}
+	malloc_zone_telemetry_t *freed = get_telemetry(zone);
+
+	T_EXPECT_EQ(find_size_class(&freed->tiny, 64)->blocks_in_use, NUM_BLOCKS / 4,
+			"64 byte blocks still in use");
+	T_EXPECT_EQ(find_size_class(&freed->tiny, 64)->blocks_free, NUM_BLOCKS / 4,
+			"64 byte blocks on free lists");
+
+	free(before);
+	free(allocated);
+	free(freed);
+	malloc_destroy_zone(zone);
+}
+
+T_DECL(telemetry_default_zone, "The default zone reports telemetry through nano",
+	   T_META_ENVVAR("MallocNanoZone=V2"))
+{
+	if (malloc_engaged_nano() != 2) {
+		T_SKIP("Nano V2 is not engaged");
+	}
+
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		blocks[i] = malloc(32);
+		T_QUIET; T_ASSERT_NOTNULL(blocks[i], "malloc");
+	}
+	malloc_zone_telemetry_t *telemetry = get_telemetry(malloc_default_zone());
+
+	T_EXPECT_GE(find_size_class(&telemetry->nano, 32)->blocks_in_use, NUM_BLOCKS,
+			"32 byte nano blocks in use");
+	T_EXPECT_GT(telemetry->tiny.num_magazines, 0U, "helper zone filled in");
+
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		free(blocks[i]);
+	}
+	free(telemetry);
+}
@@ -352,6 +352,51 @@ T_DECL(overspill_arena, "force overspill of an arena",
 #endif // CONFIG_NANOZONE
 }
 
+// Enough 16-byte allocations to span several blocks.
+#define BATCH_COUNT 4096
+
+T_DECL(nano_batch_malloc_free, "batch malloc and free in Nanov2",
+	   T_META_ENVVAR("MallocNanoZone=V2"))
+{
+#if CONFIG_NANOZONE
+	void **ptrs = calloc(BATCH_COUNT, sizeof(void *));
+	void **freed = calloc(BATCH_COUNT, sizeof(void *));
+	T_QUIET; T_ASSERT_NOTNULL(ptrs, "Unable to allocate pointers");
+	T_QUIET; T_ASSERT_NOTNULL(freed, "Unable to allocate pointers");
+
+	for (int pass = 0; pass < 2; pass++) {
+		unsigned count = malloc_zone_batch_malloc(malloc_default_zone(), 16,
+				ptrs, BATCH_COUNT);
+		T_ASSERT_EQ(count, BATCH_COUNT, "allocated the whole batch");
+		for (int i = 0; i < BATCH_COUNT; i++) {
+			T_QUIET; T_ASSERT_EQ(16, (int)malloc_size(ptrs[i]), "pointer %d has the wrong size", i);
+			memset(ptrs[i], 0xa5, 16);
+		}
+
+		// Every pointer must be distinct. Sorting also means that the next
+		// batch free sees pointers in an order other than allocation order.
+		qsort_b(ptrs, BATCH_COUNT, sizeof(void *), ^(const void *a, const void *b) {
+			uintptr_t pa = *(uintptr_t *)a, pb = *(uintptr_t *)b;
+			return pa < pb ? 1 : pa > pb ? -1 : 0;
+		});
+		for (int i = 1; i < BATCH_COUNT; i++) {
+			T_QUIET; T_ASSERT_NE(ptrs[i - 1], ptrs[i], "pointer %d is a duplicate", i);
+		}
+
+		// Batch free may overwrite the array, so check a copy afterwards.
+		memcpy(freed, ptrs, BATCH_COUNT * sizeof(void *));
+		malloc_zone_batch_free(malloc_default_zone(), ptrs, BATCH_COUNT);
+		for (int i = 0; i < BATCH_COUNT; i++) {
+			T_QUIET; T_ASSERT_EQ(0, (int)malloc_size(freed[i]), "pointer %d was not freed", i);
+		}
+	}
+	free(freed);
+	free(ptrs);
+#else // CONFIG_NANOZONE
+	T_SKIP("Nano allocator not configured");
+#endif // CONFIG_NANOZONE
+}
+
 #if TARGET_OS_OSX
 
 // Guaranteed number of 256-byte allocations to be sure we fill a region.
@@ -0,0 +1,103 @@
+//
+//  perf_large_realloc.c
+//  libmalloc
+//
+//  Measures a large buffer that grows geometrically with realloc(), and how
+//  many bytes the growth copies.
+//
+#include <stdlib.h>
+#include <string.h>
+#include <mach/vm_page_size.h>
+#include <../src/internal.h>
+#include <darwintest.h>
+#include <perfcheck_keys.h>
+
+// Start at the smallest block that is remapped rather than copied.
+#define START_SIZE LARGE_REALLOC_REMAP_THRESHOLD
+#if TARGET_OS_WATCH || TARGET_OS_TV
+#define END_SIZE (64 * 1024 * 1024)
+#else // TARGET_OS_WATCH || TARGET_OS_TV
+#define END_SIZE (256 * 1024 * 1024)
+#endif // TARGET_OS_WATCH || TARGET_OS_TV
+
+static void
+get_stats(malloc_zone_t *zone, malloc_large_realloc_statistics_t *stats)
+{
+	T_QUIET; T_ASSERT_TRUE(scalable_zone_large_realloc_statistics(zone, stats),
+			"large realloc statistics are available");
+}
+
+// Grows a buffer from START_SIZE to END_SIZE, doubling each time and writing
+// every page of the new part, and checks that the contents survive each move.
+// Returns the number of bytes that the growth would copy without remapping.
+static uint64_t
+grow_buffer(malloc_zone_t *zone)
+{
+	uint64_t copy_volume = 0;
+	size_t size = START_SIZE;
+	unsigned char *buf = malloc_zone_malloc(zone, size);
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc(%zu)", size);
+	memset(buf, 0xa5, size);
+
+	while (size < END_SIZE) {
+		buf = malloc_zone_realloc(zone, buf, 2 * size);
+		T_QUIET; T_ASSERT_NOTNULL(buf, "realloc(%zu)", 2 * size);
+		for (size_t i = 0; i < size; i += vm_page_size) {
+			T_QUIET; T_ASSERT_EQ(buf[i], 0xa5, "contents preserved at %zu", i);
+		}
+		memset(buf + size, 0xa5, size);
+		copy_volume += size;
+		size *= 2;
+	}
+
+	malloc_zone_free(zone, buf);
+	return copy_volume;
+}
+
+T_DECL(large_realloc_copy_volume, "Growing a large buffer remaps rather than copies",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	malloc_large_realloc_statistics_t stats;
+
+	uint64_t copy_volume = grow_buffer(zone);
+	get_stats(zone, &stats);
+
+	T_LOG("grew %llu times in place, %llu into headroom, remapped %llu times (%llu bytes), "
+			"copied %llu times (%llu bytes); plain growth would copy %llu bytes",
+			stats.grown_in_place, stats.grown_into_headroom, stats.remaps,
+			stats.bytes_remapped, stats.copies, stats.bytes_copied, copy_volume);
+#if CONFIG_LARGE_REALLOC_REMAP
+	T_EXPECT_EQ(stats.bytes_copied, 0ULL, "no bytes were copied");
+	T_EXPECT_GT(stats.grown_into_headroom, 0ULL, "headroom was used");
+#else // CONFIG_LARGE_REALLOC_REMAP
+	T_EXPECT_LE(stats.bytes_copied, copy_volume, "copies bounded by the growth");
+#endif // CONFIG_LARGE_REALLOC_REMAP
+
+	malloc_destroy_zone(zone);
+}
+
+T_DECL(large_realloc_growth_perf, "Geometric growth of a large buffer",
+	   T_META_TAG_PERF, T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_zone_t *zone = malloc_create_zone(0, 0);
+	dt_stat_time_t s = dt_stat_time_create("large_realloc_growth");
+	dt_stat_set_variable((dt_stat_t)s, "start size (bytes)", START_SIZE);
+	dt_stat_set_variable((dt_stat_t)s, "end size (bytes)", END_SIZE);
+
+	do {
+		int batch_size = dt_stat_batch_size(s);
+		dt_stat_token t = dt_stat_begin(s);
+		for (int i = 0; i < batch_size; i++) {
+			grow_buffer(zone);
+		}
+		dt_stat_end_batch(s, batch_size, t);
+	} while (!dt_stat_stable(s));
+	dt_stat_finalize(s);
+
+	malloc_large_realloc_statistics_t stats;
+	get_stats(zone, &stats);
+	T_LOG("bytes remapped %llu, bytes copied %llu", stats.bytes_remapped, stats.bytes_copied);
+
+	malloc_destroy_zone(zone);
+}
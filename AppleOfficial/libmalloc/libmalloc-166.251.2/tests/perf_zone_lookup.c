@@ -0,0 +1,72 @@
+//
+//  perf_zone_lookup.c
+//  libmalloc
+//
+//  Measures the cost of free() for pointers that belong to the most recently
+//  registered of 1 to 64 malloc zones, which is the worst case for
+//  find_registered_zone() when it has to ask each zone in turn.
+//
+#include <darwintest.h>
+#include <stdlib.h>
+#include <malloc/malloc.h>
+#include <perfcheck_keys.h>
+
+#define MAX_ZONES 64
+#define NUM_ALLOCS 1024
+
+static void
+run_zone_lookup_test(size_t size)
+{
+	malloc_zone_t *zones[MAX_ZONES];
+	void *ptrs[NUM_ALLOCS];
+	int nzones = 0;
+
+	for (int target = 1; target <= MAX_ZONES; target *= 2) {
+		while (nzones < target) {
+			zones[nzones] = malloc_create_zone(0, 0);
+			T_QUIET; T_ASSERT_NOTNULL(zones[nzones], "malloc_create_zone");
+			// Give each zone some regions of its own.
+			void *p = malloc_zone_malloc(zones[nzones], size);
+			T_QUIET; T_ASSERT_NOTNULL(p, "malloc_zone_malloc");
+			malloc_zone_free(zones[nzones], p);
+			nzones++;
+		}
+		malloc_zone_t *zone = zones[nzones - 1];
+
+		char name[64];
+		snprintf(name, sizeof(name), "free %zu bytes with %d zones", size, nzones);
+		dt_stat_time_t s = dt_stat_time_create(name);
+		dt_stat_set_variable((dt_stat_t)s, "zones", nzones);
+		do {
+			for (int i = 0; i < NUM_ALLOCS; i++) {
+				ptrs[i] = malloc_zone_malloc(zone, size);
+			}
+			dt_stat_token t = dt_stat_begin(s);
+			for (int i = 0; i < NUM_ALLOCS; i++) {
+				free(ptrs[i]);
+			}
+			dt_stat_end_batch(s, NUM_ALLOCS, t);
+		} while (!dt_stat_stable(s));
+		dt_stat_finalize(s);
+	}
+
+	for (int i = 0; i < nzones; i++) {
+		malloc_destroy_zone(zones[i]);
+	}
+}
+
+T_DECL(perf_zone_lookup_tiny, "free() of tiny blocks with 1-64 registered zones",
+	   T_META_TAG_PERF, T_META_ALL_VALID_ARCHS(NO),
+	   T_META_LTEPHASE(LTE_POSTINIT), T_META_CHECK_LEAKS(false),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	run_zone_lookup_test(64);
+}
+
+T_DECL(perf_zone_lookup_small, "free() of small blocks with 1-64 registered zones",
+	   T_META_TAG_PERF, T_META_ALL_VALID_ARCHS(NO),
+	   T_META_LTEPHASE(LTE_POSTINIT), T_META_CHECK_LEAKS(false),
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	run_zone_lookup_test(4096);
+}
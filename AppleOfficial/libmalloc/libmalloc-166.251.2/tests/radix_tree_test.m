@@ -8,6 +8,8 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <radix_tree.h>
 #include <radix_tree_internal.h>
@@ -15,6 +17,7 @@
 #include <darwintest.h>
 
 #include "../src/radix_tree_debug.c"
+#include "../src/radix_tree_concurrent.c"
 
 bool failed = false;
 
@@ -328,3 +331,130 @@ T_DECL(radix_tree_holes, "radix_tree_holes_test")
 	ok = radix_tree_fsck(tree);
 	T_ASSERT_TRUE(ok, "fsck");
 }
+
+T_DECL(radix_ctree_holes, "radix_ctree_holes_test")
+{
+	bool ok;
+	struct radix_ctree *tree = radix_ctree_create();
+	T_ASSERT_NOTNULL(tree, "radix_ctree_create()");
+
+	uint64_t size = 0xff00000;
+	uint64_t minsize = 0x1000;
+	uint64_t start = 0x10303c000;
+
+	ok = radix_ctree_insert(tree, start, size, 0xf00ba);
+	T_ASSERT_TRUE(ok, "created region");
+	T_ASSERT_EQ_ULLONG(radix_ctree_count(tree), size, "count");
+
+	for (uint64_t addr = start; addr < start + size; addr += minsize) {
+		T_QUIET;
+		T_ASSERT_EQ_ULLONG(radix_ctree_lookup(tree, addr), 0xf00ball, "stackid");
+		uint64_t index = (addr - start) / minsize;
+		if (index % 2) {
+			ok = radix_ctree_delete(tree, addr, minsize);
+			T_QUIET;
+			T_ASSERT_TRUE(ok, "deleted odd %lld", index);
+		}
+	}
+
+	for (uint64_t addr = start; addr < start + size; addr += minsize) {
+		uint64_t index = (addr - start) / minsize;
+		T_QUIET;
+		T_ASSERT_EQ_ULLONG(radix_ctree_lookup(tree, addr), index % 2 ? -1 : 0xf00ball, "stackid");
+		if (!(index % 2)) {
+			ok = radix_ctree_delete(tree, addr, minsize);
+			T_QUIET;
+			T_ASSERT_TRUE(ok, "deleted even, %lld", index);
+		}
+	}
+
+	T_ASSERT_EQ_ULLONG(radix_ctree_count(tree), 0ull, "empty");
+	radix_ctree_destroy(tree);
+}
+
+#define CTREE_READERS 4
+#define CTREE_STABLE_BASE 0x100000000ull
+#define CTREE_STABLE_KEYS 1024
+#define CTREE_CHURN_BASE 0x200000000ull
+#define CTREE_CHURN_KEYS 4096
+#define CTREE_WRITES 200000
+
+struct ctree_reader {
+	pthread_t thread;
+	struct radix_ctree *tree;
+	_Atomic bool *stop;
+	uint64_t lookups;
+	uint64_t wrong;
+};
+
+/*
+ * Keys in the stable range are never modified, so they must always be found.
+ * Keys in the churn range come and go, but only ever map to their own index.
+ */
+static void *
+ctree_reader_thread(void *arg)
+{
+	struct ctree_reader *reader = arg;
+	unsigned seed = (unsigned)(uintptr_t)reader;
+
+	while (!atomic_load_explicit(reader->stop, memory_order_relaxed)) {
+		uint64_t i = rand_r(&seed) % CTREE_STABLE_KEYS;
+		if (radix_ctree_lookup(reader->tree, CTREE_STABLE_BASE + i * 0x3000) != i) {
+			reader->wrong++;
+		}
+		uint64_t j = rand_r(&seed) % CTREE_CHURN_KEYS;
+		uint64_t value = radix_ctree_lookup(reader->tree, CTREE_CHURN_BASE + j * 0x2000);
+		if (value != radix_tree_invalid_value && value != j) {
+			reader->wrong++;
+		}
+		reader->lookups += 2;
+	}
+	return NULL;
+}
+
+T_DECL(radix_ctree_readers, "Lookups run alongside a writer")
+{
+	struct radix_ctree *tree = radix_ctree_create();
+	T_ASSERT_NOTNULL(tree, "radix_ctree_create()");
+
+	for (uint64_t i = 0; i < CTREE_STABLE_KEYS; i++) {
+		T_QUIET;
+		T_ASSERT_TRUE(radix_ctree_insert(tree, CTREE_STABLE_BASE + i * 0x3000, 0x1000, i), "insert %lld", i);
+	}
+
+	_Atomic bool stop = false;
+	struct ctree_reader readers[CTREE_READERS];
+	for (int i = 0; i < CTREE_READERS; i++) {
+		readers[i] = (struct ctree_reader){.tree = tree, .stop = &stop};
+		T_QUIET;
+		T_ASSERT_POSIX_ZERO(pthread_create(&readers[i].thread, NULL, ctree_reader_thread, &readers[i]), "pthread_create");
+	}
+
+	uint64_t start = clock_gettime_nsec_np(CLOCK_MONOTONIC);
+	unsigned seed = 1;
+	for (int n = 0; n < CTREE_WRITES; n++) {
+		uint64_t j = rand_r(&seed) % CTREE_CHURN_KEYS;
+		uint64_t key = CTREE_CHURN_BASE + j * 0x2000;
+		bool ok = (n & 1) ? radix_ctree_insert(tree, key, 0x1000 * (1 + j % 2), j) : radix_ctree_delete(tree, key, 0x1000);
+		T_QUIET;
+		T_ASSERT_TRUE(ok, "write %d", n);
+	}
+	uint64_t elapsed = clock_gettime_nsec_np(CLOCK_MONOTONIC) - start;
+
+	atomic_store(&stop, true);
+	uint64_t lookups = 0, wrong = 0;
+	for (int i = 0; i < CTREE_READERS; i++) {
+		T_QUIET;
+		T_ASSERT_POSIX_ZERO(pthread_join(readers[i].thread, NULL), "pthread_join");
+		lookups += readers[i].lookups;
+		wrong += readers[i].wrong;
+	}
+
+	T_LOG("%d readers: %.0f lookups/s per reader, writer: %.0f ops/s", CTREE_READERS,
+			lookups * 1e9 / elapsed / CTREE_READERS, CTREE_WRITES * 1e9 / elapsed);
+	T_EXPECT_EQ_ULLONG(wrong, 0ull, "lookups found the right values");
+
+	T_EXPECT_TRUE(radix_ctree_delete(tree, 0, -1), "delete everything");
+	T_EXPECT_EQ_ULLONG(radix_ctree_count(tree), 0ull, "empty");
+	radix_ctree_destroy(tree);
+}
@@ -0,0 +1,129 @@
+//
+//  scavenger_test.c
+//  libmalloc
+//
+//  Tests for the background scavenger (MallocScavenger).
+//
+
+#include <darwintest.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/sysctl.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+#define NUM_BLOCKS 65536
+
+static void *blocks[NUM_BLOCKS];
+
+static void
+get_stats(malloc_scavenger_statistics_t *stats)
+{
+	T_QUIET; T_ASSERT_TRUE(malloc_scavenger_statistics(stats),
+			"scavenger is enabled");
+}
+
+// Allocates and dirties NUM_BLOCKS blocks of 'size' bytes, then frees all but
+// every 'keep'th block so that the allocator has plenty of free pages to give
+// back.
+static void
+fill_and_free(size_t size, int keep)
+{
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		blocks[i] = malloc(size);
+		T_QUIET; T_ASSERT_NOTNULL(blocks[i], "malloc(%zu)", size);
+		memset(blocks[i], 0xa5, size);
+	}
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		if (keep && (i % keep) == 0) {
+			continue;
+		}
+		free(blocks[i]);
+		blocks[i] = NULL;
+	}
+}
+
+static void
+free_remaining(void)
+{
+	for (int i = 0; i < NUM_BLOCKS; i++) {
+		free(blocks[i]);
+		blocks[i] = NULL;
+	}
+}
+
+// Waits up to two seconds for the scavenger to report work of some kind.
+static void
+wait_for_scavenger(malloc_scavenger_statistics_t *stats, bool nano)
+{
+	for (int i = 0; i < 200; i++) {
+		get_stats(stats);
+		if (nano ? stats->nano_blocks_scavenged : stats->regions_scavenged) {
+			return;
+		}
+		usleep(10000);
+	}
+}
+
+T_DECL(scavenger_disabled, "Scavenger is off by default",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_scavenger_statistics_t stats;
+	T_ASSERT_FALSE(malloc_scavenger_statistics(&stats),
+			"no scavenger without MallocScavenger");
+}
+
+T_DECL(scavenger_nano_blocks, "Empty nano blocks are madvised after the decay time",
+	   T_META_ENVVAR("MallocNanoZone=V2"), T_META_ENVVAR("MallocScavenger=1"),
+	   T_META_ENVVAR("MallocScavengerInterval=10"),
+	   T_META_ENVVAR("MallocScavengerDecay=50"))
+{
+	malloc_scavenger_statistics_t stats;
+
+	fill_and_free(256, 0);
+	wait_for_scavenger(&stats, true);
+
+	T_EXPECT_GT(stats.clients, 0U, "nano zone registered");
+	T_EXPECT_GT(stats.ticks, 0ULL, "scavenger ran");
+	T_EXPECT_GT(stats.nano_blocks_scavenged, 0ULL, "empty blocks were madvised");
+
+	// Blocks that were madvised must still be usable.
+	fill_and_free(256, 0);
+	T_PASS("nano blocks reused after scavenging");
+}
+
+T_DECL(scavenger_background_policy, "MallocNanoMadvisePolicy=background enables the scavenger",
+	   T_META_ENVVAR("MallocNanoZone=V2"),
+	   T_META_ENVVAR("MallocNanoMadvisePolicy=background"))
+{
+	malloc_scavenger_statistics_t stats;
+
+	T_ASSERT_TRUE(malloc_scavenger_statistics(&stats), "scavenger is enabled");
+}
+
+T_DECL(scavenger_tiny_regions, "Depot regions are madvised after the decay time",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocScavenger=1"),
+	   T_META_ENVVAR("MallocScavengerInterval=10"),
+	   T_META_ENVVAR("MallocScavengerDecay=50"))
+{
+	int ncpu = 0;
+	size_t len = sizeof(ncpu);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("hw.activecpu", &ncpu, &len, NULL, 0),
+			"hw.activecpu");
+	if (ncpu < 2) {
+		T_SKIP("no depot with a single magazine");
+	}
+
+	malloc_scavenger_statistics_t stats;
+
+	// Keep one block in sixteen so that sparse regions move to the depot
+	// rather than being unmapped.
+	fill_and_free(512, 16);
+	wait_for_scavenger(&stats, false);
+
+	T_EXPECT_GT(stats.regions_scavenged, 0ULL, "depot regions were madvised");
+	T_EXPECT_GT(stats.bytes_scavenged, 0ULL, "bytes counted");
+
+	free_remaining();
+}
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <sys/event.h>
 #include <malloc_private.h>
+#include <pthread.h>
 #include <TargetConditionals.h>
 
 #if DARWINTEST
@@ -803,6 +804,140 @@ T_DECL(msl_test_lite_atstart_with_nano, "Test lite mode of malloc stack logging
 	do_test(stack_logging_mode_none, validate_stacks, nano_allocator_enabled, lite_mode_enabled);
 }
 
+T_DECL(msl_test_full_atstart_buffered, "Test full mode of malloc stack logging enabled at start with per-thread staging buffers", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingBuffered=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	boolean_t validate_stacks = true;
+	boolean_t nano_allocator_enabled = false;
+	boolean_t lite_mode_enabled = false;
+	
+	do_test(stack_logging_mode_none, validate_stacks, nano_allocator_enabled, lite_mode_enabled);
+}
+
+#define BUFFERED_THREADS 8
+#define BUFFERED_PTRS_PER_THREAD 1024
+
+static char *buffered_ptrs[BUFFERED_THREADS][BUFFERED_PTRS_PER_THREAD];
+
+static void *
+buffered_thread(void *arg)
+{
+	char **ptrs = arg;
+	
+	// Free half of what we allocate so that threads keep reusing each other's
+	// addresses; the index must still end with each live pointer's malloc.
+	for (int round = 0; round < 4; round++) {
+		for (int i = 0; i < BUFFERED_PTRS_PER_THREAD; i++) {
+			if (ptrs[i] && (i + round) % 2) {
+				free(ptrs[i]);
+				ptrs[i] = NULL;
+			}
+			if (!ptrs[i]) {
+				ptrs[i] = malloc(16 + (i % 8) * 16);
+			}
+		}
+	}
+	return NULL;
+}
+
+T_DECL(msl_test_buffered_threads, "Test that records staged on several threads are flushed in order", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingBuffered=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	pthread_t threads[BUFFERED_THREADS];
+	
+	for (int i = 0; i < BUFFERED_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, buffered_thread, buffered_ptrs[i]), "pthread_create");
+	}
+	for (int i = 0; i < BUFFERED_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	
+	boolean_t lite_mode;
+	kern_return_t kr = __mach_stack_logging_start_reading(mach_task_self(), __mach_stack_logging_shared_memory_address, &lite_mode);
+	T_ASSERT_MACH_SUCCESS(kr, "start reading");
+	
+	for (int i = 0; i < BUFFERED_THREADS; i++) {
+		check_stacks(buffered_ptrs[i], BUFFERED_PTRS_PER_THREAD, false);
+		free_ptrs(NULL, buffered_ptrs[i], BUFFERED_PTRS_PER_THREAD, false);
+	}
+	T_PASS("found a stack for every live pointer");
+	
+	__mach_stack_logging_stop_reading(mach_task_self());
+}
+
+// libpthread's __PTK_LIBC_DYLD_Unwind_SjLj_Key. Stack logging must never
+// store anything in a slot that belongs to someone else.
+#define DYLD_UNWIND_SJLJ_KEY 18
+
+#define EXITING_THREADS 32
+#define EXITING_PTRS_PER_THREAD 64
+
+static char *exiting_ptrs[EXITING_THREADS][EXITING_PTRS_PER_THREAD];
+static volatile boolean_t exiting_churn;
+
+static void *
+exiting_thread(void *arg)
+{
+	char **ptrs = arg;
+	
+	for (int i = 0; i < EXITING_PTRS_PER_THREAD; i++) {
+		free(malloc(32));
+		ptrs[i] = malloc(16 + (i % 8) * 16);
+	}
+	T_QUIET; T_EXPECT_NULL(pthread_getspecific(DYLD_UNWIND_SJLJ_KEY), "dyld's unwind slot is untouched");
+	return NULL;
+}
+
+static void *
+churn_thread(void *arg)
+{
+	while (exiting_churn) {
+		free(malloc(64));
+	}
+	return NULL;
+}
+
+// Threads log and exit while another thread keeps logging, so thread exit
+// (and any TSD destructors stack logging registers) races with other logging.
+static void
+test_exiting_threads(boolean_t lite_mode)
+{
+	pthread_t churn;
+	pthread_t threads[EXITING_THREADS];
+	
+	exiting_churn = true;
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&churn, NULL, churn_thread, NULL), "pthread_create");
+	for (int i = 0; i < EXITING_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, exiting_thread, exiting_ptrs[i]), "pthread_create");
+	}
+	for (int i = 0; i < EXITING_THREADS; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), "pthread_join");
+	}
+	exiting_churn = false;
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(churn, NULL), "pthread_join");
+	
+	boolean_t reading_lite_mode;
+	kern_return_t kr = __mach_stack_logging_start_reading(mach_task_self(), __mach_stack_logging_shared_memory_address, &reading_lite_mode);
+	T_ASSERT_MACH_SUCCESS(kr, "start reading");
+	T_QUIET; T_EXPECT_EQ(reading_lite_mode, lite_mode, "lite mode");
+	
+	for (int i = 0; i < EXITING_THREADS; i++) {
+		check_stacks(exiting_ptrs[i], EXITING_PTRS_PER_THREAD, lite_mode);
+		free_ptrs(NULL, exiting_ptrs[i], EXITING_PTRS_PER_THREAD, false);
+	}
+	T_PASS("found a stack for every pointer allocated by an exited thread");
+	
+	__mach_stack_logging_stop_reading(mach_task_self());
+}
+
+T_DECL(msl_test_lite_exiting_threads, "Test lite mode stack logging while threads exit", T_META_ENVVAR("MallocStackLogging=lite"), T_META_ENVVAR("MallocStackLoggingBuffered=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	test_exiting_threads(true);
+}
+
+T_DECL(msl_test_buffered_exiting_threads, "Test that staging buffers of exiting threads are flushed", T_META_ENVVAR("MallocStackLogging=1"), T_META_ENVVAR("MallocStackLoggingBuffered=1"), T_META_ENVVAR("MallocNanoZone=0"), T_META_CHECK_LEAKS(NO))
+{
+	test_exiting_threads(false);
+}
+
 T_DECL(msl_test_serialize_uniquing_table, "Test that that stack uniquing table can be serialized, deserialized and read", T_META_ENVVAR("MallocStackLogging=lite"))
 {
 	uintptr_t *foo = malloc(sizeof(uintptr_t));
@@ -0,0 +1,265 @@
+//
+//  thread_cache_test.c
+//  libmalloc
+//
+//  Tests for the per-thread tiny/small cache (MallocThreadCache).
+//
+
+#include <darwintest.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+static void
+get_stats(malloc_thread_cache_statistics_t *stats)
+{
+	T_QUIET; T_ASSERT_TRUE(scalable_zone_thread_cache_statistics(
+			malloc_default_zone(), stats), "thread cache is enabled");
+}
+
+T_DECL(thread_cache_disabled, "Thread cache is off by default",
+	   T_META_ENVVAR("MallocNanoZone=0"))
+{
+	malloc_thread_cache_statistics_t stats;
+	T_ASSERT_FALSE(scalable_zone_thread_cache_statistics(malloc_default_zone(),
+			&stats), "no thread cache without MallocThreadCache");
+}
+
+T_DECL(thread_cache_reuse, "Freed tiny and small blocks are reused by the same thread",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	const size_t sizes[] = { 16, 128, 1008, 1024, 4096 };
+	malloc_thread_cache_statistics_t before, after;
+
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		void *ptr = malloc(sizes[i]);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc(%zu)", sizes[i]);
+		free(ptr);
+
+		get_stats(&before);
+		void *ptr2 = malloc(sizes[i]);
+		get_stats(&after);
+
+		T_EXPECT_EQ(ptr2, ptr, "malloc(%zu) reuses the cached block", sizes[i]);
+		T_EXPECT_EQ(after.hits, before.hits + 1, "hit counted");
+		T_EXPECT_EQ(malloc_size(ptr2), malloc_good_size(sizes[i]), "size is intact");
+		free(ptr2);
+	}
+}
+
+T_DECL(thread_cache_calloc, "calloc() clears blocks taken from the thread cache",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	for (size_t size = 16; size <= 4096; size += 16) {
+		unsigned char *ptr = malloc(size);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "malloc(%zu)", size);
+		memset(ptr, 0xa5, size);
+		free(ptr);
+
+		ptr = calloc(1, size);
+		T_QUIET; T_ASSERT_NOTNULL(ptr, "calloc(%zu)", size);
+		for (size_t i = 0; i < size; i++) {
+			if (ptr[i]) {
+				T_FAIL("calloc(%zu) byte %zu is 0x%x", size, i, ptr[i]);
+			}
+		}
+		free(ptr);
+	}
+	T_PASS("calloc() returned zeroed blocks");
+}
+
+T_DECL(thread_cache_bounded, "Thread cache flushes to the magazines when full",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"),
+	   T_META_ENVVAR("MallocThreadCacheBytes=8192"))
+{
+	const int count = 1024;
+	void *ptrs[count];
+	malloc_thread_cache_statistics_t stats;
+
+	for (int i = 0; i < count; i++) {
+		ptrs[i] = malloc(64);
+		T_QUIET; T_ASSERT_NOTNULL(ptrs[i], "malloc(64)");
+	}
+	for (int i = 0; i < count; i++) {
+		free(ptrs[i]);
+	}
+
+	get_stats(&stats);
+	T_EXPECT_EQ(stats.max_bytes_per_thread, 8192UL, "budget from MallocThreadCacheBytes");
+	T_EXPECT_LE(stats.bytes_cached, stats.max_bytes_per_thread, "cache stays within budget");
+	T_EXPECT_GT(stats.flushes, 0ULL, "overflow was flushed");
+}
+
+static void *
+churn_thread(void *arg)
+{
+	for (int round = 0; round < 1000; round++) {
+		void *ptrs[16];
+		for (int i = 0; i < 16; i++) {
+			ptrs[i] = malloc(16 * (i + 1));
+		}
+		for (int i = 0; i < 16; i++) {
+			free(ptrs[i]);
+		}
+	}
+	return NULL;
+}
+
+T_DECL(thread_cache_thread_exit, "Caches of exited threads are flushed and retired",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	const int nthreads = 8;
+	pthread_t threads[nthreads];
+	malloc_thread_cache_statistics_t before, after;
+
+	get_stats(&before);
+
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL, churn_thread, NULL), NULL);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL), NULL);
+	}
+
+	get_stats(&after);
+
+	T_EXPECT_EQ(after.threads, before.threads, "exited threads are unlinked");
+	T_EXPECT_EQ(after.blocks_cached, before.blocks_cached, "exited threads cache nothing");
+	T_EXPECT_GE(after.hits, before.hits + nthreads * 999 * 16, "exited threads' hits are retained");
+}
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static int idle_state;
+
+static void
+idle_wait_for(int state)
+{
+	pthread_mutex_lock(&idle_lock);
+	while (idle_state != state) {
+		pthread_cond_wait(&idle_cond, &idle_lock);
+	}
+	pthread_mutex_unlock(&idle_lock);
+}
+
+static void
+idle_set(int state)
+{
+	pthread_mutex_lock(&idle_lock);
+	idle_state = state;
+	pthread_cond_broadcast(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+// Fills its cache, then sits idle until told to allocate once and exit.
+static void *
+idle_thread(void *arg)
+{
+	void *ptrs[32];
+	for (int i = 0; i < 32; i++) {
+		ptrs[i] = malloc(32);
+	}
+	for (int i = 0; i < 32; i++) {
+		free(ptrs[i]);
+	}
+	idle_set(1);
+	idle_wait_for(2);
+	free(malloc(4096));
+	idle_set(3);
+	idle_wait_for(4);
+	return NULL;
+}
+
+T_DECL(thread_cache_pressure_relief, "Pressure relief flushes the caches of other threads",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	pthread_t thread;
+	malloc_thread_cache_statistics_t before, after;
+
+	idle_state = 0;
+	T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, idle_thread, NULL), NULL);
+	idle_wait_for(1);
+
+	get_stats(&before);
+	T_EXPECT_GE(before.blocks_cached, 32U, "idle thread cached its blocks");
+
+	malloc_zone_pressure_relief(malloc_default_zone(), 0);
+	idle_set(2);
+	idle_wait_for(3);
+
+	// The idle thread cached one block after its cache was flushed, and this
+	// thread's cache was flushed by the pressure relief itself.
+	get_stats(&after);
+	T_EXPECT_LT(after.blocks_cached, 32U, "idle thread's cache was flushed on its next use");
+	T_EXPECT_GE(after.flushed_blocks, before.flushed_blocks + 32, "blocks went back to the magazines");
+
+	idle_set(4);
+	T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), NULL);
+}
+
+T_DECL(thread_cache_fork, "Caches of threads that don't survive a fork are retired in the child",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	pthread_t thread;
+	malloc_thread_cache_statistics_t stats;
+
+	idle_state = 0;
+	T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL, idle_thread, NULL), NULL);
+	idle_wait_for(1);
+	// Empty this thread's cache so that only the idle thread's is full.
+	malloc_zone_pressure_relief(malloc_default_zone(), 0);
+
+	pid_t pid = fork();
+	T_ASSERT_POSIX_SUCCESS(pid, "fork");
+	if (pid == 0) {
+		// Only this thread's cache, if it has one, is left.
+		if (!scalable_zone_thread_cache_statistics(malloc_default_zone(), &stats) ||
+				stats.threads > 1 || stats.blocks_cached >= 32) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+
+	int status;
+	T_ASSERT_POSIX_SUCCESS(waitpid(pid, &status, 0), "waitpid");
+	T_EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child retired the idle thread's cache");
+
+	idle_set(2);
+	idle_wait_for(3);
+	idle_set(4);
+	T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), NULL);
+}
+
+// Caches the block, then stays alive so that its cache keeps it.
+static void *
+free_thread(void *ptr)
+{
+	free(ptr);
+	idle_set(1);
+	idle_wait_for(2);
+	return NULL;
+}
+
+T_DECL(thread_cache_cross_thread_double_free, "Freeing a block cached by another thread is caught",
+	   T_META_ENVVAR("MallocNanoZone=0"), T_META_ENVVAR("MallocThreadCache=1"))
+{
+	pid_t pid = fork();
+	T_ASSERT_POSIX_SUCCESS(pid, "fork");
+	if (pid == 0) {
+		pthread_t thread;
+		void *ptr = malloc(32);
+		idle_state = 0;
+		pthread_create(&thread, NULL, free_thread, ptr);
+		idle_wait_for(1);
+		free(ptr);
+		_exit(0);
+	}
+
+	int status;
+	T_ASSERT_POSIX_SUCCESS(waitpid(pid, &status, 0), "waitpid");
+	T_EXPECT_TRUE(WIFSIGNALED(status), "child was stopped by the double free");
+}
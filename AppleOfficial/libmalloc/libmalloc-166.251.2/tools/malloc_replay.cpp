@@ -22,7 +22,9 @@
  */
 
 #include <mach/mach_vm.h>
+#include <mach/mach_time.h>
 #include <malloc/malloc.h>
+#include <pthread.h>
 #include <ktrace/ktrace.h>
 #include <os/assumes.h>
 #include <sys/event.h>
@@ -30,6 +32,7 @@
 #include <notify.h>
 #include <dlfcn.h>
 #include "malloc_replay.h"
+#include <atomic>
 #include <map>
 #include <string>
 #include <sysexits.h>
@@ -41,6 +44,11 @@
         x = thread_instruction_count(); \
     }
 
+#define capture_time(x, c) \
+    if (c & CONFIG_REC_LATENCY) { \
+        x = mach_absolute_time(); \
+    }
+
 #if TARGET_OS_IPHONE && !TARGET_OS_SIMULATOR
 
 // Maximum size to map when reading replay file chunks
@@ -70,6 +78,20 @@ static uint64_t s_totalFreeEvents = 0;
 static uint64_t s_totalVallocEvents = 0;
 static uint64_t s_totalFailedFreeEvents = 0;
 static uint64_t s_totalFailedReallocEvents = 0;
+static uint64_t s_totalDependencyWaits = 0;
+
+//
+//Latency histograms, merged from all replay threads.
+//
+static replay_latency_histogram *s_latency = NULL;
+static mach_timebase_info_data_t s_timebase;
+
+//
+//Memory timeline, sampled every s_sampleIntervalMs while replaying.
+//
+typedef std::vector<replay_memory_sample, ReplayAllocator<replay_memory_sample>> ReplaySampleVector;
+static uint32_t s_sampleIntervalMs = 0;
+static ReplaySampleVector *s_memorySamples = NULL;
 
 uint64_t call_ins_retired[operation_count] = {0};
 uint64_t call_count[operation_count] = {0};
@@ -83,6 +105,8 @@ enum {
 	CONFIG_RUN_REPLAY    = 1 << 2,
 	CONFIG_CONVERT_FILE  = 1 << 3,
 	CONFIG_PAUSE         = 1 << 4,
+	CONFIG_THREADED      = 1 << 5,
+	CONFIG_REC_LATENCY   = 1 << 6,
 };
 typedef uint8_t replay_config_t;
 
@@ -109,6 +133,28 @@ thread_instruction_count(void)
     return instrCounts[0];
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// record_latency - Adds the time taken by one call to a latency histogram.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static unsigned
+log2_bucket(uint64_t value, unsigned limit)
+{
+	unsigned bucket = value ? 64 - __builtin_clzll(value) : 0;
+	return bucket < limit ? bucket : limit - 1;
+}
+
+static void
+record_latency(replay_latency_histogram *histogram, uint8_t opcode,
+		uint64_t size, uint64_t start, uint64_t end)
+{
+	uint64_t ns = (end - start) * s_timebase.numer / s_timebase.denom;
+	histogram->buckets[opcode - 1][log2_bucket(size, REPLAY_SIZE_CLASSES)]
+			[log2_bucket(ns, REPLAY_LATENCY_BUCKETS)]++;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // run_ktrace - Takes a nullable input ktrace file path and an output file path.
@@ -350,6 +396,8 @@ run_event(const struct compressed_operation* currentOperation,
 
 	uint64_t preICount = 0;
 	uint64_t postICount = 0;
+	uint64_t preTime = 0;
+	uint64_t postTime = 0;
 	uint32_t reqAllocSize = 0;
 
     //printf("EVENT : %llx\n", event);
@@ -361,7 +409,9 @@ run_event(const struct compressed_operation* currentOperation,
 		struct compressed_alloc* alloc = (struct compressed_alloc*)event;
 		reqAllocSize = alloc->size;
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		uint64_t* allocation = (uint64_t*)malloc(alloc->size);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		os_assert(allocation);
 		dirty_memory((uint8_t*)allocation, alloc->size);
@@ -379,7 +429,9 @@ run_event(const struct compressed_operation* currentOperation,
 		struct compressed_calloc* alloc = (struct compressed_calloc*)event;
 		reqAllocSize = alloc->size * alloc->count;
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		uint64_t allocation = (uint64_t)calloc(alloc->count, alloc->size);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		os_assert(allocation);
 		dirty_memory((uint8_t*)allocation, alloc->size * alloc->count);
@@ -398,7 +450,9 @@ run_event(const struct compressed_operation* currentOperation,
 		reqAllocSize = alloc->size;
 		uint64_t allocation = 0;
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		posix_memalign((void**)&allocation, alloc->alignment, alloc->size);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		os_assert(allocation);
 		dirty_memory((uint8_t*)allocation, alloc->size);
@@ -416,7 +470,9 @@ run_event(const struct compressed_operation* currentOperation,
 		struct compressed_alloc* alloc = (struct compressed_alloc*)event;
 		reqAllocSize = alloc->size;
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		uint64_t allocation = (uint64_t)valloc(alloc->size);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		os_assert(allocation);
 		dirty_memory((uint8_t*)allocation, alloc->size);
@@ -440,7 +496,9 @@ run_event(const struct compressed_operation* currentOperation,
 			break;
 		}
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		free((void*)iter->second);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		s_addressMap.erase(iter);
 		s_totalFreeEvents++;
@@ -463,7 +521,9 @@ run_event(const struct compressed_operation* currentOperation,
 
 		uint64_t oldAddress = iter->second;
 		capture_thread_counters(preICount, config);
+		capture_time(preTime, config);
 		uint64_t newAddress = (uint64_t)realloc((void*)oldAddress, alloc->size);
+		capture_time(postTime, config);
 		capture_thread_counters(postICount, config);
 		os_assert(newAddress);
 		dirty_memory((uint8_t*)newAddress, alloc->size);
@@ -477,6 +537,10 @@ run_event(const struct compressed_operation* currentOperation,
 		break;
     };
 
+	if ((config & CONFIG_REC_LATENCY) && postTime) {
+		record_latency(s_latency, currentOperation->opcode, reqAllocSize, preTime, postTime);
+	}
+
 	if (config & (CONFIG_REC_COUNTERS | CONFIG_REC_STATS)) {
 		uint64_t diff = postICount - preICount;
 		uint16_t instrCount = diff <= UINT16_MAX ? diff : UINT16_MAX;
@@ -586,26 +650,24 @@ vm_range_recorder(task_t task, void* context, unsigned type, vm_range_t *ranges,
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// run_malloc_replay - Replay a compressed malloc trace.  The idea here is to replay
-//                   the recorded events while forcing a specific CPU.  By doing
-//                   so libmalloc will target a specific magazine.  This way we
-//                   can see how the current allocator would pack an old allocation
-//                   stream.
+// replay_file_operations - Maps the malloc events chunks of a compressed trace
+//                          and hands each operation to the handler, which
+//                          returns the size of the operation, or 0 to skip the
+//                          rest of the mapping.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+typedef size_t (^replay_operation_handler_t)(const struct compressed_operation* operation,
+		size_t remainingMapping);
+
 static bool
-run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config_t config)
+replay_file_operations(const char* fileName, replay_operation_handler_t handler)
 {
-    if (!setup_private_malloc_zone()) {
-        return false;
-    }
-
 	ktrace_session_t s = ktrace_session_create();
 	if (ktrace_set_file(s, fileName)) {
 		printf("Couldn't open file: %s\n", fileName);
 		ktrace_session_destroy(s);
-        return false;
+		return false;
 	}
 	configure_ktrace_session(s);
 
@@ -647,7 +709,7 @@ run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config
 			struct compressed_operation* event = (struct compressed_operation*)ptr;
 			size_t size_left = mapped_size;
 			do {
-				size_t read = run_event(event, size_left, config);
+				size_t read = handler(event, size_left);
 				if (read == 0) {
 					break;
 				}
@@ -678,8 +740,597 @@ run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config
 	dispatch_release(g);
 	dispatch_release(q);
 
-	s_addressMap.clear();
 	ktrace_session_destroy(s);
+	return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// decode_event - Decodes an operation into a replay_op, without resolving the
+//                addresses it uses.  Returns the size of the event type, or 0
+//                if the mapping ends part way through it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t
+decode_event(const struct compressed_operation* currentOperation,
+		size_t remainingMapping, replay_op* op, uint64_t* address,
+		uint64_t* oldAddress)
+{
+	const void* event = currentOperation->body;
+	size_t bodySize = 0;
+
+	op->opcode = currentOperation->opcode;
+	op->core = currentOperation->core;
+	op->dependency = REPLAY_NO_DEPENDENCY;
+	op->size = 0;
+	op->arg = 0;
+	*address = 0;
+	*oldAddress = 0;
+
+	switch (currentOperation->opcode) {
+	case op_malloc:
+	case op_valloc: {
+		const struct compressed_alloc* alloc = (const struct compressed_alloc*)event;
+		bodySize = sizeof(*alloc);
+		if (remainingMapping >= sizeof(compressed_operation) + bodySize) {
+			op->size = alloc->size;
+			*address = alloc->address;
+		}
+		break;
+	}
+	case op_calloc: {
+		const struct compressed_calloc* alloc = (const struct compressed_calloc*)event;
+		bodySize = sizeof(*alloc);
+		if (remainingMapping >= sizeof(compressed_operation) + bodySize) {
+			op->size = alloc->size;
+			op->arg = alloc->count;
+			*address = alloc->address;
+		}
+		break;
+	}
+	case op_memalign: {
+		const struct compressed_memalign* alloc = (const struct compressed_memalign*)event;
+		bodySize = sizeof(*alloc);
+		if (remainingMapping >= sizeof(compressed_operation) + bodySize) {
+			op->size = alloc->size;
+			op->arg = alloc->alignment;
+			*address = alloc->address;
+		}
+		break;
+	}
+	case op_free: {
+		const struct compressed_free* freed = (const struct compressed_free*)event;
+		bodySize = sizeof(*freed);
+		if (remainingMapping >= sizeof(compressed_operation) + bodySize) {
+			*oldAddress = freed->address;
+		}
+		break;
+	}
+	case op_realloc: {
+		const struct compressed_realloc* alloc = (const struct compressed_realloc*)event;
+		bodySize = sizeof(*alloc);
+		if (remainingMapping >= sizeof(compressed_operation) + bodySize) {
+			op->size = alloc->size;
+			*address = alloc->newAddress;
+			*oldAddress = alloc->oldAddress;
+		}
+		break;
+	}
+	default:
+		__builtin_trap();
+		break;
+	}
+
+	if (remainingMapping < sizeof(compressed_operation) + bodySize) {
+		return 0;
+	}
+	return sizeof(compressed_operation) + bodySize;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Threaded replay - Every core recorded in the trace gets its own thread, which
+//                   pins itself to that core's magazine and runs the core's
+//                   operations in trace order.  Each operation that allocates
+//                   publishes its result in s_results, indexed by its position
+//                   in the trace, and operations that free or reallocate that
+//                   block wait for it there.  A wait only ever targets an
+//                   earlier operation, so the threads cannot deadlock.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::vector<replay_op, ReplayAllocator<replay_op>> ReplayOpVector;
+
+struct replay_thread {
+	pthread_t thread;
+	uint8_t core;
+	replay_config_t config;
+	ReplayOpVector ops;
+	replay_latency_histogram* latency;
+	uint64_t counts[operation_count];
+	uint64_t dependencyWaits;
+};
+
+static std::atomic<uint64_t>* s_results = NULL;
+static std::atomic<bool> s_startReplay(false);
+
+static void
+run_threaded_event(replay_thread* thread, const replay_op& op)
+{
+	uint64_t oldAddress = 0;
+	if (op.dependency != REPLAY_NO_DEPENDENCY) {
+		oldAddress = s_results[op.dependency].load(std::memory_order_acquire);
+		if (!oldAddress) {
+			thread->dependencyWaits++;
+			do {
+				sched_yield();
+				oldAddress = s_results[op.dependency].load(std::memory_order_acquire);
+			} while (!oldAddress);
+		}
+	}
+
+	uint64_t preTime = 0;
+	uint64_t postTime = 0;
+	uint64_t reqAllocSize = op.size;
+	void* allocation = NULL;
+
+	switch (op.opcode) {
+	case op_malloc:
+		capture_time(preTime, thread->config);
+		allocation = malloc(op.size);
+		capture_time(postTime, thread->config);
+		break;
+	case op_calloc:
+		reqAllocSize = (uint64_t)op.size * op.arg;
+		capture_time(preTime, thread->config);
+		allocation = calloc(op.arg, op.size);
+		capture_time(postTime, thread->config);
+		break;
+	case op_memalign:
+		capture_time(preTime, thread->config);
+		posix_memalign(&allocation, op.arg, op.size);
+		capture_time(postTime, thread->config);
+		break;
+	case op_valloc:
+		capture_time(preTime, thread->config);
+		allocation = valloc(op.size);
+		capture_time(postTime, thread->config);
+		break;
+	case op_free:
+		capture_time(preTime, thread->config);
+		free((void*)oldAddress);
+		capture_time(postTime, thread->config);
+		break;
+	case op_realloc:
+		capture_time(preTime, thread->config);
+		allocation = realloc((void*)oldAddress, op.size);
+		capture_time(postTime, thread->config);
+		break;
+	default:
+		__builtin_trap();
+		break;
+	}
+
+	if (op.opcode != op_free) {
+		os_assert(allocation);
+		dirty_memory((uint8_t*)allocation, reqAllocSize);
+		s_results[op.index].store((uint64_t)allocation, std::memory_order_release);
+	}
+
+	thread->counts[op.opcode - 1]++;
+	if (thread->config & CONFIG_REC_LATENCY) {
+		record_latency(thread->latency, op.opcode, reqAllocSize, preTime, postTime);
+	}
+}
+
+static void*
+replay_thread_main(void* arg)
+{
+	replay_thread* thread = (replay_thread*)arg;
+
+	if (s_funcMagSetThreadIndex) {
+		s_funcMagSetThreadIndex(thread->core);
+	}
+
+	// Hold every thread until all of them exist, so that the streams start
+	// together rather than in creation order.
+	while (!s_startReplay.load(std::memory_order_acquire)) {
+		sched_yield();
+	}
+
+	for (const replay_op& op : thread->ops) {
+		run_threaded_event(thread, op);
+	}
+	return NULL;
+}
+
+static bool
+run_threaded_replay(const char* fileName, replay_config_t config)
+{
+	replay_thread** threads = (replay_thread**)malloc_zone_calloc(s_zone, UINT8_MAX + 1,
+			sizeof(replay_thread*));
+	__block uint32_t nextIndex = 0;
+
+	//
+	//Decode the whole trace, splitting it into per-core streams and resolving
+	//each consumed address to the operation that produced it.
+	//
+	bool loaded = replay_file_operations(fileName, ^size_t(const struct compressed_operation* event,
+			size_t remainingMapping) {
+		replay_op op;
+		uint64_t address, oldAddress;
+		size_t read = decode_event(event, remainingMapping, &op, &address, &oldAddress);
+		if (read == 0) {
+			return 0;
+		}
+		op.index = nextIndex++;
+
+		if (op.opcode == op_free || op.opcode == op_realloc) {
+			auto iter = s_addressMap.find(oldAddress);
+			if (iter == s_addressMap.end()) {
+				if (op.opcode == op_free) {
+					s_totalFailedFreeEvents++;
+				} else {
+					s_totalFailedReallocEvents++;
+				}
+				return read;
+			}
+			op.dependency = (uint32_t)iter->second;
+			s_addressMap.erase(iter);
+		}
+		if (op.opcode != op_free) {
+			s_addressMap.insert(std::make_pair(address, (uint64_t)op.index));
+		}
+
+		replay_thread* thread = threads[op.core];
+		if (!thread) {
+			thread = (replay_thread*)malloc_zone_calloc(s_zone, 1, sizeof(replay_thread));
+			new (&thread->ops) ReplayOpVector();
+			thread->core = op.core;
+			thread->config = config;
+			if (config & CONFIG_REC_LATENCY) {
+				thread->latency = (replay_latency_histogram*)malloc_zone_calloc(s_zone, 1,
+						sizeof(replay_latency_histogram));
+			}
+			threads[op.core] = thread;
+		}
+		thread->ops.push_back(op);
+		return read;
+	});
+	s_addressMap.clear();
+	if (!loaded) {
+		malloc_zone_free(s_zone, threads);
+		return false;
+	}
+
+	s_results = (std::atomic<uint64_t>*)malloc_zone_calloc(s_zone, MAX(nextIndex, 1),
+			sizeof(std::atomic<uint64_t>));
+	if (!s_results) {
+		printf("Couldn't allocate results for %u operations\n", nextIndex);
+		exit(1);
+	}
+
+	unsigned threadCount = 0;
+	for (unsigned core = 0; core <= UINT8_MAX; core++) {
+		replay_thread* thread = threads[core];
+		if (!thread) {
+			continue;
+		}
+		int err = pthread_create(&thread->thread, NULL, replay_thread_main, thread);
+		if (err) {
+			printf("Couldn't create replay thread for core %u: %s\n", core, strerror(err));
+			exit(1);
+		}
+		threadCount++;
+	}
+	printf("Replaying %u operations on %u threads\n", nextIndex, threadCount);
+	s_startReplay.store(true, std::memory_order_release);
+
+	//
+	//Wait for the streams to finish and merge their results.
+	//
+	for (unsigned core = 0; core <= UINT8_MAX; core++) {
+		replay_thread* thread = threads[core];
+		if (!thread) {
+			continue;
+		}
+		pthread_join(thread->thread, NULL);
+
+		s_totalMallocEvents += thread->counts[op_malloc - 1];
+		s_totalCallocEvents += thread->counts[op_calloc - 1];
+		s_totalMalignEvents += thread->counts[op_memalign - 1];
+		s_totalVallocEvents += thread->counts[op_valloc - 1];
+		s_totalFreeEvents += thread->counts[op_free - 1];
+		s_totalReallocEvents += thread->counts[op_realloc - 1];
+		s_totalDependencyWaits += thread->dependencyWaits;
+
+		if (thread->latency) {
+			uint64_t* from = &thread->latency->buckets[0][0][0];
+			uint64_t* to = &s_latency->buckets[0][0][0];
+			for (size_t i = 0; i < sizeof(replay_latency_histogram) / sizeof(uint64_t); i++) {
+				to[i] += from[i];
+			}
+			malloc_zone_free(s_zone, thread->latency);
+		}
+		thread->ops.~ReplayOpVector();
+		malloc_zone_free(s_zone, thread);
+	}
+
+	malloc_zone_free(s_zone, threads);
+	malloc_zone_free(s_zone, s_results);
+	s_results = NULL;
+	return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Memory timeline - Samples the resident size, the physical footprint and the
+//                   bytes in use and allocated by the replayed zones at a fixed
+//                   interval, from a timer on its own queue.  Zone statistics
+//                   take the zone locks, so this is safe while the replay
+//                   threads are running.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static uint64_t s_sampleStart;
+
+static void
+sample_memory(void)
+{
+	replay_memory_sample sample = {};
+	sample.time_ms = (mach_absolute_time() - s_sampleStart) * s_timebase.numer /
+			s_timebase.denom / NSEC_PER_MSEC;
+
+	task_vm_info_data_t info;
+	mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+	if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+		sample.resident = info.resident_size;
+		sample.footprint = info.phys_footprint;
+	}
+
+	vm_address_t* addresses = NULL;
+	unsigned zoneCount = 0;
+	malloc_get_all_zones(mach_task_self(), memory_reader, &addresses, &zoneCount);
+	for (unsigned i = 0; i < zoneCount; i++) {
+		malloc_zone_t* zone = (malloc_zone_t*)addresses[i];
+		if (zone == s_zone) {
+			continue;
+		}
+		malloc_statistics_t stats = {0};
+		malloc_zone_statistics(zone, &stats);
+		sample.size_in_use += stats.size_in_use;
+		sample.size_allocated += stats.size_allocated;
+	}
+
+	s_memorySamples->push_back(sample);
+}
+
+static dispatch_source_t
+start_memory_sampler(dispatch_queue_t q)
+{
+	s_memorySamples = new (malloc_zone_malloc(s_zone, sizeof(ReplaySampleVector))) ReplaySampleVector();
+	s_sampleStart = mach_absolute_time();
+
+	dispatch_source_t timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, q);
+	uint64_t interval = (uint64_t)s_sampleIntervalMs * NSEC_PER_MSEC;
+	dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, 0), interval, 0);
+	dispatch_source_set_event_handler(timer, ^{
+		sample_memory();
+	});
+	dispatch_resume(timer);
+	return timer;
+}
+
+static void
+stop_memory_sampler(dispatch_source_t timer, dispatch_queue_t q)
+{
+	dispatch_source_cancel(timer);
+	// Wait out any sample in progress, then take a final one.
+	dispatch_sync(q, ^{
+		sample_memory();
+	});
+	dispatch_release(timer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// report_latency - Prints the latency percentiles of each call and size class,
+//                  and writes the full histograms to the perfdata.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the upper bound, in ns, of the bucket holding the given quantile,
+// expressed in thousandths.
+static uint64_t
+latency_quantile(const uint64_t* buckets, uint64_t total, unsigned permille)
+{
+	uint64_t target = (total * permille + 999) / 1000;
+	uint64_t seen = 0;
+	for (unsigned b = 0; b < REPLAY_LATENCY_BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen >= target) {
+			return 1ull << b;
+		}
+	}
+	return 1ull << (REPLAY_LATENCY_BUCKETS - 1);
+}
+
+static void
+report_latency(pdwriter_t perfDataWriter)
+{
+	json_t jsonW = NULL;
+	if (perfDataWriter) {
+		jsonW = pdwriter_start_extension(perfDataWriter, "libmalloc.latency_histograms");
+	}
+
+	printf("\n\n\n");
+	printf("Call      Size (bytes)            Count   p50 (ns)   p99 (ns)  p99.9 (ns)\n");
+	printf("=========================================================================\n");
+
+	for (int call = 0; call < operation_count; call++) {
+		for (unsigned sizeClass = 0; sizeClass < REPLAY_SIZE_CLASSES; sizeClass++) {
+			const uint64_t* buckets = s_latency->buckets[call][sizeClass];
+			uint64_t total = 0;
+			for (unsigned b = 0; b < REPLAY_LATENCY_BUCKETS; b++) {
+				total += buckets[b];
+			}
+			if (!total) {
+				continue;
+			}
+
+			uint64_t sizeMin = sizeClass ? 1ull << (sizeClass - 1) : 0;
+			uint64_t sizeMax = sizeClass ? (1ull << sizeClass) - 1 : 0;
+			printf("%-8s  %5llu-%-10llu  %11llu  %9llu  %9llu  %10llu\n",
+					mcall_to_name(call + 1), sizeMin, sizeMax, total,
+					latency_quantile(buckets, total, 500),
+					latency_quantile(buckets, total, 990),
+					latency_quantile(buckets, total, 999));
+
+			if (jsonW) {
+				char description[16];
+				snprintf(description, sizeof(description), "%d:%u", call + 1, sizeClass);
+				json_member_start_object(jsonW, description);
+				json_member_int(jsonW, "call", call + 1);
+				json_member_uint(jsonW, "size_class", sizeClass);
+				json_member_uint(jsonW, "size_min", (unsigned int)sizeMin);
+				json_member_uint(jsonW, "size_max", (unsigned int)MIN(sizeMax, UINT_MAX));
+				json_member_start_array(jsonW, "buckets");
+				for (unsigned b = 0; b < REPLAY_LATENCY_BUCKETS; b++) {
+					json_value_uint(jsonW, (unsigned int)MIN(buckets[b], UINT_MAX));
+				}
+				json_end_array(jsonW);
+				json_end_object(jsonW);
+			}
+		}
+	}
+
+	if (jsonW) {
+		pdwriter_end_extension(perfDataWriter, jsonW);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// report_memory_timeline - Prints the peak resident size and footprint, and
+//                          writes the timeline to the perfdata for
+//                          malloc_replay_plotter.py.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+write_timeline_series(json_t jsonW, const char* name, size_t offset, uint64_t divisor)
+{
+	json_member_start_array(jsonW, name);
+	for (const auto& sample : *s_memorySamples) {
+		uint64_t value = *(const uint64_t*)((const char*)&sample + offset) / divisor;
+		json_value_uint(jsonW, (unsigned int)MIN(value, UINT_MAX));
+	}
+	json_end_array(jsonW);
+}
+
+static void
+report_memory_timeline(pdwriter_t perfDataWriter)
+{
+	uint64_t peakResident = 0;
+	uint64_t peakFootprint = 0;
+	double peakFrag = 0;
+	for (const auto& sample : *s_memorySamples) {
+		peakResident = MAX(peakResident, sample.resident);
+		peakFootprint = MAX(peakFootprint, sample.footprint);
+		if (sample.size_allocated) {
+			peakFrag = MAX(peakFrag, 100 - (100.0 * sample.size_in_use) / sample.size_allocated);
+		}
+	}
+
+	printf("\n\n\n");
+	printf("Samples:        %16zu\n"
+		   "PeakResident:   %16llu\n"
+		   "PeakFootprint:  %16llu\n"
+		   "PeakFrag:       %16.2f\n",
+		   s_memorySamples->size(), peakResident, peakFootprint, peakFrag);
+
+	if (perfDataWriter) {
+		pdwriter_new_value(perfDataWriter, "PeakResident", pdunit_bytes, peakResident);
+		pdwriter_new_value(perfDataWriter, "PeakFootprint", pdunit_bytes, peakFootprint);
+
+		//
+		//One array per series, all indexed by sample. Sizes are in KB, to fit
+		//the JSON writer's 32-bit values.
+		//
+		json_t jsonW = pdwriter_start_extension(perfDataWriter, "libmalloc.memory_timeline");
+		if (jsonW) {
+			json_member_uint(jsonW, "interval_ms", s_sampleIntervalMs);
+			write_timeline_series(jsonW, "time_ms", offsetof(replay_memory_sample, time_ms), 1);
+			write_timeline_series(jsonW, "resident_kb", offsetof(replay_memory_sample, resident), 1024);
+			write_timeline_series(jsonW, "footprint_kb", offsetof(replay_memory_sample, footprint), 1024);
+			write_timeline_series(jsonW, "in_use_kb", offsetof(replay_memory_sample, size_in_use), 1024);
+			write_timeline_series(jsonW, "allocated_kb", offsetof(replay_memory_sample, size_allocated), 1024);
+			pdwriter_end_extension(perfDataWriter, jsonW);
+		}
+	}
+
+	s_memorySamples->~ReplaySampleVector();
+	malloc_zone_free(s_zone, s_memorySamples);
+	s_memorySamples = NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// run_malloc_replay - Replay a compressed malloc trace.  The idea here is to replay
+//                   the recorded events while forcing a specific CPU.  By doing
+//                   so libmalloc will target a specific magazine.  This way we
+//                   can see how the current allocator would pack an old allocation
+//                   stream.  With CONFIG_THREADED, each CPU's events are replayed
+//                   on a thread of their own, so that the magazines see the
+//                   same contention as when the trace was recorded.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static bool
+run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config_t config)
+{
+    if (!setup_private_malloc_zone()) {
+        return false;
+    }
+
+	mach_timebase_info(&s_timebase);
+	if (config & CONFIG_REC_LATENCY) {
+		s_latency = (replay_latency_histogram*)malloc_zone_calloc(s_zone, 1,
+				sizeof(replay_latency_histogram));
+	}
+
+	dispatch_queue_t sampleQueue = NULL;
+	dispatch_source_t sampleTimer = NULL;
+	if (s_sampleIntervalMs) {
+		sampleQueue = dispatch_queue_create("Sample Memory", DISPATCH_QUEUE_SERIAL);
+		sampleTimer = start_memory_sampler(sampleQueue);
+	}
+
+	bool replayed;
+	if (config & CONFIG_THREADED) {
+		replayed = run_threaded_replay(fileName, config);
+	} else {
+		replayed = replay_file_operations(fileName, ^size_t(const struct compressed_operation* event,
+				size_t remainingMapping) {
+			return run_event(event, remainingMapping, config);
+		});
+		s_addressMap.clear();
+	}
+
+	if (sampleTimer) {
+		stop_memory_sampler(sampleTimer, sampleQueue);
+		dispatch_release(sampleQueue);
+	}
+	if (!replayed) {
+		return false;
+	}
 
     //
     //If passed a writer, output performance data.
@@ -713,6 +1364,12 @@ run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config
            s_totalFailedReallocEvents,
            s_totalFailedFreeEvents
            );
+	if (config & CONFIG_THREADED) {
+		printf("DependencyWaits:%16llu\n", s_totalDependencyWaits);
+		if (perfDataWriter) {
+			pdwriter_new_value(perfDataWriter, "DependencyWaits", PDUNIT_CUSTOM(dependencywaits), s_totalDependencyWaits);
+		}
+	}
 
     //
     //Now lets go over the data and find how fragmented we are.
@@ -830,6 +1487,15 @@ run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config
 			pdwriter_end_extension(perfDataWriter, jsonW);
 		}
 	}
+
+	if (config & CONFIG_REC_LATENCY) {
+		report_latency(perfDataWriter);
+		malloc_zone_free(s_zone, s_latency);
+		s_latency = NULL;
+	}
+	if (s_memorySamples) {
+		report_memory_timeline(perfDataWriter);
+	}
 	return true;
 }
 
@@ -843,13 +1509,17 @@ run_malloc_replay(const char* fileName, pdwriter_t perfDataWriter, replay_config
 static void
 usage()
 {
-    printf("libmalloc_replay -r <input mtrace file> [-p] [-j filename] [-t testname] [-c | -s]\n");
+    printf("libmalloc_replay -r <input mtrace file> [-p] [-m] [-l] [-T interval] [-j filename] [-t testname] [-c | -s]\n");
     printf("libmalloc_replay [-i <input artrace file>] -o <output mtrace file> [-p]\n");
     printf("\t-p Pause the replay process before exit\n");
     printf("\t-j  <output file>\toutput perfdata V2 formatted file\n");
     printf("\t-t  <test name>\tset the test name for the perfdata V2 formatted output file\n");
     printf("\t-c capture and output instruction counts along with the performance data.\n");
     printf("\t-s capture and output instruction count statistics along with the performance data.\n");
+    printf("\t-m replay each recorded core's events on a thread of its own. Frees and reallocs wait for the\n"
+           "\t   allocation they refer to, even if it was made on another thread. Not compatible with -c or -s.\n");
+    printf("\t-l capture and output latency histograms by call and size class.\n");
+    printf("\t-T <interval>\tsample resident size and fragmentation every <interval> ms during the replay.\n");
 }
 
 
@@ -875,7 +1545,7 @@ main(int argc, char** argv)
         return -1;
     }
 
-    while ((c = getopt(argc, (char* const*)argv, "phr:i:o:j:t:cs")) != -1) {
+    while ((c = getopt(argc, (char* const*)argv, "phr:i:o:j:t:csmlT:")) != -1) {
       switch (c) {
 		case 'r':
 			inputMTrace = strdup(optarg);
@@ -908,6 +1578,19 @@ main(int argc, char** argv)
 		case 's':
 			config |= CONFIG_REC_STATS;
 			break;
+		case 'm':
+			config |= CONFIG_THREADED;
+			break;
+		case 'l':
+			config |= CONFIG_REC_LATENCY;
+			break;
+		case 'T':
+			s_sampleIntervalMs = (uint32_t)strtoul(optarg, NULL, 0);
+			if (!s_sampleIntervalMs) {
+				printf("Invalid sample interval: %s\n", optarg);
+				return EX_USAGE;
+			}
+			break;
 		case 'h':
 		default:
 			usage();
@@ -921,6 +1604,12 @@ main(int argc, char** argv)
 		return EX_USAGE;
 	}
 
+	if ((config & CONFIG_THREADED) && (config & (CONFIG_REC_COUNTERS | CONFIG_REC_STATS))) {
+		printf("Invalid usage: -m with -c or -s\n");
+		usage();
+		return EX_USAGE;
+	}
+
 	timespec beginTime = {0};
 
     pdwriter_t writer = NULL;
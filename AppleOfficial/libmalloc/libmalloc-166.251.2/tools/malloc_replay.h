@@ -208,5 +208,44 @@ typedef struct replay_malloc_zone {
     std::vector<replay_malloc_magazine, ReplayAllocator<replay_malloc_magazine> > magazines;
 } *replay_malloc_zone_t;
 
+//
+//Threaded replay. The trace is decoded up front into one stream of operations
+//per core. An operation that consumes an address (free, realloc) records the
+//trace index of the operation that produced it, and waits for that operation
+//to complete when the two are on different streams.
+//
+#define REPLAY_NO_DEPENDENCY UINT32_MAX
+
+struct replay_op {
+	uint32_t index;		// position in the trace, and the operation's result slot
+	uint32_t dependency;	// index of the producer of the consumed address
+	uint32_t size;
+	uint32_t arg;		// calloc count or memalign alignment
+	uint8_t opcode;
+	uint8_t core;
+};
+
+//
+//Latency histograms, per operation and size class. Size class c holds requests
+//of [2^(c-1), 2^c) bytes, bucket b holds latencies of [2^(b-1), 2^b) ns.
+//
+#define REPLAY_SIZE_CLASSES 33
+#define REPLAY_LATENCY_BUCKETS 32
+
+struct replay_latency_histogram {
+	uint64_t buckets[operation_count][REPLAY_SIZE_CLASSES][REPLAY_LATENCY_BUCKETS];
+};
+
+//
+//One point of the memory timeline.
+//
+struct replay_memory_sample {
+	uint64_t time_ms;
+	uint64_t resident;
+	uint64_t footprint;
+	uint64_t size_in_use;
+	uint64_t size_allocated;
+};
+
 
 #endif // __MALLOC_REPLAY_H
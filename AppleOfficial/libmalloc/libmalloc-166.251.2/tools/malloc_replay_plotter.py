@@ -39,6 +39,10 @@ class ReportConfiguration(object):
             return RequestSizePlotter
         if self.report_type == "nano_request_bins_ysize":
             return RequestSizePlotter
+        if self.report_type == "latency":
+            return LatencyPlotter
+        if self.report_type == "memory":
+            return MemoryTimelinePlotter
 
     def call_identifier(self):
         return self.call_identifier_for_name(self.call)
@@ -320,6 +324,66 @@ class RequestSizePlotter(Plotter):
                 plt.subplots_adjust(hspace=0.5)
 
 
+class LatencyPlotter(Plotter):
+
+    # Plots the latency distribution of the chosen call for each size class, as
+    # recorded by libmalloc_replay -l. Bucket b holds latencies of
+    # [2^(b-1), 2^b) ns.
+    def plot(self, report_data):
+        num_plots = report_data.num_plots()
+        plt.figure(figsize=(20, num_plots * 5))
+        call_identifier = self.configuration.call_identifier()
+
+        for i, data, _, path in report_data.enumerate():
+            histograms = data['extensions'].get('libmalloc.latency_histograms', {})
+            ax = plt.subplot(num_plots, 1, i + 1)
+            for key, histogram in sorted(histograms.items(), key=lambda kv: kv[1]['size_class']):
+                if histogram['call'] != call_identifier:
+                    continue
+                buckets = histogram['buckets']
+                total = sum(buckets)
+                if not total:
+                    continue
+                cdf = np.cumsum(buckets) / float(total)
+                label = '{}-{} bytes ({})'.format(histogram['size_min'], histogram['size_max'], total)
+                ax.step([2 ** b for b in range(len(buckets))], cdf, where='post', label=label)
+            ax.set_xscale('log', basex=2)
+            ax.set_xlabel("Latency (ns)")
+            ax.set_ylabel("Cumulative fraction")
+            ax.set_title('{}: {}'.format(path, self.configuration.call))
+            ax.legend(loc='lower right', fontsize='small')
+
+
+class MemoryTimelinePlotter(Plotter):
+
+    # Plots resident size, footprint and fragmentation over the course of the
+    # replay, as sampled by libmalloc_replay -T.
+    def plot(self, report_data):
+        plt.figure(figsize=(20, 10))
+        labels = ["V1", "V2"]
+        mem_ax = plt.subplot(211)
+        frag_ax = plt.subplot(212)
+
+        for i, data, _, path in report_data.enumerate():
+            timeline = data['extensions'].get('libmalloc.memory_timeline')
+            if not timeline:
+                logging.warning('No memory timeline in %s' % path)
+                continue
+            times = timeline['time_ms']
+            mem_ax.plot(times, [kb / 1024.0 for kb in timeline['resident_kb']], label='{} resident'.format(labels[i]))
+            mem_ax.plot(times, [kb / 1024.0 for kb in timeline['footprint_kb']], label='{} footprint'.format(labels[i]))
+            frag = [100 - (100.0 * used / allocated) if allocated else 0
+                    for used, allocated in zip(timeline['in_use_kb'], timeline['allocated_kb'])]
+            frag_ax.plot(times, frag, label=labels[i])
+
+        mem_ax.set_ylabel("MB")
+        mem_ax.legend()
+        frag_ax.set_xlabel("Time (ms)")
+        frag_ax.set_ylabel("Fragmentation (%)")
+        frag_ax.legend()
+        plt.suptitle(self.configuration.fileV1)
+
+
 class Tool(object):
 
     def __init__(self, args):
@@ -340,10 +404,10 @@ class Tool(object):
 
     @classmethod
     def main(cls):
-        parser = argparse.ArgumentParser(description='Analyze libmalloc_replay perfdata output. This takes as input a .pdj file containing request sizes and instruction counts and outputs various plots.')
+        parser = argparse.ArgumentParser(description='Analyze libmalloc_replay perfdata output. This takes as input a .pdj file containing request sizes and instruction counts, latency histograms (-l) or a memory timeline (-T) and outputs various plots.')
         parser.add_argument('fileV1', help='Path to nano V1 data JSON file')
         parser.add_argument('fileV2', nargs='?', help='Optional path to nano V2 data JSON file')
-        parser.add_argument('--report', dest='report_type', choices=['instructions', 'scatter', 'request_sizes', 'nano_request_bins', 'nano_request_bins_ysize'], default='instructions', help='The report type to produce (default: %(default)s)')
+        parser.add_argument('--report', dest='report_type', choices=['instructions', 'scatter', 'request_sizes', 'nano_request_bins', 'nano_request_bins_ysize', 'latency', 'memory'], default='instructions', help='The report type to produce (default: %(default)s)')
         parser.add_argument('--call', dest='call', default='malloc', choices=['malloc', 'calloc', 'realloc', 'memalign', 'valloc'], help="The call to analyze (default: %(default)s)")
         parser.add_argument('-f', '--xfilter', type=int, default=0, help="Filter the histogram to a range from 0 to <%(dest)s)>")
         parser.add_argument('-b', '--num_bins', type=int, default=10000, help="The number of bins to use for histogrammed data (default: %(default)s)")
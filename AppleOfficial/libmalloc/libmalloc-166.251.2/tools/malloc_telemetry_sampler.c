@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2019 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+//
+//Periodically samples malloc_zone_telemetry() for the default zone of the
+//process it is loaded into, and writes the samples as CSV. Build it as a
+//dylib and insert it into the process under investigation:
+//
+//	clang -dynamiclib -I private -o libmalloc_telemetry_sampler.dylib \
+//		tools/malloc_telemetry_sampler.c
+//	DYLD_INSERT_LIBRARIES=libmalloc_telemetry_sampler.dylib \
+//		MallocTelemetryInterval=100 MallocTelemetryOutput=/tmp/app.csv ./app
+//
+//MallocTelemetryInterval is the sampling interval in milliseconds (default
+//1000) and MallocTelemetryOutput the output file (default stderr).
+//
+//Each sample is a set of rows that share a time stamp, in milliseconds since
+//the sampler started:
+//
+//	class,<time>,<allocator>,<size>,<blocks in use>,<blocks free>
+//	magazine,<time>,<allocator>,<magazine>,<lock acquisitions>,
+//		<lock contentions>,<regions to depot>,<regions from depot>,
+//		<bytes madvised>,<bytes in use>,<bytes in magazine>
+//	large,<time>,<blocks in use>,<bytes in use>
+//
+//Class rows are only written for size classes with blocks in use or free.
+//The lock, depot and madvise columns of magazine rows are the change since
+//the previous sample; the magazine column is -1 for the depot. The sampler's
+//own lock acquisitions are included, one per magazine per sample.
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc/malloc.h>
+#include <malloc_private.h>
+
+#define DEFAULT_INTERVAL_MS 1000
+
+static FILE *output;
+static unsigned interval_ms = DEFAULT_INTERVAL_MS;
+
+static uint64_t
+now_ms(void)
+{
+	return clock_gettime_nsec_np(CLOCK_MONOTONIC) / 1000000;
+}
+
+static void
+write_magazine(uint64_t time, const char *name, int index,
+		const malloc_magazine_telemetry_t *cur,
+		const malloc_magazine_telemetry_t *prev)
+{
+	fprintf(output, "magazine,%llu,%s,%d,%llu,%llu,%llu,%llu,%llu,%zu,%zu\n",
+			time, name, index,
+			cur->lock_acquisitions - prev->lock_acquisitions,
+			cur->lock_contentions - prev->lock_contentions,
+			cur->regions_to_depot - prev->regions_to_depot,
+			cur->regions_from_depot - prev->regions_from_depot,
+			cur->bytes_madvised - prev->bytes_madvised,
+			cur->bytes_in_use, cur->bytes_in_magazine);
+}
+
+static void
+write_allocator(uint64_t time, const char *name,
+		const malloc_allocator_telemetry_t *cur,
+		const malloc_allocator_telemetry_t *prev)
+{
+	for (unsigned i = 0; i < cur->num_size_classes; i++) {
+		const malloc_size_class_telemetry_t *sc = &cur->size_classes[i];
+		if (sc->blocks_in_use || sc->blocks_free) {
+			fprintf(output, "class,%llu,%s,%zu,%u,%u\n", time, name, sc->size,
+					sc->blocks_in_use, sc->blocks_free);
+		}
+	}
+	if (!cur->num_magazines) {
+		return;
+	}
+	write_magazine(time, name, -1, &cur->depot, &prev->depot);
+	for (unsigned i = 0; i < cur->num_magazines; i++) {
+		write_magazine(time, name, (int)i, &cur->magazines[i], &prev->magazines[i]);
+	}
+}
+
+static void *
+sampler_thread(void *arg)
+{
+	malloc_zone_t *zone = malloc_default_zone();
+	malloc_zone_telemetry_t *cur = calloc(1, sizeof(*cur));
+	malloc_zone_telemetry_t *prev = calloc(1, sizeof(*prev));
+	uint64_t start = now_ms();
+
+	if (!cur || !prev) {
+		fprintf(stderr, "malloc_telemetry_sampler: out of memory\n");
+		return NULL;
+	}
+
+	pthread_setname_np("com.apple.malloc.telemetry-sampler");
+	fprintf(output, "# class,time,allocator,size,blocks_in_use,blocks_free\n");
+	fprintf(output, "# magazine,time,allocator,magazine,lock_acquisitions,"
+			"lock_contentions,regions_to_depot,regions_from_depot,"
+			"bytes_madvised,bytes_in_use,bytes_in_magazine\n");
+	fprintf(output, "# large,time,blocks_in_use,bytes_in_use\n");
+
+	for (;;) {
+		cur->version = MALLOC_ZONE_TELEMETRY_VERSION;
+		if (!malloc_zone_telemetry(zone, cur)) {
+			fprintf(stderr, "malloc_telemetry_sampler: the default zone "
+					"does not support telemetry\n");
+			break;
+		}
+
+		uint64_t time = now_ms() - start;
+		write_allocator(time, "nano", &cur->nano, &prev->nano);
+		write_allocator(time, "tiny", &cur->tiny, &prev->tiny);
+		write_allocator(time, "small", &cur->small, &prev->small);
+		write_allocator(time, "medium", &cur->medium, &prev->medium);
+		fprintf(output, "large,%llu,%u,%zu\n", time, cur->large_blocks_in_use,
+				cur->large_bytes_in_use);
+		fflush(output);
+
+		malloc_zone_telemetry_t *tmp = prev;
+		prev = cur;
+		cur = tmp;
+		usleep(interval_ms * 1000);
+	}
+
+	free(cur);
+	free(prev);
+	return NULL;
+}
+
+__attribute__((constructor))
+static void
+sampler_init(void)
+{
+	const char *interval = getenv("MallocTelemetryInterval");
+	const char *path = getenv("MallocTelemetryOutput");
+	pthread_t thread;
+
+	if (interval) {
+		long value = strtol(interval, NULL, 10);
+		if (value > 0) {
+			interval_ms = (unsigned)value;
+		}
+	}
+
+	output = stderr;
+	if (path && (output = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "malloc_telemetry_sampler: cannot open %s: %s\n", path,
+				strerror(errno));
+		return;
+	}
+
+	if (pthread_create(&thread, NULL, sampler_thread, NULL) == 0) {
+		pthread_detach(thread);
+	}
+}
@@ -26,12 +26,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "../src/radix_tree_internal.h"
 
 void
 usage() {
 	printf ("usage: radix-tree [-l 0xADDRESS | 0xSTART-0xEND] FILENAME\n");
+	printf ("       radix-tree -b READERS\n");
 	printf ("\n");
 	printf ("This is a debugging tool for the radix-tree sidetable used to track VM allocations\n");
 	printf ("under MallocStackLogging=lite.\n");
@@ -39,17 +43,101 @@ usage() {
 	printf ("  radix-tree FILE                # print out radix tree as text\n");
 	printf ("  radix-tree -l 0xf00 FILE       # lookup address in radix tree\n");
 	printf ("  radix-tree -l 0xf00-0xba FILE  # lookup address range in radix tree\n");
+	printf ("  radix-tree -b 4                # benchmark 4 readers against 1 writer\n");
 	printf ("\n");
 	exit(0);
 }
 
 uint64_t minsize = 4096;
 
+#define BENCH_SECONDS 5
+#define BENCH_KEYS 16384
+
+struct bench_reader {
+	pthread_t thread;
+	struct radix_ctree *tree;
+	_Atomic bool *stop;
+	uint64_t lookups;
+};
+
+static void *
+bench_reader_thread(void *arg)
+{
+	struct bench_reader *reader = arg;
+	unsigned seed = (unsigned)(uintptr_t)reader;
+
+	while (!atomic_load_explicit(reader->stop, memory_order_relaxed)) {
+		uint64_t key = (uint64_t)(rand_r(&seed) % BENCH_KEYS) * 2 * minsize;
+		radix_ctree_lookup(reader->tree, key);
+		reader->lookups++;
+	}
+	return NULL;
+}
+
+/*
+ * Run readers doing lookups on a concurrent radix tree while this thread
+ * inserts and deletes keys in it, and print the throughput of each.
+ */
+static int
+bench(int num_readers)
+{
+	struct radix_ctree *tree = radix_ctree_create();
+	if (!tree) {
+		fprintf(stderr, "failed to create tree\n");
+		return 1;
+	}
+	for (uint64_t i = 0; i < BENCH_KEYS; i += 2) {
+		radix_ctree_insert(tree, i * 2 * minsize, minsize, i);
+	}
+
+	_Atomic bool stop = false;
+	struct bench_reader *readers = calloc(num_readers, sizeof(*readers));
+	for (int i = 0; i < num_readers; i++) {
+		readers[i].tree = tree;
+		readers[i].stop = &stop;
+		pthread_create(&readers[i].thread, NULL, bench_reader_thread, &readers[i]);
+	}
+
+	uint64_t start = clock_gettime_nsec_np(CLOCK_MONOTONIC);
+	uint64_t end = start + BENCH_SECONDS * NSEC_PER_SEC;
+	uint64_t now, writes = 0;
+	unsigned seed = 0;
+	do {
+		uint64_t i = rand_r(&seed) % BENCH_KEYS;
+		if (writes & 1) {
+			radix_ctree_insert(tree, i * 2 * minsize, minsize, i);
+		} else {
+			radix_ctree_delete(tree, i * 2 * minsize, minsize);
+		}
+		writes++;
+	} while ((now = clock_gettime_nsec_np(CLOCK_MONOTONIC)) < end);
+	atomic_store(&stop, true);
+
+	double seconds = (double)(now - start) / NSEC_PER_SEC;
+	for (int i = 0; i < num_readers; i++) {
+		pthread_join(readers[i].thread, NULL);
+		printf ("reader %d: %.0f lookups/sec\n", i, readers[i].lookups / seconds);
+	}
+	printf ("writer: %.0f ops/sec\n", writes / seconds);
+
+	free(readers);
+	radix_ctree_destroy(tree);
+	return 0;
+}
+
 int main(int argc, char **argv) {
 	int ch;
 	uint64_t start = 0, end = 0;
-	while ((ch = getopt(argc, argv, "l:")) != -1) {
+	int readers = 0;
+	while ((ch = getopt(argc, argv, "b:l:")) != -1) {
 		switch (ch) {
+			case 'b':
+				readers = atoi(optarg);
+				if (readers <= 0) {
+					usage();
+				}
+			break;
+
 			case 'l': {
 				char *p = strchr(optarg, '-');
 				if (p) {
@@ -72,6 +160,11 @@ int main(int argc, char **argv) {
 	}
 	argc -= optind;
 	argv += optind;
+	if (readers) {
+		if (argc != 0 || start != 0)
+			usage();
+		return bench(readers);
+	}
 	if (argc != 1)
 		usage();
 
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// Message send profile reader.
+//
+// Ranks the methods in a profile written by a process run with
+// OBJC_PROFILE_MSGSEND=path. Methods that keep missing the cache or
+// keep being forwarded are the dynamic dispatch worth removing.
+// Counts are scaled by the profile's sampling interval. A class
+// entry covers all of that class's sends; it is not the class that
+// implements the method.
+//
+//   clang++ -std=c++14 -O2 msgprof.cpp -o msgprof
+//   ./msgprof [-s misses|fills|expansions|forwards] [-n count] profile
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "runtime/objc-msgprof.h"
+
+static const char * const eventNames[MsgprofEventCount] = {
+    "misses", "fills", "expansions", "forwards",
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s misses|fills|expansions|forwards] "
+            "[-n count] profile\n", name);
+    exit(2);
+}
+
+static void fail(const char *path, const char *why)
+{
+    fprintf(stderr, "%s: %s\n", path, why);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int sortEvent = MsgprofMiss;
+    size_t limit = 50;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-s")  &&  i+1 < argc) {
+            const char *name = argv[++i];
+            for (sortEvent = 0; sortEvent < MsgprofEventCount; sortEvent++) {
+                if (0 == strcmp(name, eventNames[sortEvent])) break;
+            }
+            if (sortEvent == MsgprofEventCount) usage(argv[0]);
+        } else if (0 == strcmp(argv[i], "-n")  &&  i+1 < argc) {
+            limit = strtoul(argv[++i], NULL, 0);
+        } else if (argv[i][0] == '-'  ||  path) {
+            usage(argv[0]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) usage(argv[0]);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) fail(path, strerror(errno));
+
+    msgprof_header_t header;
+    if (fread(&header, sizeof(header), 1, f) != 1  ||
+        0 != memcmp(header.magic, OBJC_MSGPROF_MAGIC, sizeof(header.magic)))
+    {
+        fail(path, "not a message send profile");
+    }
+    if (header.version != OBJC_MSGPROF_VERSION) {
+        fail(path, "unsupported profile version");
+    }
+
+    std::vector<msgprof_record_t> records(header.recordCount);
+    std::vector<char> strings(header.stringBytes + 1);
+    if (fread(records.data(), sizeof(msgprof_record_t), records.size(), f)
+            != records.size()  ||
+        fread(strings.data(), 1, header.stringBytes, f) != header.stringBytes)
+    {
+        fail(path, "profile is truncated");
+    }
+    fclose(f);
+    strings[header.stringBytes] = '\0';
+
+    for (const msgprof_record_t& r : records) {
+        if (r.className >= header.stringBytes  ||
+            r.selName >= header.stringBytes)
+        {
+            fail(path, "profile is corrupt");
+        }
+    }
+
+    uint64_t totals[MsgprofEventCount] = {};
+    for (const msgprof_record_t& r : records) {
+        for (int e = 0; e < MsgprofEventCount; e++) totals[e] += r.counts[e];
+    }
+
+    std::sort(records.begin(), records.end(),
+              [=](const msgprof_record_t& a, const msgprof_record_t& b) {
+                  return a.counts[sortEvent] > b.counts[sortEvent];
+              });
+
+    uint64_t interval = header.interval ? header.interval : 1;
+    printf("%u methods, sampled 1 in %llu, by %s\n", header.recordCount,
+           (unsigned long long)interval, eventNames[sortEvent]);
+    printf("%12s %12s %12s %12s  %s\n", "misses", "fills", "expansions",
+           "forwards", "method");
+
+    size_t shown = 0;
+    for (const msgprof_record_t& r : records) {
+        if (shown++ == limit  ||  r.counts[sortEvent] == 0) break;
+        const char *cls = &strings[r.className];
+        bool meta = cls[0] == '+';
+        printf("%12llu %12llu %12llu %12llu  %c[%s %s]\n",
+               (unsigned long long)(r.counts[MsgprofMiss] * interval),
+               (unsigned long long)(r.counts[MsgprofFill] * interval),
+               (unsigned long long)(r.counts[MsgprofExpand] * interval),
+               (unsigned long long)(r.counts[MsgprofForward] * interval),
+               meta ? '+' : '-', meta ? cls+1 : cls, &strings[r.selName]);
+    }
+
+    printf("%12llu %12llu %12llu %12llu  total\n",
+           (unsigned long long)(totals[MsgprofMiss] * interval),
+           (unsigned long long)(totals[MsgprofFill] * interval),
+           (unsigned long long)(totals[MsgprofExpand] * interval),
+           (unsigned long long)(totals[MsgprofForward] * interval));
+    return 0;
+}
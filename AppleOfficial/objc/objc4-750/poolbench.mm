@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// Autorelease pool push/pop throughput benchmark.
+//
+// Measures popping pools that hold many objects, which is where
+// releaseUntil() batches, prefetches, and coalesces releases. Run it
+// once normally and once with OBJC_DISABLE_BATCHED_POOL_DRAIN=YES
+// to compare against releasing one object at a time.
+//
+//   clang++ -O2 -fno-objc-arc poolbench.mm -lobjc -o poolbench
+//   ./poolbench [objects per pool] [pools]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach/mach_time.h>
+#include <objc/runtime.h>
+#include <objc/NSObject.h>
+
+extern "C" {
+    void *objc_autoreleasePoolPush(void);
+    void objc_autoreleasePoolPop(void *context);
+    id objc_autorelease(id obj);
+    id objc_retain(id obj);
+    void objc_release(id obj);
+}
+
+// Average nanoseconds per operation, from mach_absolute_time() ticks.
+static double nanosecondsPer(uint64_t ticks, uint64_t count)
+{
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom) mach_timebase_info(&timebase);
+    return (double)ticks * timebase.numer / timebase.denom / count;
+}
+
+// Empty pools: the cost of push and pop themselves.
+static void emptyPools(size_t pools)
+{
+    uint64_t start = mach_absolute_time();
+    for (size_t p = 0; p < pools; p++) {
+        void *pool = objc_autoreleasePoolPush();
+        objc_autoreleasePoolPop(pool);
+    }
+    printf("%-32s %8.1f ns/pool\n", "empty push/pop",
+           nanosecondsPer(mach_absolute_time() - start, pools));
+}
+
+// Each object is autoreleased once and deallocated by the pop.
+static void freshObjects(size_t objects, size_t pools)
+{
+    id *objs = (id *)malloc(objects * sizeof(id));
+    uint64_t total = 0;
+
+    for (size_t p = 0; p < pools; p++) {
+        for (size_t i = 0; i < objects; i++) {
+            objs[i] = [[NSObject alloc] init];
+        }
+        void *pool = objc_autoreleasePoolPush();
+        for (size_t i = 0; i < objects; i++) {
+            objc_autorelease(objs[i]);
+        }
+        uint64_t start = mach_absolute_time();
+        objc_autoreleasePoolPop(pool);
+        total += mach_absolute_time() - start;
+    }
+
+    free(objs);
+    printf("%-32s %8.1f ns/object\n", "pop, deallocating",
+           nanosecondsPer(total, objects * pools));
+}
+
+// A few long-lived objects autoreleased many times each,
+// as in loops that return the same object repeatedly.
+static void repeatedObjects(size_t objects, size_t pools)
+{
+    enum { Distinct = 8 };
+    id objs[Distinct];
+    for (int i = 0; i < Distinct; i++) objs[i] = [[NSObject alloc] init];
+
+    uint64_t total = 0;
+    for (size_t p = 0; p < pools; p++) {
+        void *pool = objc_autoreleasePoolPush();
+        for (size_t i = 0; i < objects; i++) {
+            objc_autorelease(objc_retain(objs[i % Distinct]));
+        }
+        uint64_t start = mach_absolute_time();
+        objc_autoreleasePoolPop(pool);
+        total += mach_absolute_time() - start;
+    }
+
+    for (int i = 0; i < Distinct; i++) objc_release(objs[i]);
+    printf("%-32s %8.1f ns/object\n", "pop, repeated objects",
+           nanosecondsPer(total, objects * pools));
+}
+
+static bool batchedDrainDisabled(void)
+{
+    const char *value = getenv("OBJC_DISABLE_BATCHED_POOL_DRAIN");
+    return value  &&  0 == strcmp(value, "YES");
+}
+
+int main(int argc, char **argv)
+{
+    size_t objects = argc > 1 ? strtoul(argv[1], NULL, 0) : 100000;
+    size_t pools = argc > 2 ? strtoul(argv[2], NULL, 0) : 20;
+
+    printf("%zu objects per pool, %zu pools, batched drain %s\n",
+           objects, pools,
+           batchedDrainDisabled() ? "off" : "on");
+
+    emptyPools(objects * pools);
+    freshObjects(objects, pools);
+    repeatedObjects(objects, pools);
+    return 0;
+}
@@ -26,6 +26,9 @@
 
 #include "objc-weak.h"
 #include "llvm-DenseMap.h"
+#if __OBJC2__
+#include "objc-cache.h"
+#endif
 #include "NSObject.h"
 
 #include <malloc/malloc.h>
@@ -94,8 +97,16 @@ struct SideTable {
     RefcountMap refcnts;
     weak_table_t weak_table;
 
-    SideTable() {
+    // Weak loads that do not take slock. See objc_loadWeakRetained().
+    // weakSeq advances each time weak references are cleared.
+    // weakReaders[weakSeq & 1] counts the loads that started since then.
+    std::atomic<uint32_t> weakSeq;
+    std::atomic<uint32_t> weakReaders[2];
+
+    SideTable() : weakSeq(0) {
         memset(&weak_table, 0, sizeof(weak_table));
+        weakReaders[0].store(0, std::memory_order_relaxed);
+        weakReaders[1].store(0, std::memory_order_relaxed);
     }
 
     ~SideTable() {
@@ -104,7 +115,14 @@ struct SideTable {
 
     void lock() { slock.lock(); }
     void unlock() { slock.unlock(); }
-    void forceReset() { slock.forceReset(); }
+    void forceReset() { 
+        slock.forceReset(); 
+        // Loads in progress on other threads died with them.
+        weakReaders[0].store(0, std::memory_order_relaxed);
+        weakReaders[1].store(0, std::memory_order_relaxed);
+    }
+
+    void waitForWeakReaders();
 
     // Address-ordered lock discipline for a pair of side tables.
 
@@ -173,6 +191,40 @@ static StripedMap<SideTable>& SideTables() {
     return *reinterpret_cast<StripedMap<SideTable>*>(SideTableBuf);
 }
 
+
+/***********************************************************************
+* SideTable::waitForWeakReaders
+* Call after weak_clear_no_lock() and before the object can be freed.
+* Waits for unlocked weak loads that may have read one of the 
+* references just cleared. Loads that start afterwards see weakSeq 
+* change and retry under the lock, so this never waits for new ones.
+* Locking: slock must be held.
+**********************************************************************/
+void SideTable::waitForWeakReaders()
+{
+    uint32_t seq = weakSeq.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic<uint32_t>& readers = weakReaders[seq & 1];
+
+    // The reader increments readers and then loads weakSeq; this thread 
+    // increments weakSeq and then loads readers. Only seq_cst on both 
+    // sides guarantees that one of the two loads sees the other's store.
+    for (unsigned spins = 0; 
+         readers.load(std::memory_order_seq_cst) != 0; 
+         spins++) 
+    {
+        // A reader may have been preempted inside its load.
+        if (spins < 100) {
+#if __x86_64__  ||  __i386__
+            __builtin_ia32_pause();
+#elif __arm64__  ||  __arm__
+            __builtin_arm_yield();
+#endif
+        } else {
+            sched_yield();
+        }
+    }
+}
+
 // anonymous namespace
 };
 
@@ -457,6 +509,41 @@ objc_destroyWeak(id *location)
   So we now don't touch the storage until deallocation completes.
 */
 
+/*
+  Weak loads first try to retain without the side table lock. 
+  The referent cannot be freed before weak_clear_no_lock() nils 
+  *location, and the clearing thread then calls waitForWeakReaders(), 
+  which waits for every load counted under the current weakSeq.
+  So once a load has counted itself and seen both *location and 
+  weakSeq unchanged, the referent stays allocated until it stops 
+  counting. The retain itself is only attempted when it is an isa 
+  update; anything that needs the side table or calls out to 
+  -retainWeakReference falls back to the lock.
+*/
+static ALWAYS_INLINE id
+loadWeakRetainedUnlocked(id *location, id obj, SideTable *table, 
+                         bool *done)
+{
+    uint32_t seq = table->weakSeq.load(std::memory_order_acquire);
+    std::atomic<uint32_t>& readers = table->weakReaders[seq & 1];
+    readers.fetch_add(1, std::memory_order_seq_cst);
+
+    id result = nil;
+    std::atomic<id> *slot = (std::atomic<id> *)location;
+    if (slot->load(std::memory_order_seq_cst) == obj  &&  
+        table->weakSeq.load(std::memory_order_seq_cst) == seq  &&  
+        !obj->ISA()->hasCustomRR()  &&  
+        obj->rootTryRetainInline())
+    {
+        result = obj;
+        *done = true;
+    }
+
+    readers.fetch_sub(1, std::memory_order_release);
+    return result;
+}
+
+
 id
 objc_loadWeakRetained(id *location)
 {
@@ -467,12 +554,17 @@ objc_loadWeakRetained(id *location)
     SideTable *table;
     
  retry:
-    // fixme std::atomic this load
-    obj = *location;
+    obj = ((std::atomic<id> *)location)->load(std::memory_order_relaxed);
     if (!obj) return nil;
     if (obj->isTaggedPointer()) return obj;
     
     table = &SideTables()[obj];
+
+    if (fastpath(!DisableUnlockedWeakLoads)) {
+        bool done = false;
+        result = loadWeakRetainedUnlocked(location, obj, table, &done);
+        if (done) return result;
+    }
     
     table->lock();
     if (*location != obj) {
@@ -780,6 +872,118 @@ class AutoreleasePoolPage
         releaseUntil(begin());
     }
 
+    // Objects popped from a pool and released together by releaseUntil().
+    // A whole page would take too much stack with 16KB pages, 
+    // and -dealloc may pop nested pools.
+    static size_t const DRAIN_BATCH = 128;
+
+    struct DrainEntry {
+        id obj;
+        SideTable *table;  // raw isa objects only
+        uint32_t count;    // times obj was popped in this batch
+        bool dealloc;
+    };
+
+    // Whether obj's retain count lives in its side table with 
+    // no custom retain/release. An earlier object's -dealloc may change 
+    // this for a later one, so it is checked again when obj is released.
+    static bool releasesInSideTable(id obj)
+    {
+        return !obj->hasNonpointerIsa()  &&  !obj->ISA()->hasCustomRR();
+    }
+
+    // Release a batch of objects popped from a pool, 
+    // objs[n-1] (the most recently autoreleased) first.
+    // Repeated releases of one object are coalesced. Objects with 
+    // raw isa that share a side table are released under one lock hold.
+    static void releaseBatch(id *objs, size_t n)
+    {
+        DrainEntry entries[DRAIN_BATCH];
+        // 1 + index into entries, or 0 if empty
+        uint16_t slots[DRAIN_BATCH * 2];
+        size_t const mask = DRAIN_BATCH * 2 - 1;
+        size_t count = 0;
+
+        // Coalesce, and start loading every isa.
+        bzero(slots, sizeof(slots));
+        for (size_t i = n; i-- > 0; ) {
+            id obj = objs[i];
+            if (obj == POOL_BOUNDARY  ||  obj->isTaggedPointer()) continue;
+
+            size_t slot = ptr_hash((uintptr_t)obj) & mask;
+            while (slots[slot]  &&  entries[slots[slot]-1].obj != obj) {
+                slot = (slot+1) & mask;
+            }
+            if (slots[slot]) {
+                entries[slots[slot]-1].count++;
+                continue;
+            }
+
+            __builtin_prefetch(obj);
+            entries[count] = DrainEntry{obj, nil, 1, false};
+            slots[slot] = (uint16_t)++count;
+        }
+
+        // Find the side tables of raw isa objects and start loading them.
+        for (size_t i = 0; i < count; i++) {
+            id obj = entries[i].obj;
+            if (releasesInSideTable(obj)) {
+                entries[i].table = &SideTables()[obj];
+                __builtin_prefetch(entries[i].table);
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            DrainEntry& entry = entries[i];
+            if (entry.table) {
+                if (entry.count) releaseSideTableGroup(entries + i, count - i);
+                // Cleared if obj no longer releases in its side table.
+                if (entry.table) continue;
+            }
+
+            id obj = entry.obj;
+            if (entry.count > 1  &&  !obj->ISA()->hasCustomRR()  &&  
+                obj->rootTryReleaseMany(entry.count))
+            {
+                continue;
+            }
+            for (uint32_t c = 0; c < entry.count; c++) {
+                objc_release(obj);
+            }
+        }
+    }
+
+    // Release entries[0] and every later entry that shares its side table, 
+    // taking the side table lock once. Released entries are left with 
+    // a count of zero. Entries that no longer release in the side table 
+    // are left with no table, for releaseBatch to release normally.
+    static void releaseSideTableGroup(DrainEntry *entries, size_t count)
+    {
+        SideTable *table = entries[0].table;
+
+        table->lock();
+        for (size_t i = 0; i < count; i++) {
+            DrainEntry& entry = entries[i];
+            if (entry.table != table  ||  entry.count == 0) continue;
+            if (!releasesInSideTable(entry.obj)) {
+                entry.table = nil;
+                continue;
+            }
+            entry.dealloc = 
+                entry.obj->sidetable_releaseMany_nolock(*table, entry.count);
+            entry.count = 0;
+        }
+        table->unlock();
+
+        // Deallocate outside the lock; -dealloc takes it again.
+        for (size_t i = 0; i < count; i++) {
+            DrainEntry& entry = entries[i];
+            if (entry.table != table  ||  !entry.dealloc) continue;
+            entry.dealloc = false;
+            ((void(*)(objc_object *, SEL))objc_msgSend)(entry.obj, SEL_dealloc);
+        }
+    }
+
     void releaseUntil(id *stop) 
     {
         // Not recursive: we don't want to blow out the stack 
@@ -796,14 +1000,33 @@ class AutoreleasePoolPage
                 setHotPage(page);
             }
 
+            if (DisableBatchedPoolDrain) {
+                page->unprotect();
+                id obj = *--page->next;
+                memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
+                page->protect();
+
+                if (obj != POOL_BOUNDARY) {
+                    objc_release(obj);
+                }
+                continue;
+            }
+
+            // Pop up to DRAIN_BATCH objects off the top of this page, 
+            // but nothing below stop.
+            id *bottom = (page == this) ? stop : page->begin();
+            size_t n = MIN((size_t)(page->next - bottom), DRAIN_BATCH);
+            id batch[DRAIN_BATCH];
+
             page->unprotect();
-            id obj = *--page->next;
-            memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
+            page->next -= n;
+            memcpy(batch, page->next, n * sizeof(id));
+            memset((void*)page->next, SCRIBBLE, n * sizeof(id));
             page->protect();
 
-            if (obj != POOL_BOUNDARY) {
-                objc_release(obj);
-            }
+            // Objects autoreleased by -release and -dealloc land above 
+            // page->next and are released on the next pass.
+            releaseBatch(batch, n);
         }
 
         setHotPage(this);
@@ -1232,6 +1455,7 @@ objc_object::clearDeallocating_slow()
     table.lock();
     if (isa.weakly_referenced) {
         weak_clear_no_lock(&table.weak_table, (id)this);
+        table.waitForWeakReaders();
     }
     if (isa.has_sidetable_rc) {
         table.refcnts.erase(this);
@@ -1559,6 +1783,31 @@ objc_object::sidetable_release(bool performDealloc)
 }
 
 
+// Equivalent to count calls to sidetable_release(false), 
+// for a caller that already holds table's lock.
+// Returns true if the object should now be deallocated.
+bool
+objc_object::sidetable_releaseMany_nolock(SideTable& table, uintptr_t count)
+{
+#if SUPPORT_NONPOINTER_ISA
+    assert(!isa.nonpointer);
+#endif
+    bool do_dealloc = false;
+
+    size_t& refcntStorage = table.refcnts[this];
+    for (; count > 0; count--) {
+        if (refcntStorage < SIDE_TABLE_DEALLOCATING) {
+            // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+            do_dealloc = true;
+            refcntStorage |= SIDE_TABLE_DEALLOCATING;
+        } else if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+            refcntStorage -= SIDE_TABLE_RC_ONE;
+        }
+    }
+    return do_dealloc;
+}
+
+
 void 
 objc_object::sidetable_clearDeallocating()
 {
@@ -1572,6 +1821,7 @@ objc_object::sidetable_clearDeallocating()
     if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
             weak_clear_no_lock(&table.weak_table, (id)this);
+            table.waitForWeakReaders();
         }
         table.refcnts.erase(it);
     }
@@ -1837,6 +2087,10 @@ void
 objc_autoreleasePoolPop(void *ctxt)
 {
     AutoreleasePoolPage::pop(ctxt);
+#if __OBJC2__
+    // Run loops pop a pool every turn, so idle threads report here.
+    cache_quiescent();
+#endif
 }
 
 
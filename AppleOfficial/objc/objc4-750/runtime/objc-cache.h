@@ -3,6 +3,7 @@
 #define _OBJC_CACHE_H
 
 #include "objc-private.h"
+#include "objc-msgprof.h"
 
 __BEGIN_DECLS
 
@@ -16,6 +17,12 @@ extern void cache_delete(Class cls);
 
 extern void cache_collect(bool collectALot);
 
+extern void cache_quiescent(void);
+
+extern void cache_profileMessage(Class cls, SEL sel, msgprof_event_t event);
+
+extern void cache_forgetMessageProfile(Class cls);
+
 __END_DECLS
 
 #endif
@@ -46,20 +46,25 @@
  * The memory is now only accessible to instances of objc_msgSend that 
  * were running when the memory was disconnected; any further calls to 
  * objc_msgSend will not see the garbage memory because the other data 
- * structures don't point to it anymore. The collecting_in_critical
- * function checks the PC of all threads and returns FALSE when all threads 
- * are found to be outside objc_msgSend. This means any call to objc_msgSend 
- * that could have had access to the garbage has finished or moved past the 
- * cache lookup stage, so it is safe to free the memory.
+ * structures don't point to it anymore. 
+ *
+ * Garbage is tagged with the current cache epoch. Threads report a 
+ * quiescent state - a point where they cannot be inside a cache reader - 
+ * by calling cache_quiescent(), which records the epoch they saw. 
+ * The collector advances the epoch and frees garbage older than 
+ * the oldest epoch seen by any thread. A thread that has not reported 
+ * since the epoch advanced has its PC checked instead, and counts as 
+ * quiescent if it is outside objc_msgSend. Threads that regularly pass 
+ * through the runtime are therefore never inspected.
  *
  * All functions that modify cache data or structures must acquire the 
  * cacheUpdateLock to prevent interference from concurrent modifications.
  * The function that frees cache garbage must acquire the cacheUpdateLock 
- * and use collecting_in_critical() to flush out cache readers.
+ * and use oldest_reader_epoch() to flush out cache readers.
  * The cacheUpdateLock is also used to protect the custom allocator used 
  * for large method cache blocks.
  *
- * Cache readers (PC-checked by collecting_in_critical())
+ * Cache readers (epoch-tracked or PC-checked by oldest_reader_epoch())
  * objc_msgSend*
  * cache_getImp
  *
@@ -85,6 +90,8 @@
 
 #include "objc-private.h"
 #include "objc-cache.h"
+#include "llvm-DenseMap.h"
+#include <signal.h>
 
 
 /* Initial cache bucket count. INIT_CACHE_SIZE must be a power of two. */
@@ -93,11 +100,37 @@ enum {
     INIT_CACHE_SIZE      = (1 << INIT_CACHE_SIZE_LOG2)
 };
 
+/* Largest initial bucket count that OBJC_CACHE_PROFILE may ask for. */
+enum {
+    PROFILE_MAX_CACHE_SIZE_LOG2 = 16,
+    PROFILE_MAX_CACHE_SIZE      = (1 << PROFILE_MAX_CACHE_SIZE_LOG2)
+};
+
 static void cache_collect_free(struct bucket_t *data, mask_t capacity);
-static int _collecting_in_critical(void);
+static uintptr_t oldest_reader_epoch(uintptr_t currentEpoch);
 static void _garbage_make_room(void);
 
 
+/***********************************************************************
+* Cache reader epochs.
+* cacheEpoch advances each time the collector runs. Each thread that 
+* has called cache_quiescent() owns a cache_reader_t recording the 
+* epoch it saw then. Readers are never freed; a reader whose thread 
+* has exited is reused by the next new thread.
+* Locking: cacheUpdateLock protects the reader list and reader ownership.
+* Each reader's epoch is written only by its own thread.
+**********************************************************************/
+
+struct cache_reader_t {
+    std::atomic<uintptr_t> epoch;
+    mach_port_t thread;  // MACH_PORT_NULL if unused
+    cache_reader_t *next;
+};
+
+static std::atomic<uintptr_t> cacheEpoch{1};
+static cache_reader_t *cacheReaders;
+
+
 /***********************************************************************
 * Cache statistics for OBJC_PRINT_CACHE_SETUP
 **********************************************************************/
@@ -471,6 +504,25 @@ bool cache_t::canBeFreed()
 }
 
 
+// Copy every filled bucket of oldBuckets into newBuckets, which is 
+// not yet visible to objc_msgSend. Returns the number copied.
+static mask_t cache_rehash(bucket_t *oldBuckets, mask_t oldCapacity, 
+                           bucket_t *newBuckets, mask_t newMask)
+{
+    mask_t copied = 0;
+    for (mask_t i = 0; i < oldCapacity; i++) {
+        cache_key_t key = oldBuckets[i].key();
+        if (key == 0) continue;
+
+        mask_t j = cache_hash(key, newMask);
+        while (newBuckets[j].key() != 0) j = cache_next(j, newMask);
+        newBuckets[j].set(key, oldBuckets[i].imp());
+        copied++;
+    }
+    return copied;
+}
+
+
 void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
 {
     bool freeOld = canBeFreed();
@@ -478,14 +530,20 @@ void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
     bucket_t *oldBuckets = buckets();
     bucket_t *newBuckets = allocateBuckets(newCapacity);
 
-    // Cache's old contents are not propagated. 
-    // This is thought to save cache memory at the cost of extra cache fills.
-    // fixme re-measure this
-
     assert(newCapacity > 0);
     assert((uintptr_t)(mask_t)(newCapacity-1) == newCapacity-1);
 
-    setBucketsAndMask(newBuckets, newCapacity - 1);
+    // A growing cache keeps its old contents, so hot selectors don't 
+    // all miss again at once. A cache that can't grow is emptied instead
+    // to make room.
+    mask_t newOccupied = 0;
+    if (freeOld  &&  newCapacity > oldCapacity) {
+        newOccupied = 
+            cache_rehash(oldBuckets, oldCapacity, newBuckets, newCapacity - 1);
+    }
+
+    setBucketsAndMask(newBuckets, newCapacity - 1);  // also clears occupied
+    _occupied = newOccupied;
     
     if (freeOld) {
         cache_collect_free(oldBuckets, oldCapacity);
@@ -558,10 +616,325 @@ void cache_t::expand()
 }
 
 
+/***********************************************************************
+* Cache profiles.
+* OBJC_PRINT_CACHE_PROFILE counts, for each class, the cache misses that 
+* reached cache_fill, the entries actually filled, and the times the 
+* cache grew. They are logged at exit with each cache's final capacity.
+*
+* OBJC_CACHE_PROFILE names a file of such log lines, or of lines 
+* "ClassName capacity" with metaclasses written "+ClassName". 
+* A class listed there gets a cache of that capacity when its cache 
+* is first allocated, so large classes start warm instead of growing 
+* through a series of miss storms.
+* Classes that are freed or unloaded are dropped from the profile.
+* Cache locks: cacheUpdateLock protects both tables.
+**********************************************************************/
+
+struct cache_profile_t {
+    size_t misses;
+    size_t fills;
+    size_t expansions;
+};
+
+static objc::DenseMap<Class, cache_profile_t> *cacheProfiles;
+static void cache_printProfile(void);
+
+static cache_profile_t& cache_profileForClass(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+
+    if (!cacheProfiles) {
+        cacheProfiles = new objc::DenseMap<Class, cache_profile_t>;
+        atexit(cache_printProfile);
+    }
+    return (*cacheProfiles)[cls];
+}
+
+static void cache_printProfile(void)
+{
+    mutex_locker_t lock(cacheUpdateLock);
+
+    for (auto& pair : *cacheProfiles) {
+        Class cls = pair.first;
+        const cache_profile_t& profile = pair.second;
+        _objc_inform("CACHES: profile %s%s %u (misses %zu, fills %zu, "
+                     "expansions %zu)", cls->isMetaClass() ? "+" : "", 
+                     cls->mangledName(), (unsigned)cls->cache.capacity(), 
+                     profile.misses, profile.fills, profile.expansions);
+    }
+}
+
+
+// Parse OBJC_CACHE_PROFILE into a map from class name to capacity.
+static NXMapTable *cache_loadProfile(void)
+{
+    NXMapTable *capacities = NXCreateMapTable(NXStrValueMapPrototype, 64);
+
+    FILE *f = fopen(CacheProfilePath, "r");
+    if (!f) {
+        _objc_inform("CACHES: can't read OBJC_CACHE_PROFILE %s", 
+                     CacheProfilePath);
+        return capacities;
+    }
+
+    char line[1024];
+    char name[1024];
+    unsigned capacity;
+    while (fgets(line, sizeof(line), f)) {
+        // Accept OBJC_PRINT_CACHE_PROFILE output as logged.
+        const char *text = strstr(line, "CACHES: profile ");
+        text = text ? text + strlen("CACHES: profile ") : line;
+        if (sscanf(text, "%1023s %u", name, &capacity) != 2) continue;
+        if (capacity == 0) continue;
+        NXMapInsert(capacities, strdup(name), (void *)(uintptr_t)capacity);
+    }
+    fclose(f);
+
+    return capacities;
+}
+
+
+// Returns the capacity for cls's first cache.
+static mask_t cache_initialCapacity(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+
+    static NXMapTable *capacities;
+    if (!CacheProfilePath) return INIT_CACHE_SIZE;
+    if (!capacities) capacities = cache_loadProfile();
+
+    const char *name = cls->mangledName();
+    uintptr_t wanted;
+    if (cls->isMetaClass()) {
+        size_t len = strlen(name);
+        char *metaName = (char *)alloca(len + 2);
+        metaName[0] = '+';
+        memcpy(metaName + 1, name, len + 1);
+        wanted = (uintptr_t)NXMapGet(capacities, metaName);
+    } else {
+        wanted = (uintptr_t)NXMapGet(capacities, name);
+    }
+
+    // Round up to a power of two that mask_t can hold. 
+    // A bad profile must not ask for an enormous cache.
+    if (wanted > PROFILE_MAX_CACHE_SIZE) wanted = PROFILE_MAX_CACHE_SIZE;
+    uint32_t capacity = INIT_CACHE_SIZE;
+    while (capacity < wanted  &&  
+           (uint32_t)(mask_t)(capacity * 2) == capacity * 2) 
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+
+/***********************************************************************
+* Message send profile.
+* With OBJC_PROFILE_MSGSEND=path, objc_msgSend cache misses, cache fills, 
+* cache expansions, and choices to forward are counted for each 
+* class and selector. With OBJC_PROFILE_MSGSEND_INTERVAL=n only one of 
+* every n events is counted. 
+* The counts are written to path at exit, and after SIGUSR2 as soon as 
+* another event is counted. See objc-msgprof.h for the file format 
+* and msgprof.cpp for a tool that reads it.
+* Classes that are freed or unloaded are dropped from the profile, 
+* since writing it reads their names.
+* Locking: msgprofLock protects the profile.
+**********************************************************************/
+
+struct msgprof_counts_t {
+    uint32_t counts[MsgprofEventCount];
+};
+
+typedef objc::DenseMap<std::pair<Class, SEL>, msgprof_counts_t> MsgprofMap;
+
+static spinlock_t msgprofLock(fork_unsafe_lock);
+static MsgprofMap *msgprofCounts;
+static std::atomic<uint32_t> msgprofTicks;
+static volatile sig_atomic_t msgprofDumpRequested;
+
+static void msgprof_requestDump(int sig __unused)
+{
+    msgprofDumpRequested = 1;
+}
+
+
+// Returns the offset of name in strings, adding it if necessary.
+static uint32_t msgprof_string(NXMapTable *offsets, char **strings, 
+                               uint32_t *stringBytes, const char *prefix, 
+                               const char *name)
+{
+    size_t prefixLen = strlen(prefix);
+    size_t nameLen = strlen(name);
+    char *key = (char *)malloc(prefixLen + nameLen + 1);
+    memcpy(key, prefix, prefixLen);
+    memcpy(key + prefixLen, name, nameLen + 1);
+
+    // Offsets are stored plus one so that offset 0 is not nil.
+    uintptr_t offset = (uintptr_t)NXMapGet(offsets, key);
+    if (offset) {
+        free(key);
+        return (uint32_t)(offset - 1);
+    }
+
+    offset = *stringBytes;
+    *strings = (char *)realloc(*strings, offset + prefixLen + nameLen + 1);
+    memcpy(*strings + offset, key, prefixLen + nameLen + 1);
+    *stringBytes += (uint32_t)(prefixLen + nameLen + 1);
+    NXMapInsert(offsets, key, (void *)(offset + 1));
+    return (uint32_t)offset;
+}
+
+
+static void msgprof_write_nolock(void)
+{
+    msgprofLock.assertLocked();
+
+    FILE *f = fopen(MsgSendProfilePath, "w");
+    if (!f) {
+        _objc_inform("MSGSEND PROFILE: can't write %s", MsgSendProfilePath);
+        return;
+    }
+
+    NXMapTable *offsets = NXCreateMapTable(NXStrValueMapPrototype, 256);
+    char *strings = nil;
+    uint32_t stringBytes = 0;
+    uint32_t count = msgprofCounts->size();
+    msgprof_record_t *records = (msgprof_record_t *)
+        calloc(count, sizeof(msgprof_record_t));
+
+    uint32_t i = 0;
+    for (auto& pair : *msgprofCounts) {
+        Class cls = pair.first.first;
+        SEL sel = pair.first.second;
+
+        // The class may not be realized if it never filled its cache.
+        const class_ro_t *ro = (cls->isRealized()  ||  cls->isFuture())
+            ? cls->data()->ro : (const class_ro_t *)cls->data();
+        const char *prefix = (ro->flags & RO_META) ? "+" : "";
+
+        msgprof_record_t& r = records[i++];
+        r.className = msgprof_string(offsets, &strings, &stringBytes, 
+                                     prefix, cls->mangledName());
+        r.selName = msgprof_string(offsets, &strings, &stringBytes, 
+                                   "", sel_getName(sel));
+        memcpy(r.counts, pair.second.counts, sizeof(r.counts));
+    }
+
+    msgprof_header_t header;
+    memcpy(header.magic, OBJC_MSGPROF_MAGIC, sizeof(header.magic));
+    header.version = OBJC_MSGPROF_VERSION;
+    header.interval = MsgSendProfileInterval;
+    header.recordCount = count;
+    header.stringBytes = stringBytes;
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1  ||  
+        fwrite(records, sizeof(msgprof_record_t), count, f) != count  ||  
+        fwrite(strings, 1, stringBytes, f) != stringBytes)
+    {
+        _objc_inform("MSGSEND PROFILE: can't write %s", MsgSendProfilePath);
+    }
+    fclose(f);
+
+    NXMapState state = NXInitMapState(offsets);
+    const void *key;
+    const void *value;
+    while (NXNextMapState(offsets, &state, &key, &value)) {
+        free((void *)key);
+    }
+    NXFreeMapTable(offsets);
+    free(strings);
+    free(records);
+}
+
+
+static void msgprof_write(void)
+{
+    mutex_locker_t lock(msgprofLock);
+    msgprof_write_nolock();
+}
+
+
+/***********************************************************************
+* cache_profileMessage
+* Count event for cls and sel in the OBJC_PROFILE_MSGSEND profile.
+* Callers check MsgSendProfilePath first.
+* Locking: may be called with runtimeLock or cacheUpdateLock held.
+**********************************************************************/
+void cache_profileMessage(Class cls, SEL sel, msgprof_event_t event)
+{
+    // Racing threads may sample a few events more or less than one 
+    // in every interval, which is fine for a profile.
+    uint32_t tick = msgprofTicks.fetch_add(1, std::memory_order_relaxed);
+    if (tick % MsgSendProfileInterval != 0) return;
+
+    mutex_locker_t lock(msgprofLock);
+
+    if (!msgprofCounts) {
+        msgprofCounts = new MsgprofMap;
+        atexit(msgprof_write);
+
+        // Don't take SIGUSR2 away from a process that uses it.
+        struct sigaction old;
+        if (sigaction(SIGUSR2, nil, &old) == 0  &&  
+            old.sa_handler == SIG_DFL) 
+        {
+            signal(SIGUSR2, msgprof_requestDump);
+        } else {
+            _objc_inform("MSGSEND PROFILE: SIGUSR2 is in use; "
+                         "the profile will be written at exit only");
+        }
+    }
+
+    uint32_t& count = (*msgprofCounts)[std::make_pair(cls, sel)].counts[event];
+    if (count != UINT32_MAX) count++;
+
+    if (msgprofDumpRequested) {
+        msgprofDumpRequested = 0;
+        msgprof_write_nolock();
+    }
+}
+
+
+/***********************************************************************
+* cache_forgetMessageProfile
+* Remove cls from the OBJC_PROFILE_MSGSEND profile before it is freed.
+* Callers check MsgSendProfilePath first.
+* Locking: called by free_class with runtimeLock held.
+**********************************************************************/
+void cache_forgetMessageProfile(Class cls)
+{
+    mutex_locker_t lock(msgprofLock);
+    if (!msgprofCounts) return;
+
+    // Erasing may rehash the map, so find cls's entries first.
+    SEL *sels = nil;
+    size_t count = 0;
+    size_t capacity = 0;
+    for (auto& pair : *msgprofCounts) {
+        if (pair.first.first != cls) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity*2 : 16;
+            sels = (SEL *)realloc(sels, capacity * sizeof(SEL));
+        }
+        sels[count++] = pair.first.second;
+    }
+    for (size_t i = 0; i < count; i++) {
+        msgprofCounts->erase(std::make_pair(cls, sels[i]));
+    }
+    free(sels);
+}
+
+
 static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
 {
     cacheUpdateLock.assertLocked();
 
+    cache_profile_t *profile = 
+        PrintCacheProfile ? &cache_profileForClass(cls) : nil;
+    if (profile) profile->misses++;
+
     // Never cache before +initialize is done
     if (!cls->isInitialized()) return;
 
@@ -577,7 +950,7 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     mask_t capacity = cache->capacity();
     if (cache->isConstantEmptyCache()) {
         // Cache is read-only. Replace it.
-        cache->reallocate(capacity, capacity ?: INIT_CACHE_SIZE);
+        cache->reallocate(capacity, capacity ?: cache_initialCapacity(cls));
     }
     else if (newOccupied <= capacity / 4 * 3) {
         // Cache is less than 3/4 full. Use it as-is.
@@ -585,6 +958,10 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     else {
         // Cache is too full. Expand it.
         cache->expand();
+        if (profile) profile->expansions++;
+        if (slowpath(MsgSendProfilePath)) {
+            cache_profileMessage(cls, sel, MsgprofExpand);
+        }
     }
 
     // Scan for the first unused slot and insert there.
@@ -593,6 +970,10 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     bucket_t *bucket = cache->find(key, receiver);
     if (bucket->key() == 0) cache->incrementOccupied();
     bucket->set(key, imp);
+    if (profile) profile->fills++;
+    if (slowpath(MsgSendProfilePath)) {
+        cache_profileMessage(cls, sel, MsgprofFill);
+    }
 }
 
 void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
@@ -601,7 +982,8 @@ void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
     mutex_locker_t lock(cacheUpdateLock);
     cache_fill_nolock(cls, sel, imp, receiver);
 #else
-    _collecting_in_critical();
+    mutex_locker_t lock(cacheUpdateLock);
+    oldest_reader_epoch(cacheEpoch.load(std::memory_order_relaxed));
     return;
 #endif
 }
@@ -630,6 +1012,8 @@ void cache_erase_nolock(Class cls)
 void cache_delete(Class cls)
 {
     mutex_locker_t lock(cacheUpdateLock);
+    // The profile is printed at exit, when cls is gone.
+    if (cacheProfiles) cacheProfiles->erase(cls);
     if (cls->cache.canBeFreed()) {
         if (PrintCaches) recordDeadCache(cls->cache.capacity());
         free(cls->cache.buckets());
@@ -685,26 +1069,113 @@ static uintptr_t _get_pc_for_thread(thread_t thread)
 
 #endif
 
+static cache_reader_t *cache_addReader(void)
+{
+    mutex_locker_t lock(cacheUpdateLock);
+
+    mach_port_t thread = pthread_mach_thread_np(pthread_self());
+    cache_reader_t *reader;
+    for (reader = cacheReaders; reader; reader = reader->next) {
+        if (reader->thread == MACH_PORT_NULL) break;
+    }
+    if (!reader) {
+        reader = (cache_reader_t *)calloc(1, sizeof(cache_reader_t));
+        reader->next = cacheReaders;
+        cacheReaders = reader;
+    }
+    reader->thread = thread;
+    return reader;
+}
+
+
 /***********************************************************************
-* _collecting_in_critical.
-* Returns TRUE if some thread is currently executing a cache-reading 
-* function. Collection of cache garbage is not allowed when a cache-
-* reading function is in progress because it might still be using 
-* the garbage memory.
+* cache_quiescent.
+* Report that this thread is not inside any cache reader, so no cache 
+* garbage retired before now can still be in use by it.
+* Call only from C code, never from inside a cache lookup.
+* Cache locks: cacheUpdateLock must not be held by the caller.
+**********************************************************************/
+void cache_quiescent(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(YES);
+    cache_reader_t *reader = data->cacheReader;
+    if (slowpath(!reader)) reader = data->cacheReader = cache_addReader();
+
+    // Release orders this thread's earlier cache reads before the store.
+    reader->epoch.store(cacheEpoch.load(std::memory_order_acquire), 
+                        std::memory_order_release);
+}
+
+
+void _destroyCacheReader(struct cache_reader_t *reader)
+{
+    if (!reader) return;
+    mutex_locker_t lock(cacheUpdateLock);
+    reader->thread = MACH_PORT_NULL;
+}
+
+
+// Only the forking thread survives in the child, and its port name 
+// may differ. Other readers' epochs never advance again, so a new 
+// thread that reuses one of their names is merely PC-checked.
+// Releasing them here lets new threads reuse them instead.
+void cache_readersForkChild(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(NO);
+    cache_reader_t *mine = data ? data->cacheReader : nil;
+
+    for (cache_reader_t *reader = cacheReaders; reader; reader = reader->next) {
+        reader->thread = MACH_PORT_NULL;
+    }
+    if (mine) mine->thread = pthread_mach_thread_np(pthread_self());
+}
+
+
+/***********************************************************************
+* oldest_reader_epoch.
+* Returns the oldest epoch that any thread other than this one may still 
+* be reading caches from. Garbage tagged with an older epoch is free.
+* A thread that reported quiescence at currentEpoch is not inspected. 
+* Other threads have their PC checked: outside the cache lookup code 
+* they are as good as quiescent at currentEpoch.
+* Cache locks: cacheUpdateLock must be held by the caller.
 **********************************************************************/
 extern "C" uintptr_t objc_entryPoints[];
 extern "C"  uintptr_t objc_exitPoints[];
 
-static int _collecting_in_critical(void)
+#if !TARGET_OS_WIN32
+static bool _thread_in_cache_reader(thread_t thread)
 {
+    uintptr_t pc = _get_pc_for_thread(thread);
+
+    // Check for bad status, and if so, assume the worse (can't collect)
+    if (pc == PC_SENTINEL) return true;
+
+    // Check whether it is in the cache lookup code
+    for (int region = 0; objc_entryPoints[region] != 0; region++) {
+        if ((pc >= objc_entryPoints[region]) &&
+            (pc <= objc_exitPoints[region])) 
+        {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+static uintptr_t oldest_reader_epoch(uintptr_t currentEpoch)
+{
+    cacheUpdateLock.assertLocked();
+
 #if TARGET_OS_WIN32
-    return TRUE;
+    return 0;
 #else
     thread_act_port_array_t threads;
     unsigned number;
     unsigned count;
     kern_return_t ret;
-    int result;
+    uintptr_t oldest = currentEpoch;
+    unsigned inspected = 0;
 
     mach_port_t mythread = pthread_mach_thread_np(pthread_self());
 
@@ -720,40 +1191,29 @@ static int _collecting_in_critical(void)
         _objc_fatal("task_threads failed (result 0x%x)\n", ret);
     }
 
-    // Check whether any thread is in the cache lookup code
-    result = FALSE;
     for (count = 0; count < number; count++)
     {
-        int region;
-        uintptr_t pc;
-
         // Don't bother checking ourselves
         if (threads[count] == mythread)
             continue;
 
-        // Find out where thread is executing
-        pc = _get_pc_for_thread (threads[count]);
-
-        // Check for bad status, and if so, assume the worse (can't collect)
-        if (pc == PC_SENTINEL)
+        uintptr_t seen = 0;
+        for (cache_reader_t *reader = cacheReaders; reader; 
+             reader = reader->next) 
         {
-            result = TRUE;
-            goto done;
-        }
-        
-        // Check whether it is in the cache lookup code
-        for (region = 0; objc_entryPoints[region] != 0; region++)
-        {
-            if ((pc >= objc_entryPoints[region]) &&
-                (pc <= objc_exitPoints[region])) 
-            {
-                result = TRUE;
-                goto done;
+            if (reader->thread == threads[count]) {
+                seen = reader->epoch.load(std::memory_order_acquire);
+                break;
             }
         }
+        if (seen >= currentEpoch) continue;
+
+        inspected++;
+        if (_thread_in_cache_reader(threads[count])) {
+            oldest = MIN(oldest, seen);
+        }
     }
 
- done:
     // Deallocate the port rights for the threads
     for (count = 0; count < number; count++) {
         mach_port_deallocate(mach_task_self (), threads[count]);
@@ -762,8 +1222,13 @@ static int _collecting_in_critical(void)
     // Deallocate the thread list
     vm_deallocate (mach_task_self (), (vm_address_t) threads, sizeof(threads[0]) * number);
 
-    // Return our finding
-    return result;
+    if (PrintCaches) {
+        _objc_inform("CACHES: %u threads, %u inspected, oldest epoch %lu "
+                     "of %lu", number, inspected, 
+                     (unsigned long)oldest, (unsigned long)currentEpoch);
+    }
+
+    return oldest;
 #endif
 }
 
@@ -779,8 +1244,13 @@ static size_t garbage_byte_size = 0;
 // do not empty the garbage until garbage_byte_size gets at least this big
 static size_t garbage_threshold = 32*1024;
 
-// table of refs to free
-static bucket_t **garbage_refs = 0;
+// table of refs to free, and the epoch each was retired in
+struct garbage_ref_t {
+    bucket_t *buckets;
+    size_t bytes;
+    uintptr_t epoch;
+};
+static garbage_ref_t *garbage_refs = 0;
 
 // current number of refs in garbage_refs
 static size_t garbage_count = 0;
@@ -801,16 +1271,16 @@ static void _garbage_make_room(void)
     if (first)
     {
         first = 0;
-        garbage_refs = (bucket_t**)
-            malloc(INIT_GARBAGE_COUNT * sizeof(void *));
+        garbage_refs = (garbage_ref_t *)
+            malloc(INIT_GARBAGE_COUNT * sizeof(garbage_ref_t));
         garbage_max = INIT_GARBAGE_COUNT;
     }
 
     // Double the table if it is full
     else if (garbage_count == garbage_max)
     {
-        garbage_refs = (bucket_t**)
-            realloc(garbage_refs, garbage_max * 2 * sizeof(void *));
+        garbage_refs = (garbage_ref_t *)
+            realloc(garbage_refs, garbage_max * 2 * sizeof(garbage_ref_t));
         garbage_max *= 2;
     }
 }
@@ -830,8 +1300,10 @@ static void cache_collect_free(bucket_t *data, mask_t capacity)
     if (PrintCaches) recordDeadCache(capacity);
 
     _garbage_make_room ();
-    garbage_byte_size += cache_t::bytesForCapacity(capacity);
-    garbage_refs[garbage_count++] = data;
+    size_t bytes = cache_t::bytesForCapacity(capacity);
+    garbage_byte_size += bytes;
+    garbage_refs[garbage_count++] = 
+        garbage_ref_t{data, bytes, cacheEpoch.load(std::memory_order_relaxed)};
 }
 
 
@@ -849,43 +1321,42 @@ void cache_collect(bool collectALot)
         return;
     }
 
-    // Synchronize collection with objc_msgSend and other cache readers
-    if (!collectALot) {
-        if (_collecting_in_critical ()) {
-            // objc_msgSend (or other cache reader) is currently looking in
-            // the cache and might still be using some garbage.
-            if (PrintCaches) {
-                _objc_inform ("CACHES: not collecting; "
-                              "objc_msgSend in progress");
+    // Synchronize collection with objc_msgSend and other cache readers.
+    // Advance the epoch so threads that report quiescence from now on 
+    // are known to have finished with all of the current garbage.
+    do {
+        uintptr_t current = 1 + cacheEpoch.fetch_add(1);
+        uintptr_t oldest = oldest_reader_epoch(current);
+
+        // Dispose refs retired before every reader's epoch, 
+        // keeping the rest in order.
+        // Erase each entry so debugging tools don't see stale pointers.
+        size_t freedBytes = 0;
+        size_t kept = 0;
+        for (size_t i = 0; i < garbage_count; i++) {
+            garbage_ref_t dead = garbage_refs[i];
+            garbage_refs[i] = garbage_ref_t{nil, 0, 0};
+            if (dead.epoch < oldest) {
+                freedBytes += dead.bytes;
+                free(dead.buckets);
+            } else {
+                garbage_refs[kept++] = dead;
             }
-            return;
         }
-    } 
-    else {
-        // No excuses.
-        while (_collecting_in_critical()) 
-            ;
-    }
+        garbage_count = kept;
+        garbage_byte_size -= freedBytes;
 
-    // No cache readers in progress - garbage is now deletable
+        // Log our progress
+        if (PrintCaches) {
+            if (freedBytes) cache_collections++;
+            _objc_inform ("CACHES: COLLECTED %zu bytes, %zu bytes waiting "
+                          "for cache readers (%zu allocations, "
+                          "%zu collections)", freedBytes, garbage_byte_size, 
+                          cache_allocations, cache_collections);
+        }
 
-    // Log our progress
-    if (PrintCaches) {
-        cache_collections++;
-        _objc_inform ("CACHES: COLLECTING %zu bytes (%zu allocations, %zu collections)", garbage_byte_size, cache_allocations, cache_collections);
-    }
-    
-    // Dispose all refs now in the garbage
-    // Erase each entry so debugging tools don't see stale pointers.
-    while (garbage_count--) {
-        auto dead = garbage_refs[garbage_count];
-        garbage_refs[garbage_count] = nil;
-        free(dead);
-    }
-    
-    // Clear the garbage count and total size indicator
-    garbage_count = 0;
-    garbage_byte_size = 0;
+        // No excuses when collecting a lot.
+    } while (collectALot  &&  garbage_count > 0);
 
     if (PrintCaches) {
         size_t i;
@@ -925,7 +1396,7 @@ void cache_collect(bool collectALot)
 * The code below is a modified version of task_threads(). It logs 
 * the msgh_id of the reply message. The msgh_id can identify the sender 
 * of the message, which can help pinpoint the faulty code.
-* DEBUG_TASK_THREADS also calls collecting_in_critical() during every 
+* DEBUG_TASK_THREADS also calls oldest_reader_epoch() during every 
 * message dispatch, which can increase reproducibility of bugs.
 *
 * This code can be regenerated by running 
@@ -13,6 +13,7 @@ OPTION( PrintIvars,               OBJC_PRINT_IVAR_SETUP,           "log processi
 OPTION( PrintVtables,             OBJC_PRINT_VTABLE_SETUP,         "log processing of class vtables")
 OPTION( PrintVtableImages,        OBJC_PRINT_VTABLE_IMAGES,        "print vtable images showing overridden methods")
 OPTION( PrintCaches,              OBJC_PRINT_CACHE_SETUP,          "log processing of method caches")
+OPTION( PrintCacheProfile,        OBJC_PRINT_CACHE_PROFILE,        "log per-class method cache misses, fills, and sizes at exit")
 OPTION( PrintFuture,              OBJC_PRINT_FUTURE_CLASSES,       "log use of future classes for toll-free bridging")
 OPTION( PrintPreopt,              OBJC_PRINT_PREOPTIMIZATION,      "log preoptimization courtesy of dyld shared cache")
 OPTION( PrintCxxCtors,            OBJC_PRINT_CXX_CTORS,            "log calls to C++ ctors and dtors for instance variables")
@@ -25,6 +26,7 @@ OPTION( PrintPoolHiwat,           OBJC_PRINT_POOL_HIGHWATER,       "log high-wat
 OPTION( PrintCustomRR,            OBJC_PRINT_CUSTOM_RR,            "log classes with un-optimized custom retain/release methods")
 OPTION( PrintCustomAWZ,           OBJC_PRINT_CUSTOM_AWZ,           "log classes with un-optimized custom allocWithZone methods")
 OPTION( PrintRawIsa,              OBJC_PRINT_RAW_ISA,              "log classes that require raw pointer isa fields")
+OPTION( PrintSyncContention,      OBJC_PRINT_SYNC_CONTENTION,      "log per-class @synchronized contention at exit")
 
 OPTION( DebugUnload,              OBJC_DEBUG_UNLOAD,               "warn about poorly-behaving bundles when unloaded")
 OPTION( DebugFragileSuperclasses, OBJC_DEBUG_FRAGILE_SUPERCLASSES, "warn about subclasses that may have been broken by subsequent changes to superclasses")
@@ -37,6 +39,10 @@ OPTION( DebugDuplicateClasses,    OBJC_DEBUG_DUPLICATE_CLASSES,    "halt when mu
 OPTION( DebugDontCrash,           OBJC_DEBUG_DONT_CRASH,           "halt the process by exiting instead of crashing")
 
 OPTION( DisableVtables,           OBJC_DISABLE_VTABLES,            "disable vtable dispatch")
+OPTION( DisableMethodIndex,       OBJC_DISABLE_METHOD_INDEX,       "disable hash indexes of classes with many methods")
+OPTION( DisableBatchedPoolDrain,  OBJC_DISABLE_BATCHED_POOL_DRAIN, "release autoreleased objects one at a time when a pool is popped")
+OPTION( DisableUnlockedWeakLoads, OBJC_DISABLE_UNLOCKED_WEAK_LOADS, "always take the side table lock to load a weak reference")
+OPTION( DisableParallelImageFixups, OBJC_DISABLE_PARALLEL_IMAGE_FIXUPS, "fix up class, selector, and message references on one thread when images are read")
 OPTION( DisablePreopt,            OBJC_DISABLE_PREOPTIMIZATION,    "disable preoptimization courtesy of dyld shared cache")
 OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagged pointer optimization of NSNumber et al.") 
 OPTION( DisableTaggedPointerObfuscation, OBJC_DISABLE_TAG_OBFUSCATION,    "disable obfuscation of tagged pointers")
@@ -42,7 +42,6 @@ extern recursive_mutex_t loadMethodLock;
 extern mutex_t crashlog_lock;
 extern spinlock_t objcMsgLogLock;
 extern mutex_t AltHandlerDebugLock;
-extern mutex_t AssociationsManagerLock;
 extern StripedMap<spinlock_t> PropertyLocks;
 extern StripedMap<spinlock_t> StructLocks;
 extern StripedMap<spinlock_t> CppObjectLocks;
@@ -57,6 +56,16 @@ extern void SideTableLocksSucceedLock(const void *oldlock);
 extern void SideTableLocksPrecedeLocks(StripedMap<spinlock_t>& newlocks);
 extern void SideTableLocksSucceedLocks(StripedMap<spinlock_t>& oldlocks);
 
+// Association locks are striped too.
+extern void AssociationsLockAll();
+extern void AssociationsUnlockAll();
+extern void AssociationsForceResetAll();
+extern void AssociationsDefineLockOrder();
+extern void AssociationsLocksPrecedeLock(const void *newlock);
+extern void AssociationsLocksSucceedLock(const void *oldlock);
+extern void AssociationsLocksSucceedLocks(StripedMap<spinlock_t>& oldlocks);
+extern void AssociationsLocksPrecedeSideTableLocks();
+
 #if __OBJC2__
 #include "objc-locks-new.h"
 #else
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/***********************************************************************
+* objc-msgprof.h
+* File format of the message send profile written for
+* OBJC_PROFILE_MSGSEND.
+*
+* The file is a header, then header.recordCount records, then
+* header.stringBytes bytes of NUL-terminated names. Records refer to
+* names by their offset in that string table. Metaclass names start
+* with '+'. All fields are in the byte order of the process that
+* wrote the file.
+*
+* Counts are of sampled events: the runtime recorded one of every
+* header.interval events, so multiply by it to estimate the total.
+*
+* This file has no dependencies on the rest of the runtime so that
+* msgprof.cpp can read profiles by itself.
+**********************************************************************/
+
+#ifndef _OBJC_MSGPROF_H
+#define _OBJC_MSGPROF_H
+
+#include <stdint.h>
+
+#define OBJC_MSGPROF_MAGIC "objcmsgp"
+
+enum { OBJC_MSGPROF_VERSION = 1 };
+
+enum msgprof_event_t {
+    MsgprofMiss,      // objc_msgSend missed the cache and looked up the method
+    MsgprofFill,      // an entry was added to the class's cache
+    MsgprofExpand,    // adding the entry grew the class's cache
+    MsgprofForward,   // lookup found no method and chose forwarding
+    MsgprofEventCount
+};
+
+struct msgprof_header_t {
+    char magic[8];          // OBJC_MSGPROF_MAGIC, not NUL-terminated
+    uint32_t version;       // OBJC_MSGPROF_VERSION
+    uint32_t interval;      // one of every interval events was recorded
+    uint32_t recordCount;
+    uint32_t stringBytes;
+};
+
+struct msgprof_record_t {
+    uint32_t className;     // offset in the string table
+    uint32_t selName;       // offset in the string table
+    uint32_t counts[MsgprofEventCount];  // indexed by msgprof_event_t
+};
+
+#endif
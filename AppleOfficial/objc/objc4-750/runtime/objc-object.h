@@ -523,6 +523,37 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 }
 
 
+// tryRetain that only updates the isa, ignoring overrides. 
+// Returns false without retaining if that is not enough: 
+// raw isa, deallocating, or an inline count that would overflow. 
+// The caller then uses rootTryRetain() with the side table locked.
+ALWAYS_INLINE bool 
+objc_object::rootTryRetainInline()
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.deallocating)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (slowpath(carry)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+    } while (slowpath(!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)));
+
+    return true;
+}
+
+
 // Equivalent to calling [this release], with shortcuts if there is no override
 inline void
 objc_object::release()
@@ -685,6 +716,33 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 }
 
 
+// Release count times at once, ignoring overrides, if that leaves 
+// the object alive and needs no side table.
+// Returns false without releasing anything otherwise; 
+// the caller then releases one at a time.
+ALWAYS_INLINE bool 
+objc_object::rootTryReleaseMany(uintptr_t count)
+{
+    assert(!isTaggedPointer());
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (slowpath(!newisa.nonpointer  ||  newisa.extra_rc < count)) {
+            ClearExclusive(&isa.bits);
+            return false;
+        }
+        newisa.extra_rc -= count;
+    } while (slowpath(!StoreReleaseExclusive(&isa.bits, 
+                                             oldisa.bits, newisa.bits)));
+
+    return true;
+}
+
+
 // Equivalent to [this autorelease], with shortcuts if there is no override
 inline id 
 objc_object::autorelease()
@@ -932,6 +990,22 @@ objc_object::rootReleaseShouldDealloc()
 }
 
 
+inline bool 
+objc_object::rootTryReleaseMany(uintptr_t count)
+{
+    // Raw isa objects are released in the side table.
+    return false;
+}
+
+
+inline bool 
+objc_object::rootTryRetainInline()
+{
+    // Raw isa objects are retained in the side table.
+    return false;
+}
+
+
 // Equivalent to [this autorelease], with shortcuts if there is no override
 inline id 
 objc_object::autorelease()
@@ -854,6 +854,15 @@ class recursive_mutex_tt : nocopy_t {
         os_unfair_recursive_lock_lock(&mLock);
     }
 
+    bool tryLock()
+    {
+        if (os_unfair_recursive_lock_trylock(&mLock)) {
+            lockdebug_recursive_mutex_lock(this);
+            return true;
+        }
+        return false;
+    }
+
     void unlock()
     {
         lockdebug_recursive_mutex_unlock(this);
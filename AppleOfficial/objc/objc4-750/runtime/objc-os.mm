@@ -672,7 +672,7 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&cacheUpdateLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&objcMsgLogLock, &crashlog_lock);
     lockdebug_lock_precedes_lock(&AltHandlerDebugLock, &crashlog_lock);
-    lockdebug_lock_precedes_lock(&AssociationsManagerLock, &crashlog_lock);
+    AssociationsLocksPrecedeLock(&crashlog_lock);
     SideTableLocksPrecedeLock(&crashlog_lock);
     PropertyLocks.precedeLock(&crashlog_lock);
     StructLocks.precedeLock(&crashlog_lock);
@@ -694,20 +694,20 @@ static void defineLockOrder()
     lockdebug_lock_precedes_lock(&loadMethodLock, &cacheUpdateLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &objcMsgLogLock);
     lockdebug_lock_precedes_lock(&loadMethodLock, &AltHandlerDebugLock);
-    lockdebug_lock_precedes_lock(&loadMethodLock, &AssociationsManagerLock);
+    AssociationsLocksSucceedLock(&loadMethodLock);
     SideTableLocksSucceedLock(&loadMethodLock);
     PropertyLocks.succeedLock(&loadMethodLock);
     StructLocks.succeedLock(&loadMethodLock);
     CppObjectLocks.succeedLock(&loadMethodLock);
 
-    // PropertyLocks and CppObjectLocks and AssociationManagerLock 
+    // PropertyLocks and CppObjectLocks and association locks 
     // precede everything because they are held while objc_retain() 
     // or C++ copy are called.
     // (StructLocks do not precede everything because it calls memmove only.)
     auto PropertyAndCppObjectAndAssocLocksPrecedeLock = [&](const void *lock) {
         PropertyLocks.precedeLock(lock);
         CppObjectLocks.precedeLock(lock);
-        lockdebug_lock_precedes_lock(&AssociationsManagerLock, lock);
+        AssociationsLocksPrecedeLock(lock);
     };
 #if __OBJC2__
     PropertyAndCppObjectAndAssocLocksPrecedeLock(&runtimeLock);
@@ -726,10 +726,10 @@ static void defineLockOrder()
 
     SideTableLocksSucceedLocks(PropertyLocks);
     SideTableLocksSucceedLocks(CppObjectLocks);
-    SideTableLocksSucceedLock(&AssociationsManagerLock);
+    AssociationsLocksPrecedeSideTableLocks();
 
-    PropertyLocks.precedeLock(&AssociationsManagerLock);
-    CppObjectLocks.precedeLock(&AssociationsManagerLock);
+    AssociationsLocksSucceedLocks(PropertyLocks);
+    AssociationsLocksSucceedLocks(CppObjectLocks);
     
 #if __OBJC2__
     lockdebug_lock_precedes_lock(&classInitLock, &runtimeLock);
@@ -763,6 +763,7 @@ static void defineLockOrder()
     PropertyLocks.defineLockOrder();
     StructLocks.defineLockOrder();
     CppObjectLocks.defineLockOrder();
+    AssociationsDefineLockOrder();
 }
 // LOCKDEBUG
 #endif
@@ -779,7 +780,7 @@ void _objc_atfork_prepare()
     loadMethodLock.lock();
     PropertyLocks.lockAll();
     CppObjectLocks.lockAll();
-    AssociationsManagerLock.lock();
+    AssociationsLockAll();
     SideTableLockAll();
     classInitLock.enter();
 #if __OBJC2__
@@ -809,7 +810,7 @@ void _objc_atfork_parent()
     CppObjectLocks.unlockAll();
     StructLocks.unlockAll();
     PropertyLocks.unlockAll();
-    AssociationsManagerLock.unlock();
+    AssociationsUnlockAll();
     AltHandlerDebugLock.unlock();
     objcMsgLogLock.unlock();
     crashlog_lock.unlock();
@@ -843,7 +844,7 @@ void _objc_atfork_child()
     CppObjectLocks.forceResetAll();
     StructLocks.forceResetAll();
     PropertyLocks.forceResetAll();
-    AssociationsManagerLock.forceReset();
+    AssociationsForceResetAll();
     AltHandlerDebugLock.forceReset();
     objcMsgLogLock.forceReset();
     crashlog_lock.forceReset();
@@ -854,6 +855,7 @@ void _objc_atfork_child()
 #if __OBJC2__
     DemangleCacheLock.forceReset();
     runtimeLock.forceReset();
+    cache_readersForkChild();
 #else
     impLock.forceReset();
     NXUniqueStringLock.forceReset();
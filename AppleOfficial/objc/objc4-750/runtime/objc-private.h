@@ -126,9 +126,14 @@ public:
     bool rootRelease();
     id rootAutorelease();
     bool rootTryRetain();
+    bool rootTryRetainInline();
     bool rootReleaseShouldDealloc();
     uintptr_t rootRetainCount();
 
+    // Batched release for autorelease pool drain
+    bool rootTryReleaseMany(uintptr_t count);
+    bool sidetable_releaseMany_nolock(SideTable& table, uintptr_t count);
+
     // Implementation of dealloc methods
     bool rootIsDeallocating();
     void clearDeallocating();
@@ -415,6 +420,7 @@ static inline bool sectnameStartsWith(const char *sectname, const char *prefix){
 /* selectors */
 extern void sel_init(size_t selrefCount);
 extern SEL sel_registerNameNoLock(const char *str, bool copy);
+extern SEL sel_registerNameConcurrent(const char *str, bool copy);
 
 extern SEL SEL_load;
 extern SEL SEL_initialize;
@@ -540,6 +546,14 @@ extern void gdb_objc_class_changed(Class cls, unsigned long changes, const char
 #include "objc-env.h"
 #undef OPTION
 
+// OBJC_CACHE_PROFILE: file used to pre-size method caches, or nil
+extern const char *CacheProfilePath;
+
+// OBJC_PROFILE_MSGSEND: file the message send profile is written to, or nil
+extern const char *MsgSendProfilePath;
+// OBJC_PROFILE_MSGSEND_INTERVAL: profile one of every this many events
+extern uint32_t MsgSendProfileInterval;
+
 extern void environ_init(void);
 
 extern void logReplacedMethod(const char *className, SEL s, bool isMeta, const char *catName, IMP oldImp, IMP newImp);
@@ -551,6 +565,7 @@ typedef struct {
     struct SyncCache *syncCache;  // for @synchronize
     struct alt_handler_list *handlerList;  // for exception alt handlers
     char *printableNames[4];  // temporary demangled names for logging
+    struct cache_reader_t *cacheReader;  // for method cache reclamation
 
     // If you add new fields here, don't forget to update 
     // _objc_pthread_destroyspecific()
@@ -571,6 +586,11 @@ extern char *encoding_copyArgumentType(const char *t, unsigned int index);
 
 // sync.h
 extern void _destroySyncCache(struct SyncCache *cache);
+extern void _forgetSyncContention(Class cls);
+
+// objc-cache.mm
+extern void _destroyCacheReader(struct cache_reader_t *reader);
+extern void cache_readersForkChild(void);
 
 // arr
 extern void arr_init(void);
@@ -27,7 +27,6 @@
 
 #include "objc-private.h"
 #include <objc/message.h>
-#include <map>
 
 #if _LIBCPP_VERSION
 #   include <unordered_map>
@@ -86,12 +85,6 @@ namespace objc_references_support {
         }
     };
     
-    struct ObjectPointerLess {
-        bool operator()(const void *p1, const void *p2) const {
-            return p1 < p2;
-        }
-    };
-    
     struct ObjcPointerHash {
         uintptr_t operator()(void *p) const {
             return DisguisedPointerHash()(uintptr_t(p));
@@ -165,18 +158,80 @@ namespace objc_references_support {
         bool hasValue() { return _value != nil; }
     };
 
-#if TARGET_OS_WIN32
-    typedef hash_map<void *, ObjcAssociation> ObjectAssociationMap;
-    typedef hash_map<disguised_ptr_t, ObjectAssociationMap *> AssociationsHashMap;
-#else
-    typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > ObjectAssociationMapAllocator;
-    class ObjectAssociationMap : public std::map<void *, ObjcAssociation, ObjectPointerLess, ObjectAssociationMapAllocator> {
+    // The associations of one object. Most objects have only a few, so
+    // they are kept in a flat array searched linearly, and the first few
+    // are stored inline.
+    class ObjectAssociationMap : nocopy_t {
     public:
-        void *operator new(size_t n) { return ::malloc(n); }
-        void operator delete(void *ptr) { ::free(ptr); }
+        struct Entry {
+            void *key;
+            ObjcAssociation association;
+        };
+
+    private:
+        enum { InlineCount = 4 };
+
+        Entry *_heap;           // nil while the entries fit inline
+        uint32_t _count;
+        uint32_t _capacity;
+        Entry _inline[InlineCount];
+
+        Entry *entries() { return _heap ? _heap : _inline; }
+
+        void grow() {
+            uint32_t newCapacity = _capacity * 2;
+            Entry *newEntries = (Entry *)malloc(newCapacity * sizeof(Entry));
+            memcpy(newEntries, entries(), _count * sizeof(Entry));
+            free(_heap);
+            _heap = newEntries;
+            _capacity = newCapacity;
+        }
+
+    public:
+        ObjectAssociationMap() : _heap(nil), _count(0), _capacity(InlineCount) { }
+
+        ObjectAssociationMap& operator=(ObjectAssociationMap&& other) {
+            free(_heap);
+            _heap = other._heap;
+            _count = other._count;
+            _capacity = other._capacity;
+            memcpy(_inline, other._inline, sizeof(_inline));
+            other._heap = nil;
+            other._count = 0;
+            other._capacity = InlineCount;
+            return *this;
+        }
+
+        ~ObjectAssociationMap() { free(_heap); }
+
+        size_t size() const { return _count; }
+        Entry *begin() { return entries(); }
+        Entry *end() { return entries() + _count; }
+
+        Entry *find(void *key) {
+            for (Entry *entry = begin(), *last = end(); entry != last; entry++) {
+                if (entry->key == key) return entry;
+            }
+            return nil;
+        }
+
+        // key must not already be present.
+        void insert(void *key, ObjcAssociation association) {
+            if (_count == _capacity) grow();
+            entries()[_count++] = Entry{key, association};
+        }
+
+        // Entry order is not preserved.
+        void erase(Entry *entry) {
+            *entry = entries()[--_count];
+        }
     };
-    typedef ObjcAllocator<std::pair<const disguised_ptr_t, ObjectAssociationMap*> > AssociationsHashMapAllocator;
-    class AssociationsHashMap : public unordered_map<disguised_ptr_t, ObjectAssociationMap *, DisguisedPointerHash, DisguisedPointerEqual, AssociationsHashMapAllocator> {
+
+#if TARGET_OS_WIN32
+    typedef hash_map<disguised_ptr_t, ObjectAssociationMap> AssociationsHashMap;
+#else
+    typedef ObjcAllocator<std::pair<const disguised_ptr_t, ObjectAssociationMap> > AssociationsHashMapAllocator;
+    class AssociationsHashMap : public unordered_map<disguised_ptr_t, ObjectAssociationMap, DisguisedPointerHash, DisguisedPointerEqual, AssociationsHashMapAllocator> {
     public:
         void *operator new(size_t n) { return ::malloc(n); }
         void operator delete(void *ptr) { ::free(ptr); }
@@ -186,28 +241,83 @@ namespace objc_references_support {
 
 using namespace objc_references_support;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
-// Allocating an instance acquires the lock, and calling its assocations()
-// method lazily allocates the hash table.
+// Associations are striped by object address, like the SideTables in
+// NSObject.mm. Each AssociationsTable has its own lock and hash table, so
+// objects in different stripes do not contend.
 
-spinlock_t AssociationsManagerLock;
+struct AssociationsTable {
+    spinlock_t slock;
+    // associative references: object pointer -> ObjectAssociationMap.
+    AssociationsHashMap *map = nil;
+
+    void lock() { slock.lock(); }
+    void unlock() { slock.unlock(); }
+    void forceReset() { slock.forceReset(); }
+
+    AssociationsHashMap &associations() {
+        if (map == NULL)
+            map = new AssociationsHashMap();
+        return *map;
+    }
+};
+
+static StripedMap<AssociationsTable> AssociationsTables;
+
+void AssociationsLockAll() {
+    AssociationsTables.lockAll();
+}
+
+void AssociationsUnlockAll() {
+    AssociationsTables.unlockAll();
+}
+
+void AssociationsForceResetAll() {
+    AssociationsTables.forceResetAll();
+}
+
+void AssociationsDefineLockOrder() {
+    AssociationsTables.defineLockOrder();
+}
+
+void AssociationsLocksPrecedeLock(const void *newlock) {
+    AssociationsTables.precedeLock(newlock);
+}
+
+void AssociationsLocksSucceedLock(const void *oldlock) {
+    AssociationsTables.succeedLock(oldlock);
+}
+
+void AssociationsLocksSucceedLocks(StripedMap<spinlock_t>& oldlocks) {
+    int i = 0;
+    const void *oldlock;
+    while ((oldlock = oldlocks.getLock(i++))) {
+        AssociationsTables.succeedLock(oldlock);
+    }
+}
+
+void AssociationsLocksPrecedeSideTableLocks() {
+    int i = 0;
+    const void *lock;
+    while ((lock = AssociationsTables.getLock(i++))) {
+        SideTableLocksSucceedLock(lock);
+    }
+}
+
+// class AssociationsManager locks the stripe for one object.
+// Allocating an instance acquires the lock, and calling its assocations()
+// method lazily allocates the stripe's hash table.
 
 class AssociationsManager {
-    // associative references: object pointer -> PtrPtrHashMap.
-    static AssociationsHashMap *_map;
+    AssociationsTable &_table;
 public:
-    AssociationsManager()   { AssociationsManagerLock.lock(); }
-    ~AssociationsManager()  { AssociationsManagerLock.unlock(); }
+    AssociationsManager(id object) : _table(AssociationsTables[object]) { _table.lock(); }
+    ~AssociationsManager()  { _table.unlock(); }
     
     AssociationsHashMap &associations() {
-        if (_map == NULL)
-            _map = new AssociationsHashMap();
-        return *_map;
+        return _table.associations();
     }
 };
 
-AssociationsHashMap *AssociationsManager::_map = NULL;
-
 // expanded policy bits.
 
 enum { 
@@ -223,15 +333,15 @@ id _object_get_associative_reference(id object, void *key) {
     id value = nil;
     uintptr_t policy = OBJC_ASSOCIATION_ASSIGN;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         AssociationsHashMap::iterator i = associations.find(disguised_object);
         if (i != associations.end()) {
-            ObjectAssociationMap *refs = i->second;
-            ObjectAssociationMap::iterator j = refs->find(key);
-            if (j != refs->end()) {
-                ObjcAssociation &entry = j->second;
+            ObjectAssociationMap &refs = i->second;
+            ObjectAssociationMap::Entry *j = refs.find(key);
+            if (j) {
+                ObjcAssociation &entry = j->association;
                 value = entry.value();
                 policy = entry.policy();
                 if (policy & OBJC_ASSOCIATION_GETTER_RETAIN) {
@@ -273,7 +383,7 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
     ObjcAssociation old_association(0, nil);
     id new_value = value ? acquireValue(value, policy) : nil;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         if (new_value) {
@@ -281,30 +391,28 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
             AssociationsHashMap::iterator i = associations.find(disguised_object);
             if (i != associations.end()) {
                 // secondary table exists
-                ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    j->second = ObjcAssociation(policy, new_value);
+                ObjectAssociationMap &refs = i->second;
+                ObjectAssociationMap::Entry *j = refs.find(key);
+                if (j) {
+                    old_association = j->association;
+                    j->association = ObjcAssociation(policy, new_value);
                 } else {
-                    (*refs)[key] = ObjcAssociation(policy, new_value);
+                    refs.insert(key, ObjcAssociation(policy, new_value));
                 }
             } else {
                 // create the new association (first time).
-                ObjectAssociationMap *refs = new ObjectAssociationMap;
-                associations[disguised_object] = refs;
-                (*refs)[key] = ObjcAssociation(policy, new_value);
+                associations[disguised_object].insert(key, ObjcAssociation(policy, new_value));
                 object->setHasAssociatedObjects();
             }
         } else {
             // setting the association to nil breaks the association.
             AssociationsHashMap::iterator i = associations.find(disguised_object);
             if (i !=  associations.end()) {
-                ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    refs->erase(j);
+                ObjectAssociationMap &refs = i->second;
+                ObjectAssociationMap::Entry *j = refs.find(key);
+                if (j) {
+                    old_association = j->association;
+                    refs.erase(j);
                 }
             }
         }
@@ -314,24 +422,22 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
 }
 
 void _object_remove_assocations(id object) {
-    vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > elements;
+    ObjectAssociationMap refs;
     {
-        AssociationsManager manager;
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         if (associations.size() == 0) return;
         disguised_ptr_t disguised_object = DISGUISE(object);
         AssociationsHashMap::iterator i = associations.find(disguised_object);
         if (i != associations.end()) {
-            // copy all of the associations that need to be removed.
-            ObjectAssociationMap *refs = i->second;
-            for (ObjectAssociationMap::iterator j = refs->begin(), end = refs->end(); j != end; ++j) {
-                elements.push_back(j->second);
-            }
-            // remove the secondary table.
-            delete refs;
+            // take the associations that need to be removed,
+            // and remove the secondary table.
+            refs = std::move(i->second);
             associations.erase(i);
         }
     }
     // the calls to releaseValue() happen outside of the lock.
-    for_each(elements.begin(), elements.end(), ReleaseValue());
+    for (ObjectAssociationMap::Entry &entry : refs) {
+        ReleaseValue()(entry.association);
+    }
 }
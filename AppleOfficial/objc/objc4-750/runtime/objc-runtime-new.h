@@ -274,6 +274,26 @@ struct method_list_t : entsize_list_tt<method_t, method_list_t, 0x3> {
     }
 };
 
+// Hash index of SEL -> method_t for a class with many methods.
+// Built lazily by getMethodNoSuper_nolock and never modified afterwards;
+// attaching method lists to the class discards it instead.
+// Protected by runtimeLock.
+struct method_index_t {
+    uint32_t mask;
+    uint32_t count;
+    method_t *buckets[0]; // variable-size, open addressing
+
+    method_t *lookup(SEL sel) const {
+        uint32_t i = (uint32_t)(uintptr_t)sel & mask;
+        method_t *m;
+        while ((m = buckets[i])) {
+            if (m->name == sel) return m;
+            i = (i+1) & mask;
+        }
+        return nil;
+    }
+};
+
 struct ivar_list_t : entsize_list_tt<ivar_t, ivar_list_t, 0> {
     bool containsIvar(Ivar ivar) const {
         return (ivar >= (Ivar)&*begin()  &&  ivar < (Ivar)&*end());
@@ -843,6 +863,8 @@ struct class_rw_t {
     uint32_t index;
 #endif
 
+    method_index_t *methodIndex;
+
     void setFlags(uint32_t set) 
     {
         OSAtomicOr32Barrier(set, &flags);
@@ -53,6 +53,7 @@ static bool methodListImplementsAWZ(const method_list_t *mlist);
 static void updateCustomRR_AWZ(Class cls, method_t *meth);
 static method_t *search_method_list(const method_list_t *mlist, SEL sel);
 static void flushCaches(Class cls);
+static void invalidateMethodIndex(Class cls);
 static void initializeTaggedPointerObfuscator(void);
 #if SUPPORT_FIXUP
 static void fixupMessageRef(message_ref_t *msg);
@@ -807,6 +808,7 @@ attachCategories(Class cls, category_list *cats, bool flush_caches)
     prepareMethodLists(cls, mlists, mcount, NO, fromBundle);
     rw->methods.attachLists(mlists, mcount);
     free(mlists);
+    if (mcount > 0) invalidateMethodIndex(cls);
     if (flush_caches  &&  mcount > 0) flushCaches(cls);
 
     rw->properties.attachLists(proplists, propcount);
@@ -1376,15 +1378,19 @@ Class _class_remap(Class cls)
 /***********************************************************************
 * remapClassRef
 * Fix up a class ref, in case the class referenced has been reallocated 
-* or is an ignored weak-linked class.
-* Locking: runtimeLock must be read- or write-locked by the caller
+* or is an ignored weak-linked class. map is remappedClasses(NO).
+* Locking: runtimeLock must be held by the caller, or by a thread 
+* waiting for the caller to finish.
 **********************************************************************/
-static void remapClassRef(Class *clsref)
+static void remapClassRef(NXMapTable *map, Class *clsref)
 {
-    runtimeLock.assertLocked();
-
-    Class newcls = remapClass(*clsref);    
-    if (*clsref != newcls) *clsref = newcls;
+    Class newcls;
+    if (*clsref  &&  
+        NXMapMember(map, *clsref, (void**)&newcls) != NX_MAPNOTAKEY  &&  
+        *clsref != newcls) 
+    {
+        *clsref = newcls;
+    }
 }
 
 
@@ -2436,6 +2442,239 @@ readProtocol(protocol_t *newproto, Class protocol_class,
     }
 }
 
+/***********************************************************************
+* Image reference fixups.
+* Remapping class refs, uniquing selector refs, and repairing message 
+* refs each write only the image's own references. Besides that they 
+* only read remappedClasses(), which is complete once classes are 
+* discovered, and register selectors, which is thread-safe. 
+* When a large amount of this work arrives at once, as when an app 
+* loads many images from outside the shared cache, _read_images() 
+* splits it into chunks and fixes them up on several threads. 
+* The thread calling _read_images() keeps runtimeLock and works 
+* alongside the others until every chunk is done.
+* libdispatch is not usable this early, so the threads are plain 
+* pthreads that exit when the work runs out.
+**********************************************************************/
+
+enum image_fixup_kind_t {
+    FixupClassRefs,
+    FixupSelectorRefs,
+#if SUPPORT_FIXUP
+    FixupMessageRefs,
+#endif
+    FixupKindCount
+};
+
+static const char * const imageFixupPhases[FixupKindCount] = {
+    "IMAGE TIMES: remap classes",
+    "IMAGE TIMES: fix up selector references",
+#if SUPPORT_FIXUP
+    "IMAGE TIMES: fix up objc_msgSend_fixup",
+#endif
+};
+
+// References per chunk. Large images are split into several.
+enum { ImageFixupChunk = 4096 };
+
+// Fewer references than this are fixed up on the calling thread alone.
+enum { ParallelImageFixupMinimum = 4 * ImageFixupChunk };
+
+enum { MaxImageFixupThreads = 8 };
+
+struct image_fixup_t {
+    void *refs;
+    size_t count;
+    image_fixup_kind_t kind;
+    bool isBundle;
+};
+
+struct image_fixup_list_t {
+    image_fixup_t *fixups;
+    size_t count;
+    size_t capacity;
+    size_t refCount;
+
+    std::atomic<size_t> next;
+    NXMapTable *remapped;  // remappedClasses(NO)
+    // Time spent on each kind, summed across threads. 
+    // Only measured for OBJC_PRINT_IMAGE_TIMES.
+    std::atomic<uint64_t> busy[FixupKindCount];
+
+    void add(image_fixup_kind_t kind, void *refs, size_t refCount, 
+             size_t refSize, bool isBundle) 
+    {
+        for (size_t start = 0; start < refCount; start += ImageFixupChunk) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                fixups = (image_fixup_t *)
+                    realloc(fixups, capacity * sizeof(image_fixup_t));
+            }
+            image_fixup_t& f = fixups[count++];
+            f.refs = (uint8_t *)refs + start * refSize;
+            f.count = MIN(refCount - start, (size_t)ImageFixupChunk);
+            f.kind = kind;
+            f.isBundle = isBundle;
+        }
+        this->refCount += refCount;
+    }
+
+    void fixup(const image_fixup_t& f);
+
+    // Fix up chunks until there are none left. Called on every thread.
+    void drain() {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            uint64_t start = PrintImageTimes ? nanoseconds() : 0;
+            fixup(fixups[i]);
+            if (PrintImageTimes) {
+                busy[fixups[i].kind].fetch_add(nanoseconds() - start, 
+                                               std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+
+void image_fixup_list_t::fixup(const image_fixup_t& f)
+{
+    switch (f.kind) {
+    case FixupClassRefs: {
+        Class *refs = (Class *)f.refs;
+        for (size_t i = 0; i < f.count; i++) {
+            remapClassRef(remapped, &refs[i]);
+        }
+        break;
+    }
+    case FixupSelectorRefs: {
+        SEL *sels = (SEL *)f.refs;
+        for (size_t i = 0; i < f.count; i++) {
+            sels[i] = sel_registerNameConcurrent(sel_cname(sels[i]), 
+                                                 f.isBundle);
+        }
+        break;
+    }
+#if SUPPORT_FIXUP
+    case FixupMessageRefs: {
+        message_ref_t *refs = (message_ref_t *)f.refs;
+        for (size_t i = 0; i < f.count; i++) {
+            fixupMessageRef(refs+i);
+        }
+        break;
+    }
+#endif
+    default:
+        _objc_fatal("bad image fixup kind %d", (int)f.kind);
+    }
+}
+
+
+static void *image_fixup_thread(void *arg)
+{
+    ((image_fixup_list_t *)arg)->drain();
+    return nil;
+}
+
+
+/***********************************************************************
+* fixupImageRefs
+* Remap class refs, fix up selector refs, and repair message refs 
+* in every image, possibly on several threads.
+* Locking: runtimeLock must be held by the caller. selLock must not.
+**********************************************************************/
+static void fixupImageRefs(header_info **hList, uint32_t hCount, 
+                           size_t *unfixedSelectors, TimeLogger& ts)
+{
+    runtimeLock.assertLocked();
+
+    image_fixup_list_t list{};
+    list.remapped = remappedClasses(NO);
+    size_t count;
+
+    // Class list and nonlazy class list remain unremapped.
+    // Class refs and super refs are remapped for message dispatching.
+    if (!noClassesRemapped()) {
+        for (uint32_t i = 0; i < hCount; i++) {
+            header_info *hi = hList[i];
+            Class *classrefs = _getObjc2ClassRefs(hi, &count);
+            list.add(FixupClassRefs, classrefs, count, sizeof(Class), NO);
+            // fixme why doesn't test future1 catch the absence of this?
+            classrefs = _getObjc2SuperRefs(hi, &count);
+            list.add(FixupClassRefs, classrefs, count, sizeof(Class), NO);
+        }
+    }
+
+    for (uint32_t i = 0; i < hCount; i++) {
+        header_info *hi = hList[i];
+        if (hi->isPreoptimized()) continue;
+        SEL *sels = _getObjc2SelectorRefs(hi, &count);
+        *unfixedSelectors += count;
+        list.add(FixupSelectorRefs, sels, count, sizeof(SEL), hi->isBundle());
+    }
+
+#if SUPPORT_FIXUP
+    // Fix up old objc_msgSend_fixup call sites
+    for (uint32_t i = 0; i < hCount; i++) {
+        header_info *hi = hList[i];
+        message_ref_t *refs = _getObjc2MessageRefs(hi, &count);
+        if (count == 0) continue;
+
+        if (PrintVtables) {
+            _objc_inform("VTABLES: repairing %zu unsupported vtable dispatch "
+                         "call sites in %s", count, hi->fname());
+        }
+        list.add(FixupMessageRefs, refs, count, sizeof(message_ref_t), NO);
+    }
+#endif
+
+    unsigned threadCount = 0;
+    pthread_t threads[MaxImageFixupThreads];
+    if (!DisableParallelImageFixups  &&  
+        list.refCount >= ParallelImageFixupMinimum) 
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t wanted = MIN(MIN((size_t)MaxImageFixupThreads, list.count), 
+                            (size_t)MAX(cpus, 1L));
+        // This thread is one of them.
+        for (size_t i = 1; i < wanted; i++) {
+            if (pthread_create(&threads[threadCount], nil, 
+                               image_fixup_thread, &list) != 0) 
+            {
+                break;  // fewer threads is fine
+            }
+            threadCount++;
+        }
+    }
+
+    if (threadCount == 0) {
+        // One phase at a time. Chunks were added in phase order.
+        size_t i = 0;
+        for (unsigned kind = 0; kind < FixupKindCount; kind++) {
+            for ( ; i < list.count  &&  list.fixups[i].kind == kind; i++) {
+                list.fixup(list.fixups[i]);
+            }
+            ts.log(imageFixupPhases[kind]);
+        }
+    }
+    else {
+        list.drain();
+        for (unsigned i = 0; i < threadCount; i++) {
+            pthread_join(threads[i], nil);
+        }
+        ts.log("IMAGE TIMES: fix up class, selector, and message refs");
+        if (PrintImageTimes) {
+            for (unsigned kind = 0; kind < FixupKindCount; kind++) {
+                _objc_inform("%.2f ms busy on %u threads: %s", 
+                             list.busy[kind].load() / 1000000.0, 
+                             threadCount + 1, imageFixupPhases[kind]);
+            }
+        }
+    }
+
+    free(list.fixups);
+}
+
+
 /***********************************************************************
 * _read_images
 * Perform initial processing of the headers in the linked 
@@ -2571,62 +2810,10 @@ void _read_images(header_info **hList, uint32_t hCount, int totalClasses, int un
 
     ts.log("IMAGE TIMES: discover classes");
 
-    // Fix up remapped classes
-    // Class list and nonlazy class list remain unremapped.
-    // Class refs and super refs are remapped for message dispatching.
-    
-    if (!noClassesRemapped()) {
-        for (EACH_HEADER) {
-            Class *classrefs = _getObjc2ClassRefs(hi, &count);
-            for (i = 0; i < count; i++) {
-                remapClassRef(&classrefs[i]);
-            }
-            // fixme why doesn't test future1 catch the absence of this?
-            classrefs = _getObjc2SuperRefs(hi, &count);
-            for (i = 0; i < count; i++) {
-                remapClassRef(&classrefs[i]);
-            }
-        }
-    }
-
-    ts.log("IMAGE TIMES: remap classes");
-
-    // Fix up @selector references
+    // Fix up remapped classes, @selector references, 
+    // and old objc_msgSend_fixup call sites
     static size_t UnfixedSelectors;
-    {
-        mutex_locker_t lock(selLock);
-        for (EACH_HEADER) {
-            if (hi->isPreoptimized()) continue;
-            
-            bool isBundle = hi->isBundle();
-            SEL *sels = _getObjc2SelectorRefs(hi, &count);
-            UnfixedSelectors += count;
-            for (i = 0; i < count; i++) {
-                const char *name = sel_cname(sels[i]);
-                sels[i] = sel_registerNameNoLock(name, isBundle);
-            }
-        }
-    }
-
-    ts.log("IMAGE TIMES: fix up selector references");
-
-#if SUPPORT_FIXUP
-    // Fix up old objc_msgSend_fixup call sites
-    for (EACH_HEADER) {
-        message_ref_t *refs = _getObjc2MessageRefs(hi, &count);
-        if (count == 0) continue;
-
-        if (PrintVtables) {
-            _objc_inform("VTABLES: repairing %zu unsupported vtable dispatch "
-                         "call sites in %s", count, hi->fname());
-        }
-        for (i = 0; i < count; i++) {
-            fixupMessageRef(refs+i);
-        }
-    }
-
-    ts.log("IMAGE TIMES: fix up objc_msgSend_fixup");
-#endif
+    fixupImageRefs(hList, hCount, &UnfixedSelectors, ts);
 
     // Discover protocols. Fix up protocol refs.
     for (EACH_HEADER) {
@@ -4726,6 +4913,71 @@ static method_t *search_method_list(const method_list_t *mlist, SEL sel)
     return nil;
 }
 
+
+/***********************************************************************
+* Method indexes
+* Classes with at least MethodIndexMinMethods methods get a method_index_t
+* so that a lookup does not search every method list. An index is built
+* on the first lookup and is immutable; attaching methods to the class
+* drops it, and the next lookup builds a new one.
+* rw->methodIndex is nil if no index has been built yet, and
+* &NoMethodIndex if the class is too small to need one.
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+enum { MethodIndexMinMethods = 128 };
+static method_index_t NoMethodIndex;
+
+static void invalidateMethodIndex(Class cls)
+{
+    runtimeLock.assertLocked();
+
+    auto rw = cls->data();
+    if (rw->methodIndex != &NoMethodIndex) free(rw->methodIndex);
+    rw->methodIndex = nil;
+}
+
+static method_index_t *buildMethodIndex(Class cls)
+{
+    auto rw = cls->data();
+
+    uint32_t count = 0;
+    for (auto mlists = rw->methods.beginLists(), 
+              end = rw->methods.endLists(); 
+         mlists != end;
+         ++mlists)
+    {
+        count += (*mlists)->count;
+    }
+    if (count < MethodIndexMinMethods  ||  DisableMethodIndex) {
+        return &NoMethodIndex;
+    }
+
+    // Keep the table at most half full.
+    uint32_t capacity = MethodIndexMinMethods;
+    while (capacity < count * 2) capacity *= 2;
+
+    method_index_t *index = (method_index_t *)
+        calloc(sizeof(method_index_t) + capacity * sizeof(method_t *), 1);
+    index->mask = capacity - 1;
+
+    // Lists are visited in search order and the first method with a
+    // given SEL wins, so category overrides behave as they do without
+    // the index.
+    for (auto& meth : rw->methods) {
+        uint32_t i = (uint32_t)(uintptr_t)meth.name & index->mask;
+        method_t *m;
+        while ((m = index->buckets[i])  &&  m->name != meth.name) {
+            i = (i+1) & index->mask;
+        }
+        if (!m) {
+            index->buckets[i] = &meth;
+            index->count++;
+        }
+    }
+
+    return index;
+}
+
 static method_t *
 getMethodNoSuper_nolock(Class cls, SEL sel)
 {
@@ -4735,6 +4987,28 @@ getMethodNoSuper_nolock(Class cls, SEL sel)
     // fixme nil cls? 
     // fixme nil sel?
 
+    auto rw = cls->data();
+    if (!rw->methodIndex) rw->methodIndex = buildMethodIndex(cls);
+    if (rw->methodIndex != &NoMethodIndex) {
+        method_t *m = rw->methodIndex->lookup(sel);
+#if DEBUG
+        // sanity-check the index against the method lists
+        method_t *found = nil;
+        for (auto mlists = rw->methods.beginLists(), 
+                  end = rw->methods.endLists(); 
+             mlists != end  &&  !found;
+             ++mlists)
+        {
+            found = search_method_list(*mlists, sel);
+        }
+        if (m != found) {
+            _objc_fatal("method index for %s disagrees with its method lists",
+                        cls->nameForLogging());
+        }
+#endif
+        return m;
+    }
+
     for (auto mlists = cls->data()->methods.beginLists(), 
               end = cls->data()->methods.endLists(); 
          mlists != end;
@@ -4840,6 +5114,9 @@ log_and_fill_cache(Class cls, IMP imp, SEL sel, id receiver, Class implementer)
 **********************************************************************/
 IMP _class_lookupMethodAndLoadCache3(id obj, SEL sel, Class cls)
 {
+    if (slowpath(MsgSendProfilePath)) {
+        cache_profileMessage(cls, sel, MsgprofMiss);
+    }
     return lookUpImpOrForward(cls, sel, obj, 
                               YES/*initialize*/, NO/*cache*/, YES/*resolver*/);
 }
@@ -4865,6 +5142,9 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
 
     runtimeLock.assertUnlocked();
 
+    // Our caller is done with any method cache it was reading.
+    cache_quiescent();
+
     // Optimistic cache lookup
     if (cache) {
         imp = cache_getImp(cls, sel);
@@ -4970,6 +5250,9 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     // Use forwarding.
 
     imp = (IMP)_objc_msgForward_impcache;
+    if (slowpath(MsgSendProfilePath)) {
+        cache_profileMessage(cls, sel, MsgprofForward);
+    }
     cache_fill(cls, sel, imp, inst);
 
  done:
@@ -5713,6 +5996,7 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
 
         prepareMethodLists(cls, &newlist, 1, NO, NO);
         cls->data()->methods.attachLists(&newlist, 1);
+        invalidateMethodIndex(cls);
         flushCaches(cls);
 
         result = nil;
@@ -5787,6 +6071,7 @@ addMethods(Class cls, const SEL *names, const IMP *imps, const char **types,
         
         prepareMethodLists(cls, &newlist, 1, NO, NO);
         cls->data()->methods.attachLists(&newlist, 1);
+        invalidateMethodIndex(cls);
         flushCaches(cls);
     } else {
         // Attaching the method list to the class consumes it. If we don't
@@ -6375,12 +6660,17 @@ static void free_class(Class cls)
 {
     runtimeLock.assertLocked();
 
+    // Messages to a class may be profiled before it is realized.
+    if (slowpath(MsgSendProfilePath)) cache_forgetMessageProfile(cls);
+    if (slowpath(PrintSyncContention)) _forgetSyncContention(cls);
+
     if (! cls->isRealized()) return;
 
     auto rw = cls->data();
     auto ro = rw->ro;
 
     cache_delete(cls);
+    invalidateMethodIndex(cls);
     
     for (auto& meth : rw->methods) {
         try_free(meth.types);
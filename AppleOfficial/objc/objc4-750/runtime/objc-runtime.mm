@@ -122,6 +122,14 @@ int HeaderCount = 0;
 // if the parent process was multithreaded when fork() was called.
 bool MultithreadedForkChild = false;
 
+// OBJC_CACHE_PROFILE, or nil
+const char *CacheProfilePath = nil;
+
+// OBJC_PROFILE_MSGSEND, or nil
+const char *MsgSendProfilePath = nil;
+// OBJC_PROFILE_MSGSEND_INTERVAL, never 0
+uint32_t MsgSendProfileInterval = 1;
+
 
 /***********************************************************************
 * objc_noop_imp. Used when we need to install a do-nothing method somewhere.
@@ -293,6 +301,21 @@ void environ_init(void)
             PrintOptions = true;
             continue;
         }
+        if (0 == strncmp(*p, "OBJC_CACHE_PROFILE=", 19)) {
+            if ((*p)[19]) CacheProfilePath = *p + 19;
+            continue;
+        }
+        if (0 == strncmp(*p, "OBJC_PROFILE_MSGSEND=", 21)) {
+            if ((*p)[21]) MsgSendProfilePath = *p + 21;
+            continue;
+        }
+        if (0 == strncmp(*p, "OBJC_PROFILE_MSGSEND_INTERVAL=", 30)) {
+            unsigned long interval = strtoul(*p + 30, nil, 10);
+            if (interval > 0  &&  interval <= UINT32_MAX) {
+                MsgSendProfileInterval = (uint32_t)interval;
+            }
+            continue;
+        }
         
         const char *value = strchr(*p, '=');
         if (!*value) continue;
@@ -336,9 +359,19 @@ void environ_init(void)
                 _objc_inform("OBJC_HELP is set");
             }
             _objc_inform("OBJC_PRINT_OPTIONS: list which options are set");
+            _objc_inform("OBJC_CACHE_PROFILE: pre-size method caches from a file of OBJC_PRINT_CACHE_PROFILE output");
+            _objc_inform("OBJC_PROFILE_MSGSEND: write method cache misses and forwarding per class and selector to this file");
+            _objc_inform("OBJC_PROFILE_MSGSEND_INTERVAL: with OBJC_PROFILE_MSGSEND, count only one of every this many events");
         }
         if (PrintOptions) {
             _objc_inform("OBJC_PRINT_OPTIONS is set");
+            if (CacheProfilePath) {
+                _objc_inform("OBJC_CACHE_PROFILE is %s", CacheProfilePath);
+            }
+            if (MsgSendProfilePath) {
+                _objc_inform("OBJC_PROFILE_MSGSEND is %s (interval %u)", 
+                             MsgSendProfilePath, MsgSendProfileInterval);
+            }
         }
 
         for (size_t i = 0; i < sizeof(Settings)/sizeof(Settings[0]); i++) {
@@ -415,6 +448,9 @@ void _objc_pthread_destroyspecific(void *arg)
         _destroyInitializingClassList(data->initializingClasses);
         _destroySyncCache(data->syncCache);
         _destroyAltHandlerList(data->handlerList);
+#if __OBJC2__
+        _destroyCacheReader(data->cacheReader);
+#endif
         for (int i = 0; i < (int)countof(data->printableNames); i++) {
             if (data->printableNames[i]) {
                 free(data->printableNames[i]);  
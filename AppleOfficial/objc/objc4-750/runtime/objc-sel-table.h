@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/***********************************************************************
+* objc-sel-table.h
+* Concurrent selector name interning table.
+*
+* An open-addressed hash table of selector names. Lookups never lock.
+* An insert claims an empty bucket with a compare-and-swap. Buckets
+* are never cleared, so a name found in the table stays there.
+*
+* A full table is replaced by one twice the size while holding the
+* table's lock. Each empty bucket of the old table is first frozen
+* with the same compare-and-swap an insert would use. Every name that
+* made it into the old table is therefore copied to the new one, and
+* an insert that finds a frozen bucket retries in the new table. Old
+* tables are never freed because lookups may still be reading them;
+* they add up to less than the current table.
+*
+* This file has no dependencies on the rest of the runtime so that
+* selbench.cpp can build it by itself.
+**********************************************************************/
+
+#ifndef _OBJC_SEL_TABLE_H
+#define _OBJC_SEL_TABLE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lock is held while the table grows. It must provide lock() and unlock().
+template <typename Lock>
+class sel_table_tt {
+    struct table_t {
+        uint32_t mask;
+        std::atomic<uint32_t> occupied;
+        std::atomic<const char *> buckets[0];
+    };
+
+    enum { MinCapacity = 64 };
+
+    std::atomic<table_t *> _table;
+    Lock& _lock;
+
+    // Marks an empty bucket of a table that has been replaced.
+    static const char *frozen() { return (const char *)1; }
+
+    static uint32_t hash(const char *s) {
+        uint32_t hash = 0;
+        for (;;) {
+            int a = *s++;
+            if (0 == a) break;
+            hash += (hash << 8) + a;
+        }
+        // Mix the high bits into the low bits used for the bucket index;
+        // linear probing clusters badly without it.
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        return hash;
+    }
+
+    static table_t *newTable(uint32_t capacity) {
+        table_t *t = (table_t *)
+            calloc(sizeof(table_t) + capacity * sizeof(t->buckets[0]), 1);
+        t->mask = capacity - 1;
+        return t;
+    }
+
+    // Search one table for name.
+    // Returns the registered name if there is one. Otherwise returns nil
+    // and sets *empty to the bucket where name belongs, or returns
+    // frozen() if the table is full or has been replaced.
+    static const char *search(table_t *t, const char *name, uint32_t h,
+                              uint32_t *empty)
+    {
+        uint32_t i = h & t->mask;
+        for (uint32_t n = 0; n <= t->mask; n++) {
+            const char *sel = t->buckets[i].load(std::memory_order_acquire);
+            if (!sel) {
+                *empty = i;
+                return nullptr;
+            }
+            if (sel == frozen()) return frozen();
+            if (0 == strcmp(sel, name)) return sel;
+            i = (i+1) & t->mask;
+        }
+        return frozen();
+    }
+
+    // Replace old with a table twice its size.
+    // Locking: the lock must be held.
+    void grow(table_t *old) {
+        table_t *t = newTable((old->mask + 1) * 2);
+        uint32_t occupied = 0;
+        for (uint32_t i = 0; i <= old->mask; i++) {
+            const char *sel = nullptr;
+            if (old->buckets[i].compare_exchange_strong
+                (sel, frozen(), std::memory_order_acq_rel))
+            {
+                continue;
+            }
+            uint32_t j = hash(sel) & t->mask;
+            while (t->buckets[j].load(std::memory_order_relaxed)) {
+                j = (j+1) & t->mask;
+            }
+            t->buckets[j].store(sel, std::memory_order_relaxed);
+            occupied++;
+        }
+        t->occupied.store(occupied, std::memory_order_relaxed);
+        _table.store(t, std::memory_order_release);
+    }
+
+    void growIfCurrent(table_t *t, bool lockHeld) {
+        if (!lockHeld) _lock.lock();
+        table_t *current = _table.load(std::memory_order_relaxed);
+        if (!current) _table.store(newTable(MinCapacity), std::memory_order_release);
+        else if (current == t) grow(t);
+        if (!lockHeld) _lock.unlock();
+    }
+
+ public:
+    constexpr sel_table_tt(Lock& lock) : _table(nullptr), _lock(lock) { }
+
+    // Size the table for count names. Does nothing if it already exists.
+    // Locking: the lock must be held.
+    void init(uint32_t count) {
+        if (_table.load(std::memory_order_relaxed)) return;
+        uint32_t capacity = MinCapacity;
+        while (capacity < count * 2) capacity *= 2;
+        _table.store(newTable(capacity), std::memory_order_release);
+    }
+
+    // Returns the registered name equal to name, or nil.
+    // Locking: none
+    const char *get(const char *name) {
+        table_t *t = _table.load(std::memory_order_acquire);
+        if (!t) return nullptr;
+        uint32_t empty;
+        const char *sel = search(t, name, hash(name), &empty);
+        // A frozen bucket means name was not registered when the table
+        // was replaced.
+        return sel == frozen() ? nullptr : sel;
+    }
+
+    // Registers newName unless an equal name is already registered.
+    // Returns the registered name; if that is not newName,
+    // the caller still owns newName.
+    // Locking: takes the lock to grow the table, unless lockHeld.
+    const char *insert(const char *newName, bool lockHeld) {
+        uint32_t h = hash(newName);
+        for (;;) {
+            table_t *t = _table.load(std::memory_order_acquire);
+            if (!t) {
+                growIfCurrent(nullptr, lockHeld);
+                continue;
+            }
+
+            uint32_t empty;
+            const char *sel = search(t, newName, h, &empty);
+            if (sel == frozen()) {
+                growIfCurrent(t, lockHeld);
+                continue;
+            }
+            if (sel) return sel;
+
+            // If another name claims the bucket first, search again:
+            // it may have been the same name.
+            if (t->buckets[empty].compare_exchange_strong
+                (sel, newName, std::memory_order_acq_rel))
+            {
+                uint32_t occupied = 1 + t->occupied.fetch_add
+                    (1, std::memory_order_relaxed);
+                if (occupied * 4 > (t->mask + 1) * 3) {
+                    growIfCurrent(t, lockHeld);
+                }
+                return newName;
+            }
+        }
+    }
+
+    // Number of registered names. Approximate while inserts are running.
+    uint32_t count() {
+        table_t *t = _table.load(std::memory_order_acquire);
+        return t ? t->occupied.load(std::memory_order_relaxed) : 0;
+    }
+};
+
+#endif
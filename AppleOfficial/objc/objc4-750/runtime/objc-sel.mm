@@ -25,6 +25,7 @@
 
 #include "objc-private.h"
 #include "objc-cache.h"
+#include "objc-sel-table.h"
 
 #if SUPPORT_PREOPT
 static const objc_selopt_t *builtins = NULL;
@@ -33,7 +34,8 @@ static const objc_selopt_t *builtins = NULL;
 
 static size_t SelrefCount = 0;
 
-static NXMapTable *namedSelectors;
+// Selectors registered at runtime, after the shared cache's builtins.
+static sel_table_tt<mutex_t> namedSelectors(selLock);
 
 static SEL search_builtins(const char *key);
 
@@ -69,6 +71,8 @@ void sel_init(size_t selrefCount)
 
     mutex_locker_t lock(selLock);
 
+    namedSelectors.init((uint32_t)SelrefCount);
+
     s(load);
     s(initialize);
     t(resolveInstanceMethod:, resolveInstanceMethod);
@@ -95,10 +99,9 @@ void sel_init(size_t selrefCount)
 }
 
 
-static SEL sel_alloc(const char *name, bool copy)
+static const char *sel_alloc(const char *name, bool copy)
 {
-    selLock.assertLocked();
-    return (SEL)(copy ? strdupIfMutable(name) : name);    
+    return copy ? strdupIfMutable(name) : name;
 }
 
 
@@ -117,11 +120,7 @@ BOOL sel_isMapped(SEL sel)
 
     if (sel == search_builtins(name)) return YES;
 
-    mutex_locker_t lock(selLock);
-    if (namedSelectors) {
-        return (sel == (SEL)NXMapGet(namedSelectors, name));
-    }
-    return false;
+    return (sel == (SEL)namedSelectors.get(name));
 }
 
 
@@ -146,22 +145,17 @@ static SEL __sel_registerName(const char *name, bool shouldLock, bool copy)
     result = search_builtins(name);
     if (result) return result;
     
-    conditional_mutex_locker_t lock(selLock, shouldLock);
-    if (namedSelectors) {
-        result = (SEL)NXMapGet(namedSelectors, name);
-    }
+    result = (SEL)namedSelectors.get(name);
     if (result) return result;
 
     // No match. Insert.
+    // selLock is only taken if the table needs to grow.
 
-    if (!namedSelectors) {
-        namedSelectors = NXCreateMapTable(NXStrValueMapPrototype, 
-                                          (unsigned)SelrefCount);
-    }
-    if (!result) {
-        result = sel_alloc(name, copy);
-        // fixme choose a better container (hash not map for starters)
-        NXMapInsert(namedSelectors, sel_getName(result), result);
+    const char *newName = sel_alloc(name, copy);
+    result = (SEL)namedSelectors.insert(newName, !shouldLock);
+    if (copy  &&  sel_getName(result) != newName) {
+        // Another thread registered the same name first.
+        freeIfMutable((char *)newName);
     }
 
     return result;
@@ -176,6 +170,11 @@ SEL sel_registerNameNoLock(const char *name, bool copy) {
     return __sel_registerName(name, 0, copy);  // NO lock, maybe copy
 }
 
+// For threads registering selectors on behalf of one holding runtimeLock.
+SEL sel_registerNameConcurrent(const char *name, bool copy) {
+    return __sel_registerName(name, 1, copy);  // YES lock, maybe copy
+}
+
 
 // 2001/1/24
 // the majority of uses of this function (which used to return NULL if not found)
@@ -23,17 +23,18 @@
 
 #include "objc-private.h"
 #include "objc-sync.h"
+#include "llvm-DenseMap.h"
 
 //
-// Allocate a lock only when needed.  Since few locks are needed at any point
-// in time, keep them on a single list.
+// Allocate a lock only when needed.  Locks are never freed; a lock that 
+// no thread is using is reassigned to the next object that needs one.
 //
 
 
 typedef struct alignas(CacheLineSize) SyncData {
-    struct SyncData* nextData;
     DisguisedPtr<objc_object> object;
     int32_t threadCount;  // number of THREADS using this block
+    int32_t spinCount;    // recent spins before acquiring; guarded by mutex
     recursive_mutex_t mutex;
 } SyncData;
 
@@ -56,18 +57,57 @@ typedef struct SyncCache {
   SYNC_COUNT_DIRECT_KEY == SyncCacheItem.lockCount
  */
 
+// Open-addressed hash table of SyncData, keyed by object.
+// Entries are never removed, only reassigned to another object 
+// whose probe sequence passes through them, so a probe may stop 
+// at the first empty bucket.
 struct SyncList {
-    SyncData *data;
+    SyncData **buckets;
+    uint32_t mask;
+    uint32_t occupied;
     spinlock_t lock;
 
-    constexpr SyncList() : data(nil), lock(fork_unsafe_lock) { }
+    constexpr SyncList()
+        : buckets(nil), mask(0), occupied(0), lock(fork_unsafe_lock) { }
 };
 
-// Use multiple parallel lists to decrease contention among unrelated objects.
+// Use multiple parallel tables to decrease contention among unrelated objects.
 #define LOCK_FOR_OBJ(obj) sDataLists[obj].lock
-#define LIST_FOR_OBJ(obj) sDataLists[obj].data
+#define LIST_FOR_OBJ(obj) sDataLists[obj]
 static StripedMap<SyncList> sDataLists;
 
+enum { SyncListMinCapacity = 8 };
+
+static uint32_t syncListIndex(SyncList *list, id object)
+{
+    return ptr_hash((uintptr_t)object) & list->mask;
+}
+
+
+// Add data to list, growing the table if it is 3/4 full.
+// Locking: the list's lock must be held.
+static void syncListInsert(SyncList *list, SyncData *data)
+{
+    if (!list->buckets  ||  (list->occupied + 1) * 4 > (list->mask + 1) * 3) {
+        SyncData **oldBuckets = list->buckets;
+        uint32_t oldCapacity = oldBuckets ? list->mask + 1 : 0;
+        uint32_t newCapacity = 
+            oldCapacity ? oldCapacity * 2 : SyncListMinCapacity;
+        list->buckets = (SyncData **)calloc(newCapacity, sizeof(SyncData *));
+        list->mask = newCapacity - 1;
+        list->occupied = 0;
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            if (oldBuckets[i]) syncListInsert(list, oldBuckets[i]);
+        }
+        free(oldBuckets);
+    }
+
+    uint32_t i = syncListIndex(list, (id)data->object);
+    while (list->buckets[i]) i = (i+1) & list->mask;
+    list->buckets[i] = data;
+    list->occupied++;
+}
+
 
 enum usage { ACQUIRE, RELEASE, CHECK };
 
@@ -110,7 +150,7 @@ void _destroySyncCache(struct SyncCache *cache)
 static SyncData* id2data(id object, enum usage why)
 {
     spinlock_t *lockp = &LOCK_FOR_OBJ(object);
-    SyncData **listp = &LIST_FOR_OBJ(object);
+    SyncList *list = &LIST_FOR_OBJ(object);
     SyncData* result = NULL;
 
 #if SUPPORT_DIRECT_THREAD_KEYS
@@ -193,26 +233,28 @@ static SyncData* id2data(id object, enum usage why)
     }
 
     // Thread cache didn't find anything.
-    // Walk in-use list looking for matching object
+    // Probe the table looking for matching object
     // Spinlock prevents multiple threads from creating multiple 
     // locks for the same new object.
-    // We could keep the nodes in some hash table if we find that there are
-    // more than 20 or so distinct locks active, but we don't do that now.
     
     lockp->lock();
 
     {
         SyncData* p;
         SyncData* firstUnused = NULL;
-        for (p = *listp; p != NULL; p = p->nextData) {
-            if ( p->object == object ) {
-                result = p;
-                // atomic because may collide with concurrent RELEASE
-                OSAtomicIncrement32Barrier(&result->threadCount);
-                goto done;
+        if (list->buckets) {
+            uint32_t i = syncListIndex(list, object);
+            while ((p = list->buckets[i])) {
+                if ( p->object == object ) {
+                    result = p;
+                    // atomic because may collide with concurrent RELEASE
+                    OSAtomicIncrement32Barrier(&result->threadCount);
+                    goto done;
+                }
+                if ( (firstUnused == NULL) && (p->threadCount == 0) )
+                    firstUnused = p;
+                i = (i+1) & list->mask;
             }
-            if ( (firstUnused == NULL) && (p->threadCount == 0) )
-                firstUnused = p;
         }
     
         // no SyncData currently associated with object
@@ -220,6 +262,7 @@ static SyncData* id2data(id object, enum usage why)
             goto done;
     
         // an unused one was found, use it
+        // It lies on this object's probe sequence, so lookups find it.
         if ( firstUnused != NULL ) {
             result = firstUnused;
             result->object = (objc_object *)object;
@@ -235,9 +278,9 @@ static SyncData* id2data(id object, enum usage why)
     posix_memalign((void **)&result, alignof(SyncData), sizeof(SyncData));
     result->object = (objc_object *)object;
     result->threadCount = 1;
+    result->spinCount = 0;
     new (&result->mutex) recursive_mutex_t(fork_unsafe_lock);
-    result->nextData = *listp;
-    *listp = result;
+    syncListInsert(list, result);
     
  done:
     lockp->unlock();
@@ -273,6 +316,109 @@ static SyncData* id2data(id object, enum usage why)
 }
 
 
+/***********************************************************************
+* Contention profile
+* With OBJC_PRINT_SYNC_CONTENTION set, objc_sync_enter records for each 
+* class how often threads acquired an object's lock by spinning, how often 
+* they blocked, and how long they were blocked. The totals are logged 
+* at exit. Classes that are freed or unloaded are dropped first.
+* Locking: SyncContentionLock protects the profile.
+**********************************************************************/
+
+struct SyncContention {
+    uint64_t spins;
+    uint64_t blocks;
+    uint64_t blockedTime;
+};
+
+static spinlock_t SyncContentionLock(fork_unsafe_lock);
+static objc::DenseMap<Class, SyncContention> *SyncContentionProfile;
+
+static void printSyncContention(void)
+{
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    mutex_locker_t lock(SyncContentionLock);
+    for (auto& pair : *SyncContentionProfile) {
+        const SyncContention& c = pair.second;
+        _objc_inform("SYNC CONTENTION: %s: %llu acquired by spinning, "
+                     "%llu blocked for %llu us total", 
+                     pair.first->nameForLogging(), 
+                     c.spins, c.blocks, 
+                     c.blockedTime * timebase.numer / timebase.denom / 1000);
+    }
+}
+
+// Called by free_class, since printSyncContention reads cls's name.
+void _forgetSyncContention(Class cls)
+{
+    mutex_locker_t lock(SyncContentionLock);
+    if (SyncContentionProfile) SyncContentionProfile->erase(cls);
+}
+
+static void recordSyncContention(id obj, bool blocked, uint64_t blockedTime)
+{
+    Class cls = obj->getIsa();
+
+    mutex_locker_t lock(SyncContentionLock);
+    if (!SyncContentionProfile) {
+        SyncContentionProfile = new objc::DenseMap<Class, SyncContention>;
+        atexit(printSyncContention);
+    }
+    SyncContention& c = (*SyncContentionProfile)[cls];
+    if (blocked) {
+        c.blocks++;
+        c.blockedTime += blockedTime;
+    } else {
+        c.spins++;
+    }
+}
+
+
+/***********************************************************************
+* syncDataLockSlow
+* Acquire data's lock after a failed tryLock.
+* Critical sections under @synchronized are usually short, so spin first, 
+* for up to twice the number of spins that recently sufficed, and block 
+* only if the lock is still held after that.
+**********************************************************************/
+
+enum { SyncMaxSpins = 100 };
+
+static inline void syncSpinPause()
+{
+#if __x86_64__  ||  __i386__
+    __builtin_ia32_pause();
+#elif __arm64__  ||  __arm__
+    __builtin_arm_yield();
+#endif
+}
+
+static void syncDataLockSlow(SyncData *data, id obj)
+{
+    // spinCount is only written with the lock held, so this read may be 
+    // stale. Any value produces a valid limit.
+    int32_t limit = MIN(data->spinCount * 2 + 10, (int32_t)SyncMaxSpins);
+
+    for (int32_t spins = 1; spins <= limit; spins++) {
+        syncSpinPause();
+        if (data->mutex.tryLock()) {
+            data->spinCount += (spins - data->spinCount) / 8;
+            if (PrintSyncContention) recordSyncContention(obj, false, 0);
+            return;
+        }
+    }
+
+    uint64_t start = PrintSyncContention ? nanoseconds() : 0;
+    data->mutex.lock();
+    data->spinCount += (limit - data->spinCount) / 8;
+    if (PrintSyncContention) {
+        recordSyncContention(obj, true, nanoseconds() - start);
+    }
+}
+
+
 BREAKPOINT_FUNCTION(
     void objc_sync_nil(void)
 );
@@ -288,7 +434,7 @@ int objc_sync_enter(id obj)
     if (obj) {
         SyncData* data = id2data(obj, ACQUIRE);
         assert(data);
-        data->mutex.lock();
+        if (!data->mutex.tryLock()) syncDataLockSlow(data, obj);
     } else {
         // @synchronized(nil) does nothing
         if (DebugNilSync) {
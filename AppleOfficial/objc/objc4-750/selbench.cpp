@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// Multi-threaded selector interning benchmark.
+//
+// Compares the runtime's concurrent selector table (runtime/objc-sel-table.h)
+// against a single lock around a hash map, which is how selectors used to be
+// registered. Every thread interns the same names in a different order, so
+// most inserts race with an insert of the same name on another thread.
+// Each run checks that every thread got the same pointer for each name.
+//
+//   clang++ -std=c++14 -O2 selbench.cpp -o selbench
+//   ./selbench [names] [max threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "runtime/objc-sel-table.h"
+
+struct Workload {
+    std::vector<std::string> names;
+    // results[t][i] is what thread t got for names[i].
+    std::vector<std::vector<const char *>> results;
+};
+
+struct LockedMapInterner {
+    std::mutex lock;
+    std::unordered_map<std::string, const char *> map;
+
+    const char *intern(const char *name) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = map.find(name);
+        if (it != map.end()) return it->second;
+        const char *sel = strdup(name);
+        map.emplace(name, sel);
+        return sel;
+    }
+};
+
+struct ConcurrentInterner {
+    std::mutex lock;
+    sel_table_tt<std::mutex> table{lock};
+
+    const char *intern(const char *name) {
+        const char *sel = table.get(name);
+        if (sel) return sel;
+        char *newName = strdup(name);
+        sel = table.insert(newName, false);
+        if (sel != newName) free(newName);
+        return sel;
+    }
+};
+
+template <typename Interner>
+static double run(Workload& w, unsigned nthreads)
+{
+    Interner interner;
+    size_t count = w.names.size();
+    w.results.assign(nthreads, std::vector<const char *>(count));
+
+    std::vector<std::vector<size_t>> orders(nthreads);
+    for (unsigned t = 0; t < nthreads; t++) {
+        orders[t].resize(count);
+        for (size_t i = 0; i < count; i++) orders[t][i] = i;
+        std::shuffle(orders[t].begin(), orders[t].end(), std::mt19937(t));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t] {
+            // Intern everything twice: the second pass is all lookups.
+            for (int pass = 0; pass < 2; pass++) {
+                for (size_t i : orders[t]) {
+                    w.results[t][i] = interner.intern(w.names[i].c_str());
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    for (unsigned t = 1; t < nthreads; t++) {
+        for (size_t i = 0; i < count; i++) {
+            if (w.results[t][i] != w.results[0][i]) {
+                fprintf(stderr, "thread %u interned %s as %p, thread 0 as %p\n",
+                        t, w.names[i].c_str(), w.results[t][i],
+                        w.results[0][i]);
+                exit(1);
+            }
+        }
+    }
+
+    return 2.0 * count * nthreads / elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    unsigned maxThreads = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0)
+                                   : std::thread::hardware_concurrency();
+
+    Workload w;
+    for (size_t i = 0; i < count; i++) {
+        w.names.push_back("benchmarkSelector" + std::to_string(i) +
+                          ":withObject:");
+    }
+
+    printf("%zu names\n", count);
+    printf("%8s %16s %16s\n", "threads", "locked map/s", "concurrent/s");
+    for (unsigned n = 1; n <= maxThreads; n *= 2) {
+        double locked = run<LockedMapInterner>(w, n);
+        double concurrent = run<ConcurrentInterner>(w, n);
+        printf("%8u %16.0f %16.0f\n", n, locked, concurrent);
+    }
+    return 0;
+}
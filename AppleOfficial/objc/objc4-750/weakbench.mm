@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2019 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+// Weak reference load contention benchmark.
+//
+// Many threads load the same __weak variable, as with a shared delegate.
+// Run it once normally and once with OBJC_DISABLE_UNLOCKED_WEAK_LOADS=YES
+// to compare against taking the side table lock for every load.
+//
+// A second pass keeps deallocating the referent while the readers load,
+// so unlocked loads race with weak_clear_no_lock(). Every load must
+// return either nil or a live object.
+//
+//   clang++ -O2 -fno-objc-arc weakbench.mm -lobjc -o weakbench
+//   ./weakbench [loads per thread] [max threads]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <mach/mach_time.h>
+#include <objc/runtime.h>
+#include <objc/NSObject.h>
+
+extern "C" {
+    id objc_initWeak(id *location, id newObj);
+    id objc_storeWeak(id *location, id obj);
+    id objc_loadWeakRetained(id *location);
+    void objc_destroyWeak(id *location);
+    id objc_retain(id obj);
+    void objc_release(id obj);
+}
+
+static id weakVar;
+static size_t loadsPerThread;
+static std::atomic<bool> churning;
+static std::atomic<size_t> nilLoads;
+
+// Average nanoseconds per operation, from mach_absolute_time() ticks.
+static double nanosecondsPer(uint64_t ticks, uint64_t count)
+{
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom) mach_timebase_info(&timebase);
+    return (double)ticks * timebase.numer / timebase.denom / count;
+}
+
+static void *reader(void *)
+{
+    size_t nils = 0;
+    for (size_t i = 0; i < loadsPerThread; i++) {
+        id obj = objc_loadWeakRetained(&weakVar);
+        if (!obj) { nils++; continue; }
+        // Use the object: a freed referent usually crashes here.
+        if (object_getClass(obj) != [NSObject class]) {
+            fprintf(stderr, "weak load returned a dead object %p\n", obj);
+            abort();
+        }
+        objc_release(obj);
+    }
+    nilLoads += nils;
+    return NULL;
+}
+
+// Repeatedly replace the referent and release the old one, so each
+// old referent is deallocated while readers may be loading it.
+static void *churner(void *)
+{
+    size_t replaced = 0;
+    while (churning.load(std::memory_order_relaxed)) {
+        id obj = [[NSObject alloc] init];
+        objc_storeWeak(&weakVar, obj);
+        objc_release(obj);
+        replaced++;
+    }
+    return (void *)replaced;
+}
+
+// Returns nanoseconds per load across nthreads readers.
+static double run(unsigned nthreads, bool churn, size_t *replaced)
+{
+    pthread_t threads[nthreads];
+    pthread_t churnThread;
+
+    nilLoads = 0;
+    if (churn) {
+        churning = true;
+        pthread_create(&churnThread, NULL, churner, NULL);
+    }
+
+    uint64_t start = mach_absolute_time();
+    for (unsigned t = 0; t < nthreads; t++) {
+        pthread_create(&threads[t], NULL, reader, NULL);
+    }
+    for (unsigned t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    uint64_t ticks = mach_absolute_time() - start;
+
+    if (churn) {
+        churning = false;
+        void *count;
+        pthread_join(churnThread, &count);
+        *replaced = (size_t)count;
+    }
+
+    return nanosecondsPer(ticks, loadsPerThread * nthreads);
+}
+
+static bool unlockedLoadsDisabled(void)
+{
+    const char *value = getenv("OBJC_DISABLE_UNLOCKED_WEAK_LOADS");
+    return value  &&  0 == strcmp(value, "YES");
+}
+
+int main(int argc, char **argv)
+{
+    loadsPerThread = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000;
+    unsigned maxThreads = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 0) : 8;
+
+    printf("%zu loads per thread, unlocked weak loads %s\n",
+           loadsPerThread, unlockedLoadsDisabled() ? "off" : "on");
+
+    // Shared referent that stays alive.
+    id obj = [[NSObject alloc] init];
+    objc_initWeak(&weakVar, obj);
+    printf("%8s %16s\n", "threads", "ns/load");
+    for (unsigned n = 1; n <= maxThreads; n *= 2) {
+        printf("%8u %16.1f\n", n, run(n, false, NULL));
+    }
+    objc_destroyWeak(&weakVar);
+    objc_release(obj);
+
+    // Referent deallocated and replaced continuously.
+    objc_initWeak(&weakVar, nil);
+    printf("\nwith the referent being deallocated\n");
+    printf("%8s %16s %16s %16s\n", "threads", "ns/load", "nil loads",
+           "referents");
+    for (unsigned n = 1; n <= maxThreads; n *= 2) {
+        size_t replaced = 0;
+        double ns = run(n, true, &replaced);
+        printf("%8u %16.1f %16zu %16zu\n", n, ns, nilLoads.load(), replaced);
+    }
+    objc_destroyWeak(&weakVar);
+
+    return 0;
+}